@@ -137,6 +137,7 @@
 #include <linux/kernel.h>
 #include <linux/moduleparam.h>
 #include <linux/list.h>
+#include <linux/interrupt.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/etherdevice.h>
@@ -227,6 +228,25 @@ static struct net_device *imq_devs_cache[IMQ_MAX_DEVS];
 static int numqueues = 1;
 static u32 imq_hashrnd;
 
+/*
+ * Per-CPU mode: imq_nf_queue() only appends the packet to a list of its
+ * CPU.  A tasklet then moves the list into the qdiscs, taking each root
+ * lock once per batch, and dequeues and reinjects up to IMQ_QUOTA
+ * packets per qdisc in batches of IMQ_BATCH.
+ */
+static int percpu;
+
+#define IMQ_CPU_BACKLOG	1024
+#define IMQ_BATCH	16
+#define IMQ_QUOTA	64
+
+struct imq_cpu {
+	struct sk_buff_head	queue;		/* packets for the qdiscs */
+	struct tasklet_struct	tasklet;
+};
+
+static DEFINE_PER_CPU(struct imq_cpu, imq_cpus);
+
 static inline __be16 pppoe_proto(const struct sk_buff *skb)
 {
 	return *((__be16 *)(skb_mac_header(skb) + ETH_HLEN +
@@ -382,6 +402,14 @@ static struct netdev_queue *imq_select_queue(struct net_device *dev,
 		goto out;
 	}
 
+	/* Reuse the hash of the receive path */
+	if (skb->rxhash) {
+		hash = skb->rxhash;
+		queue_index =
+			(u16)(((u64)hash * dev->real_num_tx_queues) >> 32);
+		goto out;
+	}
+
 	/* Generate hash from packet data */
 	queue_index = imq_hash(dev, skb);
 
@@ -480,6 +508,171 @@ static netdev_tx_t imq_dev_xmit(struct sk_buff *skb, struct net_device *dev)
 	return NETDEV_TX_OK;
 }
 
+/* Called under the root lock of q, false if the qdisc dropped skb */
+static bool imq_enqueue_qdisc(struct sk_buff *skb, struct Qdisc *q)
+{
+	struct sk_buff *skb_shared;
+	int users;
+
+	users = atomic_read(&skb->users);
+
+	skb_shared = skb_get(skb); /* increase reference count by one */
+	skb_save_cb(skb_shared); /* backup skb->cb, as qdisc layer will
+					overwrite it */
+	qdisc_enqueue_root(skb_shared, q); /* might kfree_skb */
+
+	if (likely(atomic_read(&skb_shared->users) == users + 1)) {
+		kfree_skb(skb_shared); /* decrease reference count by one */
+
+		skb->destructor = &imq_skb_destructor;
+		return true;
+	}
+
+	skb_restore_cb(skb_shared); /* restore skb->cb */
+	/* qdisc dropped packet and decreased skb reference count of
+	 * skb, so we don't really want to and try refree as that would
+	 * actually destroy the skb. */
+	return false;
+}
+
+/* Called with the root lock of q held, releases it */
+static void imq_qdisc_run(struct Qdisc *q, spinlock_t *root_lock)
+{
+	struct net_device *dev = qdisc_dev(q);
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	int quota = IMQ_QUOTA;
+
+	/* Requeued packets are left to the regular qdisc run */
+	if (unlikely(q->gso_skb ||
+		     netif_xmit_frozen_or_stopped(q->dev_queue))) {
+		spin_unlock(root_lock);
+		__netif_schedule(q);
+		return;
+	}
+
+	/* Whoever runs the qdisc also dequeues what we just added */
+	if (!qdisc_run_begin(q)) {
+		spin_unlock(root_lock);
+		return;
+	}
+
+	__skb_queue_head_init(&batch);
+	for (;;) {
+		while (skb_queue_len(&batch) < IMQ_BATCH &&
+		       (skb = q->dequeue(q)) != NULL)
+			__skb_queue_tail(&batch, skb);
+		if (skb_queue_empty(&batch))
+			break;
+
+		spin_unlock(root_lock);
+		while ((skb = __skb_dequeue(&batch)) != NULL)
+			imq_dev_xmit(skb, dev);
+		spin_lock(root_lock);
+
+		quota -= IMQ_BATCH;
+		if (quota <= 0 || need_resched()) {
+			__netif_schedule(q);
+			break;
+		}
+	}
+	qdisc_run_end(q);
+	spin_unlock(root_lock);
+}
+
+static void imq_cpu_drop(struct sk_buff *skb)
+{
+	struct nf_queue_entry *entry = skb->nf_queue_entry;
+
+	skb->nf_queue_entry = NULL;
+	nf_reinject(entry, NF_DROP);
+}
+
+static void imq_cpu_action(unsigned long data)
+{
+	struct imq_cpu *c = (struct imq_cpu *)data;
+	struct sk_buff_head list;
+	struct sk_buff *skb;
+	struct net_device *dev;
+	struct netdev_queue *txq;
+	struct Qdisc *q, *last = NULL;
+	spinlock_t *root_lock = NULL;
+
+	__skb_queue_head_init(&list);
+	skb_queue_splice_tail_init(&c->queue, &list);
+
+	rcu_read_lock_bh();
+
+	while ((skb = __skb_dequeue(&list)) != NULL) {
+		dev = imq_devs_cache[skb->imq_flags & IMQ_F_IFMASK];
+		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
+		q = rcu_dereference_bh(txq->qdisc);
+
+		if (q != last) {
+			if (last)
+				imq_qdisc_run(last, root_lock);
+			last = q;
+			root_lock = qdisc_lock(q);
+			spin_lock(root_lock);
+		}
+
+		if (unlikely(!q->enqueue) || !imq_enqueue_qdisc(skb, q))
+			imq_cpu_drop(skb);
+	}
+
+	if (last)
+		imq_qdisc_run(last, root_lock);
+
+	rcu_read_unlock_bh();
+}
+
+static bool imq_cpu_stage(struct sk_buff *skb)
+{
+	struct imq_cpu *c;
+	bool staged = false;
+
+	local_bh_disable();
+	c = &__get_cpu_var(imq_cpus);
+	if (likely(skb_queue_len(&c->queue) < IMQ_CPU_BACKLOG)) {
+		__skb_queue_tail(&c->queue, skb);
+		if (skb_queue_len(&c->queue) == 1)
+			tasklet_schedule(&c->tasklet);
+		staged = true;
+	}
+	local_bh_enable();
+
+	return staged;
+}
+
+static void __init imq_cpu_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct imq_cpu *c = &per_cpu(imq_cpus, cpu);
+
+		skb_queue_head_init(&c->queue);
+		tasklet_init(&c->tasklet, imq_cpu_action, (unsigned long)c);
+	}
+}
+
+static void __exit imq_cpu_cleanup(void)
+{
+	struct sk_buff *skb;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct imq_cpu *c = &per_cpu(imq_cpus, cpu);
+
+		tasklet_kill(&c->tasklet);
+
+		local_bh_disable();
+		while ((skb = __skb_dequeue(&c->queue)) != NULL)
+			imq_cpu_drop(skb);
+		local_bh_enable();
+	}
+}
+
 static struct net_device *get_imq_device_by_index(int index)
 {
 	struct net_device *dev = NULL;
@@ -510,11 +703,11 @@ static struct net_device *get_imq_device_by_index(int index)
 static int imq_nf_queue(struct nf_queue_entry *entry, unsigned int queue_num)
 {
 	struct net_device *dev;
-	struct sk_buff *skb_orig, *skb, *skb_shared;
+	struct sk_buff *skb_orig, *skb;
 	struct Qdisc *q;
 	struct netdev_queue *txq;
 	spinlock_t *root_lock;
-	int users, index;
+	int index;
 	int retval = -EINVAL;
 	unsigned int orig_queue_index;
 
@@ -576,32 +769,33 @@ static int imq_nf_queue(struct nf_queue_entry *entry, unsigned int queue_num)
 		skb->dev = dev;
 	}
 
-	/* Disables softirqs for lock below */
-	rcu_read_lock_bh();
-
 	/* Multi-queue selection */
 	orig_queue_index = skb_get_queue_mapping(skb);
 	txq = imq_select_queue(dev, skb);
 
-	q = rcu_dereference(txq->qdisc);
-	if (unlikely(!q->enqueue))
-		goto packet_not_eaten_by_imq_dev;
+	if (percpu) {
+		if (unlikely(!imq_cpu_stage(skb)))
+			goto packet_not_staged;
 
-	root_lock = qdisc_lock(q);
-	spin_lock(root_lock);
+		/* cloned? */
+		if (unlikely(skb_orig))
+			kfree_skb(skb_orig); /* free original */
 
-	users = atomic_read(&skb->users);
+		retval = 0;
+		goto out;
+	}
 
-	skb_shared = skb_get(skb); /* increase reference count by one */
-	skb_save_cb(skb_shared); /* backup skb->cb, as qdisc layer will
-					overwrite it */
-	qdisc_enqueue_root(skb_shared, q); /* might kfree_skb */
+	/* Disables softirqs for lock below */
+	rcu_read_lock_bh();
 
-	if (likely(atomic_read(&skb_shared->users) == users + 1)) {
-		kfree_skb(skb_shared); /* decrease reference count by one */
+	q = rcu_dereference_bh(txq->qdisc);
+	if (unlikely(!q->enqueue))
+		goto packet_not_eaten_by_imq_dev;
 
-		skb->destructor = &imq_skb_destructor;
+	root_lock = qdisc_lock(q);
+	spin_lock(root_lock);
 
+	if (likely(imq_enqueue_qdisc(skb, q))) {
 		/* cloned? */
 		if (unlikely(skb_orig))
 			kfree_skb(skb_orig); /* free original */
@@ -614,19 +808,14 @@ static int imq_nf_queue(struct nf_queue_entry *entry, unsigned int queue_num)
 
 		retval = 0;
 		goto out;
-	} else {
-		skb_restore_cb(skb_shared); /* restore skb->cb */
-		skb->nf_queue_entry = NULL;
-		/* qdisc dropped packet and decreased skb reference count of
-		 * skb, so we don't really want to and try refree as that would
-		 * actually destroy the skb. */
-		spin_unlock(root_lock);
-		goto packet_not_eaten_by_imq_dev;
 	}
+	spin_unlock(root_lock);
 
 packet_not_eaten_by_imq_dev:
-	skb_set_queue_mapping(skb, orig_queue_index);
 	rcu_read_unlock_bh();
+packet_not_staged:
+	skb->nf_queue_entry = NULL;
+	skb_set_queue_mapping(skb, orig_queue_index);
 
 	/* cloned? restore original */
 	if (unlikely(skb_orig)) {
@@ -791,6 +980,8 @@ static int __init imq_init_module(void)
 	BUILD_BUG_ON(CONFIG_IMQ_NUM_DEVS - 1 > IMQ_F_IFMASK);
 #endif
 
+	imq_cpu_init();
+
 	err = imq_init_devs();
 	if (err) {
 		printk(KERN_ERR "IMQ: Error trying imq_init_devs(net)\n");
@@ -806,7 +997,8 @@ static int __init imq_init_module(void)
 	}
 
 	printk(KERN_INFO "IMQ driver loaded successfully. "
-		"(numdevs = %d, numqueues = %d)\n", numdevs, numqueues);
+		"(numdevs = %d, numqueues = %d, percpu = %d)\n",
+		numdevs, numqueues, percpu);
 
 #if defined(CONFIG_IMQ_BEHAVIOR_BA) || defined(CONFIG_IMQ_BEHAVIOR_BB)
 	printk(KERN_INFO "\tHooking IMQ before NAT on PREROUTING.\n");
@@ -837,6 +1029,7 @@ static void __exit imq_cleanup_devs(void)
 static void __exit imq_exit_module(void)
 {
 	imq_unhook();
+	imq_cpu_cleanup();
 	imq_cleanup_devs();
 	printk(KERN_INFO "IMQ driver unloaded successfully.\n");
 }
@@ -846,9 +1039,12 @@ module_exit(imq_exit_module);
 
 module_param(numdevs, int, 0);
 module_param(numqueues, int, 0);
+module_param(percpu, int, 0);
 MODULE_PARM_DESC(numdevs, "number of IMQ devices (how many imq* devices will "
 			"be created)");
 MODULE_PARM_DESC(numqueues, "number of queues per IMQ device");
+MODULE_PARM_DESC(percpu, "stage packets per CPU and feed the qdiscs in "
+			"batches");
 MODULE_AUTHOR("http://www.linuximq.net");
 MODULE_DESCRIPTION("Pseudo-driver for the intermediate queue device. See "
 			"http://www.linuximq.net/ for more information.");
@@ -46,6 +46,8 @@
 #include <linux/slab.h>
 #include <linux/kernel.h>
 #include <linux/pm_runtime.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 
 #if IS_ENABLED(CONFIG_RA_HW_NAT) && defined(CONFIG_RA_HW_NAT_NIC_USB)
 #include <../ndm/hw_nat/ra_nat.h>
@@ -54,7 +56,11 @@
 #if IS_ENABLED(CONFIG_FAST_NAT)
 #include <net/fast_vpn.h>
 extern int (*go_swnat)(struct sk_buff * skb, u8 origin);
+extern void (*go_swnat_list)(struct sk_buff_head *list, u8 origin);
 extern void (*prebind_from_usb_mac)(struct sk_buff * skb);
+
+/* Max RX packets handed to go_swnat_list() at once */
+#define RX_BATCH_MAX		64
 #endif
 
 #define DRIVER_VERSION		"22-Aug-2005"
@@ -87,6 +93,11 @@ extern void (*prebind_from_usb_mac)(struct sk_buff * skb);
 // between wakeups
 #define UNLINK_TIMEOUT_MS	3
 
+/* TX URB depth is tuned at most this often, never below the minimum
+ * that keeps the bus busy while one URB completes */
+#define TX_TUNE_INTERVAL	(HZ / 10)
+#define TX_QLEN_MIN		2
+
 /*-------------------------------------------------------------------------*/
 
 // randomly generated ethernet address
@@ -97,6 +108,13 @@ static int msg_level = -1;
 module_param (msg_level, int, 0);
 MODULE_PARM_DESC (msg_level, "Override default message level");
 
+/* Slower TX completions mean the device is backlogged and more URBs
+ * only add to its queue */
+static unsigned int tx_latency = 1000;
+module_param (tx_latency, uint, 0644);
+MODULE_PARM_DESC (tx_latency,
+	"TX URB completion time in usecs the URB depth is tuned to, 0: fixed depth");
+
 /*-------------------------------------------------------------------------*/
 
 /* handles CDC Ethernet and many other network "bulk data" interfaces */
@@ -319,11 +337,30 @@ static void __usbnet_status_stop_force(struct usbnet *dev)
 	}
 }
 
-/* Passes this packet up the stack, updating its accounting.
- * Some link protocols batch packets, so their rx_fixup paths
- * can return clones as well as just modify the original skb.
- */
-void usbnet_skb_return (struct usbnet *dev, struct sk_buff *skb)
+#if IS_ENABLED(CONFIG_FAST_NAT)
+/* Offers a burst of received packets to SWNAT, passes the rest up. */
+static void usbnet_rx_batch(struct usbnet *dev, struct sk_buff_head *batch)
+{
+	typeof(go_swnat_list) swnat_list_hook;
+	struct sk_buff *skb;
+
+	rcu_read_lock();
+	if ((swnat_list_hook = rcu_dereference(go_swnat_list)))
+		swnat_list_hook(batch, SWNAT_ORIGIN_USB_MAC);
+	rcu_read_unlock();
+
+	while ((skb = __skb_dequeue(batch))) {
+		int status = netif_rx(skb);
+
+		if (status != NET_RX_SUCCESS)
+			netif_dbg(dev, rx_err, dev->net,
+				  "netif_rx status %d\n", status);
+	}
+}
+#endif
+
+static void __usbnet_skb_return(struct usbnet *dev, struct sk_buff *skb,
+				struct sk_buff_head *batch)
 {
 	int	status;
 	struct usbnet_stats64 *stats;
@@ -371,6 +408,17 @@ void usbnet_skb_return (struct usbnet *dev, struct sk_buff *skb)
 #if IS_ENABLED(CONFIG_FAST_NAT)
 		typeof(go_swnat) swnat_hook;
 
+		if (batch != NULL &&
+		    !(dev->driver_info->flags & (FLAG_MULTI_PACKET |
+						 FLAG_POINTTOPOINT |
+						 FLAG_NOARP)) &&
+		    rcu_access_pointer(go_swnat_list) != NULL) {
+			__skb_queue_tail(batch, skb);
+			if (skb_queue_len(batch) >= RX_BATCH_MAX)
+				usbnet_rx_batch(dev, batch);
+			return;
+		}
+
 		rcu_read_lock();
 		if ((dev->driver_info->flags & FLAG_MULTI_PACKET) ||
 			(dev->driver_info->flags & FLAG_POINTTOPOINT) ||
@@ -391,6 +439,15 @@ void usbnet_skb_return (struct usbnet *dev, struct sk_buff *skb)
 				  "netif_rx status %d\n", status);
 	}
 }
+
+/* Passes this packet up the stack, updating its accounting.
+ * Some link protocols batch packets, so their rx_fixup paths
+ * can return clones as well as just modify the original skb.
+ */
+void usbnet_skb_return (struct usbnet *dev, struct sk_buff *skb)
+{
+	__usbnet_skb_return(dev, skb, NULL);
+}
 EXPORT_SYMBOL_GPL(usbnet_skb_return);
 
 /* must be called if hard_mtu or rx_urb_size changed */
@@ -418,9 +475,51 @@ void usbnet_update_max_qlen(struct usbnet *dev)
 insanity:
 		dev->rx_qlen = dev->tx_qlen = 4;
 	}
+
+	dev->tx_qlen_max = dev->tx_qlen;
+	dev->tx_qlen_hit = 0;
+	dev->tx_lat = 0;
+	dev->tx_tune_stamp = jiffies;
 }
 EXPORT_SYMBOL_GPL(usbnet_update_max_qlen);
 
+/* Shrinks the TX URB depth while completions are slow, grows it back
+ * while they are fast and the depth is what stopped the queue. */
+static void usbnet_tx_tune(struct usbnet *dev, u64 lat_sum, unsigned int n)
+{
+	u32 target = tx_latency * NSEC_PER_USEC;
+	unsigned int qlen = dev->tx_qlen;
+	u32 lat;
+
+	if (!target)
+		return;
+
+	/* samples of a bh run are folded in as their mean, weight 1/8 */
+	lat = div_u64(lat_sum, n);
+	if (lat >= dev->tx_lat)
+		dev->tx_lat += (lat - dev->tx_lat) >> 3;
+	else
+		dev->tx_lat -= (dev->tx_lat - lat) >> 3;
+
+	if (time_before(jiffies, dev->tx_tune_stamp + TX_TUNE_INTERVAL))
+		return;
+
+	if (dev->tx_lat > target && qlen > TX_QLEN_MIN)
+		qlen -= max_t(unsigned int, qlen / 4, 1);
+	else if (dev->tx_lat < target / 2 && dev->tx_qlen_hit &&
+		 qlen < dev->tx_qlen_max)
+		qlen++;
+
+	if (qlen != dev->tx_qlen) {
+		netif_dbg(dev, tx_queued, dev->net, "tx qlen %u --> %u\n",
+			  dev->tx_qlen, qlen);
+		dev->tx_qlen = qlen;
+	}
+
+	dev->tx_qlen_hit = 0;
+	dev->tx_tune_stamp = jiffies;
+}
+
 /*-------------------------------------------------------------------------
  *
  * Network Device Driver (peer link to "Host Device", from USB host)
@@ -632,7 +731,8 @@ static int rx_submit (struct usbnet *dev, struct urb *urb, gfp_t flags)
 
 /*-------------------------------------------------------------------------*/
 
-static inline void rx_process (struct usbnet *dev, struct sk_buff *skb)
+static inline void rx_process (struct usbnet *dev, struct sk_buff *skb,
+			       struct sk_buff_head *batch)
 {
 	if (dev->driver_info->rx_fixup &&
 	    !dev->driver_info->rx_fixup (dev, skb)) {
@@ -652,7 +752,7 @@ static inline void rx_process (struct usbnet *dev, struct sk_buff *skb)
 		dev->net->stats.rx_length_errors++;
 		netif_dbg(dev, rx_err, dev->net, "rx length %d\n", skb->len);
 	} else {
-		usbnet_skb_return(dev, skb);
+		__usbnet_skb_return(dev, skb, batch);
 		return;
 	}
 
@@ -995,6 +1095,7 @@ int usbnet_open (struct net_device *net)
 	}
 
 	set_bit(EVENT_DEV_OPEN, &dev->flags);
+	netdev_reset_queue(net);
 	netif_start_queue (net);
 	netif_info(dev, ifup, dev->net,
 		   "open: enable queueing (rx %d, tx %d) mtu %d %s framing\n",
@@ -1268,6 +1369,8 @@ static void tx_complete (struct urb *urb)
 	struct skb_data		*entry = (struct skb_data *) skb->cb;
 	struct usbnet		*dev = entry->dev;
 
+	entry->tx_time = (u32)ktime_to_ns(ktime_get()) - entry->tx_time;
+
 	if (urb->status == 0) {
 		struct usbnet_stats64 *stats = this_cpu_ptr(dev->stats64);
 		u64_stats_update_begin(&stats->syncp);
@@ -1449,6 +1552,8 @@ netdev_tx_t usbnet_start_xmit (struct sk_buff *skb,
 	}
 #endif
 
+	entry->tx_time = (u32)ktime_to_ns(ktime_get());
+
 	switch ((retval = usb_submit_urb (urb, GFP_ATOMIC))) {
 	case -EPIPE:
 		netif_stop_queue (net);
@@ -1463,8 +1568,12 @@ netdev_tx_t usbnet_start_xmit (struct sk_buff *skb,
 	case 0:
 		net->trans_start = jiffies;
 		__usbnet_queue_skb(&dev->txq, skb, tx_start);
-		if (dev->txq.qlen >= TX_QLEN (dev))
+		/* multi-packet URBs count the frames they aggregate */
+		netdev_sent_queue(net, entry->length);
+		if (dev->txq.qlen >= TX_QLEN (dev)) {
+			dev->tx_qlen_hit = 1;
 			netif_stop_queue (net);
+		}
 	}
 	spin_unlock_irqrestore (&dev->txq.lock, flags);
 
@@ -1517,15 +1626,30 @@ static void usbnet_bh (unsigned long param)
 	struct usbnet		*dev = (struct usbnet *) param;
 	struct sk_buff		*skb;
 	struct skb_data		*entry;
+	struct sk_buff_head	*batch = NULL;
+	unsigned int		tx_pkts = 0, tx_bytes = 0, tx_n = 0;
+	u64			tx_lat = 0;
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	struct sk_buff_head	rx_batch;
+
+	__skb_queue_head_init(&rx_batch);
+	batch = &rx_batch;
+#endif
 
 	while ((skb = skb_dequeue (&dev->done))) {
 		entry = (struct skb_data *) skb->cb;
 		switch (entry->state) {
 		case rx_done:
 			entry->state = rx_cleanup;
-			rx_process (dev, skb);
+			rx_process (dev, skb, batch);
 			continue;
 		case tx_done:
+			tx_pkts += entry->packets;
+			tx_bytes += entry->length;
+			/* a stalled URB counts as one second at most */
+			tx_lat += min_t(u32, entry->tx_time, NSEC_PER_SEC);
+			tx_n++;
+			/* fall through */
 		case rx_cleanup:
 			usb_free_urb (entry->urb);
 			dev_kfree_skb (skb);
@@ -1535,6 +1659,16 @@ static void usbnet_bh (unsigned long param)
 		}
 	}
 
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	if (!skb_queue_empty(&rx_batch))
+		usbnet_rx_batch(dev, &rx_batch);
+#endif
+
+	if (tx_n) {
+		netdev_completed_queue(dev->net, tx_pkts, tx_bytes);
+		usbnet_tx_tune(dev, tx_lat, tx_n);
+	}
+
 	/* restart RX again after disabling due to high error rate */
 	clear_bit(EVENT_RX_KILL, &dev->flags);
 
@@ -1897,6 +2031,8 @@ int usbnet_resume (struct usb_interface *intf)
 		while ((res = usb_get_from_anchor(&dev->deferred))) {
 
 			skb = (struct sk_buff *)res->context;
+			((struct skb_data *)skb->cb)->tx_time =
+				(u32)ktime_to_ns(ktime_get());
 			retval = usb_submit_urb(res, GFP_ATOMIC);
 			if (retval < 0) {
 				dev_kfree_skb_any(skb);
@@ -1905,6 +2041,9 @@ int usbnet_resume (struct usb_interface *intf)
 			} else {
 				dev->net->trans_start = jiffies;
 				__skb_queue_tail(&dev->txq, skb);
+				/* BQL sees deferred URBs once submitted */
+				netdev_sent_queue(dev->net,
+					((struct skb_data *)skb->cb)->length);
 			}
 		}
 
@@ -280,6 +280,9 @@ struct ip_set_type_variant {
 	/* Return true if "b" set is the same as "a"
 	 * according to the create set parameters */
 	bool (*same_set)(const struct ip_set *a, const struct ip_set *b);
+
+	/* kadt() tests under RCU, without taking the set lock */
+	bool rcu_test;
 };
 
 /* The core set type structure */
@@ -100,6 +100,11 @@ enum ip_conntrack_status {
 #define IPS_FASTNAT_BIT 20
 #define IPS_FASTNAT (1 << IPS_FASTNAT_BIT)
 #endif
+#if IS_ENABLED(CONFIG_NF_CONNTRACK_GC)
+/* Expiry was claimed for teardown, stands for a deleted timer */
+#define IPS_EXPIRED_BIT 21
+#define IPS_EXPIRED (1 << IPS_EXPIRED_BIT)
+#endif
 #endif /* __KERNEL__ */
 
 /* Connection tracking event types */
@@ -0,0 +1,48 @@
+#ifndef _NF_CONNTRACK_HPOL_H
+#define _NF_CONNTRACK_HPOL_H
+
+/* Generic netlink interface of the per-host policer */
+#define HPOL_GENL_NAME		"HPOL"
+#define HPOL_GENL_VERSION	1
+
+enum hpol_cmd {
+	HPOL_CMD_UNSPEC,
+	HPOL_CMD_GET,		/* settings, or dump of all hosts */
+	HPOL_CMD_SET,		/* add a host or change its rates */
+	HPOL_CMD_DEL,		/* remove a host */
+	HPOL_CMD_FLUSH,		/* remove all hosts */
+	__HPOL_CMD_MAX
+};
+#define HPOL_CMD_MAX (__HPOL_CMD_MAX - 1)
+
+enum hpol_attr {
+	HPOL_A_UNSPEC,
+	HPOL_A_HOSTS_MAX,	/* u32: host table size */
+	HPOL_A_HOSTS,		/* u32: hosts in use */
+	HPOL_A_HOST,		/* nested: enum hpol_host_attr */
+	__HPOL_A_MAX
+};
+#define HPOL_A_MAX (__HPOL_A_MAX - 1)
+
+/* What the hardware NAT does with flows of a policed host */
+enum hpol_hwacc {
+	HPOL_HWACC_OFF,		/* keep them in software */
+	HPOL_HWACC_METER,	/* bind them with a meter of the host rates */
+};
+
+enum hpol_host_attr {
+	HPOL_HOST_UNSPEC,
+	HPOL_HOST_FAMILY,	/* u8: AF_INET or AF_INET6 */
+	HPOL_HOST_ADDR,		/* binary: 4 or 16 bytes */
+	HPOL_HOST_HWACC,	/* u8: enum hpol_hwacc */
+	HPOL_HOST_TX_RATE,	/* u32: bytes per second sent, 0: unlimited */
+	HPOL_HOST_TX_BURST,	/* u32: bytes */
+	HPOL_HOST_RX_RATE,	/* u32: bytes per second received */
+	HPOL_HOST_RX_BURST,	/* u32: bytes */
+	HPOL_HOST_TX_DROPS,	/* u64: packets dropped, sent by the host */
+	HPOL_HOST_RX_DROPS,	/* u64: packets dropped, sent to the host */
+	__HPOL_HOST_MAX
+};
+#define HPOL_HOST_MAX (__HPOL_HOST_MAX - 1)
+
+#endif /* _NF_CONNTRACK_HPOL_H */
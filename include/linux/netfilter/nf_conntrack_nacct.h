@@ -0,0 +1,41 @@
+#ifndef _NF_CONNTRACK_NACCT_H
+#define _NF_CONNTRACK_NACCT_H
+
+/* Generic netlink interface of the per-host accounting module */
+#define NACCT_GENL_NAME		"NACCT"
+#define NACCT_GENL_VERSION	1
+
+enum nacct_cmd {
+	NACCT_CMD_UNSPEC,
+	NACCT_CMD_GET,		/* settings, or dump of all hosts */
+	NACCT_CMD_SET,		/* change settings */
+	__NACCT_CMD_MAX
+};
+#define NACCT_CMD_MAX (__NACCT_CMD_MAX - 1)
+
+enum nacct_attr {
+	NACCT_A_UNSPEC,
+	NACCT_A_IFINDEX,	/* u32: account initiators from this device, 0: any */
+	NACCT_A_HOSTS_MAX,	/* u32: host table size */
+	NACCT_A_HOSTS,		/* u32: hosts in use */
+	NACCT_A_HOST,		/* nested: enum nacct_host_attr, repeated */
+	__NACCT_A_MAX
+};
+#define NACCT_A_MAX (__NACCT_A_MAX - 1)
+
+enum nacct_host_attr {
+	NACCT_HOST_UNSPEC,
+	NACCT_HOST_FAMILY,	/* u8: AF_INET or AF_INET6 */
+	NACCT_HOST_ADDR,	/* binary: 4 or 16 bytes */
+	NACCT_HOST_MAC,		/* binary: 6 bytes, if seen on Ethernet */
+	NACCT_HOST_SERIAL,	/* u32: changes when counters restart */
+	NACCT_HOST_CONNS,	/* u32: live connections */
+	NACCT_HOST_TX_PACKETS,	/* u64: sent by the host */
+	NACCT_HOST_TX_BYTES,	/* u64 */
+	NACCT_HOST_RX_PACKETS,	/* u64: received by the host */
+	NACCT_HOST_RX_BYTES,	/* u64 */
+	__NACCT_HOST_MAX
+};
+#define NACCT_HOST_MAX (__NACCT_HOST_MAX - 1)
+
+#endif /* _NF_CONNTRACK_NACCT_H */
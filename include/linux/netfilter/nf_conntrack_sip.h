@@ -3,6 +3,7 @@
 #ifdef __KERNEL__
 
 #include <linux/types.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
 
 #define SIP_PORT	5060
 #define SIP_TIMEOUT	3600
@@ -124,7 +125,7 @@ extern unsigned int (*nf_nat_sdp_addr_hook)(struct sk_buff *skb,
 					    unsigned int sdpoff,
 					    enum sdp_header_types type,
 					    enum sdp_header_types term,
-					    const union nf_inet_addr *addr);
+					    const union nf_conntrack_address *addr);
 extern unsigned int (*nf_nat_sdp_port_hook)(struct sk_buff *skb,
 					    unsigned int dataoff,
 					    const char **dptr,
@@ -137,7 +138,7 @@ extern unsigned int (*nf_nat_sdp_session_hook)(struct sk_buff *skb,
 					       const char **dptr,
 					       unsigned int *datalen,
 					       unsigned int sdpoff,
-					       const union nf_inet_addr *addr);
+					       const union nf_conntrack_address *addr);
 extern unsigned int (*nf_nat_sdp_media_hook)(struct sk_buff *skb,
 					     unsigned int dataoff,
 					     const char **dptr,
@@ -146,12 +147,12 @@ extern unsigned int (*nf_nat_sdp_media_hook)(struct sk_buff *skb,
 					     struct nf_conntrack_expect *rtcp_exp,
 					     unsigned int mediaoff,
 					     unsigned int medialen,
-					     union nf_inet_addr *rtp_addr);
+					     union nf_conntrack_address *rtp_addr);
 
 extern int ct_sip_parse_request(const struct nf_conn *ct,
 				const char *dptr, unsigned int datalen,
 				unsigned int *matchoff, unsigned int *matchlen,
-				union nf_inet_addr *addr, __be16 *port);
+				union nf_conntrack_address *addr, __be16 *port);
 extern int ct_sip_get_header(const struct nf_conn *ct, const char *dptr,
 			     unsigned int dataoff, unsigned int datalen,
 			     enum sip_header_types type,
@@ -160,12 +161,12 @@ extern int ct_sip_parse_header_uri(const struct nf_conn *ct, const char *dptr,
 				   unsigned int *dataoff, unsigned int datalen,
 				   enum sip_header_types type, int *in_header,
 				   unsigned int *matchoff, unsigned int *matchlen,
-				   union nf_inet_addr *addr, __be16 *port);
+				   union nf_conntrack_address *addr, __be16 *port);
 extern int ct_sip_parse_address_param(const struct nf_conn *ct, const char *dptr,
 				      unsigned int dataoff, unsigned int datalen,
 				      const char *name,
 				      unsigned int *matchoff, unsigned int *matchlen,
-				      union nf_inet_addr *addr);
+				      union nf_conntrack_address *addr);
 extern int ct_sip_parse_numerical_param(const struct nf_conn *ct, const char *dptr,
 					unsigned int off, unsigned int datalen,
 					const char *name,
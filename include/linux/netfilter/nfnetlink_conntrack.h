@@ -45,6 +45,9 @@ enum ctattr_type {
 	CTA_TIMESTAMP,
 	CTA_MARK_MASK,
 	CTA_NDMMARK,
+	CTA_NDMMARK_MASK,
+	CTA_DUMP_GEN,
+	CTA_DUMP_L4PROTO,
 	__CTA_MAX
 };
 #define CTA_MAX (__CTA_MAX - 1)
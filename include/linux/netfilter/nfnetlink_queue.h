@@ -2,6 +2,7 @@
 #define _NFNETLINK_QUEUE_H
 
 #include <linux/types.h>
+#include <linux/ioctl.h>
 #include <linux/netfilter/nfnetlink.h>
 
 enum nfqnl_msg_types {
@@ -88,4 +89,59 @@ enum nfqnl_attr_config {
 };
 #define NFQA_CFG_MAX (__NFQA_CFG_MAX-1)
 
+/*
+ * Shared ring of the nfqueue character device.  A queue bound through
+ * NFQNL_RING_SETUP hands packets to userspace in frames of a ring mapped
+ * with mmap() instead of netlink messages; the protocol family is still
+ * bound with NFQNL_CFG_CMD_PF_BIND.  Each frame starts with
+ * struct nfqnl_frame_hdr followed by up to copy_range bytes of payload.
+ * Userspace answers by filling in verdict, flags and marks and setting
+ * status to NFQNL_FRAME_VERDICT; the kernel picks up all answered frames
+ * on poll() or NFQNL_RING_VERDICT.  Fields are in host byte order except
+ * hw_protocol.
+ */
+#define NFQNL_RING_DEVICE	"nfqueue"
+
+enum nfqnl_frame_status {
+	NFQNL_FRAME_UNUSED,		/* owned by the kernel */
+	NFQNL_FRAME_PACKET,		/* packet for userspace */
+	NFQNL_FRAME_VERDICT,		/* answered, back to the kernel */
+};
+
+/* Verdict flags */
+#define NFQNL_FRAME_F_MARK	0x1	/* set the packet mark to mark */
+#define NFQNL_FRAME_F_CTMARK	0x2	/* set the connection mark to ct_mark */
+#define NFQNL_FRAME_F_FLOW	0x4	/* on NF_ACCEPT, stop queueing the flow
+					   to this queue */
+
+struct nfqnl_frame_hdr {
+	__u32	status;		/* enum nfqnl_frame_status */
+	__u32	id;		/* unique ID of packet in queue */
+	__u32	verdict;	/* NF_ACCEPT, NF_DROP, ... */
+	__u32	flags;		/* NFQNL_FRAME_F_* */
+	__u32	mark;
+	__u32	ct_mark;
+	__be16	hw_protocol;
+	__u8	hook;		/* netfilter hook */
+	__u8	pf;		/* protocol family */
+	__u32	indev;		/* ifindex, 0 if none */
+	__u32	outdev;		/* ifindex, 0 if none */
+	__u32	len;		/* length of the packet */
+	__u32	cap_len;	/* payload bytes following the header */
+	__u32	_pad;
+};
+
+#define NFQNL_FRAME_ALIGNMENT	16
+
+struct nfqnl_ring_req {
+	__u16	queue_num;
+	__u16	_pad;
+	__u32	frame_size;	/* multiple of NFQNL_FRAME_ALIGNMENT */
+	__u32	frame_nr;	/* power of two */
+	__u32	copy_range;	/* payload bytes copied, clamped to the frame */
+};
+
+#define NFQNL_RING_SETUP	_IOW('q', 0x40, struct nfqnl_ring_req)
+#define NFQNL_RING_VERDICT	_IO('q', 0x41)
+
 #endif /* _NFNETLINK_QUEUE_H */
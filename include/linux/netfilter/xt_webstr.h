@@ -0,0 +1,39 @@
+#ifndef _XT_WEBSTR_H
+#define _XT_WEBSTR_H
+
+/*
+ * Domain sets of the webstr match.  A rule of type 3 (hostset) names a
+ * set in its string and matches packets whose HTTP Host or TLS server
+ * name is a listed domain or a subdomain of one.
+ */
+#define WEBSTR_GENL_NAME	"WEBSTR"
+#define WEBSTR_GENL_VERSION	1
+
+#define WEBSTR_SET_MAXNAMELEN	32
+#define WEBSTR_DOMAIN_MAXLEN	253
+
+enum webstr_cmd {
+	WEBSTR_CMD_UNSPEC,
+	WEBSTR_CMD_NEW,		/* create a set */
+	WEBSTR_CMD_DESTROY,	/* remove a set no rule uses */
+	WEBSTR_CMD_FLUSH,	/* remove all domains of a set */
+	WEBSTR_CMD_ADD,		/* add domains to a set */
+	WEBSTR_CMD_DEL,		/* remove domains from a set */
+	WEBSTR_CMD_GET,		/* dump of all sets */
+	__WEBSTR_CMD_MAX
+};
+#define WEBSTR_CMD_MAX (__WEBSTR_CMD_MAX - 1)
+
+enum webstr_attr {
+	WEBSTR_A_UNSPEC,
+	WEBSTR_A_SET,		/* string: set name */
+	WEBSTR_A_HASHSIZE,	/* u32: initial buckets, on create */
+	WEBSTR_A_MAXELEM,	/* u32: domain limit, on create */
+	WEBSTR_A_DOMAIN,	/* string, repeated: "example.com" */
+	WEBSTR_A_ELEMENTS,	/* u32: domains in the set */
+	WEBSTR_A_REFERENCES,	/* u32: rules using the set */
+	__WEBSTR_A_MAX
+};
+#define WEBSTR_A_MAX (__WEBSTR_A_MAX - 1)
+
+#endif /* _XT_WEBSTR_H */
@@ -1,9 +1,16 @@
 #ifndef _LINUX_NTC_SHAPER_HOOKS_H
 #define _LINUX_NTC_SHAPER_HOOKS_H
 
-#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/static_key.h>
 
 struct sk_buff;
+struct nf_conn;
+
+/* Values a shaper stores in *disable_hwacc */
+#define NTC_HWACC_ALLOW		0	/* the flow may be bound to the PPE */
+#define NTC_HWACC_DISABLE	1	/* keep the flow in software */
+#define NTC_HWACC_METER		2	/* bind it with a meter, see below */
 
 typedef
 unsigned int ntc_shaper_hook_fn(struct sk_buff *skb,
@@ -16,47 +23,67 @@ unsigned int ntc_shaper_hook_fn(struct sk_buff *skb,
 
 extern int (*ntc_shaper_check_ip_and_mac)(uint32_t ipaddr, uint8_t *mac);
 
-extern rwlock_t ntc_shaper_lock;
-extern ntc_shaper_hook_fn *ntc_shaper_ingress_hook;
-extern ntc_shaper_hook_fn *ntc_shaper_egress_hook;
+/* Rate and burst in bytes a flow bound with NTC_HWACC_METER must be
+ * metered at in direction dir, non-zero if the flow has no meter */
+extern int (*ntc_shaper_hwacc_meter)(struct nf_conn *ct, int dir,
+				     uint32_t *rate, uint32_t *burst);
+
+/* Enabled while a shaper has its hooks registered */
+extern struct static_key ntc_shaper_hooks_key;
+extern ntc_shaper_hook_fn __rcu *ntc_shaper_ingress_hook;
+extern ntc_shaper_hook_fn __rcu *ntc_shaper_egress_hook;
+
+static inline bool
+ntc_shaper_hooks_enabled(void)
+{
+	return static_key_false(&ntc_shaper_hooks_key);
+}
 
+/* Returned hook may be called until the matching _put() */
 static inline ntc_shaper_hook_fn *
 ntc_shaper_ingress_hook_get(void)
 {
-	read_lock_bh(&ntc_shaper_lock);
+	rcu_read_lock();
 
-	return ntc_shaper_ingress_hook;
+	if (!ntc_shaper_hooks_enabled())
+		return NULL;
+
+	return rcu_dereference(ntc_shaper_ingress_hook);
 }
 
 static inline void
 ntc_shaper_ingress_hook_put(void)
 {
-	read_unlock_bh(&ntc_shaper_lock);
+	rcu_read_unlock();
 }
 
 static inline ntc_shaper_hook_fn *
 ntc_shaper_egress_hook_get(void)
 {
-	read_lock_bh(&ntc_shaper_lock);
+	rcu_read_lock();
+
+	if (!ntc_shaper_hooks_enabled())
+		return NULL;
 
-	return ntc_shaper_egress_hook;
+	return rcu_dereference(ntc_shaper_egress_hook);
 }
 
 static inline void
 ntc_shaper_egress_hook_put(void)
 {
-	read_unlock_bh(&ntc_shaper_lock);
+	rcu_read_unlock();
 }
 
-static inline void
-ntc_shaper_hooks_set(ntc_shaper_hook_fn *ingress_hook,
-		     ntc_shaper_hook_fn *egress_hook)
+/* Only tells if the ingress hook is set, it must not be called */
+static inline bool
+ntc_shaper_ingress_hook_active(void)
 {
-	write_lock_bh(&ntc_shaper_lock);
-	ntc_shaper_ingress_hook = ingress_hook;
-	ntc_shaper_egress_hook = egress_hook;
-	write_unlock_bh(&ntc_shaper_lock);
+	return ntc_shaper_hooks_enabled() &&
+	       rcu_access_pointer(ntc_shaper_ingress_hook) != NULL;
 }
 
-#endif
+/* May sleep, the old hooks are not in use anymore when it returns */
+extern void ntc_shaper_hooks_set(ntc_shaper_hook_fn *ingress_hook,
+				 ntc_shaper_hook_fn *egress_hook);
 
+#endif
@@ -734,4 +734,43 @@ struct tc_fq_codel_xstats {
 	};
 };
 
+/* FQ_HOST */
+
+enum {
+	TCA_FQ_HOST_UNSPEC,
+	TCA_FQ_HOST_TARGET,	/* u32, us */
+	TCA_FQ_HOST_LIMIT,	/* u32, packets */
+	TCA_FQ_HOST_INTERVAL,	/* u32, us */
+	TCA_FQ_HOST_ECN,
+	TCA_FQ_HOST_FLOWS,	/* u32, flow queues */
+	TCA_FQ_HOST_HOSTS,	/* u32, host slots */
+	TCA_FQ_HOST_QUANTUM,	/* u32, bytes */
+	TCA_FQ_HOST_MODE,	/* u32, enum tc_fq_host_mode */
+	TCA_FQ_HOST_RATE,	/* u32, bytes per second, 0 for no limit */
+	TCA_FQ_HOST_BURST,	/* u32, bytes */
+	__TCA_FQ_HOST_MAX
+};
+
+#define TCA_FQ_HOST_MAX	(__TCA_FQ_HOST_MAX - 1)
+
+enum tc_fq_host_mode {
+	TC_FQ_HOST_SRC,		/* host is the source before NAT */
+	TC_FQ_HOST_DST,		/* host is the destination after NAT */
+};
+
+struct tc_fq_host_xstats {
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	drop_overlimit; /* number of time max qdisc
+				 * packet limit was hit
+				 */
+	__u32	ecn_mark;	/* number of packets we ECN marked
+				 * instead of being dropped
+				 */
+	__u32	new_flow_count; /* number of time packets
+				 * created a 'new flow'
+				 */
+	__u32	hosts_len;	/* count of hosts with packets */
+	__u32	throttled;	/* dequeues held back by the rate */
+};
+
 #endif
@@ -75,8 +75,11 @@ extern int ppp_unit_number(struct ppp_channel *);
 /* Get the device name associated with a channel, or NULL if none */
 extern char *ppp_dev_name(struct ppp_channel *);
 
-/* Reset statistics for given device name */
+/* Reset statistics for given device name; a modular or disabled
+ * PPP provides it as a hook wrapper in <linux/ppp_hook.h> instead */
+#if IS_BUILTIN(CONFIG_PPP)
 extern void ppp_stats_reset(struct net_device *dev);
+#endif
 
 /*
  * SMP locking notes:
@@ -91,6 +91,12 @@ struct usbnet {
 #		define EVENT_RX_KILL	10
 #		define EVENT_SET_RX_MODE	12
 #		define EVENT_NO_IP_ALIGN	13
+
+	/* tx_qlen follows the URB completion time up to tx_qlen_max */
+	unsigned short		tx_qlen_max;
+	unsigned char		tx_qlen_hit;	/* queue stopped on tx_qlen */
+	u32			tx_lat;		/* average completion time, ns */
+	unsigned long		tx_tune_stamp;	/* jiffies of the last change */
 };
 
 static inline struct usb_driver *driver_of(struct usb_interface *intf)
@@ -235,6 +241,7 @@ struct skb_data {	/* skb->cb is one of these */
 	struct urb		*urb;
 	struct usbnet		*dev;
 	enum skb_state		state;
+	u32			tx_time;	/* ns: of submit, then spent */
 	long			length;
 	unsigned long		packets;
 };
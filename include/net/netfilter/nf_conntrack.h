@@ -114,24 +114,69 @@ struct nf_conn {
 	/* Have we seen traffic both ways yet? (bitset) */
 	unsigned long status;
 
-	/* If we were expected by an expectation, this will be it */
-	struct nf_conn *master;
-
+#ifdef CONFIG_NF_CONNTRACK_GC
+	/* Expiry time in jiffies, relative until confirmed.  Expired
+	   entries are reaped by the GC worker or on lookup. */
+	unsigned long timeout;
+#else
 	/* Timer function; drops refcnt when it goes off. */
 	struct timer_list timeout;
+#endif
+
+	/* If we were expected by an expectation, this will be it */
+	struct nf_conn *master;
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
 	u_int8_t fast_ext;
 	u_int8_t fast_bind_reached;
 #endif
 
+#ifdef CONFIG_NF_CONNTRACK_COMPACT
+#if defined(CONFIG_NF_CONNTRACK_MARK)
+	u_int8_t ndm_mark;
+#endif
+	/* Counters follow the entry in its slab object */
+	u_int8_t acct_inline;
+#endif
+
+	/* CPU whose unconfirmed, dying or eviction list holds us */
+	u_int16_t cpu;
+
+#if IS_ENABLED(CONFIG_NF_CONNTRACK_NACCT)
+	/* Host accounting slot plus one, 0 if not accounted */
+	u_int16_t nacct_host;
+#endif
+
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	/* Queue number plus one whose verdict accepted the rest of the
+	   flow, 0 if queued everywhere */
+	u_int16_t nfq_bypass;
+#endif
+
+#if IS_ENABLED(CONFIG_NF_CONNTRACK_HPOL)
+	/* Policer generation << 16 | host slot plus one, 0 if unbound */
+	u_int32_t hpol;
+#endif
+
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+	/* Link into the per-CPU list of our eviction class */
+	struct list_head evict_list;
+#endif
+
 #if defined(CONFIG_NF_CONNTRACK_MARK)
+#ifndef CONFIG_NF_CONNTRACK_COMPACT
 	u_int8_t ndm_mark;
 	/* 8 or 24 bit hole */
+#endif
 
 	u_int32_t mark;
 #endif
 
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	/* Dump generation of the last change, see nf_ct_touch() */
+	u_int32_t dump_gen;
+#endif
+
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
 	u_int32_t secmark;
 #endif
@@ -144,10 +189,10 @@ struct nf_conn {
 		 */
 		char *app_proto;
 		/*
-		 * application layer data so far. NULL after match decision.
+		 * search state of xt_layer7 so far, a single kmalloc'ed
+		 * block. NULL after match decision.
 		 */
-		char *app_data;
-		unsigned int app_data_len;
+		void *app_data;
 	} layer7;
 #endif
 
@@ -282,6 +327,31 @@ static inline bool nf_ct_kill(struct nf_conn *ct)
 	return __nf_ct_kill_acct(ct, 0, NULL, 0);
 }
 
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+/* Requeue a confirmed conntrack after its eviction class changed */
+extern void nf_ct_evict_update(struct nf_conn *ct);
+#else
+static inline void nf_ct_evict_update(struct nf_conn *ct)
+{
+}
+#endif
+
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+/* Mark ct as changed in the current dump generation.  The entry is
+   written only once per generation, not on every packet. */
+static inline void nf_ct_touch(struct nf_conn *ct)
+{
+	u_int32_t gen = atomic_read(&nf_ct_net(ct)->ct.dump_gen);
+
+	if (ct->dump_gen != gen)
+		ct->dump_gen = gen;
+}
+#else
+static inline void nf_ct_touch(struct nf_conn *ct)
+{
+}
+#endif
+
 /* These are for NAT.  Icky. */
 extern s32 (*nf_ct_nat_offset)(const struct nf_conn *ct,
 			       enum ip_conntrack_dir dir,
@@ -326,6 +396,68 @@ static inline int nf_ct_is_untracked(const struct nf_conn *ct)
 	return test_bit(IPS_UNTRACKED_BIT, &ct->status);
 }
 
+/* Expiry time in jiffies, relative until the conntrack is confirmed */
+#ifdef CONFIG_NF_CONNTRACK_GC
+#define nf_ct_timeout_expires(ct)	((ct)->timeout)
+#else
+#define nf_ct_timeout_expires(ct)	((ct)->timeout.expires)
+#endif
+
+/* Starts expiry of a confirmed conntrack at absolute time expires */
+static inline void nf_ct_timeout_start(struct nf_conn *ct,
+				       unsigned long expires)
+{
+#ifdef CONFIG_NF_CONNTRACK_GC
+	ct->timeout = expires;
+	smp_mb__before_clear_bit();
+	clear_bit(IPS_EXPIRED_BIT, &ct->status);
+#else
+	ct->timeout.expires = expires;
+	add_timer(&ct->timeout);
+#endif
+}
+
+/* Stops expiry like del_timer(): returns true if the caller now owns
+ * the teardown of the conntrack. */
+static inline bool nf_ct_timeout_del(struct nf_conn *ct)
+{
+#ifdef CONFIG_NF_CONNTRACK_GC
+	return test_bit(IPS_CONFIRMED_BIT, &ct->status) &&
+	       !test_and_set_bit(IPS_EXPIRED_BIT, &ct->status);
+#else
+	return del_timer(&ct->timeout);
+#endif
+}
+
+/* Remaining lifetime in jiffies, 0 if expiry is not running */
+static inline unsigned long nf_ct_expires(const struct nf_conn *ct)
+{
+	long timeout = (long)(nf_ct_timeout_expires(ct) - jiffies);
+
+#ifdef CONFIG_NF_CONNTRACK_GC
+	if (!test_bit(IPS_CONFIRMED_BIT, &ct->status) ||
+	    test_bit(IPS_EXPIRED_BIT, &ct->status))
+		return 0;
+#else
+	if (!timer_pending(&ct->timeout))
+		return 0;
+#endif
+	return timeout > 0 ? timeout : 0;
+}
+
+#ifdef CONFIG_NF_CONNTRACK_GC
+/* Only meaningful for confirmed conntracks */
+static inline bool nf_ct_is_expired(const struct nf_conn *ct)
+{
+	return (long)(ct->timeout - jiffies) <= 0;
+}
+#else
+static inline bool nf_ct_is_expired(const struct nf_conn *ct)
+{
+	return false;
+}
+#endif
+
 /* Packet is received from loopback */
 static inline bool nf_is_loopback_packet(const struct sk_buff *skb)
 {
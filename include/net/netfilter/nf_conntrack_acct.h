@@ -8,12 +8,80 @@
 
 #ifndef _NF_CONNTRACK_ACCT_H
 #define _NF_CONNTRACK_ACCT_H
+#include <linux/seqlock.h>
+#include <linux/skbuff.h>
+#include <linux/tcp.h>
 #include <net/net_namespace.h>
 #include <linux/netfilter/nf_conntrack_common.h>
 #include <linux/netfilter/nf_conntrack_tuple_common.h>
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_extend.h>
 
+#ifdef CONFIG_NF_CONNTRACK_ACCT_LOCKLESS
+/*
+ * Counters are updated with 32-bit atomics, which are lock-free on
+ * 32-bit CPUs unlike atomic64_t.  Once a 32-bit delta grows past
+ * NF_CT_ACCT_FOLD it is moved into the 64-bit base under the seqcount,
+ * readers sum both halves.
+ */
+#define NF_CT_ACCT_FOLD		(1U << 30)
+
+struct nf_conn_counter {
+	atomic_t packets;
+	atomic_t bytes;
+	u64 packets_base;
+	u64 bytes_base;
+	seqcount_t seq;
+	atomic64_t prev_packets;
+	atomic64_t prev_bytes;
+};
+
+extern void __nf_ct_acct_fold(struct nf_conn_counter *counter);
+extern void nf_ct_acct_read_and_zero(struct nf_conn_counter *counter,
+				     u64 *packets, u64 *bytes);
+
+static inline void nf_ct_acct_add(struct nf_conn_counter *counter,
+				  unsigned int packets, unsigned int bytes)
+{
+	unsigned int p = atomic_add_return(packets, &counter->packets);
+	unsigned int b = atomic_add_return(bytes, &counter->bytes);
+
+	if (unlikely(p >= NF_CT_ACCT_FOLD || b >= NF_CT_ACCT_FOLD))
+		__nf_ct_acct_fold(counter);
+}
+
+static inline u64 nf_ct_acct_read(const struct nf_conn_counter *counter,
+				  const u64 *base, const atomic_t *delta)
+{
+	unsigned int seq;
+	u64 val;
+
+	do {
+		seq = read_seqcount_begin(&counter->seq);
+		val = *base + (u32)atomic_read(delta);
+	} while (read_seqcount_retry(&counter->seq, seq));
+
+	return val;
+}
+
+static inline u64 nf_ct_acct_packets(const struct nf_conn_counter *counter)
+{
+	return nf_ct_acct_read(counter, &counter->packets_base,
+			       &counter->packets);
+}
+
+static inline u64 nf_ct_acct_bytes(const struct nf_conn_counter *counter)
+{
+	return nf_ct_acct_read(counter, &counter->bytes_base,
+			       &counter->bytes);
+}
+
+static inline void nf_ct_acct_fold(struct nf_conn_counter *acct)
+{
+	__nf_ct_acct_fold(&acct[IP_CT_DIR_ORIGINAL]);
+	__nf_ct_acct_fold(&acct[IP_CT_DIR_REPLY]);
+}
+#else
 struct nf_conn_counter {
 	atomic64_t packets;
 	atomic64_t bytes;
@@ -21,6 +89,64 @@ struct nf_conn_counter {
 	atomic64_t prev_bytes;
 };
 
+static inline void nf_ct_acct_add(struct nf_conn_counter *counter,
+				  unsigned int packets, unsigned int bytes)
+{
+	atomic64_add(packets, &counter->packets);
+	atomic64_add(bytes, &counter->bytes);
+}
+
+static inline u64 nf_ct_acct_packets(const struct nf_conn_counter *counter)
+{
+	return atomic64_read(&counter->packets);
+}
+
+static inline u64 nf_ct_acct_bytes(const struct nf_conn_counter *counter)
+{
+	return atomic64_read(&counter->bytes);
+}
+
+static inline void nf_ct_acct_read_and_zero(struct nf_conn_counter *counter,
+					    u64 *packets, u64 *bytes)
+{
+	*packets = atomic64_xchg(&counter->packets, 0);
+	*bytes = atomic64_xchg(&counter->bytes, 0);
+}
+
+static inline void nf_ct_acct_fold(struct nf_conn_counter *acct)
+{
+}
+#endif /* CONFIG_NF_CONNTRACK_ACCT_LOCKLESS */
+
+#ifdef CONFIG_NF_CONNTRACK_COMPACT
+/* Compact entries are allocated with room for the counters behind
+   struct nf_conn instead of a separate extension. */
+#define NF_CT_ACCT_OFFSET \
+	ALIGN(sizeof(struct nf_conn), __alignof__(struct nf_conn_counter))
+
+static inline
+struct nf_conn_counter *nf_conn_acct_find(const struct nf_conn *ct)
+{
+	if (!ct->acct_inline)
+		return NULL;
+
+	return (void *)ct + NF_CT_ACCT_OFFSET;
+}
+
+static inline
+struct nf_conn_counter *nf_ct_acct_ext_add(struct nf_conn *ct, gfp_t gfp)
+{
+	struct nf_conn_counter *acct = (void *)ct + NF_CT_ACCT_OFFSET;
+
+	if (!nf_ct_net(ct)->ct.sysctl_acct)
+		return NULL;
+
+	memset(acct, 0, sizeof(struct nf_conn_counter[IP_CT_DIR_MAX]));
+	ct->acct_inline = 1;
+
+	return acct;
+}
+#else
 static inline
 struct nf_conn_counter *nf_conn_acct_find(const struct nf_conn *ct)
 {
@@ -43,6 +169,37 @@ struct nf_conn_counter *nf_ct_acct_ext_add(struct nf_conn *ct, gfp_t gfp)
 
 	return acct;
 };
+#endif
+
+/* Packets in skb of *len bytes, a GRO super-packet counts as its
+   segments and *len grows by their replicated headers */
+static inline unsigned int nf_ct_acct_segs(const struct sk_buff *skb,
+					   unsigned int *len)
+{
+	unsigned int segs = 1;
+
+	if (skb_is_gso(skb) && skb_shinfo(skb)->gso_segs > 1) {
+		unsigned int hdr_len = skb_transport_offset(skb) -
+				       skb_network_offset(skb);
+
+		if (skb_shinfo(skb)->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6))
+			hdr_len += tcp_hdrlen(skb);
+
+		segs = skb_shinfo(skb)->gso_segs;
+		*len += (segs - 1) * hdr_len;
+	}
+
+	return segs;
+}
+
+/* Accounts skb of len bytes, a GRO super-packet counts as its segments */
+static inline void nf_ct_acct_skb(struct nf_conn_counter *counter,
+				  const struct sk_buff *skb, unsigned int len)
+{
+	unsigned int segs = nf_ct_acct_segs(skb, &len);
+
+	nf_ct_acct_add(counter, segs, len);
+}
 
 extern unsigned int
 seq_print_acct(struct seq_file *s, const struct nf_conn *ct, int dir);
@@ -13,6 +13,7 @@
 #define _NF_CONNTRACK_CORE_H
 
 #include <linux/netfilter.h>
+#include <linux/seqlock.h>
 #include <net/netfilter/nf_conntrack_l3proto.h>
 #include <net/netfilter/nf_conntrack_l4proto.h>
 #include <net/netfilter/nf_conntrack_ecache.h>
@@ -76,4 +77,31 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
 
 extern spinlock_t nf_conntrack_lock ;
 
+/* Hash chains are guarded by striped locks, bucket N takes
+ * nf_conntrack_locks[N % CONNTRACK_LOCKS].  nf_conntrack_lock only
+ * covers expectations and helpers. */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
+/* Bumped while the hash table is being resized */
+extern seqcount_t nf_conntrack_generation;
+
+/* Consistent snapshot of the hash table and its size for RCU readers */
+static inline void nf_conntrack_get_ht(const struct net *net,
+				       struct hlist_nulls_head **hash,
+				       unsigned int *hsize)
+{
+	unsigned int sequence;
+
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		*hash = net->ct.hash;
+		*hsize = net->ct.htable_size;
+	} while (read_seqcount_retry(&nf_conntrack_generation, sequence));
+}
+
+extern int nf_conntrack_hash_resize(unsigned int hashsize);
+
 #endif /* _NF_CONNTRACK_CORE_H */
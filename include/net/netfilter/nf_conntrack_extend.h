@@ -21,6 +21,9 @@ enum nf_ct_ext_id {
 	NF_CT_EXT_TIMEOUT,
 #endif
 	NF_CT_EXT_MARK,
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	NF_CT_EXT_FASTNAT,
+#endif
 	NF_CT_EXT_NUM,
 };
 
@@ -31,6 +34,7 @@ enum nf_ct_ext_id {
 #define NF_CT_EXT_TSTAMP_TYPE struct nf_conn_tstamp
 #define NF_CT_EXT_TIMEOUT_TYPE struct nf_conn_timeout
 #define NF_CT_EXT_MARK_TYPE struct nf_conntrack_ext_mark
+#define NF_CT_EXT_FASTNAT_TYPE struct nf_conn_fastnat
 
 /* Extensions: optional stuff which isn't permanently in struct. */
 struct nf_ct_ext {
@@ -0,0 +1,193 @@
+#ifndef _NF_CONNTRACK_FASTNAT_H
+#define _NF_CONNTRACK_FASTNAT_H
+
+#include <linux/netdevice.h>
+#include <linux/if_vlan.h>
+#include <linux/rcupdate.h>
+#include <net/dst.h>
+#include <net/net_namespace.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_extend.h>
+#include <trace/events/fastnat.h>
+
+/* Largest hardware header kept in the cache (Ethernet + VLAN) */
+#define NF_CT_FASTNAT_HH_MAX	HH_DATA_ALIGN(VLAN_ETH_HLEN)
+
+/* Route and L2 header of one conntrack direction, replaced as a whole
+ * and freed after RCU grace period. */
+struct nf_ct_fastnat_route {
+	struct rcu_head rcu;
+	struct dst_entry *dst;
+	int rt_genid;
+	unsigned int gen;
+	int iif;
+	u8 tos;
+	u8 hh_len;
+	/* Next hop the header was copied from, or which is resolving */
+	struct neighbour *neigh;
+	unsigned int hh_seq;
+	unsigned long hh_data[NF_CT_FASTNAT_HH_MAX / sizeof(long)];
+};
+
+struct nf_conn_fastnat {
+	struct nf_ct_fastnat_route __rcu *route[IP_CT_DIR_MAX];
+};
+
+static inline
+struct nf_conn_fastnat *nf_conn_fastnat_find(const struct nf_conn *ct)
+{
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	return nf_ct_ext_find(ct, NF_CT_EXT_FASTNAT);
+#else
+	return NULL;
+#endif
+}
+
+static inline
+struct nf_conn_fastnat *nf_ct_fastnat_ext_add(struct nf_conn *ct, gfp_t gfp)
+{
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	return nf_ct_ext_add(ct, NF_CT_EXT_FASTNAT, gfp);
+#else
+	return NULL;
+#endif
+}
+
+/* Fast NAT decision points, counted per CPU in /proc/net/stat/fastnat */
+enum {
+	NF_CT_FASTNAT_STAT_BIND,		/* flow bound */
+	NF_CT_FASTNAT_STAT_BIND_EXT,		/* helper, IPsec or policy */
+	NF_CT_FASTNAT_STAT_BIND_THRESHOLD,	/* below packet threshold */
+	NF_CT_FASTNAT_STAT_BIND_KEEPALIVE,	/* keepalive packet */
+	NF_CT_FASTNAT_STAT_BIND_NO_NAT,		/* flow is not NATed */
+	NF_CT_FASTNAT_STAT_NAT_NOT_READY,	/* NAT setup unfinished */
+	NF_CT_FASTNAT_STAT_SKB_NOT_READY,	/* cloned skb */
+	NF_CT_FASTNAT_STAT_MANIP_FAIL,		/* manip_pkt() failed */
+	NF_CT_FASTNAT_STAT_ROUTE_FAIL,		/* input route lookup failed */
+	NF_CT_FASTNAT_STAT_HIT,			/* IPv4 fast path */
+	NF_CT_FASTNAT_STAT_HIT6,		/* IPv6 fast path */
+	NF_CT_FASTNAT_STAT_FALLBACK6,		/* IPv6 slow path */
+	NF_CT_FASTNAT_STAT_INGRESS_STOLEN,	/* queued by ingress shaper */
+	NF_CT_FASTNAT_STAT_INGRESS_DROP,	/* dropped by ingress shaper */
+	NF_CT_FASTNAT_STAT_EGRESS_STOLEN,	/* queued by egress shaper */
+	NF_CT_FASTNAT_STAT_EGRESS_DROP,		/* dropped by egress shaper */
+	NF_CT_FASTNAT_STAT_TTL_EXCEEDED,	/* TTL or hop limit expired */
+	NF_CT_FASTNAT_STAT_FRAG,		/* fragmented at egress */
+	NF_CT_FASTNAT_STAT_GSO_SEGMENT,		/* GSO skb segmented for MTU */
+	NF_CT_FASTNAT_STAT_MAX,
+};
+
+struct nf_ct_fastnat_stat {
+	unsigned int count[NF_CT_FASTNAT_STAT_MAX];
+};
+
+#if IS_ENABLED(CONFIG_FAST_NAT)
+DECLARE_PER_CPU(struct nf_ct_fastnat_stat, nf_ct_fastnat_stat);
+
+#define NF_CT_FASTNAT_STAT_INC(item) \
+	__this_cpu_inc(nf_ct_fastnat_stat.count[NF_CT_FASTNAT_STAT_##item])
+
+/* Counts a packet which left the fast path, and traces it */
+#define NF_CT_FASTNAT_FALLBACK(skb, item) \
+	do { \
+		NF_CT_FASTNAT_STAT_INC(item); \
+		trace_fastnat_fallback(skb, NF_CT_FASTNAT_STAT_##item); \
+	} while (0)
+
+/* Bumped on netdev events, invalidates all cached routes */
+extern atomic_t nf_ct_fastnat_gen;
+
+/* Is the next hop resolved, still with the hardware header we copied? */
+static inline bool
+nf_ct_fastnat_hh_valid(const struct nf_ct_fastnat_route *r)
+{
+	return r->hh_len != 0 &&
+	       (ACCESS_ONCE(r->neigh->nud_state) & NUD_CONNECTED) &&
+	       !read_seqretry(&r->neigh->hh.hh_lock, r->hh_seq);
+}
+
+/* Must be called under rcu_read_lock(), returns NULL if no valid
+ * route is cached for this direction. */
+static inline const struct nf_ct_fastnat_route *
+nf_ct_fastnat_route_get(const struct nf_conn *ct, enum ip_conntrack_dir dir)
+{
+	const struct nf_conn_fastnat *fn = nf_conn_fastnat_find(ct);
+	const struct nf_ct_fastnat_route *r;
+
+	if (fn == NULL)
+		return NULL;
+
+	r = rcu_dereference(fn->route[dir]);
+	if (r == NULL ||
+	    r->gen != atomic_read(&nf_ct_fastnat_gen) ||
+	    r->rt_genid != atomic_read(&nf_ct_net(ct)->ipv4.rt_genid) ||
+	    r->dst->obsolete > 0)
+		return NULL;
+
+	/* Refilled once the next hop is resolved or changes its address */
+	if (unlikely(r->neigh != NULL && !nf_ct_fastnat_hh_valid(r) &&
+		     (ACCESS_ONCE(r->neigh->nud_state) & NUD_CONNECTED)))
+		return NULL;
+
+	return r;
+}
+
+/* Same as above, also matches input device and TOS of the packet */
+static inline const struct nf_ct_fastnat_route *
+nf_ct_fastnat_route_find(const struct nf_conn *ct,
+			 enum ip_conntrack_dir dir,
+			 const struct net_device *in, u8 tos)
+{
+	const struct nf_ct_fastnat_route *r = nf_ct_fastnat_route_get(ct, dir);
+
+	if (r == NULL || r->iif != in->ifindex || r->tos != tos)
+		return NULL;
+
+	return r;
+}
+
+extern void nf_ct_fastnat_route_update(struct nf_conn *ct,
+				       enum ip_conntrack_dir dir,
+				       struct dst_entry *dst,
+				       const struct net_device *in, u8 tos);
+
+extern int nf_conntrack_fastnat_init(struct net *net);
+extern void nf_conntrack_fastnat_fini(struct net *net);
+
+/* Bind policy actions */
+enum {
+	NF_CT_FASTNAT_THRESHOLD,	/* bind after packet thresholds */
+	NF_CT_FASTNAT_BIND,		/* bind immediately */
+	NF_CT_FASTNAT_NEVER,		/* never bind */
+};
+
+struct nf_ct_fastnat_rule {
+	u8 action;
+	u32 both;	/* packets in each direction */
+	u32 half;	/* packets in any direction, 0 - disabled */
+};
+
+#define NF_CT_FASTNAT_POLICY_LEN	1024
+
+/* Returns NULL if the protocol is never bound,
+ * must be called under rcu_read_lock(). */
+extern const struct nf_ct_fastnat_rule *
+nf_ct_fastnat_policy_lookup(const struct nf_conn *ct, u8 protonum);
+
+struct ctl_table;
+extern int nf_ct_fastnat_policy_sysctl(struct ctl_table *table, int write,
+				       void __user *buffer, size_t *lenp,
+				       loff_t *ppos);
+extern void nf_conntrack_fastnat_policy_fini(void);
+#else
+static inline int nf_conntrack_fastnat_init(struct net *net)
+{
+	return 0;
+}
+
+static inline void nf_conntrack_fastnat_fini(struct net *net)
+{
+}
+#endif /* IS_ENABLED(CONFIG_FAST_NAT) */
+
+#endif /* _NF_CONNTRACK_FASTNAT_H */
@@ -0,0 +1,38 @@
+#ifndef _NF_CONNTRACK_NACCT_KERNEL_H
+#define _NF_CONNTRACK_NACCT_KERNEL_H
+
+#include <linux/rcupdate.h>
+#include <linux/static_key.h>
+#include <net/netfilter/nf_conntrack.h>
+
+struct sk_buff;
+
+typedef void nacct_packet_fn(struct nf_conn *ct, enum ip_conntrack_dir dir,
+			     const struct sk_buff *skb, unsigned int len);
+
+/* Enabled while a host accounting module has its hooks registered */
+extern struct static_key nacct_packet_key;
+extern nacct_packet_fn __rcu *nacct_packet_hook;
+
+/* Called for every conntrack freed */
+extern void (*nacct_conntrack_free)(struct nf_conn *ct);
+
+/* Feeds host accounting, called wherever conntrack counters are updated */
+static inline void nf_ct_nacct_packet(struct nf_conn *ct,
+				      enum ip_conntrack_dir dir,
+				      const struct sk_buff *skb,
+				      unsigned int len)
+{
+	nacct_packet_fn *fn;
+
+	if (!static_key_false(&nacct_packet_key))
+		return;
+
+	rcu_read_lock();
+	fn = rcu_dereference(nacct_packet_hook);
+	if (fn != NULL)
+		fn(ct, dir, skb, len);
+	rcu_read_unlock();
+}
+
+#endif /* _NF_CONNTRACK_NACCT_KERNEL_H */
@@ -22,11 +22,61 @@
   "non-manipulatable" lines, for the benefit of the NAT code.
 */
 
-#define NF_CT_TUPLE_L3SIZE	ARRAY_SIZE(((union nf_inet_addr *)NULL)->all)
+#ifdef CONFIG_NF_CONNTRACK_IPV4_TUPLE
+/* Without IPv6 conntrack the tuples only carry IPv4 addresses. The
+   members are named after their union nf_inet_addr counterparts. */
+union nf_conntrack_address {
+	__u32		all[1];
+	__be32		ip;
+	struct in_addr	in;
+};
+
+static inline bool nf_ct_addr_cmp(const union nf_conntrack_address *a1,
+				  const union nf_conntrack_address *a2)
+{
+	return a1->ip == a2->ip;
+}
+
+static inline void nf_ct_addr_from_inet(union nf_conntrack_address *a,
+					const union nf_inet_addr *addr)
+{
+	a->ip = addr->ip;
+}
+
+static inline void nf_ct_addr_to_inet(union nf_inet_addr *addr,
+				      const union nf_conntrack_address *a)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->ip = a->ip;
+}
+#else
+#define nf_conntrack_address nf_inet_addr
+
+static inline bool nf_ct_addr_cmp(const union nf_conntrack_address *a1,
+				  const union nf_conntrack_address *a2)
+{
+	return nf_inet_addr_cmp(a1, a2);
+}
+
+static inline void nf_ct_addr_from_inet(union nf_conntrack_address *a,
+					const union nf_inet_addr *addr)
+{
+	*a = *addr;
+}
+
+static inline void nf_ct_addr_to_inet(union nf_inet_addr *addr,
+				      const union nf_conntrack_address *a)
+{
+	*addr = *a;
+}
+#endif
+
+#define NF_CT_TUPLE_L3SIZE \
+	ARRAY_SIZE(((union nf_conntrack_address *)NULL)->all)
 
 /* The manipulable part of the tuple. */
 struct nf_conntrack_man {
-	union nf_inet_addr u3;
+	union nf_conntrack_address u3;
 	union nf_conntrack_man_proto u;
 	/* Layer 3 protocol */
 	u_int16_t l3num;
@@ -38,7 +88,7 @@ struct nf_conntrack_tuple {
 
 	/* These are the parts of the tuple which are fixed. */
 	struct {
-		union nf_inet_addr u3;
+		union nf_conntrack_address u3;
 		union {
 			/* Add other protocols here. */
 			__be16 all;
@@ -73,7 +123,7 @@ struct nf_conntrack_tuple {
 
 struct nf_conntrack_tuple_mask {
 	struct {
-		union nf_inet_addr u3;
+		union nf_conntrack_address u3;
 		union nf_conntrack_man_proto u;
 	} src;
 };
@@ -104,9 +154,11 @@ static inline void nf_ct_dump_tuple(const struct nf_conntrack_tuple *t)
 	case AF_INET:
 		nf_ct_dump_tuple_ip(t);
 		break;
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case AF_INET6:
 		nf_ct_dump_tuple_ipv6(t);
 		break;
+#endif
 	}
 }
 
@@ -123,7 +175,7 @@ struct nf_conntrack_tuple_hash {
 static inline bool __nf_ct_tuple_src_equal(const struct nf_conntrack_tuple *t1,
 					   const struct nf_conntrack_tuple *t2)
 { 
-	return (nf_inet_addr_cmp(&t1->src.u3, &t2->src.u3) &&
+	return (nf_ct_addr_cmp(&t1->src.u3, &t2->src.u3) &&
 		t1->src.u.all == t2->src.u.all &&
 		t1->src.l3num == t2->src.l3num);
 }
@@ -131,7 +183,7 @@ static inline bool __nf_ct_tuple_src_equal(const struct nf_conntrack_tuple *t1,
 static inline bool __nf_ct_tuple_dst_equal(const struct nf_conntrack_tuple *t1,
 					   const struct nf_conntrack_tuple *t2)
 {
-	return (nf_inet_addr_cmp(&t1->dst.u3, &t2->dst.u3) &&
+	return (nf_ct_addr_cmp(&t1->dst.u3, &t2->dst.u3) &&
 		t1->dst.u.all == t2->dst.u.all &&
 		t1->dst.protonum == t2->dst.protonum);
 }
@@ -147,7 +199,7 @@ static inline bool
 nf_ct_tuple_mask_equal(const struct nf_conntrack_tuple_mask *m1,
 		       const struct nf_conntrack_tuple_mask *m2)
 {
-	return (nf_inet_addr_cmp(&m1->src.u3, &m2->src.u3) &&
+	return (nf_ct_addr_cmp(&m1->src.u3, &m2->src.u3) &&
 		m1->src.u.all == m2->src.u.all);
 }
 
@@ -21,6 +21,10 @@ struct nf_queue_entry {
 struct nf_queue_handler {
 	int			(*outfn)(struct nf_queue_entry *entry,
 					 unsigned int queuenum);
+	/* Optional, may refuse a packet before it is segmented and an
+	 * entry is allocated for it; errors as returned by outfn() */
+	int			(*precheck)(const struct sk_buff *skb,
+					    unsigned int queuenum);
 	char			*name;
 };
 
@@ -4,10 +4,36 @@
 #include <linux/list.h>
 #include <linux/list_nulls.h>
 #include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+/* Eviction classes, cheapest to reclaim first */
+enum nf_ct_evict_class {
+	NF_CT_EVICT_UNREPLIED,
+	NF_CT_EVICT_UNASSURED,
+	NF_CT_EVICT_CLOSING,
+	NF_CT_EVICT_ASSURED,
+	NF_CT_EVICT_FASTNAT,
+	NF_CT_EVICT_MAX,
+
+	/* Classes from here on are reclaimed only once timed out */
+	NF_CT_EVICT_PROTECTED = NF_CT_EVICT_ASSURED
+};
+
+/* Unconfirmed and dying conntracks of one CPU */
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+	/* Confirmed conntracks by class, oldest first */
+	struct list_head	evict[NF_CT_EVICT_MAX];
+#endif
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
@@ -15,8 +41,15 @@ struct netns_ct {
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
-	struct hlist_nulls_head	dying;
+	struct ct_pcpu __percpu	*pcpu_lists;
+#ifdef CONFIG_NF_CONNTRACK_GC
+	struct delayed_work	gc_work;
+	unsigned int		gc_bucket;
+	unsigned long		gc_interval;
+#endif
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	atomic_t		dump_gen;
+#endif
 	struct ip_conntrack_stat __percpu *stat;
 	struct nf_ct_event_notifier __rcu *nf_conntrack_event_cb;
 	struct nf_exp_event_notifier __rcu *nf_expect_event_cb;
@@ -0,0 +1,78 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM fastnat
+
+#if !defined(_TRACE_FASTNAT_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_FASTNAT_H
+
+#include <linux/skbuff.h>
+#include <linux/tracepoint.h>
+
+struct nf_conn;
+
+TRACE_EVENT(fastnat_bind,
+
+	TP_PROTO(const struct sk_buff *skb, const struct nf_conn *ct),
+
+	TP_ARGS(skb, ct),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(const void *, ctaddr)
+		__field(unsigned int, len)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = skb;
+		__entry->ctaddr = ct;
+		__entry->len = skb->len;
+	),
+
+	TP_printk("skbaddr=%p ct=%p len=%u",
+		  __entry->skbaddr, __entry->ctaddr, __entry->len)
+);
+
+TRACE_EVENT(fastnat_hit,
+
+	TP_PROTO(const struct sk_buff *skb),
+
+	TP_ARGS(skb),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+		__field(__be16, protocol)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+		__entry->protocol = skb->protocol;
+	),
+
+	TP_printk("skbaddr=%p len=%u protocol=0x%04x",
+		  __entry->skbaddr, __entry->len, ntohs(__entry->protocol))
+);
+
+TRACE_EVENT(fastnat_fallback,
+
+	TP_PROTO(const struct sk_buff *skb, int reason),
+
+	TP_ARGS(skb, reason),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(int, reason)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = skb;
+		__entry->reason = reason;
+	),
+
+	TP_printk("skbaddr=%p reason=%d", __entry->skbaddr, __entry->reason)
+);
+
+#endif /* _TRACE_FASTNAT_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
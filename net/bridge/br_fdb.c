@@ -21,6 +21,8 @@
 #include <linux/jhash.h>
 #include <linux/random.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <linux/atomic.h>
 #include <asm/unaligned.h>
 #include "br_private.h"
@@ -31,8 +33,6 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 static void fdb_notify(struct net_bridge *br,
 		       const struct net_bridge_fdb_entry *, int);
 
-static u32 fdb_salt __read_mostly;
-
 int __init br_fdb_init(void)
 {
 	br_fdb_cache = kmem_cache_create("bridge_fdb_cache",
@@ -42,7 +42,6 @@ int __init br_fdb_init(void)
 	if (!br_fdb_cache)
 		return -ENOMEM;
 
-	get_random_bytes(&fdb_salt, sizeof(fdb_salt));
 	return 0;
 }
 
@@ -51,6 +50,77 @@ void br_fdb_fini(void)
 	kmem_cache_destroy(br_fdb_cache);
 }
 
+/* Writers hold br->hash_lock */
+static inline struct net_bridge_fdb_htable *fdb_htable(struct net_bridge *br)
+{
+	return rcu_dereference_protected(br->fdb, 1);
+}
+
+/* Large tables are vmalloc()ed, so they are allocated and freed in
+ * process context only */
+static struct net_bridge_fdb_htable *fdb_htable_alloc(u32 max)
+{
+	struct net_bridge_fdb_htable *tbl;
+	size_t size = max * sizeof(*tbl->hash);
+
+	tbl = kzalloc(sizeof(*tbl), GFP_KERNEL);
+	if (!tbl)
+		return NULL;
+
+	if (size <= PAGE_SIZE)
+		tbl->hash = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	else
+		tbl->hash = __vmalloc(size,
+				      GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN,
+				      PAGE_KERNEL);
+	if (!tbl->hash) {
+		kfree(tbl);
+		return NULL;
+	}
+
+	tbl->max = max;
+	get_random_bytes(&tbl->secret, sizeof(tbl->secret));
+	return tbl;
+}
+
+static void fdb_htable_free(struct net_bridge_fdb_htable *tbl)
+{
+	if (is_vmalloc_addr(tbl->hash))
+		vfree(tbl->hash);
+	else
+		kfree(tbl->hash);
+	kfree(tbl);
+}
+
+static void br_fdb_rehash(struct work_struct *work);
+
+int br_fdb_hash_init(struct net_bridge *br)
+{
+	struct net_bridge_fdb_htable *tbl;
+
+	tbl = fdb_htable_alloc(BR_HASH_SIZE);
+	if (!tbl)
+		return -ENOMEM;
+
+	INIT_WORK(&br->fdb_rehash_work, br_fdb_rehash);
+	br->fdb_rehash_retry = jiffies;
+	RCU_INIT_POINTER(br->fdb, tbl);
+	return 0;
+}
+
+/* All entries are gone when the bridge device is freed */
+void br_fdb_hash_fini(struct net_bridge *br)
+{
+	struct net_bridge_fdb_htable *tbl = rcu_dereference_protected(br->fdb, 1);
+
+	if (!tbl)
+		return;
+
+	/* the work may replace the table */
+	cancel_work_sync(&br->fdb_rehash_work);
+	fdb_htable_free(fdb_htable(br));
+}
+
 
 /* if topology_changing then use forward_delay (default 15 sec)
  * otherwise keep longer (default 5 minutes)
@@ -67,11 +137,53 @@ static inline int has_expired(const struct net_bridge *br,
 		time_before_eq(fdb->updated + hold_time(br), jiffies);
 }
 
-static inline int br_mac_hash(const unsigned char *mac)
+static inline int br_mac_hash(const struct net_bridge_fdb_htable *tbl,
+			      const unsigned char *mac)
 {
 	/* use 1 byte of OUI cnd 3 bytes of NIC */
 	u32 key = get_unaligned((u32 *)(mac + 2));
-	return jhash_1word(key, fdb_salt) & (BR_HASH_SIZE - 1);
+	return jhash_1word(key, tbl->secret) & (tbl->max - 1);
+}
+
+/* Doubles the buckets, scheduled by fdb_create().  Entries are linked
+ * into the new table through their other hlist node, so readers still
+ * walking the old table are not disturbed; it is freed after a grace
+ * period, before the work can run again.  Only this work replaces the
+ * table, so it may look at it without hash_lock.
+ */
+static void br_fdb_rehash(struct work_struct *work)
+{
+	struct net_bridge *br = container_of(work, struct net_bridge,
+					     fdb_rehash_work);
+	struct net_bridge_fdb_htable *old = fdb_htable(br);
+	struct net_bridge_fdb_htable *tbl;
+	struct net_bridge_fdb_entry *f;
+	struct hlist_node *h;
+	u32 i;
+
+	if (old->max >= BR_FDB_HASH_MAX)
+		return;
+
+	tbl = fdb_htable_alloc(old->max * 2);
+	if (!tbl) {
+		br->fdb_rehash_retry = jiffies + BR_FDB_REHASH_RETRY;
+		return;
+	}
+
+	spin_lock_bh(&br->hash_lock);
+	tbl->size = old->size;
+	tbl->ver = old->ver ^ 1;
+
+	for (i = 0; i < old->max; i++)
+		hlist_for_each_entry(f, h, &old->hash[i], hlist[old->ver])
+			hlist_add_head(&f->hlist[tbl->ver],
+				       &tbl->hash[br_mac_hash(tbl, f->addr.addr)]);
+
+	rcu_assign_pointer(br->fdb, tbl);
+	spin_unlock_bh(&br->hash_lock);
+
+	synchronize_rcu();
+	fdb_htable_free(old);
 }
 
 static void fdb_rcu_free(struct rcu_head *head)
@@ -83,7 +195,10 @@ static void fdb_rcu_free(struct rcu_head *head)
 
 static void fdb_delete(struct net_bridge *br, struct net_bridge_fdb_entry *f)
 {
-	hlist_del_rcu(&f->hlist);
+	struct net_bridge_fdb_htable *tbl = fdb_htable(br);
+
+	hlist_del_rcu(&f->hlist[tbl->ver]);
+	tbl->size--;
 	fdb_notify(br, f, RTM_DELNEIGH);
 	call_rcu(&f->rcu, fdb_rcu_free);
 }
@@ -91,17 +206,20 @@ static void fdb_delete(struct net_bridge *br, struct net_bridge_fdb_entry *f)
 void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 {
 	struct net_bridge *br = p->br;
-	int i;
+	struct net_bridge_fdb_htable *tbl;
+	u32 i;
 
 	spin_lock_bh(&br->hash_lock);
+	tbl = fdb_htable(br);
 
 	/* Search all chains since old address/hash is unknown */
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	for (i = 0; i < tbl->max; i++) {
 		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
+		hlist_for_each(h, &tbl->hash[i]) {
 			struct net_bridge_fdb_entry *f;
 
-			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
+			f = hlist_entry(h, struct net_bridge_fdb_entry,
+					hlist[tbl->ver]);
 			if (f->dst == p && f->is_local) {
 				/* maybe another port has same hw addr? */
 				struct net_bridge_port *op;
@@ -139,44 +257,70 @@ void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
 	fdb_insert(br, NULL, newaddr);
 }
 
+/* Ages BR_FDB_GC_BUCKETS buckets per run, so a large table is walked in
+ * slices a tick apart.  A pass cut by a resize finishes on the new table;
+ * entries it misses are aged on the next pass and are not returned by
+ * lookups meanwhile.
+ */
 void br_fdb_cleanup(unsigned long _data)
 {
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
-	unsigned long next_timer = jiffies + br->ageing_time;
-	int i;
+	struct net_bridge_fdb_htable *tbl;
+	unsigned long next_timer;
+	u32 i, end;
 
 	spin_lock(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = fdb_htable(br);
+
+	if (br->gc_bucket == 0 || br->gc_bucket >= tbl->max) {
+		br->gc_bucket = 0;
+		br->gc_next = jiffies + br->ageing_time;
+	}
+
+	end = min_t(u32, br->gc_bucket + BR_FDB_GC_BUCKETS, tbl->max);
+	for (i = br->gc_bucket; i < end; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
 
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		hlist_for_each_entry_safe(f, h, n, &tbl->hash[i],
+					  hlist[tbl->ver]) {
 			unsigned long this_timer;
 			if (f->is_static)
 				continue;
 			this_timer = f->updated + delay;
 			if (time_before_eq(this_timer, jiffies))
 				fdb_delete(br, f);
-			else if (time_before(this_timer, next_timer))
-				next_timer = this_timer;
+			else if (time_before(this_timer, br->gc_next))
+				br->gc_next = this_timer;
 		}
 	}
+
+	if (end < tbl->max) {
+		br->gc_bucket = end;
+		next_timer = jiffies + 1;
+	} else {
+		br->gc_bucket = 0;
+		next_timer = round_jiffies_up(br->gc_next);
+	}
 	spin_unlock(&br->hash_lock);
 
-	mod_timer(&br->gc_timer, round_jiffies_up(next_timer));
+	mod_timer(&br->gc_timer, next_timer);
 }
 
 /* Completely flush all dynamic entries in forwarding database.*/
 void br_fdb_flush(struct net_bridge *br)
 {
-	int i;
+	struct net_bridge_fdb_htable *tbl;
+	u32 i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = fdb_htable(br);
+	for (i = 0; i < tbl->max; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		hlist_for_each_entry_safe(f, h, n, &tbl->hash[i],
+					  hlist[tbl->ver]) {
 			if (!f->is_static)
 				fdb_delete(br, f);
 		}
@@ -191,15 +335,18 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			   const struct net_bridge_port *p,
 			   int do_all)
 {
-	int i;
+	struct net_bridge_fdb_htable *tbl;
+	u32 i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = fdb_htable(br);
+	for (i = 0; i < tbl->max; i++) {
 		struct hlist_node *h, *g;
 
-		hlist_for_each_safe(h, g, &br->hash[i]) {
+		hlist_for_each_safe(h, g, &tbl->hash[i]) {
 			struct net_bridge_fdb_entry *f
-				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
+				= hlist_entry(h, struct net_bridge_fdb_entry,
+					      hlist[tbl->ver]);
 			if (f->dst != p)
 				continue;
 
@@ -233,10 +380,12 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 struct net_bridge_fdb_entry *__br_fdb_get(struct net_bridge *br,
 					  const unsigned char *addr)
 {
+	struct net_bridge_fdb_htable *tbl = rcu_dereference(br->fdb);
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, &br->hash[br_mac_hash(addr)], hlist) {
+	hlist_for_each_entry_rcu(fdb, h, &tbl->hash[br_mac_hash(tbl, addr)],
+				 hlist[tbl->ver]) {
 		if (!compare_ether_addr(fdb->addr.addr, addr)) {
 			if (unlikely(has_expired(br, fdb)))
 				break;
@@ -279,15 +428,18 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 		   unsigned long maxnum, unsigned long skip)
 {
 	struct __fdb_entry *fe = buf;
-	int i, num = 0;
+	struct net_bridge_fdb_htable *tbl;
+	int num = 0;
+	u32 i;
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *f;
 
 	memset(buf, 0, maxnum*sizeof(struct __fdb_entry));
 
 	rcu_read_lock();
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
+	tbl = rcu_dereference(br->fdb);
+	for (i = 0; i < tbl->max; i++) {
+		hlist_for_each_entry_rcu(f, h, &tbl->hash[i], hlist[tbl->ver]) {
 			if (num >= maxnum)
 				goto out;
 
@@ -324,36 +476,42 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 	return num;
 }
 
-static struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
+static struct net_bridge_fdb_entry *fdb_find(struct net_bridge *br,
 					     const unsigned char *addr)
 {
+	struct net_bridge_fdb_htable *tbl = fdb_htable(br);
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry(fdb, h, head, hlist) {
+	hlist_for_each_entry(fdb, h, &tbl->hash[br_mac_hash(tbl, addr)],
+			     hlist[tbl->ver]) {
 		if (!compare_ether_addr(fdb->addr.addr, addr))
 			return fdb;
 	}
 	return NULL;
 }
 
-static struct net_bridge_fdb_entry *fdb_find_rcu(struct hlist_head *head,
+static struct net_bridge_fdb_entry *fdb_find_rcu(struct net_bridge *br,
 						 const unsigned char *addr)
 {
+	struct net_bridge_fdb_htable *tbl = rcu_dereference(br->fdb);
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
+	hlist_for_each_entry_rcu(fdb, h, &tbl->hash[br_mac_hash(tbl, addr)],
+				 hlist[tbl->ver]) {
 		if (!compare_ether_addr(fdb->addr.addr, addr))
 			return fdb;
 	}
 	return NULL;
 }
 
-static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
+static struct net_bridge_fdb_entry *fdb_create(struct net_bridge *br,
 					       struct net_bridge_port *source,
 					       const unsigned char *addr)
 {
+	struct net_bridge_fdb_htable *tbl = fdb_htable(br);
+	struct hlist_head *head = &tbl->hash[br_mac_hash(tbl, addr)];
 	struct net_bridge_fdb_entry *fdb;
 
 #if defined(CONFIG_BRIDGE_2WAYS_FDB)
@@ -363,7 +521,7 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 	int mac_count=0;
 
 	//prevent ARP flooding attack (memory protection code)
-	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
+	hlist_for_each_entry_rcu(fdb, h, head, hlist[tbl->ver]) {
 	    if(++mac_count > MAX_FDB_ENTRY) {
 		return NULL;
 	    }
@@ -377,7 +535,10 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 		fdb->is_local = 0;
 		fdb->is_static = 0;
 		fdb->updated = fdb->used = jiffies;
-		hlist_add_head_rcu(&fdb->hlist, head);
+		hlist_add_head_rcu(&fdb->hlist[tbl->ver], head);
+		if (++tbl->size > tbl->max && tbl->max < BR_FDB_HASH_MAX &&
+		    time_after_eq(jiffies, br->fdb_rehash_retry))
+			schedule_work(&br->fdb_rehash_work);
 	}
 	return fdb;
 }
@@ -385,13 +546,12 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(br, addr);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
@@ -404,7 +564,7 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		fdb_delete(br, fdb);
 	}
 
-	fdb = fdb_create(head, source, addr);
+	fdb = fdb_create(br, source, addr);
 	if (!fdb)
 		return -ENOMEM;
 
@@ -428,7 +588,6 @@ int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		   const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
 	/* some users want to always flood. */
@@ -440,7 +599,7 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 	      source->state == BR_STATE_FORWARDING))
 		return;
 
-	fdb = fdb_find_rcu(head, addr);
+	fdb = fdb_find_rcu(br, addr);
 	if (likely(fdb)) {
 		/* attempt to update an entry for a local interface */
 		if (unlikely(fdb->is_local)) {
@@ -453,14 +612,19 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 			;
 #endif
 		} else {
-			/* fastpath: update of existing entry */
-			fdb->dst = source;
-			fdb->updated = jiffies;
+			/* fastpath: update of existing entry, written only
+			 * when it changes or its age is worth refreshing */
+			if (unlikely(fdb->dst != source)) {
+				fdb->dst = source;
+				fdb->updated = jiffies;
+			} else {
+				br_fdb_refresh(&fdb->updated);
+			}
 		}
 	} else {
 		spin_lock_bh(&br->hash_lock);
-		if (likely(!fdb_find(head, addr))) {
-			fdb = fdb_create(head, source, addr);
+		if (likely(!fdb_find(br, addr))) {
+			fdb = fdb_create(br, source, addr);
 			if (fdb)
 				fdb_notify(br, fdb, RTM_NEWNEIGH);
 		}
@@ -561,16 +725,19 @@ int br_fdb_dump(struct sk_buff *skb, struct netlink_callback *cb)
 	rcu_read_lock();
 	for_each_netdev_rcu(net, dev) {
 		struct net_bridge *br = netdev_priv(dev);
-		int i;
+		struct net_bridge_fdb_htable *tbl;
+		u32 i;
 
 		if (!(dev->priv_flags & IFF_EBRIDGE))
 			continue;
 
-		for (i = 0; i < BR_HASH_SIZE; i++) {
+		tbl = rcu_dereference(br->fdb);
+		for (i = 0; i < tbl->max; i++) {
 			struct hlist_node *h;
 			struct net_bridge_fdb_entry *f;
 
-			hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
+			hlist_for_each_entry_rcu(f, h, &tbl->hash[i],
+						 hlist[tbl->ver]) {
 				if (idx < cb->args[0])
 					goto skip;
 
@@ -597,15 +764,14 @@ static int fdb_add_entry(struct net_bridge_port *source, const __u8 *addr,
 			 __u16 state, __u16 flags)
 {
 	struct net_bridge *br = source->br;
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(br, addr);
 	if (fdb == NULL) {
 		if (!(flags & NLM_F_CREATE))
 			return -ENOENT;
 
-		fdb = fdb_create(head, source, addr);
+		fdb = fdb_create(br, source, addr);
 		if (!fdb)
 			return -ENOMEM;
 		fdb_notify(br, fdb, RTM_NEWNEIGH);
@@ -699,10 +865,9 @@ int br_fdb_add(struct sk_buff *skb, struct nlmsghdr *nlh, void *arg)
 static int fdb_delete_by_addr(struct net_bridge_port *p, const u8 *addr)
 {
 	struct net_bridge *br = p->br;
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
 	struct net_bridge_fdb_entry *fdb;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(br, addr);
 	if (!fdb)
 		return -ENOENT;
 
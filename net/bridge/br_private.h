@@ -21,6 +21,14 @@
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
+/* The FDB hash starts at BR_HASH_SIZE buckets and doubles up to this */
+#define BR_FDB_HASH_MAX (1 << 14)
+/* Wait before growing again after the table could not be allocated */
+#define BR_FDB_REHASH_RETRY (10*HZ)
+/* Buckets aged per run of the gc timer */
+#define BR_FDB_GC_BUCKETS 256
+/* Timestamps of an entry are rewritten at most this often */
+#define BR_FDB_REFRESH (1*HZ)
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -65,7 +73,8 @@ struct br_ip
 
 struct net_bridge_fdb_entry
 {
-	struct hlist_node		hlist;
+	/* one per table version, see br_fdb_rehash() */
+	struct hlist_node		hlist[2];
 	struct net_bridge_port		*dst;
 
 	struct rcu_head			rcu;
@@ -76,6 +85,15 @@ struct net_bridge_fdb_entry
 	unsigned char			is_static;
 };
 
+struct net_bridge_fdb_htable
+{
+	struct hlist_head		*hash;
+	u32				size;
+	u32				max;
+	u32				secret;
+	u32				ver;
+};
+
 struct net_bridge_port_group {
 	struct net_bridge_port		*port;
 	struct net_bridge_port_group __rcu *next;
@@ -189,7 +207,12 @@ struct net_bridge
 
 	struct br_cpu_netstats __percpu *stats;
 	spinlock_t			hash_lock;
-	struct hlist_head		hash[BR_HASH_SIZE];
+	struct net_bridge_fdb_htable __rcu *fdb;
+	struct work_struct		fdb_rehash_work;
+	unsigned long			fdb_rehash_retry;
+	/* next bucket to age and earliest expiry seen in this pass */
+	u32				gc_bucket;
+	unsigned long			gc_next;
 #ifdef CONFIG_BRIDGE_NETFILTER
 	struct rtable 			fake_rtable;
 	bool				nf_call_iptables;
@@ -350,6 +373,8 @@ static inline void br_netpoll_disable(struct net_bridge_port *p)
 /* br_fdb.c */
 extern int br_fdb_init(void);
 extern void br_fdb_fini(void);
+extern int br_fdb_hash_init(struct net_bridge *br);
+extern void br_fdb_hash_fini(struct net_bridge *br);
 extern void br_fdb_flush(struct net_bridge *br);
 extern void br_fdb_changeaddr(struct net_bridge_port *p,
 			      const unsigned char *newaddr);
@@ -372,6 +397,15 @@ extern int br_fdb_dump(struct sk_buff *skb, struct netlink_callback *cb);
 extern int br_fdb_add(struct sk_buff *skb, struct nlmsghdr *nlh, void *arg);
 extern int br_fdb_delete(struct sk_buff *skb, struct nlmsghdr *nlh, void *arg);
 
+/* Keeps frames of a known station from dirtying its entry */
+static inline void br_fdb_refresh(unsigned long *stamp)
+{
+	unsigned long now = jiffies;
+
+	if (time_after(now, *stamp + BR_FDB_REFRESH))
+		*stamp = now;
+}
+
 /* br_forward.c */
 extern void br_deliver(const struct net_bridge_port *to,
 		struct sk_buff *skb);
@@ -6,6 +6,7 @@
 #include <linux/ip.h>
 #include <net/sock.h>
 #include <linux/skbuff.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
 
 struct net_device;
 struct nf_conn;
@@ -41,6 +42,9 @@ EXPORT_SYMBOL(ppp_stat_block_hook);
 int (*go_swnat)(struct sk_buff * skb, u8 origin) = NULL;
 EXPORT_SYMBOL(go_swnat);
 
+void (*go_swnat_list)(struct sk_buff_head *list, u8 origin) = NULL;
+EXPORT_SYMBOL(go_swnat_list);
+
 void (*prebind_from_fastnat)(struct sk_buff * skb,
 	u32 orig_saddr, u16 orig_sport, struct nf_conn * ct,
 	enum ip_conntrack_info ctinfo) = NULL;
@@ -116,6 +120,12 @@ EXPORT_SYMBOL(ipv4_fastnat_conntrack);
 
 int (*fast_nat_bind_hook_ingress)(struct sk_buff * skb) = NULL;
 EXPORT_SYMBOL(fast_nat_bind_hook_ingress);
+
+int (*fast_nat6_hit_hook_func)(struct sk_buff *skb) = NULL;
+EXPORT_SYMBOL(fast_nat6_hit_hook_func);
+
+int ipv6_fastnat_conntrack = 0;
+EXPORT_SYMBOL(ipv6_fastnat_conntrack);
 #endif
 
 #if IS_ENABLED(CONFIG_RA_HW_NAT)
@@ -149,3 +159,9 @@ EXPORT_SYMBOL(ntce_enq_pkt_hook_func);
 
 void (*nacct_conntrack_free)(struct nf_conn *ct) = NULL;
 EXPORT_SYMBOL(nacct_conntrack_free);
+
+struct static_key nacct_packet_key = STATIC_KEY_INIT_FALSE;
+EXPORT_SYMBOL(nacct_packet_key);
+
+nacct_packet_fn __rcu *nacct_packet_hook = NULL;
+EXPORT_SYMBOL(nacct_packet_hook);
@@ -1,15 +1,46 @@
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/ntc_shaper_hooks.h>
 
-rwlock_t ntc_shaper_lock = __RW_LOCK_UNLOCKED(ntc_shaper_lock);
-EXPORT_SYMBOL(ntc_shaper_lock);
+static DEFINE_MUTEX(ntc_shaper_mutex);
 
-ntc_shaper_hook_fn *ntc_shaper_ingress_hook = NULL;
+struct static_key ntc_shaper_hooks_key = STATIC_KEY_INIT_FALSE;
+EXPORT_SYMBOL(ntc_shaper_hooks_key);
+
+ntc_shaper_hook_fn __rcu *ntc_shaper_ingress_hook = NULL;
 EXPORT_SYMBOL(ntc_shaper_ingress_hook);
 
-ntc_shaper_hook_fn *ntc_shaper_egress_hook = NULL;
+ntc_shaper_hook_fn __rcu *ntc_shaper_egress_hook = NULL;
 EXPORT_SYMBOL(ntc_shaper_egress_hook);
 
 int (*ntc_shaper_check_ip_and_mac)(uint32_t ipaddr, uint8_t * mac) = NULL;
 EXPORT_SYMBOL(ntc_shaper_check_ip_and_mac);
 
+int (*ntc_shaper_hwacc_meter)(struct nf_conn *ct, int dir,
+			      uint32_t *rate, uint32_t *burst) = NULL;
+EXPORT_SYMBOL(ntc_shaper_hwacc_meter);
+
+void ntc_shaper_hooks_set(ntc_shaper_hook_fn *ingress_hook,
+			  ntc_shaper_hook_fn *egress_hook)
+{
+	bool was_set, set = ingress_hook != NULL || egress_hook != NULL;
+
+	mutex_lock(&ntc_shaper_mutex);
+
+	was_set = rcu_access_pointer(ntc_shaper_ingress_hook) != NULL ||
+		  rcu_access_pointer(ntc_shaper_egress_hook) != NULL;
+
+	rcu_assign_pointer(ntc_shaper_ingress_hook, ingress_hook);
+	rcu_assign_pointer(ntc_shaper_egress_hook, egress_hook);
+
+	if (set && !was_set)
+		static_key_slow_inc(&ntc_shaper_hooks_key);
+	else if (!set && was_set)
+		static_key_slow_dec(&ntc_shaper_hooks_key);
+
+	mutex_unlock(&ntc_shaper_mutex);
+
+	/* Wait for callers of the old hooks */
+	synchronize_rcu();
+}
+EXPORT_SYMBOL(ntc_shaper_hooks_set);
@@ -89,8 +89,6 @@ struct skb_cb_table {
 	atomic_t		refcnt;
 };
 
-static DEFINE_SPINLOCK(skb_cb_store_lock);
-
 int skb_save_cb(struct sk_buff *skb)
 {
 	struct skb_cb_table *next;
@@ -125,13 +123,9 @@ int skb_restore_cb(struct sk_buff *skb)
 	memcpy(skb->cb, next->cb, sizeof(skb->cb));
 	skb->cb_next = next->cb_next;
 
-	spin_lock(&skb_cb_store_lock);
-
 	if (atomic_dec_and_test(&next->refcnt))
 		kmem_cache_free(skbuff_cb_store_cache, next);
 
-	spin_unlock(&skb_cb_store_lock);
-
 	return 0;
 }
 EXPORT_SYMBOL(skb_restore_cb);
@@ -146,15 +140,12 @@ static void skb_copy_stored_cb(struct sk_buff *new, const struct sk_buff *__old)
 		return;
 	}
 
-	spin_lock(&skb_cb_store_lock);
-
 	old = (struct sk_buff *)__old;
 
+	/* The reference of old keeps next alive, no lock needed */
 	next = old->cb_next;
 	atomic_inc(&next->refcnt);
 	new->cb_next = next;
-
-	spin_unlock(&skb_cb_store_lock);
 }
 #endif
 /*
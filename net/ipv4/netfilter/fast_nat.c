@@ -15,6 +15,7 @@
 #include <linux/netdevice.h>
 #include <linux/module.h>
 #include <linux/ip.h>
+#include <linux/tcp.h>
 #include <net/route.h>
 #include <net/ip.h>
 #include <net/icmp.h>
@@ -24,6 +25,8 @@
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_core.h>
 #include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
 #include <linux/netfilter/nf_conntrack_common.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 #include <linux/rcupdate.h>
@@ -73,6 +76,72 @@ static inline int skb_is_ready(struct sk_buff *skb)
 	return 1;
 }
 
+/*
+ * Route input packet, reusing route cached in conntrack if possible.
+ * Returns non-zero on routing failure.
+ */
+static inline int fast_nat_route_input(struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	struct net_device *dev = skb->dev;
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+
+	if (likely(ct != NULL)) {
+		const struct nf_ct_fastnat_route *r;
+
+		/* rcu_read_lock()ed by nf_hook_slow */
+		r = nf_ct_fastnat_route_find(ct, CTINFO2DIR(ctinfo),
+					     dev, iph->tos);
+		if (likely(r != NULL)) {
+			skb_dst_set_noref(skb, r->dst);
+			skb->dev = r->dst->dev;
+			return 0;
+		}
+	}
+
+	if (ip_route_input(skb, iph->daddr, iph->saddr, iph->tos, dev))
+		return -1;
+
+	if (ct != NULL)
+		nf_ct_fastnat_route_update(ct, CTINFO2DIR(ctinfo),
+					   skb_dst(skb), dev, iph->tos);
+
+	/* Change skb owner to output device */
+	skb->dev = skb_dst(skb)->dev;
+
+	return 0;
+}
+
+/*
+ * Prepend hardware header cached in conntrack, if it is still
+ * valid for the skb destination.
+ */
+static inline bool fast_nat_hh_output(struct sk_buff *skb)
+{
+	const struct nf_ct_fastnat_route *r;
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+	unsigned int hh_alen;
+
+	if (unlikely(ct == NULL))
+		return false;
+
+	/* rcu_read_lock()ed by caller */
+	r = nf_ct_fastnat_route_get(ct, CTINFO2DIR(ctinfo));
+	if (r == NULL || r->dst != skb_dst(skb) || !nf_ct_fastnat_hh_valid(r))
+		return false;
+
+	hh_alen = HH_DATA_ALIGN(r->hh_len);
+	if (unlikely(skb_headroom(skb) < hh_alen))
+		return false;
+
+	memcpy(skb->data - hh_alen, r->hh_data, hh_alen);
+	skb_push(skb, r->hh_len);
+
+	return true;
+}
+
 /*
  * Direct send packets to output.
  * Stolen from ip_finish_output2.
@@ -100,6 +169,14 @@ static inline int fast_nat_path_output(struct sk_buff *skb)
 	}
 
 	rcu_read_lock();
+	if (fast_nat_hh_output(skb)) {
+		int res = dev_queue_xmit(skb);
+
+		rcu_read_unlock();
+
+		return (res == 1) ? 0 : res;
+	}
+
 	neigh = dst_get_neighbour_noref(dst);
 	if (neigh) {
 		int res = neigh_output(neigh, skb);
@@ -125,20 +202,102 @@ static inline int ip_skb_dst_mtu(struct sk_buff *skb)
 		skb_dst(skb)->dev->mtu : dst_mtu(skb_dst(skb));
 }
 
+/*
+ * Length of the largest IP packet a GSO skb is split into.
+ */
+static inline unsigned int fast_nat_gso_seglen(const struct sk_buff *skb)
+{
+	unsigned int hdr_len = skb_transport_header(skb) - skb_network_header(skb);
+
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV4)
+		hdr_len += tcp_hdrlen(skb);
+
+	return hdr_len + skb_shinfo(skb)->gso_size;
+}
+
+/*
+ * GRO super-packet which segments do not fit output MTU.
+ * Segment it in software and fragment every segment, the same as
+ * original packets would be forwarded without GRO.
+ */
+static int fast_nat_gso_output(struct sk_buff *skb, unsigned int mtu)
+{
+	struct sk_buff *segs;
+	int ret = 0;
+
+	if (ip_hdr(skb)->frag_off & htons(IP_DF)) {
+		icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
+		kfree_skb(skb);
+		return -EMSGSIZE;
+	}
+
+	NF_CT_FASTNAT_STAT_INC(GSO_SEGMENT);
+
+	segs = skb_gso_segment(skb, netif_skb_features(skb) & ~NETIF_F_GSO_MASK);
+	if (IS_ERR_OR_NULL(segs)) {
+		kfree_skb(skb);
+		return -ENOMEM;
+	}
+
+	consume_skb(skb);
+
+	do {
+		struct sk_buff *nskb = segs->next;
+		int err;
+
+		segs->next = NULL;
+
+		if (segs->len <= mtu) {
+			/* Fits as is, keep checksum offload */
+			err = fast_nat_path_output(segs);
+		} else {
+			/* ip_fragment() does not resolve partial checksum */
+			err = segs->ip_summed == CHECKSUM_PARTIAL ?
+				skb_checksum_help(segs) : 0;
+			if (err)
+				kfree_skb(segs);
+			else
+				err = ip_fragment(segs, fast_nat_path_output);
+		}
+
+		if (err && ret == 0)
+			ret = err;
+		segs = nskb;
+	} while (segs);
+
+	return ret;
+}
+
 static int fast_nat_bind_hook_egress(struct sk_buff * skb)
 {
 	struct iphdr *iph = ip_hdr(skb);
+	unsigned int mtu;
 
 	if (iph->ttl <= 1) {
+		NF_CT_FASTNAT_FALLBACK(skb, TTL_EXCEEDED);
 		icmp_send(skb, ICMP_TIME_EXCEEDED, ICMP_EXC_TTL, 0);
 		kfree_skb(skb);
 		return -EPERM;
 	}
 
+	/* TTL and NAT rewrite of GRO super-packet is done once,
+	 * it is copied to every segment at egress. */
 	ip_decrease_ttl(iph);
 
-	if (skb->len > ip_skb_dst_mtu(skb) && !skb_is_gso(skb))
+	mtu = ip_skb_dst_mtu(skb);
+
+	if (skb_is_gso(skb)) {
+		/* Device TSO or dev_queue_xmit() segments it */
+		if (likely(fast_nat_gso_seglen(skb) <= mtu))
+			return fast_nat_path_output(skb);
+
+		return fast_nat_gso_output(skb, mtu);
+	}
+
+	if (skb->len > mtu) {
+		NF_CT_FASTNAT_STAT_INC(FRAG);
 		return ip_fragment(skb, fast_nat_path_output);
+	}
 
 	return fast_nat_path_output(skb);
 }
@@ -148,6 +307,7 @@ static int fast_nat_bind_hook_egress(struct sk_buff * skb)
 static int fast_nat_path(struct sk_buff *skb)
 {
 	ntc_shaper_hook_fn *shaper_egress;
+	uint32_t disable_hwacc = NTC_HWACC_ALLOW;
 	int retval = 0;
 
 	if (likely(1
@@ -166,38 +326,48 @@ static int fast_nat_path(struct sk_buff *skb)
 			struct nf_conn_counter *acct = nf_conn_acct_find(ct);
 
 			if (likely(acct != NULL)) {
-				atomic64_inc(&acct[CTINFO2DIR(ctinfo)].packets);
-				atomic64_add(skb->len, &acct[CTINFO2DIR(ctinfo)].bytes);
+				nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb, skb->len);
 			}
+			nf_ct_touch(ct);
+			nf_ct_nacct_packet(ct, CTINFO2DIR(ctinfo), skb,
+					   skb->len);
 		}
 	}
 
-	if (skb_dst(skb) == NULL) {
-		const struct iphdr *iph = ip_hdr(skb);
-		struct net_device *dev = skb->dev;
-
-		if (ip_route_input(skb, iph->daddr, iph->saddr, iph->tos, dev)) {
-			kfree_skb(skb);
-			return -EPERM;
-		}
-
-		/*  Change skb owner to output device */
-		skb->dev = skb_dst(skb)->dev;
+	if (skb_dst(skb) == NULL && fast_nat_route_input(skb)) {
+		NF_CT_FASTNAT_FALLBACK(skb, ROUTE_FAIL);
+		kfree_skb(skb);
+		return -EPERM;
 	}
 
+	NF_CT_FASTNAT_STAT_INC(HIT);
+	trace_fastnat_hit(skb);
+
 	shaper_egress = ntc_shaper_egress_hook_get();
 
 	if (shaper_egress) {
-		unsigned int ntc_retval = shaper_egress(skb, 0, 0, NULL, fast_nat_bind_hook_egress, NULL, NULL);
+		unsigned int ntc_retval;
+
+		/* Shaper may queue skb beyond RCU section */
+		skb_dst_force(skb);
+
+		ntc_retval = shaper_egress(skb, 0, 0, &disable_hwacc, fast_nat_bind_hook_egress, NULL, NULL);
 
 		switch (ntc_retval) {
 			case NF_ACCEPT:
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+				/* Shaper limits the flow in software */
+				if (disable_hwacc == NTC_HWACC_DISABLE)
+					FOE_ALG_MARK(skb);
+#endif
 				retval = fast_nat_bind_hook_egress(skb);
 				break;
 			case NF_STOLEN:
+				NF_CT_FASTNAT_STAT_INC(EGRESS_STOLEN);
 				retval = 0;
 				break;
 			default:
+				NF_CT_FASTNAT_STAT_INC(EGRESS_DROP);
 				kfree_skb(skb);
 				retval = -EPERM;
 				break;
@@ -222,11 +392,13 @@ fast_nat_do_bindings(struct nf_conn *ct,
 	unsigned int i = 0;
 
 	/* This check prevent corrupt conntrack data */
-	if(!nat_is_ready(ct) || !skb_is_ready(skb)) {
-#ifdef DEBUG
-		if (net_ratelimit())
-		    printk(KERN_DEBUG "fast_path: SKB or CT not ready for offload\n");
-#endif
+	if (!nat_is_ready(ct)) {
+		NF_CT_FASTNAT_FALLBACK(skb, NAT_NOT_READY);
+		return NF_ACCEPT; /* Ignore */
+	}
+
+	if (!skb_is_ready(skb)) {
+		NF_CT_FASTNAT_FALLBACK(skb, SKB_NOT_READY);
 		return NF_ACCEPT; /* Ignore */
 	}
 
@@ -246,22 +418,19 @@ fast_nat_do_bindings(struct nf_conn *ct,
 		if (ct->status & statusbit) {
 			struct nf_conntrack_tuple target;
 
-			if (skb_dst(skb) == NULL && mtype == NF_NAT_MANIP_SRC) {
-				const struct iphdr *iph = ip_hdr(skb);
-				struct net_device *dev = skb->dev;
-
-				if (ip_route_input(skb, iph->daddr, iph->saddr, iph->tos, dev))
-					return NF_DROP;
-
-				/* Change skb owner to output device */
-				skb->dev = skb_dst(skb)->dev;
+			if (skb_dst(skb) == NULL && mtype == NF_NAT_MANIP_SRC &&
+			    fast_nat_route_input(skb)) {
+				NF_CT_FASTNAT_FALLBACK(skb, ROUTE_FAIL);
+				return NF_DROP;
 			}
 
 			/* We are aiming to look like inverse of other direction. */
 			nf_ct_invert_tuple(&target, &ct->tuplehash[!dir].tuple, l3proto, l4proto);
 
-			if (!manip_pkt(target.dst.protonum, skb, 0, &target, mtype))
+			if (!manip_pkt(target.dst.protonum, skb, 0, &target, mtype)) {
+				NF_CT_FASTNAT_FALLBACK(skb, MANIP_FAIL);
 				return NF_DROP;
+			}
 		}
 		i++;
 	} while (i < 2);
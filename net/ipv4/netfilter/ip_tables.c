@@ -26,6 +26,7 @@
 #include <linux/cpumask.h>
 
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
@@ -344,6 +345,394 @@ ipt_handle_default_rule(struct ipt_entry *e, unsigned int *verdict)
 }
 #endif
 
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+/*
+ * Rule prefilter.
+ *
+ * When a table is loaded every rule gets a bit in a few bitmaps keyed
+ * on what ip_packet_match() and a leading tcp or udp match look at:
+ * input and output interface, protocol and destination port.  For a
+ * packet, the AND of the bitmaps selected by its keys has a bit set for
+ * each rule which may match, and ipt_do_table() jumps over the rules in
+ * between without touching them.  Those would have failed the header
+ * or port check before any other match ran, so counters and match side
+ * effects stay the same.  Chain heads, returns and policies are
+ * unconditional and always remain candidates, so a jump never leaves
+ * the current chain.
+ *
+ * Keys which do not fit the limits below leave the rule a candidate
+ * for every packet in that dimension.
+ */
+#define IPT_PF_MIN_RULES	16
+#define IPT_PF_IFACES		BITS_PER_LONG
+#define IPT_PF_PROTOS		16	/* including "any other" */
+#define IPT_PF_PORT_BOUNDS	64
+
+struct ipt_pf_iface {
+	char name[IFNAMSIZ] __attribute__((aligned(sizeof(long))));
+	char mask[IFNAMSIZ] __attribute__((aligned(sizeof(long))));
+};
+
+struct ipt_pf_dev {
+	unsigned int n;
+	struct ipt_pf_iface iface[IPT_PF_IFACES];
+	unsigned long *any;	/* rules which match any interface */
+	unsigned long *map;	/* [pattern][word] */
+};
+
+struct ipt_prefilter {
+	unsigned int rules;
+	unsigned int words;	/* per bitmap */
+	u32 *offset;		/* rule index to entry offset */
+	struct ipt_pf_dev dev[2];	/* in, out */
+	unsigned int nprotos;
+	u8 proto_class[256];
+	unsigned long *proto;	/* [class][word] */
+	unsigned int nbounds;
+	u16 bound[IPT_PF_PORT_BOUNDS];
+	unsigned long *port;	/* [class][word], class n: bound[n-1]..bound[n] */
+};
+
+/* Packet keys, per ipt_do_table() call */
+struct ipt_pf_key {
+	bool valid;
+	unsigned int hint;		/* index of the last candidate */
+	unsigned long dev[2];		/* interface patterns matched */
+	const unsigned long *proto;
+	const unsigned long *port;	/* NULL if not known */
+};
+
+/* What a rule asks for, -1 where it is not narrowed down */
+struct ipt_pf_rule {
+	int dev[2];
+	int proto;
+	bool proto_inv;
+	int port_lo, port_hi;
+};
+
+static int ipt_pf_iface(struct ipt_pf_dev *dev, const char *name,
+			const unsigned char *mask, bool inv, bool add)
+{
+	static const unsigned char nomask[IFNAMSIZ];
+	unsigned int i;
+
+	if (inv || memcmp(mask, nomask, IFNAMSIZ) == 0)
+		return -1;
+
+	for (i = 0; i < dev->n; i++)
+		if (memcmp(dev->iface[i].name, name, IFNAMSIZ) == 0 &&
+		    memcmp(dev->iface[i].mask, mask, IFNAMSIZ) == 0)
+			return i;
+
+	if (!add || dev->n == IPT_PF_IFACES)
+		return -1;
+	memcpy(dev->iface[i].name, name, IFNAMSIZ);
+	memcpy(dev->iface[i].mask, mask, IFNAMSIZ);
+	return dev->n++;
+}
+
+static unsigned int ipt_pf_port_class(const struct ipt_prefilter *pf,
+				      unsigned int port)
+{
+	unsigned int lo = 0, hi = pf->nbounds;
+
+	/* Number of bounds not above port */
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (pf->bound[mid] <= port)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static bool ipt_pf_has_bound(const struct ipt_prefilter *pf, unsigned int b)
+{
+	unsigned int c;
+
+	if (b == 0 || b > USHRT_MAX)
+		return true;
+	c = ipt_pf_port_class(pf, b);
+	return c > 0 && pf->bound[c - 1] == b;
+}
+
+static void ipt_pf_add_bound(struct ipt_prefilter *pf, unsigned int b)
+{
+	unsigned int c;
+
+	if (ipt_pf_has_bound(pf, b))
+		return;
+	c = ipt_pf_port_class(pf, b);
+	memmove(&pf->bound[c + 1], &pf->bound[c],
+		(pf->nbounds - c) * sizeof(pf->bound[0]));
+	pf->bound[c] = b;
+	pf->nbounds++;
+}
+
+/* Destination port range of a leading, non-inverted tcp or udp match */
+static bool ipt_pf_port_range(const struct ipt_entry *e,
+			      unsigned int *lo, unsigned int *hi)
+{
+	const struct xt_entry_match *m;
+	const struct xt_match *match;
+
+	if (e->target_offset == sizeof(struct ipt_entry))
+		return false;
+	m = (const void *)e->elems;
+	match = m->u.kernel.match;
+	if (match->revision != 0)
+		return false;
+
+	if (strcmp(match->name, "tcp") == 0) {
+		const struct xt_tcp *tcp = (const void *)m->data;
+
+		if (tcp->invflags & XT_TCP_INV_DSTPT)
+			return false;
+		*lo = tcp->dpts[0];
+		*hi = tcp->dpts[1];
+	} else if (strcmp(match->name, "udp") == 0) {
+		const struct xt_udp *udp = (const void *)m->data;
+
+		if (udp->invflags & XT_UDP_INV_DSTPT)
+			return false;
+		*lo = udp->dpts[0];
+		*hi = udp->dpts[1];
+	} else
+		return false;
+
+	return *lo != 0 || *hi != USHRT_MAX;
+}
+
+static void ipt_pf_rule(struct ipt_prefilter *pf, const struct ipt_entry *e,
+			struct ipt_pf_rule *r, bool add)
+{
+	const struct ipt_ip *ip = &e->ip;
+	unsigned int lo, hi, missing;
+
+	r->dev[0] = ipt_pf_iface(&pf->dev[0], ip->iniface, ip->iniface_mask,
+				 ip->invflags & IPT_INV_VIA_IN, add);
+	r->dev[1] = ipt_pf_iface(&pf->dev[1], ip->outiface, ip->outiface_mask,
+				 ip->invflags & IPT_INV_VIA_OUT, add);
+
+	r->proto = -1;
+	r->proto_inv = ip->invflags & IPT_INV_PROTO;
+	if (ip->proto) {
+		if (!pf->proto_class[ip->proto] && add &&
+		    pf->nprotos < IPT_PF_PROTOS)
+			pf->proto_class[ip->proto] = pf->nprotos++;
+		if (pf->proto_class[ip->proto])
+			r->proto = pf->proto_class[ip->proto];
+	}
+
+	r->port_lo = r->port_hi = -1;
+	if (!ipt_pf_port_range(e, &lo, &hi) || lo > hi)
+		return;
+	missing = !ipt_pf_has_bound(pf, lo) + !ipt_pf_has_bound(pf, hi + 1);
+	if (missing) {
+		if (!add || pf->nbounds + missing > IPT_PF_PORT_BOUNDS)
+			return;
+		ipt_pf_add_bound(pf, lo);
+		ipt_pf_add_bound(pf, hi + 1);
+	}
+	r->port_lo = lo;
+	r->port_hi = hi;
+}
+
+/* Returns NULL if the table is small or memory is short */
+static struct ipt_prefilter *
+ipt_prefilter_build(const struct xt_table_info *info, const void *entry0)
+{
+	struct ipt_prefilter *tmp, *pf = NULL;
+	const struct ipt_entry *iter;
+	struct ipt_pf_rule r;
+	unsigned long *map;
+	unsigned int i, c, d, words, nmaps;
+
+	if (info->number < IPT_PF_MIN_RULES)
+		return NULL;
+
+	tmp = kzalloc(sizeof(*tmp), GFP_KERNEL);
+	if (tmp == NULL)
+		return NULL;
+	tmp->nprotos = 1;
+
+	/* Collect interface patterns, protocols and port bounds */
+	xt_entry_foreach(iter, entry0, info->size)
+		ipt_pf_rule(tmp, iter, &r, true);
+
+	words = BITS_TO_LONGS(info->number);
+	nmaps = 2 + tmp->dev[0].n + tmp->dev[1].n +
+		tmp->nprotos + tmp->nbounds + 1;
+	pf = vzalloc(sizeof(*pf) + nmaps * words * sizeof(long) +
+		     info->number * sizeof(u32));
+	if (pf == NULL)
+		goto out;
+
+	memcpy(pf, tmp, sizeof(*pf));
+	pf->rules = info->number;
+	pf->words = words;
+	map = (unsigned long *)(pf + 1);
+	for (d = 0; d < 2; d++) {
+		pf->dev[d].any = map;
+		map += words;
+		pf->dev[d].map = map;
+		map += pf->dev[d].n * words;
+	}
+	pf->proto = map;
+	map += pf->nprotos * words;
+	pf->port = map;
+	map += (pf->nbounds + 1) * words;
+	pf->offset = (u32 *)map;
+
+	i = 0;
+	xt_entry_foreach(iter, entry0, info->size) {
+		ipt_pf_rule(pf, iter, &r, false);
+		pf->offset[i] = (const void *)iter - entry0;
+
+		for (d = 0; d < 2; d++) {
+			if (r.dev[d] < 0)
+				__set_bit(i, pf->dev[d].any);
+			else
+				__set_bit(i, pf->dev[d].map + r.dev[d] * words);
+		}
+
+		for (c = 0; c < pf->nprotos; c++)
+			if (r.proto < 0 || (c == r.proto) != r.proto_inv)
+				__set_bit(i, pf->proto + c * words);
+
+		if (r.port_lo < 0) {
+			for (c = 0; c <= pf->nbounds; c++)
+				__set_bit(i, pf->port + c * words);
+		} else {
+			for (c = ipt_pf_port_class(pf, r.port_lo);
+			     c <= ipt_pf_port_class(pf, r.port_hi); c++)
+				__set_bit(i, pf->port + c * words);
+		}
+		++i;
+	}
+ out:
+	kfree(tmp);
+	return pf;
+}
+
+static void
+ipt_pf_key_init(const struct ipt_prefilter *pf, struct ipt_pf_key *k,
+		const struct sk_buff *skb, const struct iphdr *ip,
+		const char *indev, const char *outdev,
+		const struct xt_action_param *par)
+{
+	const char *devname[2] = { indev, outdev };
+	unsigned int d, i;
+	int port = -1;
+
+	for (d = 0; d < 2; d++) {
+		const struct ipt_pf_dev *dev = &pf->dev[d];
+
+		k->dev[d] = 0;
+		for (i = 0; i < dev->n; i++)
+			if (ifname_compare_aligned(devname[d],
+						   dev->iface[i].name,
+						   dev->iface[i].mask) == 0)
+				k->dev[d] |= 1UL << i;
+	}
+	k->proto = pf->proto + pf->proto_class[ip->protocol] * pf->words;
+
+	/* Left unknown wherever the tcp or udp match would not get as
+	 * far as the port, it may drop the packet instead. */
+	if (pf->nbounds && par->fragoff == 0) {
+		if (ip->protocol == IPPROTO_TCP) {
+			const struct tcphdr *th;
+			struct tcphdr _tcph;
+
+			th = skb_header_pointer(skb, par->thoff,
+						sizeof(_tcph), &_tcph);
+			if (th != NULL)
+				port = ntohs(th->dest);
+		} else if (ip->protocol == IPPROTO_UDP) {
+			const struct udphdr *uh;
+			struct udphdr _udph;
+
+			uh = skb_header_pointer(skb, par->thoff,
+						sizeof(_udph), &_udph);
+			if (uh != NULL)
+				port = ntohs(uh->dest);
+		}
+	}
+	k->port = port < 0 ? NULL :
+		  pf->port + ipt_pf_port_class(pf, port) * pf->words;
+	k->hint = 0;
+	k->valid = true;
+}
+
+static unsigned long
+ipt_pf_word(const struct ipt_prefilter *pf, const struct ipt_pf_key *k,
+	    unsigned int w)
+{
+	unsigned long word = k->proto[w];
+	unsigned int d;
+
+	if (k->port != NULL)
+		word &= k->port[w];
+	for (d = 0; d < 2 && word; d++) {
+		const struct ipt_pf_dev *dev = &pf->dev[d];
+		unsigned long m = k->dev[d], dw = dev->any[w];
+
+		while (m) {
+			dw |= dev->map[__ffs(m) * pf->words + w];
+			m &= m - 1;
+		}
+		word &= dw;
+	}
+	return word;
+}
+
+static unsigned int ipt_pf_index(const struct ipt_prefilter *pf, u32 off)
+{
+	unsigned int lo = 0, hi = pf->rules - 1;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (pf->offset[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* First rule at or after e which may match the packet */
+static struct ipt_entry *
+ipt_pf_next(const struct ipt_prefilter *pf, struct ipt_pf_key *k,
+	    const void *table_base, struct ipt_entry *e)
+{
+	u32 off = (void *)e - table_base;
+	unsigned int i = k->hint, w;
+	unsigned long word;
+
+	if (pf->offset[i] != off) {
+		if (i + 1 < pf->rules && pf->offset[i + 1] == off)
+			i++;
+		else
+			i = ipt_pf_index(pf, off);
+	}
+
+	w = BIT_WORD(i);
+	word = ipt_pf_word(pf, k, w) & (~0UL << (i % BITS_PER_LONG));
+	while (!word) {
+		/* Not reached: the table ends in an unconditional rule */
+		if (++w >= pf->words)
+			return e;
+		word = ipt_pf_word(pf, k, w);
+	}
+	i = w * BITS_PER_LONG + __ffs(word);
+	k->hint = i;
+	return get_entry(table_base, pf->offset[i]);
+}
+#endif
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -363,6 +752,10 @@ ipt_do_table(struct sk_buff *skb,
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
 	unsigned int addend;
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+	const struct ipt_prefilter *pf;
+	struct ipt_pf_key pk;
+#endif
 
 	/* Initialization */
 #ifdef CONFIG_IP_NF_IPTABLES_SPEEDUP
@@ -424,6 +817,11 @@ ipt_do_table(struct sk_buff *skb,
 	e = get_entry(table_base, private->hook_entry[hook]);
 #endif
 
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+	pf = private->prefilter;
+	pk.valid = false;
+#endif
+
 	pr_debug("Entering %s(hook %u); sp at %u (UF %p)\n",
 		 table->name, hook, origptr,
 		 get_entry(table_base, private->underflow[hook]));
@@ -433,6 +831,14 @@ ipt_do_table(struct sk_buff *skb,
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+		if (pf != NULL) {
+			if (!pk.valid)
+				ipt_pf_key_init(pf, &pk, skb, ip,
+						indev, outdev, &acpar);
+			e = ipt_pf_next(pf, &pk, table_base, e);
+		}
+#endif
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
@@ -504,6 +910,9 @@ ipt_do_table(struct sk_buff *skb,
 		verdict = t->u.kernel.target->target(skb, &acpar);
 		/* Target might have changed stuff. */
 		ip = ip_hdr(skb);
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+		pk.valid = false;
+#endif
 		if (verdict == XT_CONTINUE)
 			e = ipt_next_entry(e);
 		else
@@ -962,6 +1371,10 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+	newinfo->prefilter = ipt_prefilter_build(newinfo, entry0);
+#endif
+
 	return ret;
 }
 
@@ -1884,6 +2297,10 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+#ifdef CONFIG_IP_NF_IPTABLES_PREFILTER
+	newinfo->prefilter = ipt_prefilter_build(newinfo, entry1);
+#endif
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
@@ -68,7 +68,7 @@ static unsigned int mangle_packet(struct sk_buff *skb, unsigned int dataoff,
 static int map_addr(struct sk_buff *skb, unsigned int dataoff,
 		    const char **dptr, unsigned int *datalen,
 		    unsigned int matchoff, unsigned int matchlen,
-		    union nf_inet_addr *addr, __be16 port)
+		    union nf_conntrack_address *addr, __be16 port)
 {
 	enum ip_conntrack_info ctinfo;
 	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
@@ -107,7 +107,7 @@ static int map_sip_addr(struct sk_buff *skb, unsigned int dataoff,
 	enum ip_conntrack_info ctinfo;
 	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
 	unsigned int matchlen, matchoff;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	__be16 port;
 
 	if (ct_sip_parse_header_uri(ct, *dptr, NULL, *datalen, type, NULL,
@@ -126,7 +126,7 @@ static unsigned int ip_nat_sip(struct sk_buff *skb, unsigned int dataoff,
 	struct nf_conn_help *help = nfct_help(ct);
 	unsigned int coff, matchoff, matchlen;
 	enum sip_header_types hdr;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	__be16 port;
 	int request, in_header;
 
@@ -412,7 +412,7 @@ static unsigned int ip_nat_sdp_addr(struct sk_buff *skb, unsigned int dataoff,
 				    unsigned int sdpoff,
 				    enum sdp_header_types type,
 				    enum sdp_header_types term,
-				    const union nf_inet_addr *addr)
+				    const union nf_conntrack_address *addr)
 {
 	char buffer[sizeof("nnn.nnn.nnn.nnn")];
 	unsigned int buflen;
@@ -445,7 +445,7 @@ static unsigned int ip_nat_sdp_port(struct sk_buff *skb, unsigned int dataoff,
 static unsigned int ip_nat_sdp_session(struct sk_buff *skb, unsigned int dataoff,
 				       const char **dptr, unsigned int *datalen,
 				       unsigned int sdpoff,
-				       const union nf_inet_addr *addr)
+				       const union nf_conntrack_address *addr)
 {
 	char buffer[sizeof("nnn.nnn.nnn.nnn")];
 	unsigned int buflen;
@@ -485,7 +485,7 @@ static unsigned int ip_nat_sdp_media(struct sk_buff *skb, unsigned int dataoff,
 				     struct nf_conntrack_expect *rtcp_exp,
 				     unsigned int mediaoff,
 				     unsigned int medialen,
-				     union nf_inet_addr *rtp_addr)
+				     union nf_conntrack_address *rtp_addr)
 {
 	enum ip_conntrack_info ctinfo;
 	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
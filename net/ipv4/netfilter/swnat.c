@@ -0,0 +1,788 @@
+/*
+ * Software flow cache for Fast NAT.
+ *
+ * Flows bound by fast_nat.c are recorded here from the prebind hooks:
+ * prebind_from_fastnat() remembers the NAT rewrite of the packet being
+ * bound, prebind_from_pppoetx() adds the PPPoE session and the driver
+ * TX prebind (prebind_from_raeth/prebind_from_usb_mac) completes the
+ * entry with the output device and the ready L2 header.
+ *
+ * Packets of a cached flow are picked up by go_swnat(), or by
+ * go_swnat_list() for a whole RX burst, straight from the driver RX
+ * path, rewritten and queued to the output device, so they skip
+ * nf_conntrack_in() and the IPv4 stack altogether.  Once per
+ * SWNAT_REFRESH a packet is passed to the slow path to keep conntrack
+ * timers, TCP state and the cached L2 header up to date.
+ *
+ * Tables are per-CPU and direct-mapped: a new binding replaces the
+ * entry in its slot.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/if_vlan.h>
+#include <linux/if_pppox.h>
+#include <linux/ppp_hook.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/timer.h>
+#include <linux/netfilter.h>
+#include <net/ip.h>
+#include <net/checksum.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
+#include <net/fast_vpn.h>
+#include <linux/ntc_shaper_hooks.h>
+
+#define SWNAT_HSIZE_DEF		512
+#define SWNAT_L2_MAX		32
+#define SWNAT_REFRESH		HZ
+#define SWNAT_IDLE		(30 * HZ)
+#define SWNAT_GC_INTERVAL	(5 * HZ)
+
+extern int ipv4_fastnat_conntrack;
+
+extern int (*go_swnat)(struct sk_buff *skb, u8 origin);
+
+extern void (*go_swnat_list)(struct sk_buff_head *list, u8 origin);
+
+extern void (*prebind_from_fastnat)(struct sk_buff *skb,
+	u32 orig_saddr, u16 orig_sport, struct nf_conn *ct,
+	enum ip_conntrack_info ctinfo);
+
+extern void (*prebind_from_pppoetx)(struct sk_buff *skb, struct sock *sock,
+	u16 sid);
+
+extern void (*prebind_from_raeth)(struct sk_buff *skb);
+
+extern void (*prebind_from_usb_mac)(struct sk_buff *skb);
+
+struct swnat_tuple {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+	u8 proto;
+};
+
+struct swnat_entry {
+	struct swnat_tuple key;		/* as received */
+	struct swnat_tuple nat;		/* as transmitted */
+	struct nf_conn *ct;
+	struct net_device *out_dev;
+	struct sock *sk;		/* PPPoE session or NULL */
+	unsigned long last_used;
+	unsigned long last_slow;
+	int rt_genid;
+	u16 mtu;
+	u16 vlan_tci;
+	__be16 protocol;
+	u8 dir;
+	u8 l2_len;
+	u8 l2_hdr[SWNAT_L2_MAX];
+};
+
+/* NAT half of a binding waiting for the driver TX prebind */
+struct swnat_pending {
+	struct swnat_tuple key;
+	struct swnat_tuple nat;
+	struct nf_conn *ct;
+	struct sock *sk;
+	int rt_genid;
+	u16 mtu;
+	u8 dir;
+};
+
+struct swnat_table {
+	spinlock_t lock;
+	struct swnat_pending pending;
+	struct swnat_entry *entries;
+};
+
+static unsigned int swnat_hsize __read_mostly = SWNAT_HSIZE_DEF;
+module_param_named(hashsize, swnat_hsize, uint, 0400);
+MODULE_PARM_DESC(hashsize, "per-CPU flow cache size (power of two)");
+
+static u32 swnat_hash_rnd __read_mostly;
+static DEFINE_PER_CPU(struct swnat_table, swnat_tables);
+static struct timer_list swnat_gc_timer;
+
+static inline u32 swnat_hash(const struct swnat_tuple *t)
+{
+	return jhash_3words((__force u32)t->saddr, (__force u32)t->daddr,
+			    ((__force u32)t->sport << 16) |
+			    (__force u32)t->dport,
+			    swnat_hash_rnd ^ t->proto) & (swnat_hsize - 1);
+}
+
+static inline bool swnat_tuple_equal(const struct swnat_tuple *a,
+				     const struct swnat_tuple *b)
+{
+	return a->saddr == b->saddr &&
+	       a->daddr == b->daddr &&
+	       a->sport == b->sport &&
+	       a->dport == b->dport &&
+	       a->proto == b->proto;
+}
+
+static inline int swnat_rt_genid(const struct net_device *dev)
+{
+	return atomic_read(&dev_net(dev)->ipv4.rt_genid);
+}
+
+static void swnat_pending_release(struct swnat_pending *p)
+{
+	if (p->sk != NULL) {
+		sock_put(p->sk);
+		p->sk = NULL;
+	}
+
+	if (p->ct != NULL) {
+		nf_ct_put(p->ct);
+		p->ct = NULL;
+	}
+}
+
+static void swnat_entry_release(struct swnat_entry *e)
+{
+	if (e->ct == NULL)
+		return;
+
+	if (e->sk != NULL) {
+		sock_put(e->sk);
+		e->sk = NULL;
+	}
+
+	dev_put(e->out_dev);
+	e->out_dev = NULL;
+
+	nf_ct_put(e->ct);
+	e->ct = NULL;
+}
+
+/* Returns true if cached entry may not be used anymore. */
+static inline bool swnat_entry_stale(const struct swnat_entry *e)
+{
+	const struct net_device *dev = e->out_dev;
+
+	if (unlikely(nf_ct_is_dying(e->ct) || e->ct->fast_ext))
+		return true;
+
+	if (unlikely(!netif_running(dev) || !netif_carrier_ok(dev)))
+		return true;
+
+	if (unlikely(e->rt_genid != swnat_rt_genid(dev)))
+		return true;
+
+#if IS_ENABLED(CONFIG_PPPOE)
+	if (e->sk != NULL &&
+	    (sock_flag(e->sk, SOCK_DEAD) ||
+	     !(e->sk->sk_state & PPPOX_CONNECTED)))
+		return true;
+#endif
+
+	return false;
+}
+
+/* Extract the lookup key, caller has validated the IPv4 header. */
+static inline void swnat_skb_tuple(const struct iphdr *iph,
+				   struct swnat_tuple *t)
+{
+	const __be16 *ports = (const __be16 *)((const u8 *)iph + sizeof(*iph));
+
+	t->saddr = iph->saddr;
+	t->daddr = iph->daddr;
+	t->sport = ports[0];
+	t->dport = ports[1];
+	t->proto = iph->protocol;
+}
+
+static void swnat_rewrite(struct sk_buff *skb, const struct swnat_entry *e)
+{
+	struct iphdr *iph = (struct iphdr *)skb->data;
+	__be16 *ports = (__be16 *)(skb->data + sizeof(*iph));
+	__sum16 *check;
+
+	if (e->key.proto == IPPROTO_TCP)
+		check = &((struct tcphdr *)ports)->check;
+	else
+		check = &((struct udphdr *)ports)->check;
+
+	if (e->key.proto == IPPROTO_TCP ||
+	    *check || skb->ip_summed == CHECKSUM_PARTIAL) {
+		inet_proto_csum_replace4(check, skb,
+			iph->saddr, e->nat.saddr, 1);
+		inet_proto_csum_replace4(check, skb,
+			iph->daddr, e->nat.daddr, 1);
+		inet_proto_csum_replace2(check, skb,
+			ports[0], e->nat.sport, 0);
+		inet_proto_csum_replace2(check, skb,
+			ports[1], e->nat.dport, 0);
+		if (e->key.proto == IPPROTO_UDP && !*check)
+			*check = CSUM_MANGLED_0;
+	}
+
+	ports[0] = e->nat.sport;
+	ports[1] = e->nat.dport;
+
+	csum_replace4(&iph->check, iph->saddr, e->nat.saddr);
+	csum_replace4(&iph->check, iph->daddr, e->nat.daddr);
+	iph->saddr = e->nat.saddr;
+	iph->daddr = e->nat.daddr;
+
+	ip_decrease_ttl(iph);
+}
+
+/* Prepends cached L2 header, skb is ready for dev_queue_xmit() after it. */
+static bool swnat_encap(struct sk_buff *skb, const struct swnat_entry *e)
+{
+	const unsigned int len = skb->len;
+	struct nf_conn_counter *acct;
+
+	if (skb_cow_head(skb, e->l2_len))
+		return false;
+
+	skb_push(skb, e->l2_len);
+	memcpy(skb->data, e->l2_hdr, e->l2_len);
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, e->l2_len);
+
+#if IS_ENABLED(CONFIG_PPPOE)
+	if (e->sk != NULL) {
+		struct pppoe_hdr *ph = (struct pppoe_hdr *)
+			(skb->data + e->l2_len - PPPOE_SES_HLEN);
+
+		ph->length = htons(len + PPPOE_SES_HLEN - sizeof(*ph));
+		ppp_stat_add_tx(&pppox_sk(e->sk)->chan, 1, len);
+	}
+#endif
+
+	skb->dev = e->out_dev;
+	skb->protocol = e->protocol;
+	skb->vlan_tci = e->vlan_tci;
+	skb->pkt_type = PACKET_OUTGOING;
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+	if (e->ct->mark != 0)
+		skb->mark = e->ct->mark;
+
+	if (e->ct->ndm_mark != 0)
+		skb->ndm_mark = e->ct->ndm_mark;
+#endif
+
+	acct = nf_conn_acct_find(e->ct);
+	if (likely(acct != NULL)) {
+		nf_ct_acct_add(&acct[e->dir], 1, len);
+	}
+	nf_ct_touch(e->ct);
+	nf_ct_nacct_packet(e->ct, e->dir, skb, len);
+
+	SWNAT_FNAT_RESET_MARK(skb);
+
+	return true;
+}
+
+enum {
+	SWNAT_RX_PASS,		/* not cached, pass it up the stack */
+	SWNAT_RX_XMIT,		/* rewritten, ready for dev_queue_xmit() */
+	SWNAT_RX_DROP,		/* consumed */
+};
+
+/* Validates headers of a received packet and extracts its key.
+ * Returns IP total length or 0 if the packet is not for the cache. */
+static unsigned int swnat_rx_parse(struct sk_buff *skb, struct swnat_tuple *key)
+{
+	const struct iphdr *iph;
+	unsigned int tot_len;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    skb->pkt_type != PACKET_HOST)
+		return 0;
+
+	if (!pskb_may_pull(skb, sizeof(*iph) + sizeof(struct udphdr)))
+		return 0;
+
+	iph = (const struct iphdr *)skb->data;
+
+	if (iph->version != 4 || iph->ihl != 5 ||
+	    (iph->frag_off & htons(IP_MF | IP_OFFSET)) ||
+	    iph->ttl <= 1 ||
+	    ip_fast_csum((const u8 *)iph, iph->ihl))
+		return 0;
+
+	tot_len = ntohs(iph->tot_len);
+	if (tot_len > skb->len)
+		return 0;
+
+	if (iph->protocol == IPPROTO_TCP) {
+		const struct tcphdr *th;
+
+		if (!pskb_may_pull(skb, sizeof(*iph) + sizeof(*th)))
+			return 0;
+
+		iph = (const struct iphdr *)skb->data;
+		th = (const struct tcphdr *)(skb->data + sizeof(*iph));
+		if (tcp_flag_word(th) & (TCP_FLAG_SYN | TCP_FLAG_FIN |
+					 TCP_FLAG_RST))
+			return 0;
+	} else if (iph->protocol != IPPROTO_UDP) {
+		return 0;
+	}
+
+	swnat_skb_tuple(iph, key);
+
+	return tot_len;
+}
+
+/* Looks up and applies cached binding, called under tbl->lock.
+ * *last is the entry used by the previous packet of a burst, packets
+ * of the same flow skip hashing and validation. */
+static int swnat_rx_one(struct swnat_table *tbl, struct sk_buff *skb,
+			const struct swnat_tuple *key, unsigned int tot_len,
+			struct swnat_entry **last)
+{
+	struct swnat_entry *e = *last;
+
+	if (e == NULL || e->ct == NULL || !swnat_tuple_equal(&e->key, key)) {
+		*last = NULL;
+
+		e = &tbl->entries[swnat_hash(key)];
+		if (e->ct == NULL || !swnat_tuple_equal(&e->key, key))
+			return SWNAT_RX_PASS;
+
+		if (swnat_entry_stale(e)) {
+			swnat_entry_release(e);
+			return SWNAT_RX_PASS;
+		}
+
+		/* Let conntrack see the flow from time to time */
+		if (time_after(jiffies, e->last_slow + SWNAT_REFRESH)) {
+			e->last_slow = jiffies;
+			return SWNAT_RX_PASS;
+		}
+
+		e->last_used = jiffies;
+	}
+
+	if (tot_len > e->mtu)
+		return SWNAT_RX_PASS;
+
+	if (pskb_trim_rcsum(skb, tot_len) ||
+	    !skb_make_writable(skb, sizeof(struct iphdr) +
+				    sizeof(struct tcphdr)))
+		return SWNAT_RX_PASS;
+
+	swnat_rewrite(skb, e);
+	if (!swnat_encap(skb, e)) {
+		/* Header already rewritten, cannot give it back */
+		kfree_skb(skb);
+		return SWNAT_RX_DROP;
+	}
+
+	*last = e;
+
+	return SWNAT_RX_XMIT;
+}
+
+/* Returns 1 if the packet has been consumed, 0 to pass it up the stack. */
+static int swnat_rx(struct sk_buff *skb, u8 origin)
+{
+	struct swnat_table *tbl;
+	struct swnat_entry *last = NULL;
+	struct swnat_tuple key;
+	struct net_device *out_dev;
+	unsigned int tot_len;
+	int ret;
+
+	/* The shaper must see every packet, leave it to the slow path */
+	if (!ipv4_fastnat_conntrack || ntc_shaper_ingress_hook_active())
+		return 0;
+
+	tot_len = swnat_rx_parse(skb, &key);
+	if (tot_len == 0)
+		return 0;
+
+	tbl = this_cpu_ptr(&swnat_tables);
+	spin_lock_bh(&tbl->lock);
+
+	ret = swnat_rx_one(tbl, skb, &key, tot_len, &last);
+	if (ret == SWNAT_RX_XMIT) {
+		out_dev = skb->dev;
+		dev_hold(out_dev);
+	}
+
+	spin_unlock_bh(&tbl->lock);
+
+	if (ret == SWNAT_RX_PASS)
+		return 0;
+
+	if (ret == SWNAT_RX_XMIT) {
+		dev_queue_xmit(skb);
+		dev_put(out_dev);
+	}
+
+	return 1;
+}
+
+/*
+ * Burst version of swnat_rx() for driver RX poll loops.  Consumes
+ * cached packets from the list and leaves the rest, in order, for the
+ * caller to pass up the stack.  The shaper check and the table lock are
+ * taken once per burst, consecutive packets of one flow reuse the
+ * entry, and one output device reference covers a run of packets to
+ * the same device.
+ */
+static void swnat_rx_list(struct sk_buff_head *list, u8 origin)
+{
+	struct sk_buff_head pass, xmit;
+	struct swnat_table *tbl;
+	struct swnat_entry *last = NULL;
+	struct net_device *out_dev = NULL;
+	struct sk_buff *skb;
+
+	if (!ipv4_fastnat_conntrack || ntc_shaper_ingress_hook_active())
+		return;
+
+	__skb_queue_head_init(&pass);
+	__skb_queue_head_init(&xmit);
+
+	tbl = this_cpu_ptr(&swnat_tables);
+	spin_lock_bh(&tbl->lock);
+
+	while ((skb = __skb_dequeue(list)) != NULL) {
+		struct swnat_tuple key;
+		unsigned int tot_len = swnat_rx_parse(skb, &key);
+
+		if (tot_len == 0) {
+			__skb_queue_tail(&pass, skb);
+			continue;
+		}
+
+		switch (swnat_rx_one(tbl, skb, &key, tot_len, &last)) {
+		case SWNAT_RX_PASS:
+			__skb_queue_tail(&pass, skb);
+			break;
+		case SWNAT_RX_XMIT:
+			if (skb->dev != out_dev) {
+				out_dev = skb->dev;
+				dev_hold(out_dev);
+			}
+			__skb_queue_tail(&xmit, skb);
+			break;
+		}
+	}
+
+	spin_unlock_bh(&tbl->lock);
+
+	skb_queue_splice(&pass, list);
+
+	while ((skb = __skb_dequeue(&xmit)) != NULL) {
+		struct sk_buff *next = skb_peek(&xmit);
+
+		out_dev = skb->dev;
+		dev_queue_xmit(skb);
+
+		/* Last packet of the run to this device */
+		if (next == NULL || next->dev != out_dev)
+			dev_put(out_dev);
+	}
+}
+
+static void swnat_prebind_fastnat(struct sk_buff *skb,
+				  u32 orig_saddr, u16 orig_sport,
+				  struct nf_conn *ct,
+				  enum ip_conntrack_info ctinfo)
+{
+	const enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
+	const struct nf_conntrack_tuple *t = &ct->tuplehash[dir].tuple;
+	const struct nf_conntrack_tuple *r = &ct->tuplehash[!dir].tuple;
+	struct swnat_table *tbl;
+	struct swnat_pending *p;
+
+	if (t->dst.protonum != IPPROTO_TCP && t->dst.protonum != IPPROTO_UDP)
+		return;
+
+	tbl = this_cpu_ptr(&swnat_tables);
+	spin_lock_bh(&tbl->lock);
+
+	p = &tbl->pending;
+	swnat_pending_release(p);
+
+	p->key.saddr = t->src.u3.ip;
+	p->key.daddr = t->dst.u3.ip;
+	p->key.sport = t->src.u.all;
+	p->key.dport = t->dst.u.all;
+	p->key.proto = t->dst.protonum;
+
+	/* Transmitted packet looks like inverse of other direction */
+	p->nat.saddr = r->dst.u3.ip;
+	p->nat.daddr = r->src.u3.ip;
+	p->nat.sport = r->dst.u.all;
+	p->nat.dport = r->src.u.all;
+	p->nat.proto = r->dst.protonum;
+
+	p->dir = dir;
+	p->mtu = skb_dst(skb) ? min_t(unsigned int,
+		dst_mtu(skb_dst(skb)), 0xffff) : 0xffff;
+	p->rt_genid = atomic_read(&nf_ct_net(ct)->ipv4.rt_genid);
+
+	nf_conntrack_get(&ct->ct_general);
+	p->ct = ct;
+
+	spin_unlock_bh(&tbl->lock);
+}
+
+static inline const struct iphdr *
+swnat_pending_match(const struct swnat_pending *p,
+		    const struct sk_buff *skb,
+		    unsigned int nhoff)
+{
+	const struct iphdr *iph;
+	struct swnat_tuple t;
+
+	if (skb_headlen(skb) < nhoff + sizeof(*iph) + 2 * sizeof(__be16))
+		return NULL;
+
+	iph = (const struct iphdr *)(skb->data + nhoff);
+	if (iph->version != 4 || iph->ihl != 5)
+		return NULL;
+
+	swnat_skb_tuple(iph, &t);
+	if (!swnat_tuple_equal(&t, &p->nat))
+		return NULL;
+
+	return iph;
+}
+
+#if IS_ENABLED(CONFIG_PPPOE)
+static void swnat_prebind_pppoetx(struct sk_buff *skb, struct sock *sk,
+				  u16 sid)
+{
+	struct swnat_table *tbl = this_cpu_ptr(&swnat_tables);
+	struct swnat_pending *p;
+
+	spin_lock_bh(&tbl->lock);
+
+	p = &tbl->pending;
+
+	/* skb->data points to PPPoE header followed by PPP protocol */
+	if (p->ct != NULL && p->sk == NULL &&
+	    swnat_pending_match(p, skb, PPPOE_SES_HLEN) != NULL) {
+		/* Reference taken by caller is passed to the entry */
+		p->sk = sk;
+		sk = NULL;
+	}
+
+	spin_unlock_bh(&tbl->lock);
+
+	if (sk != NULL)
+		sock_put(sk);
+}
+#endif
+
+static void swnat_prebind_tx(struct sk_buff *skb)
+{
+	struct swnat_table *tbl = this_cpu_ptr(&swnat_tables);
+	struct net_device *dev = skb->dev;
+	struct swnat_pending *p;
+	struct swnat_entry *e;
+	unsigned int l2_len;
+	unsigned int mtu;
+
+	spin_lock_bh(&tbl->lock);
+
+	p = &tbl->pending;
+	if (p->ct == NULL)
+		goto out;
+
+	l2_len = skb_network_offset(skb);
+	if (SWNAT_PPP_CHECK_MARK(skb)) {
+		if (p->sk == NULL)
+			goto out;
+		l2_len += PPPOE_SES_HLEN;
+	} else if (p->sk != NULL) {
+		goto out;
+	}
+
+	if (l2_len < ETH_HLEN || l2_len > SWNAT_L2_MAX ||
+	    dev->type != ARPHRD_ETHER ||
+	    swnat_pending_match(p, skb, l2_len) == NULL)
+		goto out;
+
+	mtu = dev->mtu - (l2_len - ETH_HLEN);
+	if (mtu > p->mtu)
+		mtu = p->mtu;
+
+	e = &tbl->entries[swnat_hash(&p->key)];
+	swnat_entry_release(e);
+
+	e->key = p->key;
+	e->nat = p->nat;
+	e->dir = p->dir;
+	e->rt_genid = p->rt_genid;
+	e->mtu = mtu;
+	e->protocol = skb->protocol;
+	e->vlan_tci = skb->vlan_tci;
+	e->l2_len = l2_len;
+	memcpy(e->l2_hdr, skb->data, l2_len);
+	e->last_used = e->last_slow = jiffies;
+
+	dev_hold(dev);
+	e->out_dev = dev;
+
+	/* Move references from pending to the entry */
+	e->sk = p->sk;
+	e->ct = p->ct;
+	p->sk = NULL;
+	p->ct = NULL;
+
+out:
+	spin_unlock_bh(&tbl->lock);
+}
+
+static void swnat_flush(const struct net_device *dev, bool idle_only)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct swnat_table *tbl = &per_cpu(swnat_tables, cpu);
+		unsigned int i;
+
+		spin_lock_bh(&tbl->lock);
+
+		if (!idle_only)
+			swnat_pending_release(&tbl->pending);
+
+		for (i = 0; i < swnat_hsize; i++) {
+			struct swnat_entry *e = &tbl->entries[i];
+
+			if (e->ct == NULL)
+				continue;
+
+			if (idle_only) {
+				if (time_after(jiffies, e->last_used + SWNAT_IDLE) ||
+				    swnat_entry_stale(e))
+					swnat_entry_release(e);
+			} else if (dev == NULL || e->out_dev == dev) {
+				swnat_entry_release(e);
+			}
+		}
+
+		spin_unlock_bh(&tbl->lock);
+	}
+}
+
+static void swnat_gc(unsigned long data)
+{
+	swnat_flush(NULL, true);
+	mod_timer(&swnat_gc_timer, jiffies + SWNAT_GC_INTERVAL);
+}
+
+static int swnat_netdev_event(struct notifier_block *this,
+			      unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+
+	switch (event) {
+	case NETDEV_DOWN:
+	case NETDEV_UNREGISTER:
+	case NETDEV_CHANGEMTU:
+	case NETDEV_CHANGEADDR:
+		swnat_flush(dev, false);
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block swnat_netdev_notifier = {
+	.notifier_call = swnat_netdev_event,
+};
+
+static void swnat_tables_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(swnat_tables, cpu).entries);
+}
+
+static int __init swnat_init(void)
+{
+	int cpu, ret;
+
+	if (!is_power_of_2(swnat_hsize))
+		swnat_hsize = roundup_pow_of_two(swnat_hsize);
+
+	get_random_bytes(&swnat_hash_rnd, sizeof(swnat_hash_rnd));
+
+	for_each_possible_cpu(cpu) {
+		struct swnat_table *tbl = &per_cpu(swnat_tables, cpu);
+
+		spin_lock_init(&tbl->lock);
+		tbl->entries = kcalloc(swnat_hsize, sizeof(*tbl->entries),
+				       GFP_KERNEL);
+		if (tbl->entries == NULL) {
+			swnat_tables_free();
+			return -ENOMEM;
+		}
+	}
+
+	ret = register_netdevice_notifier(&swnat_netdev_notifier);
+	if (ret) {
+		swnat_tables_free();
+		return ret;
+	}
+
+	setup_timer(&swnat_gc_timer, swnat_gc, 0);
+	mod_timer(&swnat_gc_timer, jiffies + SWNAT_GC_INTERVAL);
+
+	rcu_assign_pointer(prebind_from_raeth, swnat_prebind_tx);
+	rcu_assign_pointer(prebind_from_usb_mac, swnat_prebind_tx);
+#if IS_ENABLED(CONFIG_PPPOE)
+	rcu_assign_pointer(prebind_from_pppoetx, swnat_prebind_pppoetx);
+#endif
+	rcu_assign_pointer(prebind_from_fastnat, swnat_prebind_fastnat);
+	synchronize_rcu();
+	rcu_assign_pointer(go_swnat, swnat_rx);
+	rcu_assign_pointer(go_swnat_list, swnat_rx_list);
+
+	printk(KERN_INFO "SWNAT flow cache loaded (%u entries per CPU)\n",
+	       swnat_hsize);
+
+	return 0;
+}
+
+static void __exit swnat_fini(void)
+{
+	rcu_assign_pointer(go_swnat_list, NULL);
+	rcu_assign_pointer(go_swnat, NULL);
+	rcu_assign_pointer(prebind_from_fastnat, NULL);
+#if IS_ENABLED(CONFIG_PPPOE)
+	rcu_assign_pointer(prebind_from_pppoetx, NULL);
+#endif
+	rcu_assign_pointer(prebind_from_usb_mac, NULL);
+	rcu_assign_pointer(prebind_from_raeth, NULL);
+	synchronize_net();
+
+	del_timer_sync(&swnat_gc_timer);
+	unregister_netdevice_notifier(&swnat_netdev_notifier);
+
+	swnat_flush(NULL, false);
+	swnat_tables_free();
+
+	printk(KERN_INFO "SWNAT flow cache unloaded\n");
+}
+
+module_init(swnat_init);
+module_exit(swnat_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("http://www.ndmsystems.com");
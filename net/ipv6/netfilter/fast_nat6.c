@@ -0,0 +1,242 @@
+/*
+ * IPv6 fast forwarding for established conntrack flows.
+ *
+ * nf_conntrack_in() returns NF_FAST_NAT for bound IPv6 flows at
+ * PRE_ROUTING; nf_hook_slow() then hands the packet over here and
+ * the rest of netfilter hooks and ip6_forward() are skipped.
+ * Packets which are not plainly forwarded (local delivery, redirects,
+ * route errors) are returned to the normal ip6_rcv_finish() path.
+ */
+#include <linux/module.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/ipv6.h>
+#include <linux/icmpv6.h>
+#include <linux/netfilter.h>
+#include <linux/rcupdate.h>
+#include <net/ipv6.h>
+#include <net/ip6_route.h>
+#include <net/addrconf.h>
+#include <net/neighbour.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
+#include <linux/ntc_shaper_hooks.h>
+
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+#include <../ndm/hw_nat/ra_nat.h>
+#endif
+
+extern int ipv6_fastnat_conntrack;
+
+extern int (*fast_nat6_hit_hook_func)(struct sk_buff *skb);
+
+/*
+ * Direct send packets to output.
+ * Stolen from ip6_finish_output2.
+ */
+static inline int fast_nat6_path_output(struct sk_buff *skb)
+{
+	struct dst_entry *dst = skb_dst(skb);
+	struct neighbour *neigh;
+
+	skb->protocol = htons(ETH_P_IPV6);
+	skb->dev = dst->dev;
+
+	rcu_read_lock();
+	neigh = dst_get_neighbour_noref(dst);
+	if (neigh) {
+		int res = neigh_output(neigh, skb);
+
+		rcu_read_unlock();
+
+		/* Don't return 1 */
+		return (res == 1) ? 0 : res;
+	}
+	rcu_read_unlock();
+
+	IP6_INC_STATS_BH(dev_net(dst->dev),
+			 ip6_dst_idev(dst), IPSTATS_MIB_OUTNOROUTES);
+	kfree_skb(skb);
+	return -EINVAL;
+}
+
+static int fast_nat6_bind_hook_egress(struct sk_buff *skb)
+{
+	struct dst_entry *dst = skb_dst(skb);
+	struct net *net = dev_net(dst->dev);
+	struct ipv6hdr *hdr = ipv6_hdr(skb);
+	u32 mtu;
+
+	if (hdr->hop_limit <= 1) {
+		NF_CT_FASTNAT_FALLBACK(skb, TTL_EXCEEDED);
+		/* Force OUTPUT device used as source address */
+		skb->dev = dst->dev;
+		icmpv6_send(skb, ICMPV6_TIME_EXCEED, ICMPV6_EXC_HOPLIMIT, 0);
+		IP6_INC_STATS_BH(net,
+				 ip6_dst_idev(dst), IPSTATS_MIB_INHDRERRORS);
+
+		kfree_skb(skb);
+		return -ETIMEDOUT;
+	}
+
+	mtu = dst_mtu(dst);
+	if (mtu < IPV6_MIN_MTU)
+		mtu = IPV6_MIN_MTU;
+
+	if (!skb->local_df && skb->len > mtu && !skb_is_gso(skb)) {
+		/* Again, force OUTPUT device used as source address */
+		skb->dev = dst->dev;
+		icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu);
+		IP6_INC_STATS_BH(net,
+				 ip6_dst_idev(dst), IPSTATS_MIB_INTOOBIGERRORS);
+		IP6_INC_STATS_BH(net,
+				 ip6_dst_idev(dst), IPSTATS_MIB_FRAGFAILS);
+		kfree_skb(skb);
+		return -EMSGSIZE;
+	}
+
+	if (skb_cow(skb, dst->dev->hard_header_len)) {
+		IP6_INC_STATS(net, ip6_dst_idev(dst), IPSTATS_MIB_OUTDISCARDS);
+		kfree_skb(skb);
+		return -ENOMEM;
+	}
+
+	hdr = ipv6_hdr(skb);
+
+	/* Mangling hops number delayed to point after skb COW */
+	hdr->hop_limit--;
+
+	IP6_INC_STATS_BH(net, ip6_dst_idev(dst), IPSTATS_MIB_OUTFORWDATAGRAMS);
+	return fast_nat6_path_output(skb);
+}
+
+/* Returns 1 if the packet is not a plain forward and needs ip6_rcv_finish */
+static inline int fast_nat6_route(struct sk_buff *skb)
+{
+	const struct ipv6hdr *hdr = ipv6_hdr(skb);
+	struct dst_entry *dst;
+	int addrtype;
+
+	if (skb->pkt_type != PACKET_HOST || unlikely(skb->sk))
+		return 1;
+
+	addrtype = ipv6_addr_type(&hdr->saddr);
+	if (addrtype == IPV6_ADDR_ANY ||
+	    addrtype & (IPV6_ADDR_MULTICAST | IPV6_ADDR_LOOPBACK |
+			IPV6_ADDR_LINKLOCAL))
+		return 1;
+
+	if (ipv6_addr_is_multicast(&hdr->daddr))
+		return 1;
+
+	if (skb_dst(skb) == NULL)
+		ip6_route_input(skb);
+
+	dst = skb_dst(skb);
+	if (dst->error || dst->input != ip6_forward)
+		return 1;
+
+	if (dev_net(dst->dev)->ipv6.devconf_all->forwarding == 0)
+		return 1;
+
+	/* Leave redirects to ip6_forward() */
+	if (skb->dev == dst->dev)
+		return 1;
+
+	return 0;
+}
+
+/* Returns 1 if nf_hook okfn() needs to be executed by the caller,
+ * -EPERM for NF_DROP, 0 otherwise. */
+static int fast_nat6_path(struct sk_buff *skb)
+{
+	ntc_shaper_hook_fn *shaper_egress;
+	uint32_t disable_hwacc = NTC_HWACC_ALLOW;
+	int retval = 0;
+
+	if (!ipv6_fastnat_conntrack || fast_nat6_route(skb)) {
+		NF_CT_FASTNAT_FALLBACK(skb, FALLBACK6);
+		return 1;
+	}
+
+	/* FORWARD hooks are skipped, so account the packet here */
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+	if (likely(!FOE_SKB_IS_KEEPALIVE(skb)))
+#endif
+	{
+		struct nf_conn *ct;
+		enum ip_conntrack_info ctinfo;
+
+		ct = nf_ct_get(skb, &ctinfo);
+		if (likely(ct != NULL)) {
+			struct nf_conn_counter *acct = nf_conn_acct_find(ct);
+
+			if (likely(acct != NULL)) {
+				nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb, skb->len);
+			}
+			nf_ct_touch(ct);
+			nf_ct_nacct_packet(ct, CTINFO2DIR(ctinfo), skb,
+					   skb->len);
+		}
+	}
+
+	NF_CT_FASTNAT_STAT_INC(HIT6);
+	trace_fastnat_hit(skb);
+
+	skb_forward_csum(skb);
+
+	shaper_egress = ntc_shaper_egress_hook_get();
+
+	if (shaper_egress) {
+		unsigned int ntc_retval = shaper_egress(skb, 0, 0, &disable_hwacc, fast_nat6_bind_hook_egress, NULL, NULL);
+
+		switch (ntc_retval) {
+			case NF_ACCEPT:
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+				/* Shaper limits the flow in software */
+				if (disable_hwacc == NTC_HWACC_DISABLE)
+					FOE_ALG_MARK(skb);
+#endif
+				retval = fast_nat6_bind_hook_egress(skb);
+				break;
+			case NF_STOLEN:
+				NF_CT_FASTNAT_STAT_INC(EGRESS_STOLEN);
+				retval = 0;
+				break;
+			default:
+				NF_CT_FASTNAT_STAT_INC(EGRESS_DROP);
+				kfree_skb(skb);
+				retval = -EPERM;
+				break;
+		}
+	} else
+		retval = fast_nat6_bind_hook_egress(skb);
+
+	ntc_shaper_egress_hook_put();
+
+	return retval;
+}
+
+static int __init fast_nat6_init(void)
+{
+	rcu_assign_pointer(fast_nat6_hit_hook_func, fast_nat6_path);
+	ipv6_fastnat_conntrack = 1;
+	printk(KERN_INFO "Fast NAT IPv6 loaded\n");
+	return 0;
+}
+
+static void __exit fast_nat6_fini(void)
+{
+	ipv6_fastnat_conntrack = 0;
+	rcu_assign_pointer(fast_nat6_hit_hook_func, NULL);
+	synchronize_net();
+	printk(KERN_INFO "Fast NAT IPv6 unloaded\n");
+}
+
+module_init(fast_nat6_init);
+module_exit(fast_nat6_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("http://www.ndmsystems.com");
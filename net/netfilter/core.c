@@ -27,6 +27,7 @@
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
 extern int (*fast_nat_hit_hook_func)(struct sk_buff *skb);
+extern int (*fast_nat6_hit_hook_func)(struct sk_buff *skb);
 #endif
 
 #if defined(CONFIG_NETFILTER_FP_SMB)
@@ -229,7 +230,12 @@ next_hook:
 	}
 #if IS_ENABLED(CONFIG_FAST_NAT)
 	else if (verdict == NF_FAST_NAT) {
-		if ((fast_nat_hit_hook = rcu_dereference(fast_nat_hit_hook_func))) {
+		if (pf == NFPROTO_IPV6)
+			fast_nat_hit_hook = rcu_dereference(fast_nat6_hit_hook_func);
+		else
+			fast_nat_hit_hook = rcu_dereference(fast_nat_hit_hook_func);
+
+		if (fast_nat_hit_hook) {
 			ret = fast_nat_hit_hook(skb);
 		} else {
 			kfree_skb(skb);
@@ -0,0 +1,811 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the trie:net type
+ *
+ * Networks are stored in a multibit trie of 6 bit strides.  A node
+ * keeps a bitmap of the prefixes ending in it, one bit for each of
+ * its 63 positions (lengths depth..depth+5), and a bitmap of the slots
+ * which continue in a child node, the children packed in slot order
+ * and indexed by population count.  A lookup visits at most one node
+ * per stride, 6 for IPv4 and 22 for IPv6, whatever the number and the
+ * lengths of the networks in the set.
+ *
+ * Lookups from the packet path take no lock.  Writers run under the
+ * set lock and change prefix bits in place; a node whose children
+ * change is copied and the copy published, the old one is freed after
+ * an RCU grace period.
+ */
+
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/rcupdate.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/pfxlen.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("http://www.ndmsystems.com");
+MODULE_DESCRIPTION("trie:net type of IP sets");
+MODULE_ALIAS("ip_set_trie:net");
+
+#define TRIE_STRIDE	6
+#define TRIE_SLOTS	(1 << TRIE_STRIDE)
+#define TRIE_LEVELS	(128 / TRIE_STRIDE + 1)
+
+struct trie_node {
+	u64 ext;		/* slots continued in a child */
+	u64 pfx;		/* prefixes ending here, by position */
+	u64 nomatch;		/* ... of them added as nomatch */
+	u32 count;		/* prefixes in the subtree */
+	struct rcu_head rcu;
+	struct trie_node __rcu *child[0];
+};
+
+struct trie_net {
+	struct trie_node __rcu *root;
+	u32 maxelem;
+	u32 elements;
+	size_t memsize;
+	u8 words;		/* of the address, 1 or 4 */
+	u8 host_mask;
+};
+
+/* Member element, the address in host order */
+struct trie_net_elem {
+	u32 ip[4];
+	u8 cidr;
+	u8 nomatch;
+};
+
+/* Positions of the prefixes covering a slot, one per length */
+static u64 trie_cover[TRIE_SLOTS] __read_mostly;
+
+/* Writers hold the set lock, listing too */
+#define trie_deref(p)	rcu_dereference_protected(p, 1)
+
+static inline unsigned int
+trie_pos(unsigned int slot, unsigned int k)
+{
+	return (1 << k) - 1 + (slot >> (TRIE_STRIDE - k));
+}
+
+/* Bits depth..depth+5 of the address, zero past its end */
+static inline unsigned int
+trie_slot(const u32 *a, unsigned int depth, unsigned int words)
+{
+	unsigned int w = depth / 32, sh = depth % 32;
+	u32 v = a[w] << sh;
+
+	if (sh > 32 - TRIE_STRIDE && w + 1 < words)
+		v |= a[w + 1] >> (32 - sh);
+	return v >> (32 - TRIE_STRIDE);
+}
+
+static inline unsigned int
+trie_children(const struct trie_node *n)
+{
+	return hweight64(n->ext);
+}
+
+static inline size_t
+trie_node_size(unsigned int children)
+{
+	return sizeof(struct trie_node) +
+	       children * sizeof(struct trie_node *);
+}
+
+static struct trie_node *
+trie_node_alloc(struct trie_net *t, unsigned int children)
+{
+	struct trie_node *n;
+
+	n = kzalloc(trie_node_size(children), GFP_ATOMIC);
+	if (n)
+		t->memsize += trie_node_size(children);
+	return n;
+}
+
+static void
+trie_node_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct trie_node, rcu));
+}
+
+/* Free a node once readers are done with it, not its children */
+static void
+trie_node_release(struct trie_net *t, struct trie_node *n)
+{
+	t->memsize -= trie_node_size(trie_children(n));
+	call_rcu(&n->rcu, trie_node_free_rcu);
+}
+
+static void
+trie_tree_free(struct trie_node *n)
+{
+	unsigned int i;
+
+	for (i = 0; i < trie_children(n); i++)
+		trie_tree_free(trie_deref(n->child[i]));
+	kfree(n);
+}
+
+static void
+trie_tree_free_rcu(struct rcu_head *head)
+{
+	trie_tree_free(container_of(head, struct trie_node, rcu));
+}
+
+/* Free nodes readers have never seen */
+static void
+trie_tree_discard(struct trie_net *t, struct trie_node *n)
+{
+	unsigned int i;
+
+	for (i = 0; i < trie_children(n); i++)
+		trie_tree_discard(t, trie_deref(n->child[i]));
+	t->memsize -= trie_node_size(trie_children(n));
+	kfree(n);
+}
+
+/* Copy of n with the child at slot bit added, or removed if child is
+ * NULL. */
+static struct trie_node *
+trie_node_copy(struct trie_net *t, const struct trie_node *n, u64 bit,
+	       struct trie_node *child)
+{
+	unsigned int idx = hweight64(n->ext & (bit - 1));
+	unsigned int i, j, children = trie_children(n);
+	struct trie_node *new;
+
+	new = trie_node_alloc(t, child ? children + 1 : children - 1);
+	if (!new)
+		return NULL;
+	new->ext = child ? n->ext | bit : n->ext & ~bit;
+	new->pfx = n->pfx;
+	new->nomatch = n->nomatch;
+	new->count = n->count;
+	for (i = 0, j = 0; i < children; i++) {
+		if (i == idx) {
+			if (child)
+				RCU_INIT_POINTER(new->child[j++], child);
+			else
+				continue;
+		}
+		RCU_INIT_POINTER(new->child[j++], trie_deref(n->child[i]));
+	}
+	if (child && idx == children)
+		RCU_INIT_POINTER(new->child[j], child);
+	return new;
+}
+
+/* New nodes from depth down to the one holding the prefix */
+static struct trie_node *
+trie_chain(struct trie_net *t, const struct trie_net_elem *d,
+	   unsigned int depth)
+{
+	unsigned int level = depth +
+		(d->cidr - depth) / TRIE_STRIDE * TRIE_STRIDE;
+	struct trie_node *n, *below;
+
+	n = trie_node_alloc(t, 0);
+	if (!n)
+		return NULL;
+	n->pfx = 1ULL << trie_pos(trie_slot(d->ip, level, t->words),
+				  d->cidr - level);
+	n->nomatch = d->nomatch ? n->pfx : 0;
+	n->count = 1;
+
+	while (level > depth) {
+		below = n;
+		level -= TRIE_STRIDE;
+		n = trie_node_alloc(t, 1);
+		if (!n) {
+			trie_tree_discard(t, below);
+			return NULL;
+		}
+		n->ext = 1ULL << trie_slot(d->ip, level, t->words);
+		RCU_INIT_POINTER(n->child[0], below);
+		n->count = 1;
+	}
+	return n;
+}
+
+static int
+trie_net_add(struct ip_set *set, void *value, u32 timeout, u32 flags)
+{
+	struct trie_net *t = set->data;
+	const struct trie_net_elem *d = value;
+	struct trie_node __rcu **pslot = &t->root;
+	struct trie_node *path[TRIE_LEVELS], *n, *new;
+	unsigned int depth = 0, level = 0, i;
+	u64 bit;
+
+	if (t->elements >= t->maxelem)
+		return -IPSET_ERR_HASH_FULL;
+
+	for (;;) {
+		n = trie_deref(*pslot);
+		if (!n) {
+			/* Empty set */
+			new = trie_chain(t, d, depth);
+			if (!new)
+				return -ENOMEM;
+			rcu_assign_pointer(*pslot, new);
+			break;
+		}
+		if (d->cidr < depth + TRIE_STRIDE) {
+			bit = 1ULL << trie_pos(trie_slot(d->ip, depth,
+							 t->words),
+					       d->cidr - depth);
+			if (n->pfx & bit)
+				return -IPSET_ERR_EXIST;
+			if (d->nomatch)
+				n->nomatch |= bit;
+			else
+				n->nomatch &= ~bit;
+			smp_wmb();
+			ACCESS_ONCE(n->pfx) = n->pfx | bit;
+			path[level++] = n;
+			break;
+		}
+		bit = 1ULL << trie_slot(d->ip, depth, t->words);
+		if (!(n->ext & bit)) {
+			struct trie_node *chain;
+
+			chain = trie_chain(t, d, depth + TRIE_STRIDE);
+			if (!chain)
+				return -ENOMEM;
+			new = trie_node_copy(t, n, bit, chain);
+			if (!new) {
+				trie_tree_discard(t, chain);
+				return -ENOMEM;
+			}
+			rcu_assign_pointer(*pslot, new);
+			trie_node_release(t, n);
+			path[level++] = new;
+			break;
+		}
+		path[level++] = n;
+		pslot = &n->child[hweight64(n->ext & (bit - 1))];
+		depth += TRIE_STRIDE;
+	}
+
+	for (i = 0; i < level; i++)
+		path[i]->count++;
+	t->elements++;
+	return 0;
+}
+
+static int
+trie_net_del(struct ip_set *set, void *value, u32 timeout, u32 flags)
+{
+	struct trie_net *t = set->data;
+	const struct trie_net_elem *d = value;
+	struct trie_node __rcu **pslot[TRIE_LEVELS];
+	struct trie_node *path[TRIE_LEVELS], *n, *new;
+	unsigned int depth = 0, level = 0, top, i;
+	u64 bit;
+
+	pslot[0] = &t->root;
+	for (;;) {
+		n = trie_deref(*pslot[level]);
+		if (!n)
+			return -IPSET_ERR_EXIST;
+		path[level] = n;
+		if (d->cidr < depth + TRIE_STRIDE)
+			break;
+		bit = 1ULL << trie_slot(d->ip, depth, t->words);
+		if (!(n->ext & bit))
+			return -IPSET_ERR_EXIST;
+		pslot[level + 1] = &n->child[hweight64(n->ext & (bit - 1))];
+		level++;
+		depth += TRIE_STRIDE;
+	}
+
+	bit = 1ULL << trie_pos(trie_slot(d->ip, depth, t->words),
+			       d->cidr - depth);
+	if (!(n->pfx & bit))
+		return -IPSET_ERR_EXIST;
+	ACCESS_ONCE(n->pfx) = n->pfx & ~bit;
+	smp_wmb();
+	n->nomatch &= ~bit;
+
+	for (i = 0; i <= level; i++)
+		path[i]->count--;
+	t->elements--;
+
+	if (n->pfx || n->ext)
+		return 0;
+
+	/* Unlink the chain of nodes left without prefixes */
+	top = level;
+	while (top > 0 && !path[top - 1]->pfx &&
+	       trie_children(path[top - 1]) == 1)
+		top--;
+	if (top == 0) {
+		rcu_assign_pointer(t->root, NULL);
+	} else {
+		bit = 1ULL << trie_slot(d->ip, (top - 1) * TRIE_STRIDE,
+					t->words);
+		new = trie_node_copy(t, path[top - 1], bit, NULL);
+		if (!new)
+			/* Empty nodes are harmless, keep them */
+			return 0;
+		rcu_assign_pointer(*pslot[top - 1], new);
+		trie_node_release(t, path[top - 1]);
+	}
+	for (i = top; i <= level; i++)
+		trie_node_release(t, path[i]);
+
+	return 0;
+}
+
+/* Longest prefix match */
+static int
+trie_net_lookup(const struct trie_net *t, const u32 *a)
+{
+	const struct trie_node *n;
+	unsigned int depth = 0, slot;
+	int ret = 0;
+	u64 m, bit;
+
+	rcu_read_lock();
+	n = rcu_dereference(t->root);
+	while (n) {
+		slot = trie_slot(a, depth, t->words);
+		m = ACCESS_ONCE(n->pfx) & trie_cover[slot];
+		if (m) {
+			smp_rmb();
+			ret = !(n->nomatch & (1ULL << (fls64(m) - 1)));
+		}
+		bit = 1ULL << slot;
+		if (!(n->ext & bit))
+			break;
+		n = rcu_dereference(n->child[hweight64(n->ext & (bit - 1))]);
+		depth += TRIE_STRIDE;
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/* Test an address against the set, or a network for being in it */
+static int
+trie_net_test(struct ip_set *set, void *value, u32 timeout, u32 flags)
+{
+	const struct trie_net *t = set->data;
+	const struct trie_net_elem *d = value;
+	const struct trie_node *n;
+	unsigned int depth = 0;
+	u64 bit;
+
+	if (d->cidr == t->host_mask)
+		return trie_net_lookup(t, d->ip);
+
+	n = trie_deref(t->root);
+	while (n && d->cidr >= depth + TRIE_STRIDE) {
+		bit = 1ULL << trie_slot(d->ip, depth, t->words);
+		if (!(n->ext & bit))
+			return 0;
+		n = trie_deref(n->child[hweight64(n->ext & (bit - 1))]);
+		depth += TRIE_STRIDE;
+	}
+	if (!n)
+		return 0;
+	bit = 1ULL << trie_pos(trie_slot(d->ip, depth, t->words),
+			       d->cidr - depth);
+	return (n->pfx & bit) && !(n->nomatch & bit);
+}
+
+static inline void
+trie_net_netmask(struct trie_net_elem *d, unsigned int words)
+{
+	unsigned int i;
+
+	for (i = 0; i < words; i++) {
+		if (d->cidr >= (i + 1) * 32)
+			continue;
+		d->ip[i] &= d->cidr <= i * 32 ? 0 :
+			    ~0U << ((i + 1) * 32 - d->cidr);
+	}
+}
+
+static int
+trie_net_kadt(struct ip_set *set, const struct sk_buff *skb,
+	      const struct xt_action_param *par,
+	      enum ipset_adt adt, const struct ip_set_adt_opt *opt)
+{
+	const struct trie_net *t = set->data;
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct trie_net_elem data = { .cidr = t->host_mask };
+	bool src = opt->flags & IPSET_DIM_ONE_SRC;
+
+	if (set->family == NFPROTO_IPV4) {
+		data.ip[0] = ntohl(ip4addr(skb, src));
+	} else {
+		struct in6_addr ip6;
+		unsigned int i;
+
+		ip6addrptr(skb, src, &ip6);
+		for (i = 0; i < 4; i++)
+			data.ip[i] = ntohl(ip6.s6_addr32[i]);
+	}
+
+	return adtfn(set, &data, 0, opt->cmdflags);
+}
+
+static int
+trie_net_uadt(struct ip_set *set, struct nlattr *tb[],
+	      enum ipset_adt adt, u32 *lineno, u32 flags, bool retried)
+{
+	const struct trie_net *t = set->data;
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct trie_net_elem data = { .cidr = t->host_mask };
+	u32 ip, ip_to, last;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS)))
+		return -IPSET_ERR_PROTOCOL;
+	if (unlikely(tb[IPSET_ATTR_TIMEOUT]))
+		return -IPSET_ERR_TIMEOUT;
+
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = nla_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	if (set->family == NFPROTO_IPV4) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &data.ip[0]);
+	} else {
+		union nf_inet_addr ip6;
+		unsigned int i;
+
+		if (unlikely(tb[IPSET_ATTR_IP_TO]))
+			return -IPSET_ERR_HASH_RANGE_UNSUPPORTED;
+		ret = ip_set_get_ipaddr6(tb[IPSET_ATTR_IP], &ip6);
+		for (i = 0; i < 4; i++)
+			data.ip[i] = ntohl(ip6.ip6[i]);
+	}
+	if (ret)
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		data.cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (!data.cidr || data.cidr > t->host_mask)
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+
+	if (tb[IPSET_ATTR_CADT_FLAGS] && adt == IPSET_ADD) {
+		u32 cadt_flags = ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]);
+		data.nomatch = !!(cadt_flags & IPSET_FLAG_NOMATCH);
+	}
+
+	if (adt == IPSET_TEST || !tb[IPSET_ATTR_IP_TO]) {
+		trie_net_netmask(&data, t->words);
+		ret = adtfn(set, &data, 0, flags);
+		return ip_set_eexist(ret, flags) ? 0 : ret;
+	}
+
+	ip = data.ip[0];
+	ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+	if (ret)
+		return ret;
+	if (ip_to < ip)
+		swap(ip, ip_to);
+	if (ip + UINT_MAX == ip_to)
+		return -IPSET_ERR_HASH_RANGE;
+
+	while (!after(ip, ip_to)) {
+		data.ip[0] = ip;
+		last = ip_set_range_to_cidr(ip, ip_to, &data.cidr);
+		ret = adtfn(set, &data, 0, flags);
+		if (ret && !ip_set_eexist(ret, flags))
+			return ret;
+		else
+			ret = 0;
+		ip = last + 1;
+	}
+	return ret;
+}
+
+static void
+trie_net_flush(struct ip_set *set)
+{
+	struct trie_net *t = set->data;
+	struct trie_node *root = trie_deref(t->root);
+
+	if (!root)
+		return;
+	rcu_assign_pointer(t->root, NULL);
+	call_rcu(&root->rcu, trie_tree_free_rcu);
+	t->elements = 0;
+	t->memsize = 0;
+}
+
+static void
+trie_net_destroy(struct ip_set *set)
+{
+	trie_net_flush(set);
+	kfree(set->data);
+	set->data = NULL;
+}
+
+static int
+trie_net_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct trie_net *t = set->data;
+	struct nlattr *nested;
+	u32 elements;
+	size_t memsize;
+
+	read_lock_bh(&set->lock);
+	elements = t->elements;
+	memsize = sizeof(*t) + t->memsize;
+	read_unlock_bh(&set->lock);
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	if (nla_put_net32(skb, IPSET_ATTR_MAXELEM, htonl(t->maxelem)) ||
+	    nla_put_net32(skb, IPSET_ATTR_ELEMENTS, htonl(elements)) ||
+	    nla_put_net32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1)) ||
+	    nla_put_net32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize)))
+		goto nla_put_failure;
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+struct trie_walk {
+	const struct ip_set *set;
+	struct sk_buff *skb;
+	u32 ip[4];
+	unsigned long skip;	/* listed in earlier messages */
+	unsigned long done;
+};
+
+static void
+trie_put_bits(u32 *a, unsigned int depth, unsigned int n, unsigned int v)
+{
+	while (n--) {
+		u32 m = 1U << (31 - depth % 32);
+
+		if (v & (1U << n))
+			a[depth / 32] |= m;
+		else
+			a[depth / 32] &= ~m;
+		depth++;
+	}
+}
+
+static int
+trie_list_elem(struct trie_walk *w, u8 cidr, bool nomatch)
+{
+	const struct trie_net *t = w->set->data;
+	struct trie_net_elem data = { .cidr = cidr };
+	struct nlattr *nested;
+	int ret;
+
+	memcpy(data.ip, w->ip, sizeof(data.ip));
+	trie_net_netmask(&data, t->words);
+
+	nested = ipset_nest_start(w->skb, IPSET_ATTR_DATA);
+	if (!nested)
+		return -EMSGSIZE;
+	if (t->words == 1) {
+		ret = nla_put_ipaddr4(w->skb, IPSET_ATTR_IP, htonl(data.ip[0]));
+	} else {
+		struct in6_addr ip6;
+		unsigned int i;
+
+		for (i = 0; i < 4; i++)
+			ip6.s6_addr32[i] = htonl(data.ip[i]);
+		ret = nla_put_ipaddr6(w->skb, IPSET_ATTR_IP, &ip6);
+	}
+	if (ret ||
+	    nla_put_u8(w->skb, IPSET_ATTR_CIDR, cidr) ||
+	    (nomatch &&
+	     nla_put_net32(w->skb, IPSET_ATTR_CADT_FLAGS,
+			   htonl(IPSET_FLAG_NOMATCH)))) {
+		nla_nest_cancel(w->skb, nested);
+		return -EMSGSIZE;
+	}
+	ipset_nest_end(w->skb, nested);
+	return 0;
+}
+
+/* Prefixes of a node first, then its children in slot order */
+static int
+trie_list_node(struct trie_walk *w, const struct trie_node *n,
+	       unsigned int depth)
+{
+	const struct trie_node *c;
+	unsigned int pos, slot, k, i = 0;
+
+	if (w->skip >= hweight64(n->pfx)) {
+		w->skip -= hweight64(n->pfx);
+	} else {
+		for (pos = 0; pos < TRIE_SLOTS - 1; pos++) {
+			if (!(n->pfx & (1ULL << pos)))
+				continue;
+			if (w->skip) {
+				w->skip--;
+				continue;
+			}
+			k = fls(pos + 1) - 1;
+			trie_put_bits(w->ip, depth, k, pos + 1 - (1 << k));
+			if (trie_list_elem(w, depth + k,
+					   n->nomatch & (1ULL << pos)))
+				return -EMSGSIZE;
+			w->done++;
+		}
+	}
+
+	for (slot = 0; slot < TRIE_SLOTS; slot++) {
+		if (!(n->ext & (1ULL << slot)))
+			continue;
+		c = trie_deref(n->child[i++]);
+		if (w->skip >= c->count) {
+			w->skip -= c->count;
+			continue;
+		}
+		trie_put_bits(w->ip, depth, TRIE_STRIDE, slot);
+		if (trie_list_node(w, c, depth + TRIE_STRIDE))
+			return -EMSGSIZE;
+	}
+	return 0;
+}
+
+static int
+trie_net_list(const struct ip_set *set,
+	      struct sk_buff *skb, struct netlink_callback *cb)
+{
+	const struct trie_net *t = set->data;
+	const struct trie_node *root = trie_deref(t->root);
+	struct trie_walk w = {
+		.set = set,
+		.skb = skb,
+		.skip = cb->args[2],
+	};
+	struct nlattr *atd;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	if (root && trie_list_node(&w, root, 0)) {
+		if (!w.done) {
+			nla_nest_cancel(skb, atd);
+			return -EMSGSIZE;
+		}
+		/* Continue after the listed ones in the next message */
+		ipset_nest_end(skb, atd);
+		cb->args[2] += w.done;
+		return 0;
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[2] = 0;
+
+	return 0;
+}
+
+static bool
+trie_net_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct trie_net *x = a->data;
+	const struct trie_net *y = b->data;
+
+	return x->maxelem == y->maxelem;
+}
+
+static const struct ip_set_type_variant trie_net_variant = {
+	.kadt	= trie_net_kadt,
+	.uadt	= trie_net_uadt,
+	.adt	= {
+		[IPSET_ADD] = trie_net_add,
+		[IPSET_DEL] = trie_net_del,
+		[IPSET_TEST] = trie_net_test,
+	},
+	.destroy = trie_net_destroy,
+	.flush	= trie_net_flush,
+	.head	= trie_net_head,
+	.list	= trie_net_list,
+	.same_set = trie_net_same_set,
+	.rcu_test = true,
+};
+
+/* Create trie:net type of sets */
+
+static int
+trie_net_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	struct trie_net *t;
+
+	if (!(set->family == NFPROTO_IPV4 || set->family == NFPROTO_IPV6))
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM)))
+		return -IPSET_ERR_PROTOCOL;
+	if (unlikely(tb[IPSET_ATTR_TIMEOUT]))
+		return -IPSET_ERR_TIMEOUT;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+
+	t->maxelem = IPSET_DEFAULT_MAXELEM;
+	if (tb[IPSET_ATTR_MAXELEM])
+		t->maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+	if (set->family == NFPROTO_IPV4) {
+		t->words = 1;
+		t->host_mask = 32;
+	} else {
+		t->words = 4;
+		t->host_mask = 128;
+	}
+
+	set->data = t;
+	set->variant = &trie_net_variant;
+
+	pr_debug("create %s maxelem %u: %p\n",
+		 set->name, t->maxelem, set->data);
+
+	return 0;
+}
+
+static struct ip_set_type trie_net_type __read_mostly = {
+	.name		= "trie:net",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP,
+	.dimension	= IPSET_DIM_ONE,
+	.family		= NFPROTO_UNSPEC,
+	.revision_min	= 0,
+	.revision_max	= 0,
+	.create		= trie_net_create,
+	.create_policy	= {
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+trie_net_init(void)
+{
+	unsigned int slot, k;
+
+	for (slot = 0; slot < TRIE_SLOTS; slot++)
+		for (k = 0; k < TRIE_STRIDE; k++)
+			trie_cover[slot] |= 1ULL << trie_pos(slot, k);
+
+	return ip_set_type_register(&trie_net_type);
+}
+
+static void __exit
+trie_net_fini(void)
+{
+	ip_set_type_unregister(&trie_net_type);
+	rcu_barrier();
+}
+
+module_init(trie_net_init);
+module_exit(trie_net_fini);
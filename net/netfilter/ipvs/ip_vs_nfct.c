@@ -107,12 +107,12 @@ ip_vs_update_conntrack(struct sk_buff *skb, struct ip_vs_conn *cp, int outin)
 	 * This will also take care of UDP and other protocols.
 	 */
 	if (outin) {
-		new_tuple.src.u3 = cp->daddr;
+		nf_ct_addr_from_inet(&new_tuple.src.u3, &cp->daddr);
 		if (new_tuple.dst.protonum != IPPROTO_ICMP &&
 		    new_tuple.dst.protonum != IPPROTO_ICMPV6)
 			new_tuple.src.u.tcp.port = cp->dport;
 	} else {
-		new_tuple.dst.u3 = cp->vaddr;
+		nf_ct_addr_from_inet(&new_tuple.dst.u3, &cp->vaddr);
 		if (new_tuple.dst.protonum != IPPROTO_ICMP &&
 		    new_tuple.dst.protonum != IPPROTO_ICMPV6)
 			new_tuple.dst.u.tcp.port = cp->vport;
@@ -138,6 +138,7 @@ static void ip_vs_nfct_expect_callback(struct nf_conn *ct,
 	struct nf_conntrack_expect *exp)
 {
 	struct nf_conntrack_tuple *orig, new_reply;
+	union nf_inet_addr saddr, daddr;
 	struct ip_vs_conn *cp;
 	struct ip_vs_conn_param p;
 	struct net *net = nf_ct_net(ct);
@@ -155,9 +156,11 @@ static void ip_vs_nfct_expect_callback(struct nf_conn *ct,
 
 	/* RS->CLIENT */
 	orig = &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+	nf_ct_addr_to_inet(&saddr, &orig->src.u3);
+	nf_ct_addr_to_inet(&daddr, &orig->dst.u3);
 	ip_vs_conn_fill_param(net, exp->tuple.src.l3num, orig->dst.protonum,
-			      &orig->src.u3, orig->src.u.tcp.port,
-			      &orig->dst.u3, orig->dst.u.tcp.port, &p);
+			      &saddr, orig->src.u.tcp.port,
+			      &daddr, orig->dst.u.tcp.port, &p);
 	cp = ip_vs_conn_out_get(&p);
 	if (cp) {
 		/* Change reply CLIENT->RS to CLIENT->VS */
@@ -167,7 +170,7 @@ static void ip_vs_nfct_expect_callback(struct nf_conn *ct,
 			  __func__, ct, ct->status,
 			  ARG_TUPLE(orig), ARG_TUPLE(&new_reply),
 			  ARG_CONN(cp));
-		new_reply.dst.u3 = cp->vaddr;
+		nf_ct_addr_from_inet(&new_reply.dst.u3, &cp->vaddr);
 		new_reply.dst.u.tcp.port = cp->vport;
 		IP_VS_DBG(7, "%s: ct=%p, new tuples=" FMT_TUPLE ", " FMT_TUPLE
 			  ", inout cp=" FMT_CONN "\n",
@@ -187,7 +190,7 @@ static void ip_vs_nfct_expect_callback(struct nf_conn *ct,
 			  __func__, ct, ct->status,
 			  ARG_TUPLE(orig), ARG_TUPLE(&new_reply),
 			  ARG_CONN(cp));
-		new_reply.src.u3 = cp->daddr;
+		nf_ct_addr_from_inet(&new_reply.src.u3, &cp->daddr);
 		new_reply.src.u.tcp.port = cp->dport;
 		IP_VS_DBG(7, "%s: ct=%p, new tuples=" FMT_TUPLE ", "
 			  FMT_TUPLE ", outin cp=" FMT_CONN "\n",
@@ -220,6 +223,7 @@ void ip_vs_nfct_expect_related(struct sk_buff *skb, struct nf_conn *ct,
 			       struct ip_vs_conn *cp, u_int8_t proto,
 			       const __be16 port, int from_rs)
 {
+	union nf_conntrack_address saddr, daddr;
 	struct nf_conntrack_expect *exp;
 
 	if (ct == NULL || nf_ct_is_untracked(ct))
@@ -229,9 +233,10 @@ void ip_vs_nfct_expect_related(struct sk_buff *skb, struct nf_conn *ct,
 	if (!exp)
 		return;
 
+	nf_ct_addr_from_inet(&saddr, from_rs ? &cp->daddr : &cp->caddr);
+	nf_ct_addr_from_inet(&daddr, from_rs ? &cp->caddr : &cp->vaddr);
 	nf_ct_expect_init(exp, NF_CT_EXPECT_CLASS_DEFAULT, nf_ct_l3num(ct),
-			from_rs ? &cp->daddr : &cp->caddr,
-			from_rs ? &cp->caddr : &cp->vaddr,
+			&saddr, &daddr,
 			proto, port ? &port : NULL,
 			from_rs ? &cp->cport : &cp->vport);
 
@@ -258,10 +263,10 @@ void ip_vs_conn_drop_conntrack(struct ip_vs_conn *cp)
 
 	tuple = (struct nf_conntrack_tuple) {
 		.dst = { .protonum = cp->protocol, .dir = IP_CT_DIR_ORIGINAL } };
-	tuple.src.u3 = cp->caddr;
+	nf_ct_addr_from_inet(&tuple.src.u3, &cp->caddr);
 	tuple.src.u.all = cp->cport;
 	tuple.src.l3num = cp->af;
-	tuple.dst.u3 = cp->vaddr;
+	nf_ct_addr_from_inet(&tuple.dst.u3, &cp->vaddr);
 	tuple.dst.u.all = cp->vport;
 
 	IP_VS_DBG(7, "%s: dropping conntrack with tuple=" FMT_TUPLE
@@ -271,13 +276,10 @@ void ip_vs_conn_drop_conntrack(struct ip_vs_conn *cp)
 	h = nf_conntrack_find_get(ip_vs_conn_net(cp), &tuple);
 	if (h) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* Show what happens instead of calling nf_ct_kill() */
-		if (del_timer(&ct->timeout)) {
+		if (nf_ct_kill(ct)) {
 			IP_VS_DBG(7, "%s: ct=%p, deleted conntrack timer for tuple="
 				FMT_TUPLE "\n",
 				__func__, ct, ARG_TUPLE(&tuple));
-			if (ct->timeout.function)
-				ct->timeout.function(ct->timeout.data);
 		} else {
 			IP_VS_DBG(7, "%s: ct=%p, no conntrack timer for tuple="
 				FMT_TUPLE "\n",
@@ -19,6 +19,7 @@
 #include <net/netfilter/nf_conntrack.h>
 #include <net/netfilter/nf_conntrack_extend.h>
 #include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
 
 #include <net/fast_vpn.h>
 
@@ -45,6 +46,51 @@ static struct ctl_table acct_sysctl_table[] = {
 };
 #endif /* CONFIG_SYSCTL */
 
+#ifdef CONFIG_NF_CONNTRACK_ACCT_LOCKLESS
+/* Serializes rare folds of all conntracks, hot path never takes it */
+static DEFINE_SPINLOCK(nf_ct_acct_fold_lock);
+
+void __nf_ct_acct_fold(struct nf_conn_counter *counter)
+{
+	unsigned int packets, bytes;
+
+	spin_lock_bh(&nf_ct_acct_fold_lock);
+	write_seqcount_begin(&counter->seq);
+
+	packets = atomic_read(&counter->packets);
+	bytes = atomic_read(&counter->bytes);
+
+	counter->packets_base += packets;
+	counter->bytes_base += bytes;
+
+	atomic_sub(packets, &counter->packets);
+	atomic_sub(bytes, &counter->bytes);
+
+	write_seqcount_end(&counter->seq);
+	spin_unlock_bh(&nf_ct_acct_fold_lock);
+}
+EXPORT_SYMBOL_GPL(__nf_ct_acct_fold);
+
+void nf_ct_acct_read_and_zero(struct nf_conn_counter *counter,
+			      u64 *packets, u64 *bytes)
+{
+	spin_lock_bh(&nf_ct_acct_fold_lock);
+	write_seqcount_begin(&counter->seq);
+
+	*packets = counter->packets_base +
+		   (u32)atomic_xchg(&counter->packets, 0);
+	*bytes = counter->bytes_base +
+		 (u32)atomic_xchg(&counter->bytes, 0);
+
+	counter->packets_base = 0;
+	counter->bytes_base = 0;
+
+	write_seqcount_end(&counter->seq);
+	spin_unlock_bh(&nf_ct_acct_fold_lock);
+}
+EXPORT_SYMBOL_GPL(nf_ct_acct_read_and_zero);
+#endif /* CONFIG_NF_CONNTRACK_ACCT_LOCKLESS */
+
 unsigned int
 seq_print_acct(struct seq_file *s, const struct nf_conn *ct, int dir)
 {
@@ -55,11 +101,12 @@ seq_print_acct(struct seq_file *s, const struct nf_conn *ct, int dir)
 		return 0;
 
 	return seq_printf(s, "packets=%llu bytes=%llu ",
-			  (unsigned long long)atomic64_read(&acct[dir].packets),
-			  (unsigned long long)atomic64_read(&acct[dir].bytes));
+			  (unsigned long long)nf_ct_acct_packets(&acct[dir]),
+			  (unsigned long long)nf_ct_acct_bytes(&acct[dir]));
 };
 EXPORT_SYMBOL_GPL(seq_print_acct);
 
+/* Stays unused with CONFIG_NF_CONNTRACK_COMPACT, see nf_conn_acct_find() */
 static struct nf_ct_ext_type acct_extend __read_mostly = {
 	.len	= sizeof(struct nf_conn_counter[IP_CT_DIR_MAX]),
 	.align	= __alignof__(struct nf_conn_counter[IP_CT_DIR_MAX]),
@@ -142,9 +189,10 @@ static unsigned int do_ipv4_conntrack_acct(unsigned int hooknum,
 		acct = nf_conn_acct_find(ct);
 
 		if (likely(acct != NULL)) {
-			atomic64_inc(&acct[CTINFO2DIR(ctinfo)].packets);
-			atomic64_add(skb->len, &acct[CTINFO2DIR(ctinfo)].bytes);
+			nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb, skb->len);
 		}
+		nf_ct_touch(ct);
+		nf_ct_nacct_packet(ct, CTINFO2DIR(ctinfo), skb, skb->len);
 	}
 
 	return NF_ACCEPT;
@@ -179,9 +227,10 @@ static unsigned int do_ipv6_conntrack_acct(unsigned int hooknum,
 		acct = nf_conn_acct_find(ct);
 
 		if (likely(acct != NULL)) {
-			atomic64_inc(&acct[CTINFO2DIR(ctinfo)].packets);
-			atomic64_add(skb->len, &acct[CTINFO2DIR(ctinfo)].bytes);
+			nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb, skb->len);
 		}
+		nf_ct_touch(ct);
+		nf_ct_nacct_packet(ct, CTINFO2DIR(ctinfo), skb, skb->len);
 	}
 
 	return NF_ACCEPT;
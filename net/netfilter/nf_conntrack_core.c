@@ -41,9 +41,11 @@
 #include <net/netfilter/nf_conntrack_core.h>
 #include <net/netfilter/nf_conntrack_extend.h>
 #include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
 #include <net/netfilter/nf_conntrack_ecache.h>
 #include <net/netfilter/nf_conntrack_timestamp.h>
 #include <net/netfilter/nf_conntrack_timeout.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
 #include <net/netfilter/nf_nat.h>
 #include <net/netfilter/nf_nat_core.h>
 
@@ -53,6 +55,7 @@
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
 #include <net/ip.h>
+#include <net/ipv6.h>
 #include <net/tcp.h>
 #include <net/fast_vpn.h>
 #endif
@@ -67,9 +70,6 @@
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
 
-#define FAST_NAT_BIND_PKT_DIR_BOTH	2
-#define FAST_NAT_BIND_PKT_DIR_HALF	200
-
 /* Enable or Disable FastNAT */
 extern int ipv4_fastnat_conntrack;
 
@@ -87,6 +87,11 @@ extern void (*prebind_from_fastnat)(struct sk_buff * skb,
 	enum ip_conntrack_info ct_info);
 
 extern int (*fast_nat_bind_hook_ingress)(struct sk_buff * skb);
+
+/* Enable or Disable IPv6 fast forwarding */
+extern int ipv6_fastnat_conntrack;
+
+extern int (*fast_nat6_hit_hook_func)(struct sk_buff *skb);
 #endif
 
 #if defined(CONFIG_NTCE_MODULE)
@@ -94,8 +99,6 @@ extern unsigned int (*ntce_pass_pkt_func)(struct sk_buff *skb);
 extern void (*ntce_enq_pkt_hook_func)(struct sk_buff *skb);
 #endif /* defined(CONFIG_NTCE_MODULE) */
 
-extern void (*nacct_conntrack_free)(struct nf_conn *ct);
-
 int (*nfnetlink_parse_nat_setup_hook)(struct nf_conn *ct,
 				      enum nf_nat_manip_type manip,
 				      const struct nlattr *attr) __read_mostly;
@@ -104,6 +107,92 @@ EXPORT_SYMBOL_GPL(nfnetlink_parse_nat_setup_hook);
 DEFINE_SPINLOCK(nf_conntrack_lock);
 EXPORT_SYMBOL_GPL(nf_conntrack_lock);
 
+spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS] __cacheline_aligned_in_smp;
+EXPORT_SYMBOL_GPL(nf_conntrack_locks);
+
+/* Held by the resizer together with all bucket locks */
+static DEFINE_SPINLOCK(nf_conntrack_locks_all_lock);
+static bool nf_conntrack_locks_all;
+
+seqcount_t nf_conntrack_generation __read_mostly = SEQCNT_ZERO;
+EXPORT_SYMBOL_GPL(nf_conntrack_generation);
+
+/* Takes one bucket lock, BHs must be disabled by the caller */
+void nf_conntrack_bucket_lock(spinlock_t *lock) __acquires(lock)
+{
+	spin_lock(lock);
+	if (likely(!ACCESS_ONCE(nf_conntrack_locks_all))) {
+		/* Pairs with smp_mb() in nf_conntrack_all_unlock() */
+		smp_rmb();
+		return;
+	}
+
+	/* Resize in progress, queue up behind it */
+	spin_unlock(lock);
+	spin_lock(&nf_conntrack_locks_all_lock);
+	spin_lock(lock);
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_bucket_lock);
+
+static void nf_conntrack_double_unlock(unsigned int h1, unsigned int h2)
+{
+	h1 %= CONNTRACK_LOCKS;
+	h2 %= CONNTRACK_LOCKS;
+	spin_unlock(&nf_conntrack_locks[h1]);
+	if (h1 != h2)
+		spin_unlock(&nf_conntrack_locks[h2]);
+}
+
+/* Returns true if the table was resized since sequence was read,
+ * the locks are then released and the buckets must be recomputed. */
+static bool nf_conntrack_double_lock(unsigned int h1, unsigned int h2,
+				     unsigned int sequence)
+{
+	unsigned int l1 = h1 % CONNTRACK_LOCKS;
+	unsigned int l2 = h2 % CONNTRACK_LOCKS;
+
+	/* Always lock in ascending order, nf_conntrack_all_lock() does */
+	if (l1 <= l2) {
+		nf_conntrack_bucket_lock(&nf_conntrack_locks[l1]);
+		if (l1 != l2)
+			spin_lock_nested(&nf_conntrack_locks[l2],
+					 SINGLE_DEPTH_NESTING);
+	} else {
+		nf_conntrack_bucket_lock(&nf_conntrack_locks[l2]);
+		spin_lock_nested(&nf_conntrack_locks[l1],
+				 SINGLE_DEPTH_NESTING);
+	}
+
+	if (read_seqcount_retry(&nf_conntrack_generation, sequence)) {
+		nf_conntrack_double_unlock(h1, h2);
+		return true;
+	}
+
+	return false;
+}
+
+/* Waits for all bucket lock holders and keeps new ones out */
+static void nf_conntrack_all_lock(void)
+{
+	int i;
+
+	spin_lock(&nf_conntrack_locks_all_lock);
+	nf_conntrack_locks_all = true;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++) {
+		spin_lock(&nf_conntrack_locks[i]);
+		spin_unlock(&nf_conntrack_locks[i]);
+	}
+}
+
+static void nf_conntrack_all_unlock(void)
+{
+	smp_mb();
+	nf_conntrack_locks_all = false;
+	spin_unlock(&nf_conntrack_locks_all_lock);
+}
+
 DEFINE_PER_CPU(struct nf_conn, nf_conntrack_untracked);
 EXPORT_PER_CPU_SYMBOL(nf_conntrack_untracked);
 
@@ -252,17 +341,125 @@ static int kill_all(struct nf_conn *i, void *data)
 	return 1;
 }
 
+/* Both hash buckets of the conntrack must be locked */
 static void
 clean_from_lists(struct nf_conn *ct)
 {
 	pr_debug("clean_from_lists(%p)\n", ct);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
+}
 
-	/* Destroy all pending expectations */
+static void nf_ct_remove_expectations_locked(struct nf_conn *ct)
+{
+	/* Most connections never expect any others, skip the lock */
+	if (!nfct_help(ct))
+		return;
+
+	spin_lock_bh(&nf_conntrack_lock);
 	nf_ct_remove_expectations(ct);
+	spin_unlock_bh(&nf_conntrack_lock);
 }
 
+/* The original tuple links the conntrack into a per-CPU unconfirmed
+ * or dying list, ct->cpu records which one. */
+static void nf_ct_add_to_pcpu_list(struct nf_conn *ct, bool dying)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = raw_smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock_bh(&pcpu->lock);
+	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
+				 dying ? &pcpu->dying : &pcpu->unconfirmed);
+	spin_unlock_bh(&pcpu->lock);
+}
+
+static void nf_ct_del_from_pcpu_list(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock_bh(&pcpu->lock);
+	BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
+	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+	spin_unlock_bh(&pcpu->lock);
+}
+
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+static enum nf_ct_evict_class nf_ct_evict_class(const struct nf_conn *ct)
+{
+	if (!test_bit(IPS_SEEN_REPLY_BIT, &ct->status))
+		return NF_CT_EVICT_UNREPLIED;
+	if (nf_ct_protonum(ct) == IPPROTO_TCP &&
+	    ct->proto.tcp.state >= TCP_CONNTRACK_FIN_WAIT &&
+	    ct->proto.tcp.state <= TCP_CONNTRACK_CLOSE)
+		return NF_CT_EVICT_CLOSING;
+	if (!test_bit(IPS_ASSURED_BIT, &ct->status))
+		return NF_CT_EVICT_UNASSURED;
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	if (ct->fast_bind_reached && !ct->fast_ext)
+		return NF_CT_EVICT_FASTNAT;
+#endif
+	return NF_CT_EVICT_ASSURED;
+}
+
+/* Confirmed conntracks are queued on an eviction list of the
+ * confirming CPU, ct->cpu records which one.  Called with the hash
+ * buckets of the conntrack locked. */
+static void nf_ct_evict_add(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	ct->cpu = raw_smp_processor_id();
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	list_add_tail(&ct->evict_list, &pcpu->evict[nf_ct_evict_class(ct)]);
+	spin_unlock(&pcpu->lock);
+}
+
+static void nf_ct_evict_del(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists, ct->cpu);
+
+	spin_lock(&pcpu->lock);
+	list_del_init(&ct->evict_list);
+	spin_unlock(&pcpu->lock);
+}
+
+/* Called when a reply is first seen, when a protocol assures the
+ * conntrack and when a TCP connection enters or leaves the closing
+ * states.  Fast NAT binds are picked up lazily by early_drop(). */
+void nf_ct_evict_update(struct nf_conn *ct)
+{
+	struct ct_pcpu *pcpu;
+
+	pcpu = per_cpu_ptr(nf_ct_net(ct)->ct.pcpu_lists,
+			   ACCESS_ONCE(ct->cpu));
+
+	spin_lock_bh(&pcpu->lock);
+	/* Unlinked entries may since sit on another CPU's dying list */
+	if (!list_empty(&ct->evict_list))
+		list_move_tail(&ct->evict_list,
+			       &pcpu->evict[nf_ct_evict_class(ct)]);
+	spin_unlock_bh(&pcpu->lock);
+}
+EXPORT_SYMBOL_GPL(nf_ct_evict_update);
+#else
+static inline void nf_ct_evict_add(struct nf_conn *ct)
+{
+}
+
+static inline void nf_ct_evict_del(struct nf_conn *ct)
+{
+}
+#endif
+
 static void
 destroy_conntrack(struct nf_conntrack *nfct)
 {
@@ -272,7 +469,9 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
+#ifndef CONFIG_NF_CONNTRACK_GC
 	NF_CT_ASSERT(!timer_pending(&ct->timeout));
+#endif
 
 	/* To make sure we don't get any weird locking issues here:
 	 * destroy_conntrack() MUST NOT be called with a write lock
@@ -284,12 +483,11 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	rcu_read_unlock();
 
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Expectations will have been removed in clean_from_lists,
+	/* Expectations will have been removed in nf_ct_delete_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
 	 * too. */
-	nf_ct_remove_expectations(ct);
+	nf_ct_remove_expectations_locked(ct);
 
 #if IS_ENABLED(CONFIG_NETFILTER_XT_MATCH_LAYER7)
 	if(ct->layer7.app_proto)
@@ -299,13 +497,10 @@ destroy_conntrack(struct nf_conntrack *nfct)
 #endif
 
 	/* We overload first tuple to link into unconfirmed list. */
-	if (!nf_ct_is_confirmed(ct)) {
-		BUG_ON(hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode));
-		hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	}
+	if (!nf_ct_is_confirmed(ct))
+		nf_ct_del_from_pcpu_list(ct);
 
-	NF_CT_STAT_INC(net, delete);
-	spin_unlock_bh(&nf_conntrack_lock);
+	NF_CT_STAT_INC_ATOMIC(net, delete);
 
 	if (ct->master)
 		nf_ct_put(ct->master);
@@ -317,14 +512,29 @@ destroy_conntrack(struct nf_conntrack *nfct)
 void nf_ct_delete_from_lists(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
+	unsigned int hash, repl_hash, sequence;
 
 	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
+
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = hash_conntrack(net,
+				      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl_hash = hash_conntrack(net,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
+
+	/* BHs are disabled so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
 	NF_CT_STAT_INC(net, delete_list);
 	clean_from_lists(ct);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_evict_del(ct);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
+
+	/* Destroy all pending expectations */
+	nf_ct_remove_expectations_locked(ct);
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
 
@@ -345,9 +555,7 @@ static void death_by_event(unsigned long ul_conntrack)
 	}
 	/* we've got the event delivered, now it's dying */
 	set_bit(IPS_DYING_BIT, &ct->status);
-	spin_lock(&nf_conntrack_lock);
-	hlist_nulls_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	spin_unlock(&nf_conntrack_lock);
+	nf_ct_del_from_pcpu_list(ct);
 	nf_ct_put(ct);
 }
 
@@ -359,10 +567,7 @@ void nf_ct_insert_dying_list(struct nf_conn *ct)
 	BUG_ON(ecache == NULL);
 
 	/* add this conntrack to the dying list */
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-			     &net->ct.dying);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_add_to_pcpu_list(ct, true);
 	/* set a new timer to retry event delivery */
 	setup_timer(&ecache->timeout, death_by_event, (unsigned long)ct);
 	ecache->timeout.expires = jiffies +
@@ -392,6 +597,26 @@ void death_by_timeout(unsigned long ul_conntrack)
 	nf_ct_put(ct);
 }
 
+#ifdef CONFIG_NF_CONNTRACK_GC
+/* Tears down an expired conntrack met in the hash table */
+static void nf_ct_gc_expired(struct nf_conn *ct)
+{
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		return;
+
+	/* The object may have been reused meanwhile, check again */
+	if (nf_ct_is_confirmed(ct) && nf_ct_is_expired(ct) &&
+	    nf_ct_timeout_del(ct))
+		death_by_timeout((unsigned long)ct);
+
+	nf_ct_put(ct);
+}
+#else
+static inline void nf_ct_gc_expired(struct nf_conn *ct)
+{
+}
+#endif
+
 static inline bool
 nf_ct_key_equal(struct nf_conntrack_tuple_hash *h,
 			const struct nf_conntrack_tuple *tuple)
@@ -409,22 +634,30 @@ nf_ct_key_equal(struct nf_conntrack_tuple_hash *h,
  * - Caller must take a reference on returned object
  *   and recheck nf_ct_tuple_equal(tuple, &h->tuple)
  * OR
- * - Caller must lock nf_conntrack_lock before calling this function
+ * - Caller must hold the bucket lock before calling this function
  */
 static inline struct nf_conntrack_tuple_hash *
 ____nf_conntrack_find(struct net *net,
 		      const struct nf_conntrack_tuple *tuple, u32 hash)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = hash_bucket(hash, net);
+	unsigned int bucket, hsize;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	bucket = __hash_bucket(hash, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
+		if (nf_ct_is_expired(nf_ct_tuplehash_to_ctrack(h))) {
+			nf_ct_gc_expired(nf_ct_tuplehash_to_ctrack(h));
+			continue;
+		}
 		if (nf_ct_key_equal(h, tuple)) {
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
@@ -455,7 +688,7 @@ nf_ct_cone_tuple_equal(const struct nf_conntrack_tuple *t1,
 		return __nf_ct_tuple_dst_equal(t1, t2);
 	else if (nf_conntrack_nat_mode == NAT_MODE_RCONE)
 		return (__nf_ct_tuple_dst_equal(t1, t2) &&
-			nf_inet_addr_cmp(&t1->src.u3, &t2->src.u3)  &&
+			nf_ct_addr_cmp(&t1->src.u3, &t2->src.u3)  &&
 			t1->src.l3num == t2->src.l3num);
 	else
 		return false;
@@ -466,15 +699,19 @@ __nf_cone_conntrack_find(struct net *net,
 			 const struct nf_conntrack_tuple *tuple, u32 hash)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = hash_bucket(hash, net);
+	unsigned int bucket, hsize;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	bucket = __hash_bucket(hash, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
 		if (nf_ct_cone_tuple_equal(tuple, &h->tuple)) {
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
@@ -562,6 +799,7 @@ nf_conntrack_find_get(struct net *net,
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
+/* Both buckets must be locked */
 static void __nf_conntrack_hash_insert(struct nf_conn *ct,
 				       unsigned int hash,
 				       unsigned int repl_hash)
@@ -578,16 +816,18 @@ int
 nf_conntrack_hash_check_insert(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
 
-	hash = hash_conntrack(net,
-			      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(net,
-				   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		hash = hash_conntrack(net,
+				      &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		repl_hash = hash_conntrack(net,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
 
 	/* See if there's one in the list already, including reverse */
 	hlist_nulls_for_each_entry(h, n, &net->ct.hash[hash], hnnode)
@@ -599,17 +839,20 @@ nf_conntrack_hash_check_insert(struct nf_conn *ct)
 				      &h->tuple))
 			goto out;
 
-	add_timer(&ct->timeout);
+	nf_ct_timeout_start(ct, nf_ct_timeout_expires(ct));
 	nf_conntrack_get(&ct->ct_general);
+	nf_ct_evict_add(ct);
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	return 0;
 
 out:
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return -EEXIST;
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
@@ -618,7 +861,7 @@ EXPORT_SYMBOL_GPL(nf_conntrack_hash_check_insert);
 int
 __nf_conntrack_confirm(struct sk_buff *skb)
 {
-	unsigned int hash, repl_hash;
+	unsigned int hash, repl_hash, sequence;
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct nf_conn_help *help;
@@ -637,11 +880,15 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	if (CTINFO2DIR(ctinfo) != IP_CT_DIR_ORIGINAL)
 		return NF_ACCEPT;
 
-	/* reuse the hash saved before */
-	hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
-	hash = hash_bucket(hash, net);
-	repl_hash = hash_conntrack(net,
-				   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	local_bh_disable();
+	do {
+		sequence = read_seqcount_begin(&nf_conntrack_generation);
+		/* reuse the hash saved before */
+		hash = *(unsigned long *)&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev;
+		hash = hash_bucket(hash, net);
+		repl_hash = hash_conntrack(net,
+					   &ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (nf_conntrack_double_lock(hash, repl_hash, sequence));
 
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
@@ -653,15 +900,17 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	NF_CT_ASSERT(!nf_ct_is_confirmed(ct));
 	pr_debug("Confirming conntrack %p\n", ct);
 
-	spin_lock_bh(&nf_conntrack_lock);
-
-	/* We have to check the DYING flag inside the lock to prevent
-	   a race against nf_ct_get_next_corpse() possibly called from
-	   user context, else we insert an already 'dead' hash, blocking
-	   further use of that particular connection -JM */
+	/* Remove from unconfirmed list.  We have to check the DYING flag
+	   after unlink to prevent a race against nf_ct_get_next_corpse()
+	   possibly called from user context, else we insert an already
+	   'dead' hash, blocking further use of that particular
+	   connection -JM */
+	nf_ct_del_from_pcpu_list(ct);
 
 	if (unlikely(nf_ct_is_dying(ct))) {
-		spin_unlock_bh(&nf_conntrack_lock);
+		nf_ct_add_to_pcpu_list(ct, false);
+		nf_conntrack_double_unlock(hash, repl_hash);
+		local_bh_enable();
 		return NF_ACCEPT;
 	}
 
@@ -677,14 +926,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 				      &h->tuple))
 			goto out;
 
-	/* Remove from unconfirmed list */
-	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-
 	/* Timer relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	nf_ct_timeout_start(ct, nf_ct_timeout_expires(ct) + jiffies);
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -696,6 +941,7 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
+	nf_ct_evict_add(ct);
 	/* Since the lookup is lockless, hash insertion must be done after
 	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
@@ -703,7 +949,8 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	 */
 	__nf_conntrack_hash_insert(ct, hash, repl_hash);
 	NF_CT_STAT_INC(net, insert);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	help = nfct_help(ct);
 	if (help && help->helper)
@@ -714,8 +961,11 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	return NF_ACCEPT;
 
 out:
+	/* Lost the race, destroy_conntrack() unlinks us again */
+	nf_ct_add_to_pcpu_list(ct, false);
 	NF_CT_STAT_INC(net, insert_failed);
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_conntrack_double_unlock(hash, repl_hash);
+	local_bh_enable();
 	return NF_DROP;
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_confirm);
@@ -728,16 +978,21 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 {
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
 	struct nf_conn *ct;
-	unsigned int hash = hash_conntrack(net, tuple);
+	u32 raw_hash = hash_conntrack_raw(tuple);
+	unsigned int hash, hsize;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	hash = __hash_bucket(raw_hash, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[hash], hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (ct != ignored_conntrack &&
 		    nf_ct_tuple_equal(tuple, &h->tuple)) {
@@ -759,6 +1014,91 @@ begin:
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 
+/* Kill a referenced eviction victim, drops the reference */
+static int early_drop_kill(struct net *net, struct nf_conn *ct)
+{
+	int dropped = 0;
+
+	if (nf_ct_timeout_del(ct)) {
+		death_by_timeout((unsigned long)ct);
+		/* Check if we indeed killed this entry. Reliable event
+		   delivery may have inserted it into the dying list. */
+		if (test_bit(IPS_DYING_BIT, &ct->status)) {
+			dropped = 1;
+			NF_CT_STAT_INC_ATOMIC(net, early_drop);
+		}
+	}
+	nf_ct_put(ct);
+	return dropped;
+}
+
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+
+#define NF_CT_EVICTION_BUDGET	64
+
+/* Take a reference to the oldest entry of the cheapest evictable
+ * class.  Entries which moved to a dearer class without a call to
+ * nf_ct_evict_update(), i.e. fast NAT binds, are requeued on the
+ * right list as we walk over them.  Assured and fast NAT bound entries
+ * are taken last and only once timed out; live ones are rotated to
+ * the tail so the next run looks further. */
+static struct nf_conn *early_drop_pick(struct net *net, unsigned int *budget)
+{
+	enum nf_ct_evict_class class, now;
+	struct nf_conn *ct, *tmp;
+	struct ct_pcpu *pcpu;
+	int cpu;
+
+	for (class = 0; class < NF_CT_EVICT_MAX; class++) {
+		for_each_possible_cpu(cpu) {
+			pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+			spin_lock_bh(&pcpu->lock);
+			list_for_each_entry_safe(ct, tmp, &pcpu->evict[class],
+						 evict_list) {
+				if (*budget == 0) {
+					spin_unlock_bh(&pcpu->lock);
+					return NULL;
+				}
+				(*budget)--;
+
+				now = nf_ct_evict_class(ct);
+				if ((now > class ||
+				     now >= NF_CT_EVICT_PROTECTED) &&
+				    !nf_ct_is_expired(ct)) {
+					list_move_tail(&ct->evict_list,
+						       &pcpu->evict[now]);
+					continue;
+				}
+				if (nf_ct_is_dying(ct) ||
+				    !atomic_inc_not_zero(&ct->ct_general.use))
+					continue;
+
+				spin_unlock_bh(&pcpu->lock);
+				return ct;
+			}
+			spin_unlock_bh(&pcpu->lock);
+		}
+	}
+	return NULL;
+}
+
+/* Reclaim from the cheapest class first, whichever bucket the new
+   connection hashes to. */
+static noinline int early_drop(struct net *net, unsigned int hash)
+{
+	unsigned int budget = NF_CT_EVICTION_BUDGET;
+	struct nf_conn *ct;
+
+	while ((ct = early_drop_pick(net, &budget)) != NULL) {
+		if (early_drop_kill(net, ct))
+			return 1;
+	}
+	return 0;
+}
+
+#else
+
 #define NF_CT_EVICTION_RANGE	8
 
 /* There's a small race here where we may free a just-assured
@@ -768,16 +1108,20 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 	/* Use oldest entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
-	unsigned int i, cnt = 0;
-	int dropped = 0;
+	unsigned int i, hsize, cnt = 0;
 
 	rcu_read_lock();
-	for (i = 0; i < net->ct.htable_size; i++) {
-		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	hash = __hash_bucket(hash, hsize);
+
+	for (i = 0; i < hsize; i++) {
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
-			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
+			if (!test_bit(IPS_ASSURED_BIT, &tmp->status) ||
+			    nf_ct_is_expired(tmp))
 				ct = tmp;
 			cnt++;
 		}
@@ -793,25 +1137,16 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 		if (cnt >= NF_CT_EVICTION_RANGE)
 			break;
 
-		hash = (hash + 1) % net->ct.htable_size;
+		hash = (hash + 1) % hsize;
 	}
 	rcu_read_unlock();
 
 	if (!ct)
-		return dropped;
+		return 0;
 
-	if (del_timer(&ct->timeout)) {
-		death_by_timeout((unsigned long)ct);
-		/* Check if we indeed killed this entry. Reliable event
-		   delivery may have inserted it into the dying list. */
-		if (test_bit(IPS_DYING_BIT, &ct->status)) {
-			dropped = 1;
-			NF_CT_STAT_INC_ATOMIC(net, early_drop);
-		}
-	}
-	nf_ct_put(ct);
-	return dropped;
+	return early_drop_kill(net, ct);
 }
+#endif
 
 void init_nf_conntrack_hash_rnd(void)
 {
@@ -847,7 +1182,7 @@ __nf_conntrack_alloc(struct net *net,
 
 	if (nf_conntrack_max &&
 	    unlikely(atomic_read(&net->ct.count) > nf_conntrack_max)) {
-		if (!early_drop(net, hash_bucket(hash, net))) {
+		if (!early_drop(net, hash)) {
 			atomic_dec(&net->ct.count);
 			net_warn_ratelimited("nf_conntrack: table full (%u), dropping packet\n",
 				nf_conntrack_max);
@@ -872,13 +1207,22 @@ __nf_conntrack_alloc(struct net *net,
 	       offsetof(struct nf_conn, proto) -
 	       offsetof(struct nf_conn, tuplehash[IP_CT_DIR_MAX]));
 	spin_lock_init(&ct->lock);
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+	INIT_LIST_HEAD(&ct->evict_list);
+#endif
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	/* New entries count as changed */
+	ct->dump_gen = atomic_read(&net->ct.dump_gen);
+#endif
 	ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple = *orig;
 	ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode.pprev = NULL;
 	ct->tuplehash[IP_CT_DIR_REPLY].tuple = *repl;
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
+#ifndef CONFIG_NF_CONNTRACK_GC
 	/* Don't set timer yet: wait for confirmation */
 	setup_timer(&ct->timeout, death_by_timeout, (unsigned long)ct);
+#endif
 	write_pnet(&ct->ct_net, net);
 	/*
 	 * changes to lookup keys must be done before setting refcnt to 1
@@ -905,6 +1249,12 @@ void nf_conntrack_free(struct nf_conn *ct)
 	rcu_read_lock();
 
 	if ((nacct_conntrack_free_hook = rcu_dereference(nacct_conntrack_free))) {
+		struct nf_conn_counter *acct = nf_conn_acct_find(ct);
+
+		/* Hand over final totals in the 64-bit counters */
+		if (acct != NULL)
+			nf_ct_acct_fold(acct);
+
 		nacct_conntrack_free_hook(ct);
 	}
 
@@ -962,45 +1312,51 @@ init_conntrack(struct net *net, struct nf_conn *tmpl,
 
 	nf_ct_acct_ext_add(ct, GFP_ATOMIC);
 	nf_ct_tstamp_ext_add(ct, GFP_ATOMIC);
+	nf_ct_fastnat_ext_add(ct, GFP_ATOMIC);
 
 	ecache = tmpl ? nf_ct_ecache_find(tmpl) : NULL;
 	nf_ct_ecache_ext_add(ct, ecache ? ecache->ctmask : 0,
 				 ecache ? ecache->expmask : 0,
 			     GFP_ATOMIC);
 
-	spin_lock_bh(&nf_conntrack_lock);
-	exp = nf_ct_find_expectation(net, tuple);
-	if (exp) {
-		pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
-			 ct, exp);
-		/* Welcome, Mr. Bond.  We've been expecting you... */
-		__set_bit(IPS_EXPECTED_BIT, &ct->status);
-		ct->master = exp->master;
-		if (exp->helper) {
-			help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
-			if (help)
-				rcu_assign_pointer(help->helper, exp->helper);
-		}
+	/* Expectations are rare, do not take the lock without them */
+	exp = NULL;
+	if (net->ct.expect_count) {
+		spin_lock_bh(&nf_conntrack_lock);
+		exp = nf_ct_find_expectation(net, tuple);
+		if (exp) {
+			pr_debug("conntrack: expectation arrives ct=%p exp=%p\n",
+				 ct, exp);
+			/* Welcome, Mr. Bond.  We've been expecting you... */
+			__set_bit(IPS_EXPECTED_BIT, &ct->status);
+			ct->master = exp->master;
+			if (exp->helper) {
+				help = nf_ct_helper_ext_add(ct, GFP_ATOMIC);
+				if (help)
+					rcu_assign_pointer(help->helper,
+							   exp->helper);
+			}
 
 #ifdef CONFIG_NF_CONNTRACK_MARK
-		ct->mark = exp->master->mark;
-		ct->ndm_mark = exp->master->ndm_mark;
+			ct->mark = exp->master->mark;
+			ct->ndm_mark = exp->master->ndm_mark;
 #endif
 #ifdef CONFIG_NF_CONNTRACK_SECMARK
-		ct->secmark = exp->master->secmark;
+			ct->secmark = exp->master->secmark;
 #endif
-		nf_conntrack_get(&ct->master->ct_general);
-		NF_CT_STAT_INC(net, expect_new);
-	} else {
+			nf_conntrack_get(&ct->master->ct_general);
+			NF_CT_STAT_INC(net, expect_new);
+		}
+		spin_unlock_bh(&nf_conntrack_lock);
+	}
+
+	if (!exp) {
 		__nf_ct_try_assign_helper(ct, tmpl, GFP_ATOMIC);
-		NF_CT_STAT_INC(net, new);
+		NF_CT_STAT_INC_ATOMIC(net, new);
 	}
 
 	/* Overload tuple linked list to put us in unconfirmed list. */
-	hlist_nulls_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
-		       &net->ct.unconfirmed);
-
-	spin_unlock_bh(&nf_conntrack_lock);
+	nf_ct_add_to_pcpu_list(ct, false);
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1228,21 +1584,28 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 	NF_CT_ASSERT(skb->nfct);
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
-	if (!ct->fast_bind_reached) {
+	if (!ct->fast_bind_reached && !ct->fast_ext) {
 		struct nf_conn_counter *ctrs = nf_conn_acct_find(ct);
+		const struct nf_ct_fastnat_rule *rule;
+
+		rule = nf_ct_fastnat_policy_lookup(ct, protonum);
 
-		if (likely(ctrs != NULL)) {
+		if (rule == NULL) {
+			/* Not a bindable protocol */
+		} else if (rule->action == NF_CT_FASTNAT_BIND) {
+			ct->fast_bind_reached = 1;
+		} else if (rule->action == NF_CT_FASTNAT_NEVER) {
+			ct->fast_ext = 1;
+		} else if (likely(ctrs != NULL)) {
 			uint64_t pkt_o, pkt_r;
 
-			pkt_r = atomic64_read(&ctrs[IP_CT_DIR_REPLY].packets);
-			pkt_o = atomic64_read(&ctrs[IP_CT_DIR_ORIGINAL].packets);
+			pkt_r = nf_ct_acct_packets(&ctrs[IP_CT_DIR_REPLY]);
+			pkt_o = nf_ct_acct_packets(&ctrs[IP_CT_DIR_ORIGINAL]);
 
-			if (pkt_o > FAST_NAT_BIND_PKT_DIR_BOTH &&
-			    pkt_r > FAST_NAT_BIND_PKT_DIR_BOTH)
+			if (pkt_o > rule->both && pkt_r > rule->both)
 				ct->fast_bind_reached = 1;
-			else if (protonum == IPPROTO_UDP &&
-				 (pkt_o > FAST_NAT_BIND_PKT_DIR_HALF ||
-				  pkt_r > FAST_NAT_BIND_PKT_DIR_HALF))
+			else if (rule->half != 0 &&
+				 (pkt_o > rule->half || pkt_r > rule->half))
 				ct->fast_bind_reached = 1;
 		}
 	}
@@ -1276,6 +1639,17 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 	}
 
 #if IS_ENABLED(CONFIG_FAST_NAT)
+	if ((hooknum == NF_INET_PRE_ROUTING) &&
+	    (ctinfo == IP_CT_ESTABLISHED || ctinfo == IP_CT_ESTABLISHED_REPLY) &&
+	    (protonum == IPPROTO_UDP || protonum == IPPROTO_TCP)) {
+		if (ct->fast_ext)
+			NF_CT_FASTNAT_FALLBACK(skb, BIND_EXT);
+		else if (!ct->fast_bind_reached)
+			NF_CT_FASTNAT_FALLBACK(skb, BIND_THRESHOLD);
+		else if (SWNAT_KA_CHECK_MARK(skb))
+			NF_CT_FASTNAT_FALLBACK(skb, BIND_KEEPALIVE);
+	}
+
 	if ((hooknum == NF_INET_PRE_ROUTING) &&
 	    (ctinfo == IP_CT_ESTABLISHED || ctinfo == IP_CT_ESTABLISHED_REPLY) &&
 	    (pf == PF_INET) &&
@@ -1301,6 +1675,7 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 				const struct iphdr *iph;
 				unsigned char _l4hdr[4];
 				__be32 orig_src, new_src;
+				__be32 orig_dst, new_dst;
 				__be16 orig_port = 0;
 #ifdef CONFIG_NF_CONNTRACK_MARK
 				u32 oldmark = skb->mark;
@@ -1308,6 +1683,7 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 
 				iph = ip_hdr(skb);
 				orig_src = iph->saddr;
+				orig_dst = iph->daddr;
 
 				if (protonum == IPPROTO_TCP) {
 					const struct tcphdr *tcph;
@@ -1342,12 +1718,17 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 					skb->ndm_mark = ct->ndm_mark;
 #endif
 				ret = fast_nat_bind_hook(ct, ctinfo, skb, l3proto, l4proto);
+				if (ret == NF_FAST_NAT) {
+					NF_CT_FASTNAT_STAT_INC(BIND);
+					trace_fastnat_bind(skb, ct);
+				}
 
 				iph = ip_hdr(skb);
 				new_src = iph->saddr;
+				new_dst = iph->daddr;
 
-				/* Get rid of junky binds, do swnat only when src IP changed */
-				if (orig_src != new_src
+				/* Get rid of junky binds, do swnat only when IP changed */
+				if ((orig_src != new_src || orig_dst != new_dst)
 #if defined(CONFIG_NTCE_MODULE)
 					&& !ntce_skip_swnat
 #endif
@@ -1361,6 +1742,7 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 				if (ret == NF_FAST_NAT && orig_src != new_src) {
 					typeof(fast_nat_bind_hook_ingress) fn_bind_ingress;
 					ntc_shaper_hook_fn *ntc_ingress;
+					uint32_t disable_hwacc = NTC_HWACC_ALLOW;
 
 					/* from fast_nat.c */
 					fn_bind_ingress = rcu_dereference(fast_nat_bind_hook_ingress);
@@ -1370,16 +1752,24 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 					if (fn_bind_ingress && ntc_ingress) {
 						/* Fast NAT should not be unloaded in realtime now */
 						unsigned int ntc_retval = ntc_ingress(skb,
-							ntohl(orig_src), 0, NULL, fn_bind_ingress, NULL, NULL);
+							ntohl(orig_src), 0, &disable_hwacc,
+							fn_bind_ingress, NULL, NULL);
 
 						if (ntc_retval == NF_ACCEPT) {
 							/* Shaper skipped that packet */
 							ret = NF_FAST_NAT;
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+							/* Shaper limits the flow in software */
+							if (disable_hwacc == NTC_HWACC_DISABLE)
+								FOE_ALG_MARK(skb);
+#endif
 						} else if (ntc_retval == NF_DROP) {
 							/* Shaper tell us to drop it */
+							NF_CT_FASTNAT_STAT_INC(INGRESS_DROP);
 							ret = NF_DROP;
 						} else if (ntc_retval == NF_STOLEN) {
 							/* Shaper queued packet and will handle it's destiny */
+							NF_CT_FASTNAT_STAT_INC(INGRESS_STOLEN);
 							ret = NF_STOLEN;
 						}
 					}
@@ -1390,10 +1780,49 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 					skb->mark = oldmark;
 				}
 #endif
+			} else {
+				NF_CT_FASTNAT_FALLBACK(skb, BIND_NO_NAT);
 			}
 		}
 		rcu_read_unlock();
 	}
+
+#if IS_ENABLED(CONFIG_IPV6)
+	/* IPv6 flows are not NATed, fast path only skips the rest
+	 * of netfilter hooks and ip6_forward(). */
+	if ((hooknum == NF_INET_PRE_ROUTING) &&
+	    (ctinfo == IP_CT_ESTABLISHED || ctinfo == IP_CT_ESTABLISHED_REPLY) &&
+	    (pf == PF_INET6) &&
+	    (protonum == IPPROTO_UDP || protonum == IPPROTO_TCP) &&
+	    ipv6_hdr(skb)->nexthdr == protonum &&
+	    !ct->fast_ext &&
+	     ct->fast_bind_reached &&
+	    ipv6_fastnat_conntrack &&
+	    !SWNAT_KA_CHECK_MARK(skb) &&
+	    rcu_access_pointer(fast_nat6_hit_hook_func) != NULL) {
+#if defined(CONFIG_NTCE_MODULE)
+		typeof(ntce_pass_pkt_func) ntce_pass_pkt;
+		typeof(ntce_enq_pkt_hook_func) ntce_enq_pkt_hook;
+
+		rcu_read_lock();
+		if ((ntce_pass_pkt = rcu_dereference(ntce_pass_pkt_func)) &&
+		    (ntce_enq_pkt_hook = rcu_dereference(ntce_enq_pkt_hook_func))) {
+			if (ntce_pass_pkt(skb))
+				ntce_enq_pkt_hook(skb);
+		}
+		rcu_read_unlock();
+#endif
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+		if (ct->mark != 0)
+			skb->mark = ct->mark;
+
+		if (ct->ndm_mark != 0)
+			skb->ndm_mark = ct->ndm_mark;
+#endif
+		ret = NF_FAST_NAT;
+	}
+#endif
 #endif
 
 	if (set_reply && !test_and_set_bit(IPS_SEEN_REPLY_BIT, &ct->status)) {
@@ -1402,6 +1831,7 @@ nf_conntrack_in(struct net *net, u_int8_t pf, unsigned int hooknum,
 			ct->fast_ext = 1;
 #endif
 		nf_conntrack_event_cache(IPCT_REPLY, ct);
+		nf_ct_evict_update(ct);
 	}
 out:
 	if (tmpl) {
@@ -1463,7 +1893,9 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
+#ifndef CONFIG_NF_CONNTRACK_GC
 	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
+#endif
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
@@ -1472,15 +1904,20 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 
 	/* If not in hash table, timer will not be active yet */
 	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
+		nf_ct_timeout_expires(ct) = extra_jiffies;
 	} else {
 		unsigned long newtime = jiffies + extra_jiffies;
 
 		/* Only update the timeout if the new timeout is at least
 		   HZ jiffies from the old timeout. Need del_timer for race
 		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
+		if (newtime - nf_ct_timeout_expires(ct) >= HZ)
+#ifdef CONFIG_NF_CONNTRACK_GC
+			/* Plain store, the GC worker checks it */
+			ct->timeout = newtime;
+#else
 			mod_timer_pending(&ct->timeout, newtime);
+#endif
 	}
 
 acct:
@@ -1495,13 +1932,14 @@ acct:
 		return;
 	}
 
+	nf_ct_touch(ct);
+
 	if (do_acct) {
 		struct nf_conn_counter *acct;
 
 		acct = nf_conn_acct_find(ct);
 		if (acct) {
-			atomic64_inc(&acct[CTINFO2DIR(ctinfo)].packets);
-			atomic64_add(skb->len, &acct[CTINFO2DIR(ctinfo)].bytes);
+			nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb, skb->len);
 		}
 	}
 }
@@ -1517,14 +1955,13 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 
 		acct = nf_conn_acct_find(ct);
 		if (acct) {
-			atomic64_inc(&acct[CTINFO2DIR(ctinfo)].packets);
-			atomic64_add(skb->len - skb_network_offset(skb),
-				     &acct[CTINFO2DIR(ctinfo)].bytes);
+			nf_ct_acct_skb(&acct[CTINFO2DIR(ctinfo)], skb,
+				       skb->len - skb_network_offset(skb));
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->timeout.function((unsigned long)ct);
+	if (nf_ct_timeout_del(ct)) {
+		death_by_timeout((unsigned long)ct);
 		return true;
 	}
 	return false;
@@ -1606,25 +2043,42 @@ get_next_corpse(struct net *net, int (*iter)(struct nf_conn *i, void *data),
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	spinlock_t *lockp;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
 	for (; *bucket < net->ct.htable_size; (*bucket)++) {
-		hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket], hnnode) {
+		lockp = &nf_conntrack_locks[*bucket % CONNTRACK_LOCKS];
+		local_bh_disable();
+		nf_conntrack_bucket_lock(lockp);
+		/* The table may have shrunk while we were waiting */
+		if (*bucket < net->ct.htable_size) {
+			hlist_nulls_for_each_entry(h, n, &net->ct.hash[*bucket],
+						   hnnode) {
+				ct = nf_ct_tuplehash_to_ctrack(h);
+				if (iter(ct, data))
+					goto found;
+			}
+		}
+		spin_unlock(lockp);
+		local_bh_enable();
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->unconfirmed, hnnode) {
 			ct = nf_ct_tuplehash_to_ctrack(h);
 			if (iter(ct, data))
-				goto found;
+				set_bit(IPS_DYING_BIT, &ct->status);
 		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	hlist_nulls_for_each_entry(h, n, &net->ct.unconfirmed, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		if (iter(ct, data))
-			set_bit(IPS_DYING_BIT, &ct->status);
-	}
-	spin_unlock_bh(&nf_conntrack_lock);
 	return NULL;
 found:
 	atomic_inc(&ct->ct_general.use);
-	spin_unlock_bh(&nf_conntrack_lock);
+	spin_unlock(lockp);
+	local_bh_enable();
 	return ct;
 }
 
@@ -1640,7 +2094,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
+		if (nf_ct_timeout_del(ct))
 			death_by_timeout((unsigned long)ct);
 		/* ... else the timer will get him soon. */
 
@@ -1700,19 +2154,118 @@ void nf_conntrack_flush_report(struct net *net, u32 pid, int report)
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_flush_report);
 
+#ifdef CONFIG_NF_CONNTRACK_GC
+/* Buckets scanned per run, as a fraction of the table */
+#define GC_BUCKETS_DIV		16u
+#define GC_MAX_BUCKETS		4096u
+/* A run stops after this many evictions */
+#define GC_MAX_EVICTS		256u
+#define GC_INTERVAL_MIN		(HZ / 50)
+#define GC_INTERVAL_MAX		(2 * HZ)
+/* Percentage of expired entries which makes the next run immediate */
+#define GC_EVICT_RATIO		50u
+
+/* Reaps expired conntracks from a window of buckets, then picks the
+ * next run time from the share of expired entries it has seen. */
+static void nf_conntrack_gc_worker(struct work_struct *work)
+{
+	struct net *net = container_of(to_delayed_work(work), struct net,
+				       ct.gc_work);
+	unsigned int i, hsize, goal, buckets = 0;
+	unsigned int scanned = 0, expired = 0;
+	unsigned long next_run;
+
+	i = net->ct.gc_bucket;
+	goal = clamp(ACCESS_ONCE(net->ct.htable_size) / GC_BUCKETS_DIV,
+		     1u, GC_MAX_BUCKETS);
+
+	do {
+		struct nf_conntrack_tuple_hash *h;
+		struct hlist_nulls_head *ct_hash;
+		struct hlist_nulls_node *n;
+		struct nf_conn *ct;
+
+		rcu_read_lock();
+		nf_conntrack_get_ht(net, &ct_hash, &hsize);
+		if (i >= hsize)
+			i = 0;
+
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[i], hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			scanned++;
+			if (nf_ct_is_expired(ct)) {
+				nf_ct_gc_expired(ct);
+				expired++;
+			}
+		}
+		rcu_read_unlock();
+
+		i++;
+		cond_resched();
+	} while (++buckets < goal && expired < GC_MAX_EVICTS);
+
+	net->ct.gc_bucket = i;
+
+	if (expired >= GC_MAX_EVICTS ||
+	    (scanned && expired * 100 >= scanned * GC_EVICT_RATIO)) {
+		/* Mostly garbage, keep going */
+		net->ct.gc_interval = GC_INTERVAL_MIN;
+		next_run = 0;
+	} else if (expired) {
+		net->ct.gc_interval = max_t(unsigned long,
+					    net->ct.gc_interval / 2,
+					    GC_INTERVAL_MIN);
+		next_run = net->ct.gc_interval;
+	} else {
+		net->ct.gc_interval = min_t(unsigned long,
+					    net->ct.gc_interval * 2,
+					    GC_INTERVAL_MAX);
+		next_run = net->ct.gc_interval;
+	}
+
+	schedule_delayed_work(&net->ct.gc_work, next_run);
+}
+
+static void nf_conntrack_gc_init(struct net *net)
+{
+	INIT_DELAYED_WORK(&net->ct.gc_work, nf_conntrack_gc_worker);
+	net->ct.gc_bucket = 0;
+	net->ct.gc_interval = GC_INTERVAL_MAX;
+	schedule_delayed_work(&net->ct.gc_work, GC_INTERVAL_MAX);
+}
+
+static void nf_conntrack_gc_fini(struct net *net)
+{
+	cancel_delayed_work_sync(&net->ct.gc_work);
+}
+#else
+static inline void nf_conntrack_gc_init(struct net *net)
+{
+}
+
+static inline void nf_conntrack_gc_fini(struct net *net)
+{
+}
+#endif /* CONFIG_NF_CONNTRACK_GC */
+
 static void nf_ct_release_dying_list(struct net *net)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	int cpu;
 
-	spin_lock_bh(&nf_conntrack_lock);
-	hlist_nulls_for_each_entry(h, n, &net->ct.dying, hnnode) {
-		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* never fails to remove them, no listeners at this point */
-		nf_ct_kill(ct);
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, &pcpu->dying, hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			/* never fails to remove them, no listeners at this point */
+			nf_ct_kill(ct);
+		}
+		spin_unlock_bh(&pcpu->lock);
 	}
-	spin_unlock_bh(&nf_conntrack_lock);
 }
 
 static int untrack_refs(void)
@@ -1738,6 +2291,7 @@ static void nf_conntrack_cleanup_init_net(void)
 
 static void nf_conntrack_cleanup_net(struct net *net)
 {
+	nf_conntrack_gc_fini(net);
  i_see_dead_people:
 	nf_ct_iterate_cleanup(net, kill_all, NULL);
 	nf_ct_release_dying_list(net);
@@ -1747,6 +2301,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	}
 
 	nf_ct_free_hashtable(net->ct.hash, net->ct.htable_size);
+	nf_conntrack_fastnat_fini(net);
 	nf_conntrack_timeout_fini(net);
 	nf_conntrack_ecache_fini(net);
 	nf_conntrack_tstamp_fini(net);
@@ -1755,6 +2310,7 @@ static void nf_conntrack_cleanup_net(struct net *net)
 	kmem_cache_destroy(net->ct.nf_conntrack_cachep);
 	kfree(net->ct.slabname);
 	free_percpu(net->ct.stat);
+	free_percpu(net->ct.pcpu_lists);
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1801,22 +2357,17 @@ void *nf_ct_alloc_hashtable(unsigned int *sizep, int nulls)
 }
 EXPORT_SYMBOL_GPL(nf_ct_alloc_hashtable);
 
-int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+/* Moves every conntrack of init_net into a new table of hashsize
+ * buckets.  Lookups stay lockless: they snapshot the table under
+ * nf_conntrack_generation and restart when an entry moved under them.
+ * Writers are held off by the bucket locks for the duration. */
+int nf_conntrack_hash_resize(unsigned int hashsize)
 {
 	int i, bucket;
-	unsigned int hashsize, old_size;
+	unsigned int old_size;
 	struct hlist_nulls_head *hash, *old_hash;
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct;
 
-	if (current->nsproxy->net_ns != &init_net)
-		return -EOPNOTSUPP;
-
-	/* On boot, we can set this without any fancy locking. */
-	if (!nf_conntrack_htable_size)
-		return param_set_uint(val, kp);
-
-	hashsize = simple_strtoul(val, NULL, 0);
 	if (!hashsize)
 		return -EINVAL;
 
@@ -1824,17 +2375,19 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	if (!hash)
 		return -ENOMEM;
 
+	local_bh_disable();
+	nf_conntrack_all_lock();
+	write_seqcount_begin(&nf_conntrack_generation);
+
 	/* Lookups in the old hash might happen in parallel, which means we
 	 * might get false negatives during connection lookup. New connections
 	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the lock.
+	 * though since that required taking the bucket locks.
 	 */
-	spin_lock_bh(&nf_conntrack_lock);
 	for (i = 0; i < init_net.ct.htable_size; i++) {
 		while (!hlist_nulls_empty(&init_net.ct.hash[i])) {
 			h = hlist_nulls_entry(init_net.ct.hash[i].first,
 					struct nf_conntrack_tuple_hash, hnnode);
-			ct = nf_ct_tuplehash_to_ctrack(h);
 			hlist_nulls_del_rcu(&h->hnnode);
 			bucket = __hash_conntrack(&h->tuple, hashsize);
 			hlist_nulls_add_head_rcu(&h->hnnode, &hash[bucket]);
@@ -1845,11 +2398,29 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 
 	init_net.ct.htable_size = nf_conntrack_htable_size = hashsize;
 	init_net.ct.hash = hash;
-	spin_unlock_bh(&nf_conntrack_lock);
 
+	write_seqcount_end(&nf_conntrack_generation);
+	nf_conntrack_all_unlock();
+	local_bh_enable();
+
+	/* Readers may still walk the old table */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
 }
+EXPORT_SYMBOL_GPL(nf_conntrack_hash_resize);
+
+int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
+{
+	if (current->nsproxy->net_ns != &init_net)
+		return -EOPNOTSUPP;
+
+	/* On boot, we can set this without any fancy locking. */
+	if (!nf_conntrack_htable_size)
+		return param_set_uint(val, kp);
+
+	return nf_conntrack_hash_resize(simple_strtoul(val, NULL, 0));
+}
 EXPORT_SYMBOL_GPL(nf_conntrack_set_hashsize);
 
 module_param_call(hashsize, nf_conntrack_set_hashsize, param_get_uint,
@@ -1867,7 +2438,10 @@ EXPORT_SYMBOL_GPL(nf_ct_untracked_status_or);
 static int nf_conntrack_init_init_net(void)
 {
 	int max_factor = 4;
-	int ret, cpu;
+	int ret, cpu, i;
+
+	for (i = 0; i < CONNTRACK_LOCKS; i++)
+		spin_lock_init(&nf_conntrack_locks[i]);
 
 #if 0
 	/* Idea from tcp.c: use 1/16384 of memory.  On i386: 32MB
@@ -1944,11 +2518,34 @@ err_proto:
 
 static int nf_conntrack_init_net(struct net *net)
 {
-	int ret;
+	int ret, cpu;
 
 	atomic_set(&net->ct.count, 0);
-	INIT_HLIST_NULLS_HEAD(&net->ct.unconfirmed, UNCONFIRMED_NULLS_VAL);
-	INIT_HLIST_NULLS_HEAD(&net->ct.dying, DYING_NULLS_VAL);
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	atomic_set(&net->ct.dump_gen, 1);
+#endif
+
+	net->ct.pcpu_lists = alloc_percpu(struct ct_pcpu);
+	if (!net->ct.pcpu_lists) {
+		ret = -ENOMEM;
+		goto err_pcpu_lists;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+		int class;
+#endif
+
+		spin_lock_init(&pcpu->lock);
+		INIT_HLIST_NULLS_HEAD(&pcpu->unconfirmed, UNCONFIRMED_NULLS_VAL);
+		INIT_HLIST_NULLS_HEAD(&pcpu->dying, DYING_NULLS_VAL);
+#ifdef CONFIG_NF_CONNTRACK_EVICT
+		for (class = 0; class < NF_CT_EVICT_MAX; class++)
+			INIT_LIST_HEAD(&pcpu->evict[class]);
+#endif
+	}
+
 	net->ct.stat = alloc_percpu(struct ip_conntrack_stat);
 	if (!net->ct.stat) {
 		ret = -ENOMEM;
@@ -1961,9 +2558,17 @@ static int nf_conntrack_init_net(struct net *net)
 		goto err_slabname;
 	}
 
+#ifdef CONFIG_NF_CONNTRACK_COMPACT
+	/* Whole cache lines per entry, counters included */
+	net->ct.nf_conntrack_cachep = kmem_cache_create(net->ct.slabname,
+				NF_CT_ACCT_OFFSET +
+				sizeof(struct nf_conn_counter[IP_CT_DIR_MAX]), 0,
+				SLAB_DESTROY_BY_RCU | SLAB_HWCACHE_ALIGN, NULL);
+#else
 	net->ct.nf_conntrack_cachep = kmem_cache_create(net->ct.slabname,
 							sizeof(struct nf_conn), 0,
 							SLAB_DESTROY_BY_RCU, NULL);
+#endif
 	if (!net->ct.nf_conntrack_cachep) {
 		printk(KERN_ERR "Unable to create nf_conn slab cache\n");
 		ret = -ENOMEM;
@@ -1992,9 +2597,15 @@ static int nf_conntrack_init_net(struct net *net)
 	ret = nf_conntrack_timeout_init(net);
 	if (ret < 0)
 		goto err_timeout;
+	ret = nf_conntrack_fastnat_init(net);
+	if (ret < 0)
+		goto err_fastnat;
 
+	nf_conntrack_gc_init(net);
 	return 0;
 
+err_fastnat:
+	nf_conntrack_timeout_fini(net);
 err_timeout:
 	nf_conntrack_ecache_fini(net);
 err_ecache:
@@ -2012,6 +2623,8 @@ err_cache:
 err_slabname:
 	free_percpu(net->ct.stat);
 err_stat:
+	free_percpu(net->ct.pcpu_lists);
+err_pcpu_lists:
 	return ret;
 }
 
@@ -242,8 +242,8 @@ EXPORT_SYMBOL_GPL(nf_ct_expect_alloc);
 
 void nf_ct_expect_init(struct nf_conntrack_expect *exp, unsigned int class,
 		       u_int8_t family,
-		       const union nf_inet_addr *saddr,
-		       const union nf_inet_addr *daddr,
+		       const union nf_conntrack_address *saddr,
+		       const union nf_conntrack_address *daddr,
 		       u_int8_t proto, const __be16 *src, const __be16 *dst)
 {
 	int len;
@@ -0,0 +1,313 @@
+/*
+ * Per-direction route and hardware header cache for Fast NAT.
+ *
+ * A bound flow reuses the input route and the neighbour hardware
+ * header resolved for its first packet, so the fast path needs neither
+ * ip_route_input() nor neigh_output().  Cached entries are checked
+ * against the IPv4 route generation and a global generation bumped on
+ * netdev events.  The hardware header is checked against its own
+ * neighbour, so neighbour updates only touch the flows using it.
+ *
+ * Also holds per-CPU counters of fast path decisions, shown in
+ * /proc/net/stat/fastnat, and the fastnat tracepoints.
+ */
+
+#include <linux/netfilter.h>
+#include <linux/slab.h>
+#include <linux/kernel.h>
+#include <linux/export.h>
+#include <linux/netdevice.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <net/neighbour.h>
+
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_extend.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/fastnat.h>
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(fastnat_bind);
+EXPORT_TRACEPOINT_SYMBOL_GPL(fastnat_hit);
+EXPORT_TRACEPOINT_SYMBOL_GPL(fastnat_fallback);
+
+atomic_t nf_ct_fastnat_gen = ATOMIC_INIT(0);
+EXPORT_SYMBOL_GPL(nf_ct_fastnat_gen);
+
+DEFINE_PER_CPU(struct nf_ct_fastnat_stat, nf_ct_fastnat_stat);
+EXPORT_PER_CPU_SYMBOL_GPL(nf_ct_fastnat_stat);
+
+static void nf_ct_fastnat_route_free_rcu(struct rcu_head *head)
+{
+	struct nf_ct_fastnat_route *r =
+		container_of(head, struct nf_ct_fastnat_route, rcu);
+
+	if (r->neigh != NULL)
+		neigh_release(r->neigh);
+	dst_release(r->dst);
+	kfree(r);
+}
+
+static inline void nf_ct_fastnat_route_free(struct nf_ct_fastnat_route *r)
+{
+	if (r != NULL)
+		call_rcu(&r->rcu, nf_ct_fastnat_route_free_rcu);
+}
+
+/* Copy neighbour hardware header if it is resolved and small enough.
+ * A neighbour still resolving is kept so the route is refilled once it
+ * is, see nf_ct_fastnat_route_get(). */
+static void nf_ct_fastnat_hh_fill(struct nf_ct_fastnat_route *r,
+				  struct dst_entry *dst)
+{
+	struct neighbour *neigh;
+
+	r->hh_len = 0;
+	r->neigh = NULL;
+
+	rcu_read_lock();
+	neigh = dst_get_neighbour_noref(dst);
+	if (neigh == NULL)
+		goto out;
+
+	if (neigh->nud_state & NUD_CONNECTED) {
+		const struct hh_cache *hh = &neigh->hh;
+		unsigned int seq;
+		int hh_len;
+
+		do {
+			seq = read_seqbegin(&hh->hh_lock);
+			hh_len = hh->hh_len;
+			if (hh_len > 0 &&
+			    HH_DATA_ALIGN(hh_len) <= NF_CT_FASTNAT_HH_MAX)
+				memcpy(r->hh_data, hh->hh_data,
+				       HH_DATA_ALIGN(hh_len));
+			else
+				hh_len = 0;
+		} while (read_seqretry(&hh->hh_lock, seq));
+
+		if (hh_len == 0)
+			goto out;
+
+		r->hh_len = hh_len;
+		r->hh_seq = seq;
+	}
+
+	neigh_hold(neigh);
+	r->neigh = neigh;
+out:
+	rcu_read_unlock();
+}
+
+void nf_ct_fastnat_route_update(struct nf_conn *ct,
+				enum ip_conntrack_dir dir,
+				struct dst_entry *dst,
+				const struct net_device *in, u8 tos)
+{
+	struct nf_conn_fastnat *fn = nf_conn_fastnat_find(ct);
+	struct nf_ct_fastnat_route *r;
+
+	if (fn == NULL || (dst->flags & DST_NOCACHE))
+		return;
+
+	r = kmalloc(sizeof(*r), GFP_ATOMIC);
+	if (r == NULL)
+		return;
+
+	/* Snapshot generations before looking at the neighbour */
+	r->gen = atomic_read(&nf_ct_fastnat_gen);
+	r->rt_genid = atomic_read(&nf_ct_net(ct)->ipv4.rt_genid);
+	r->iif = in->ifindex;
+	r->tos = tos;
+	r->dst = dst_clone(dst);
+	nf_ct_fastnat_hh_fill(r, dst);
+
+	nf_ct_fastnat_route_free(xchg(&fn->route[dir], r));
+}
+EXPORT_SYMBOL_GPL(nf_ct_fastnat_route_update);
+
+static void nf_ct_fastnat_destroy(struct nf_conn *ct)
+{
+	struct nf_conn_fastnat *fn = nf_conn_fastnat_find(ct);
+	int dir;
+
+	if (fn == NULL)
+		return;
+
+	for (dir = 0; dir < IP_CT_DIR_MAX; dir++)
+		nf_ct_fastnat_route_free(xchg(&fn->route[dir], NULL));
+}
+
+static struct nf_ct_ext_type fastnat_extend __read_mostly = {
+	.len		= sizeof(struct nf_conn_fastnat),
+	.align		= __alignof__(struct nf_conn_fastnat),
+	.destroy	= nf_ct_fastnat_destroy,
+	.id		= NF_CT_EXT_FASTNAT,
+};
+
+static int nf_ct_fastnat_netdev_event(struct notifier_block *this,
+				      unsigned long event, void *ptr)
+{
+	switch (event) {
+	case NETDEV_DOWN:
+	case NETDEV_CHANGE:
+	case NETDEV_CHANGEMTU:
+	case NETDEV_CHANGEADDR:
+	case NETDEV_UNREGISTER:
+		atomic_inc(&nf_ct_fastnat_gen);
+		break;
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block nf_ct_fastnat_netdev_notifier = {
+	.notifier_call	= nf_ct_fastnat_netdev_event,
+};
+
+#ifdef CONFIG_PROC_FS
+static void *fastnat_cpu_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	int cpu;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+
+	for (cpu = *pos-1; cpu < nr_cpu_ids; ++cpu) {
+		if (!cpu_possible(cpu))
+			continue;
+		*pos = cpu + 1;
+		return &per_cpu(nf_ct_fastnat_stat, cpu);
+	}
+
+	return NULL;
+}
+
+static void *fastnat_cpu_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	int cpu;
+
+	for (cpu = *pos; cpu < nr_cpu_ids; ++cpu) {
+		if (!cpu_possible(cpu))
+			continue;
+		*pos = cpu + 1;
+		return &per_cpu(nf_ct_fastnat_stat, cpu);
+	}
+
+	return NULL;
+}
+
+static void fastnat_cpu_seq_stop(struct seq_file *seq, void *v)
+{
+}
+
+static int fastnat_cpu_seq_show(struct seq_file *seq, void *v)
+{
+	const struct nf_ct_fastnat_stat *st = v;
+	int i;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(seq, "bind bind_ext bind_threshold bind_keepalive "
+				"bind_no_nat nat_not_ready skb_not_ready "
+				"manip_fail route_fail hit hit6 fallback6 "
+				"ingress_stolen ingress_drop egress_stolen "
+				"egress_drop ttl_exceeded frag gso_segment\n");
+		return 0;
+	}
+
+	for (i = 0; i < NF_CT_FASTNAT_STAT_MAX; i++)
+		seq_printf(seq, "%s%08x", i ? " " : "", st->count[i]);
+	seq_putc(seq, '\n');
+
+	return 0;
+}
+
+static const struct seq_operations fastnat_cpu_seq_ops = {
+	.start	= fastnat_cpu_seq_start,
+	.next	= fastnat_cpu_seq_next,
+	.stop	= fastnat_cpu_seq_stop,
+	.show	= fastnat_cpu_seq_show,
+};
+
+static int fastnat_cpu_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &fastnat_cpu_seq_ops);
+}
+
+static const struct file_operations fastnat_cpu_seq_fops = {
+	.owner	 = THIS_MODULE,
+	.open	 = fastnat_cpu_seq_open,
+	.read	 = seq_read,
+	.llseek	 = seq_lseek,
+	.release = seq_release,
+};
+
+static int nf_conntrack_fastnat_init_proc(struct net *net)
+{
+	if (!proc_create("fastnat", S_IRUGO, net->proc_net_stat,
+			 &fastnat_cpu_seq_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void nf_conntrack_fastnat_fini_proc(struct net *net)
+{
+	remove_proc_entry("fastnat", net->proc_net_stat);
+}
+#else
+static int nf_conntrack_fastnat_init_proc(struct net *net)
+{
+	return 0;
+}
+
+static void nf_conntrack_fastnat_fini_proc(struct net *net)
+{
+}
+#endif /* CONFIG_PROC_FS */
+
+int nf_conntrack_fastnat_init(struct net *net)
+{
+	int ret;
+
+	if (!net_eq(net, &init_net))
+		return 0;
+
+	ret = nf_ct_extend_register(&fastnat_extend);
+	if (ret < 0) {
+		printk(KERN_ERR "nf_ct_fastnat: Unable to register "
+				"extension\n");
+		goto out_extend_register;
+	}
+
+	ret = register_netdevice_notifier(&nf_ct_fastnat_netdev_notifier);
+	if (ret < 0)
+		goto out_netdev;
+
+	ret = nf_conntrack_fastnat_init_proc(net);
+	if (ret < 0)
+		goto out_proc;
+
+	return 0;
+
+out_proc:
+	unregister_netdevice_notifier(&nf_ct_fastnat_netdev_notifier);
+out_netdev:
+	nf_ct_extend_unregister(&fastnat_extend);
+out_extend_register:
+	return ret;
+}
+
+void nf_conntrack_fastnat_fini(struct net *net)
+{
+	if (!net_eq(net, &init_net))
+		return;
+
+	nf_conntrack_fastnat_fini_proc(net);
+	unregister_netdevice_notifier(&nf_ct_fastnat_netdev_notifier);
+	nf_ct_extend_unregister(&fastnat_extend);
+	nf_conntrack_fastnat_policy_fini();
+	rcu_barrier();
+}
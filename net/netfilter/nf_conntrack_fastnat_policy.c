@@ -0,0 +1,459 @@
+/*
+ * Fast NAT bind policy.
+ *
+ * Decides after how many packets an established flow is bound to
+ * the fast path.  The policy is set through the
+ * net.netfilter.nf_conntrack_fastnat_policy sysctl as a list of rules
+ * separated by ';' or new lines, for example:
+ *
+ *   proto=udp port=53 bind; proto=udp port=5060-5061 never;
+ *   proto=udp port=443 both=1 half=4; mark=3 never
+ *
+ * A rule has one selector: "mark=N" (ndm_mark of the conntrack),
+ * "proto=tcp|udp" or "proto=tcp|udp port=A[-B]" (destination port of
+ * the original direction), and one action: "bind" (bind on the first
+ * established packet), "never" or "both=N [half=N]" (bind when both
+ * directions passed N packets, or when any direction passed half,
+ * half=0 disables it).  Mark rules take precedence over port rules,
+ * port rules over protocol rules, the first matching rule of a kind
+ * wins.  Unmatched flows use the built-in defaults.
+ *
+ * Rules are compiled into direct lookup tables, the lookup does not
+ * depend on the number of rules.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/export.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/sysctl.h>
+#include <linux/in.h>
+
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
+
+#define NF_CT_FASTNAT_RULES_MAX		32
+
+/* Packets seen in both directions before binding */
+#define NF_CT_FASTNAT_DEF_BOTH		2
+/* Packets seen in one direction before binding UDP */
+#define NF_CT_FASTNAT_DEF_HALF		200
+
+enum {
+	NF_CT_FASTNAT_PROTO_TCP,
+	NF_CT_FASTNAT_PROTO_UDP,
+	NF_CT_FASTNAT_PROTO_MAX,
+};
+
+/* 16-bit key to rule index, index 0 means no rule.  A block of 256
+ * keys mapped to the same rule is kept as a single byte. */
+struct nf_ct_fastnat_map {
+	u8 rule[256];
+	u8 *block[256];
+};
+
+struct nf_ct_fastnat_policy {
+	struct rcu_head rcu;
+	struct nf_ct_fastnat_rule rules[NF_CT_FASTNAT_RULES_MAX + 1];
+	u8 mark[256];
+	u8 proto[NF_CT_FASTNAT_PROTO_MAX];
+	struct nf_ct_fastnat_map *port[NF_CT_FASTNAT_PROTO_MAX];
+};
+
+static const struct nf_ct_fastnat_rule nf_ct_fastnat_defaults[] = {
+	[NF_CT_FASTNAT_PROTO_TCP] = {
+		.action	= NF_CT_FASTNAT_THRESHOLD,
+		.both	= NF_CT_FASTNAT_DEF_BOTH,
+		.half	= 0,
+	},
+	[NF_CT_FASTNAT_PROTO_UDP] = {
+		.action	= NF_CT_FASTNAT_THRESHOLD,
+		.both	= NF_CT_FASTNAT_DEF_BOTH,
+		.half	= NF_CT_FASTNAT_DEF_HALF,
+	},
+};
+
+static struct nf_ct_fastnat_policy __rcu *nf_ct_fastnat_policy __read_mostly;
+
+static DEFINE_MUTEX(nf_ct_fastnat_policy_mutex);
+static char nf_ct_fastnat_policy_str[NF_CT_FASTNAT_POLICY_LEN];
+
+static inline int nf_ct_fastnat_proto_idx(u8 protonum)
+{
+	if (protonum == IPPROTO_TCP)
+		return NF_CT_FASTNAT_PROTO_TCP;
+	if (protonum == IPPROTO_UDP)
+		return NF_CT_FASTNAT_PROTO_UDP;
+	return -1;
+}
+
+static inline u8 nf_ct_fastnat_map_get(const struct nf_ct_fastnat_map *m,
+				       u16 key)
+{
+	const u8 *b = m->block[key >> 8];
+
+	return b ? b[key & 0xff] : m->rule[key >> 8];
+}
+
+const struct nf_ct_fastnat_rule *
+nf_ct_fastnat_policy_lookup(const struct nf_conn *ct, u8 protonum)
+{
+	const struct nf_ct_fastnat_policy *p;
+	const struct nf_conntrack_tuple *t;
+	int idx = nf_ct_fastnat_proto_idx(protonum);
+	u8 rule = 0;
+
+	if (idx < 0)
+		return NULL;
+
+	/* rcu_read_lock()ed by nf_hook_slow */
+	p = rcu_dereference(nf_ct_fastnat_policy);
+	if (p == NULL)
+		return &nf_ct_fastnat_defaults[idx];
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+	rule = p->mark[ct->ndm_mark];
+#endif
+
+	if (rule == 0 && p->port[idx] != NULL) {
+		t = &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple;
+		rule = nf_ct_fastnat_map_get(p->port[idx],
+					     ntohs(t->dst.u.all));
+	}
+
+	if (rule == 0)
+		rule = p->proto[idx];
+
+	if (rule == 0)
+		return &nf_ct_fastnat_defaults[idx];
+
+	return &p->rules[rule];
+}
+EXPORT_SYMBOL_GPL(nf_ct_fastnat_policy_lookup);
+
+static void nf_ct_fastnat_map_free(struct nf_ct_fastnat_map *m)
+{
+	int i;
+
+	if (m == NULL)
+		return;
+
+	for (i = 0; i < 256; i++)
+		kfree(m->block[i]);
+
+	kfree(m);
+}
+
+static void nf_ct_fastnat_policy_free(struct nf_ct_fastnat_policy *p)
+{
+	int i;
+
+	if (p == NULL)
+		return;
+
+	for (i = 0; i < NF_CT_FASTNAT_PROTO_MAX; i++)
+		nf_ct_fastnat_map_free(p->port[i]);
+
+	kfree(p);
+}
+
+static void nf_ct_fastnat_policy_free_rcu(struct rcu_head *head)
+{
+	nf_ct_fastnat_policy_free(
+		container_of(head, struct nf_ct_fastnat_policy, rcu));
+}
+
+/* Compresses flat 64K map into 256 blocks */
+static struct nf_ct_fastnat_map *nf_ct_fastnat_map_build(const u8 *flat)
+{
+	struct nf_ct_fastnat_map *m;
+	int i, j;
+
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (m == NULL)
+		return NULL;
+
+	for (i = 0; i < 256; i++) {
+		const u8 *src = flat + (i << 8);
+
+		for (j = 1; j < 256; j++)
+			if (src[j] != src[0])
+				break;
+
+		if (j == 256) {
+			m->rule[i] = src[0];
+			continue;
+		}
+
+		m->block[i] = kmemdup(src, 256, GFP_KERNEL);
+		if (m->block[i] == NULL) {
+			nf_ct_fastnat_map_free(m);
+			return NULL;
+		}
+	}
+
+	return m;
+}
+
+struct nf_ct_fastnat_sel {
+	int proto;		/* -1 for a mark rule */
+	u8 mark;
+	bool has_port;
+	u16 port_lo;
+	u16 port_hi;
+};
+
+static int nf_ct_fastnat_parse_uint(const char *s, unsigned int max,
+				    unsigned int *val)
+{
+	unsigned int v;
+
+	if (kstrtouint(s, 10, &v) || v > max)
+		return -EINVAL;
+
+	*val = v;
+	return 0;
+}
+
+static int nf_ct_fastnat_parse_rule(char *str, struct nf_ct_fastnat_sel *sel,
+				    struct nf_ct_fastnat_rule *rule)
+{
+	bool has_sel = false, has_action = false;
+	unsigned int v;
+	char *tok;
+
+	memset(sel, 0, sizeof(*sel));
+	sel->proto = -1;
+	memset(rule, 0, sizeof(*rule));
+	rule->action = NF_CT_FASTNAT_THRESHOLD;
+
+	while ((tok = strsep(&str, " \t")) != NULL) {
+		char *val;
+
+		if (*tok == '\0')
+			continue;
+
+		val = strchr(tok, '=');
+		if (val != NULL)
+			*val++ = '\0';
+
+		if (!strcmp(tok, "bind") && val == NULL) {
+			rule->action = NF_CT_FASTNAT_BIND;
+			has_action = true;
+		} else if (!strcmp(tok, "never") && val == NULL) {
+			rule->action = NF_CT_FASTNAT_NEVER;
+			has_action = true;
+		} else if (!strcmp(tok, "both") && val != NULL) {
+			if (nf_ct_fastnat_parse_uint(val, UINT_MAX, &rule->both))
+				return -EINVAL;
+			has_action = true;
+		} else if (!strcmp(tok, "half") && val != NULL) {
+			if (nf_ct_fastnat_parse_uint(val, UINT_MAX, &rule->half))
+				return -EINVAL;
+		} else if (!strcmp(tok, "mark") && val != NULL) {
+			if (has_sel || nf_ct_fastnat_parse_uint(val, 255, &v))
+				return -EINVAL;
+			sel->mark = v;
+			has_sel = true;
+		} else if (!strcmp(tok, "proto") && val != NULL) {
+			if (has_sel)
+				return -EINVAL;
+			if (!strcmp(val, "tcp"))
+				sel->proto = NF_CT_FASTNAT_PROTO_TCP;
+			else if (!strcmp(val, "udp"))
+				sel->proto = NF_CT_FASTNAT_PROTO_UDP;
+			else
+				return -EINVAL;
+			has_sel = true;
+		} else if (!strcmp(tok, "port") && val != NULL) {
+			char *hi = strchr(val, '-');
+
+			if (sel->proto < 0 || sel->has_port)
+				return -EINVAL;
+			if (hi != NULL)
+				*hi++ = '\0';
+			if (nf_ct_fastnat_parse_uint(val, 65535, &v))
+				return -EINVAL;
+			sel->port_lo = sel->port_hi = v;
+			if (hi != NULL) {
+				if (nf_ct_fastnat_parse_uint(hi, 65535, &v) ||
+				    v < sel->port_lo)
+					return -EINVAL;
+				sel->port_hi = v;
+			}
+			sel->has_port = true;
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	if (!has_sel || !has_action)
+		return -EINVAL;
+
+	return 0;
+}
+
+static struct nf_ct_fastnat_policy *nf_ct_fastnat_policy_build(char *str)
+{
+	struct nf_ct_fastnat_sel *sels;
+	struct nf_ct_fastnat_policy *p;
+	unsigned int nr = 0, i;
+	u8 *flat = NULL;
+	char *line;
+	int proto, err = -EINVAL;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	sels = kcalloc(NF_CT_FASTNAT_RULES_MAX + 1, sizeof(*sels), GFP_KERNEL);
+	if (p == NULL || sels == NULL) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	while ((line = strsep(&str, ";\n")) != NULL) {
+		line = strim(line);
+		if (*line == '\0')
+			continue;
+
+		if (nr == NF_CT_FASTNAT_RULES_MAX)
+			goto err;
+
+		nr++;
+		err = nf_ct_fastnat_parse_rule(line, &sels[nr], &p->rules[nr]);
+		if (err)
+			goto err;
+	}
+
+	/* Fill in reverse order, so the first matching rule wins */
+	for (i = nr; i > 0; i--) {
+		if (sels[i].proto < 0)
+			p->mark[sels[i].mark] = i;
+		else if (!sels[i].has_port)
+			p->proto[sels[i].proto] = i;
+	}
+
+	for (proto = 0; proto < NF_CT_FASTNAT_PROTO_MAX; proto++) {
+		bool used = false;
+
+		for (i = nr; i > 0; i--) {
+			unsigned int port;
+
+			if (sels[i].proto != proto || !sels[i].has_port)
+				continue;
+
+			if (flat == NULL) {
+				flat = vmalloc(65536);
+				if (flat == NULL) {
+					err = -ENOMEM;
+					goto err;
+				}
+			}
+
+			if (!used)
+				memset(flat, 0, 65536);
+			used = true;
+
+			for (port = sels[i].port_lo; port <= sels[i].port_hi; port++)
+				flat[port] = i;
+		}
+
+		if (!used)
+			continue;
+
+		p->port[proto] = nf_ct_fastnat_map_build(flat);
+		if (p->port[proto] == NULL) {
+			err = -ENOMEM;
+			goto err;
+		}
+	}
+
+	vfree(flat);
+	kfree(sels);
+	return p;
+
+err:
+	vfree(flat);
+	kfree(sels);
+	nf_ct_fastnat_policy_free(p);
+	return ERR_PTR(err);
+}
+
+static void nf_ct_fastnat_policy_replace(struct nf_ct_fastnat_policy *p)
+{
+	struct nf_ct_fastnat_policy *old;
+
+	old = rcu_dereference_protected(nf_ct_fastnat_policy,
+			lockdep_is_held(&nf_ct_fastnat_policy_mutex));
+	rcu_assign_pointer(nf_ct_fastnat_policy, p);
+
+	if (old != NULL)
+		call_rcu(&old->rcu, nf_ct_fastnat_policy_free_rcu);
+}
+
+int nf_ct_fastnat_policy_sysctl(struct ctl_table *table, int write,
+				void __user *buffer, size_t *lenp,
+				loff_t *ppos)
+{
+	struct ctl_table tmp = *table;
+	char *buf;
+	int ret;
+
+	buf = kzalloc(NF_CT_FASTNAT_POLICY_LEN, GFP_KERNEL);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	tmp.data = buf;
+	tmp.maxlen = NF_CT_FASTNAT_POLICY_LEN;
+
+	mutex_lock(&nf_ct_fastnat_policy_mutex);
+
+	if (!write)
+		strlcpy(buf, nf_ct_fastnat_policy_str, NF_CT_FASTNAT_POLICY_LEN);
+
+	ret = proc_dostring(&tmp, write, buffer, lenp, ppos);
+	if (write && ret == 0) {
+		char *rules = kstrdup(buf, GFP_KERNEL);
+		struct nf_ct_fastnat_policy *p;
+
+		if (rules == NULL) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		p = nf_ct_fastnat_policy_build(rules);
+		kfree(rules);
+
+		if (IS_ERR(p)) {
+			ret = PTR_ERR(p);
+			goto out;
+		}
+
+		/* Empty policy restores the defaults */
+		if (strim(buf)[0] == '\0') {
+			nf_ct_fastnat_policy_free(p);
+			p = NULL;
+		}
+
+		nf_ct_fastnat_policy_replace(p);
+		strlcpy(nf_ct_fastnat_policy_str, buf,
+			NF_CT_FASTNAT_POLICY_LEN);
+	}
+
+out:
+	mutex_unlock(&nf_ct_fastnat_policy_mutex);
+	kfree(buf);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(nf_ct_fastnat_policy_sysctl);
+
+void nf_conntrack_fastnat_policy_fini(void)
+{
+	mutex_lock(&nf_ct_fastnat_policy_mutex);
+	nf_ct_fastnat_policy_replace(NULL);
+	nf_ct_fastnat_policy_str[0] = '\0';
+	mutex_unlock(&nf_ct_fastnat_policy_mutex);
+
+	rcu_barrier();
+}
@@ -106,6 +106,7 @@ static struct ftp_search {
 	},
 };
 
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 static int
 get_ipv6_addr(const char *src, size_t dlen, struct in6_addr *dst, u_int8_t term)
 {
@@ -115,6 +116,7 @@ get_ipv6_addr(const char *src, size_t dlen, struct in6_addr *dst, u_int8_t term)
 		return (int)(end - src);
 	return 0;
 }
+#endif
 
 static int try_number(const char *data, size_t dlen, u_int32_t array[],
 		      int array_size, char sep, char term)
@@ -254,9 +256,14 @@ static int try_eprt(const char *data, size_t dlen, struct nf_conntrack_man *cmd,
 			cmd->u3.ip = htonl((array[0] << 24) | (array[1] << 16)
 					   | (array[2] << 8) | array[3]);
 	} else {
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 		/* Now we have IPv6 address. */
 		length = get_ipv6_addr(data + 3, dlen - 3,
 				       (struct in6_addr *)cmd->u3.ip6, delim);
+#else
+		/* IPv4 only tuples, cannot be an IPv6 connection */
+		length = 0;
+#endif
 	}
 
 	if (length == 0)
@@ -395,7 +402,7 @@ static int help(struct sk_buff *skb,
 	unsigned int uninitialized_var(matchlen), uninitialized_var(matchoff);
 	struct nf_ct_ftp_master *ct_ftp_info = &nfct_help(ct)->help.ct_ftp_info;
 	struct nf_conntrack_expect *exp;
-	union nf_inet_addr *daddr;
+	union nf_conntrack_address *daddr;
 	struct nf_conntrack_man cmd = {};
 	unsigned int i;
 	int found = 0, ends_in_nl;
@@ -499,9 +506,11 @@ static int help(struct sk_buff *skb,
 				 &cmd.u3.ip,
 				 &ct->tuplehash[dir].tuple.src.u3.ip);
 		} else {
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 			pr_debug("conntrack_ftp: NOT RECORDING: %pI6 != %pI6\n",
 				 cmd.u3.ip6,
 				 ct->tuplehash[dir].tuple.src.u3.ip6);
+#endif
 		}
 
 		/* Thanks to Cristiano Lincoln Mattos
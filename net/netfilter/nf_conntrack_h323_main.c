@@ -51,12 +51,12 @@ MODULE_PARM_DESC(callforward_filter, "only create call forwarding expectations "
 int (*set_h245_addr_hook) (struct sk_buff *skb,
 			   unsigned char **data, int dataoff,
 			   H245_TransportAddress *taddr,
-			   union nf_inet_addr *addr, __be16 port)
+			   union nf_conntrack_address *addr, __be16 port)
 			   __read_mostly;
 int (*set_h225_addr_hook) (struct sk_buff *skb,
 			   unsigned char **data, int dataoff,
 			   TransportAddress *taddr,
-			   union nf_inet_addr *addr, __be16 port)
+			   union nf_conntrack_address *addr, __be16 port)
 			   __read_mostly;
 int (*set_sig_addr_hook) (struct sk_buff *skb,
 			  struct nf_conn *ct,
@@ -215,7 +215,7 @@ static int get_tpkt_data(struct sk_buff *skb, unsigned int protoff,
 /****************************************************************************/
 static int get_h245_addr(struct nf_conn *ct, const unsigned char *data,
 			 H245_TransportAddress *taddr,
-			 union nf_inet_addr *addr, __be16 *port)
+			 union nf_conntrack_address *addr, __be16 *port)
 {
 	const unsigned char *p;
 	int len;
@@ -230,12 +230,14 @@ static int get_h245_addr(struct nf_conn *ct, const unsigned char *data,
 		p = data + taddr->unicastAddress.iPAddress.network;
 		len = 4;
 		break;
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case eUnicastAddress_iP6Address:
 		if (nf_ct_l3num(ct) != AF_INET6)
 			return 0;
 		p = data + taddr->unicastAddress.iP6Address.network;
 		len = 16;
 		break;
+#endif
 	default:
 		return 0;
 	}
@@ -257,7 +259,7 @@ static int expect_rtp_rtcp(struct sk_buff *skb, struct nf_conn *ct,
 	int ret = 0;
 	__be16 port;
 	__be16 rtp_port, rtcp_port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *rtp_exp;
 	struct nf_conntrack_expect *rtcp_exp;
 	typeof(nat_rtp_rtcp_hook) nat_rtp_rtcp;
@@ -329,7 +331,7 @@ static int expect_t120(struct sk_buff *skb,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 	typeof(nat_t120_hook) nat_t120;
 
@@ -625,7 +627,7 @@ static struct nf_conntrack_helper nf_conntrack_helper_h245 __read_mostly = {
 /****************************************************************************/
 int get_h225_addr(struct nf_conn *ct, unsigned char *data,
 		  TransportAddress *taddr,
-		  union nf_inet_addr *addr, __be16 *port)
+		  union nf_conntrack_address *addr, __be16 *port)
 {
 	const unsigned char *p;
 	int len;
@@ -637,12 +639,14 @@ int get_h225_addr(struct nf_conn *ct, unsigned char *data,
 		p = data + taddr->ipAddress.ip;
 		len = 4;
 		break;
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case eTransportAddress_ip6Address:
 		if (nf_ct_l3num(ct) != AF_INET6)
 			return 0;
 		p = data + taddr->ip6Address.ip;
 		len = 16;
 		break;
+#endif
 	default:
 		return 0;
 	}
@@ -663,7 +667,7 @@ static int expect_h245(struct sk_buff *skb, struct nf_conn *ct,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 	typeof(nat_h245_hook) nat_h245;
 
@@ -705,8 +709,8 @@ static int expect_h245(struct sk_buff *skb, struct nf_conn *ct,
 
 /* If the calling party is on the same side of the forward-to party,
  * we don't need to track the second call */
-static int callforward_do_filter(const union nf_inet_addr *src,
-				 const union nf_inet_addr *dst,
+static int callforward_do_filter(const union nf_conntrack_address *src,
+				 const union nf_conntrack_address *dst,
 				 u_int8_t family)
 {
 	const struct nf_afinfo *afinfo;
@@ -780,7 +784,7 @@ static int expect_callforwarding(struct sk_buff *skb,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 	typeof(nat_callforwarding_hook) nat_callforwarding;
 
@@ -836,7 +840,7 @@ static int process_setup(struct sk_buff *skb, struct nf_conn *ct,
 	int ret;
 	int i;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	typeof(set_h225_addr_hook) set_h225_addr;
 
 	pr_debug("nf_ct_q931: Setup\n");
@@ -1205,7 +1209,7 @@ static unsigned char *get_udp_data(struct sk_buff *skb, unsigned int protoff,
 
 /****************************************************************************/
 static struct nf_conntrack_expect *find_expect(struct nf_conn *ct,
-					       union nf_inet_addr *addr,
+					       union nf_conntrack_address *addr,
 					       __be16 port)
 {
 	struct net *net = nf_ct_net(ct);
@@ -1248,7 +1252,7 @@ static int expect_q931(struct sk_buff *skb, struct nf_conn *ct,
 	int ret = 0;
 	int i;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 	typeof(nat_q931_hook) nat_q931;
 
@@ -1317,7 +1321,7 @@ static int process_gcf(struct sk_buff *skb, struct nf_conn *ct,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 
 	pr_debug("nf_ct_ras: GCF\n");
@@ -1477,7 +1481,7 @@ static int process_arq(struct sk_buff *skb, struct nf_conn *ct,
 	const struct nf_ct_h323_master *info = &nfct_help(ct)->help.ct_h323_info;
 	int dir = CTINFO2DIR(ctinfo);
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	typeof(set_h225_addr_hook) set_h225_addr;
 
 	pr_debug("nf_ct_ras: ARQ\n");
@@ -1519,7 +1523,7 @@ static int process_acf(struct sk_buff *skb, struct nf_conn *ct,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 	typeof(set_sig_addr_hook) set_sig_addr;
 
@@ -1582,7 +1586,7 @@ static int process_lcf(struct sk_buff *skb, struct nf_conn *ct,
 	int dir = CTINFO2DIR(ctinfo);
 	int ret = 0;
 	__be16 port;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	struct nf_conntrack_expect *exp;
 
 	pr_debug("nf_ct_ras: LCF\n");
@@ -0,0 +1,765 @@
+/*
+ * Per-host policer.
+ *
+ * Each configured host has a token bucket for what it sends (original
+ * direction of the connections it initiates) and one for what it
+ * receives (reply direction).  A packet over the rate is dropped; a
+ * conforming packet may take the bucket into debt, so GRO super-packets
+ * pass whole and are paid back later.
+ *
+ * The policer takes the NTC shaper hooks, which fast NAT calls for every
+ * packet it forwards, and a FORWARD hook for the slow path.  A conntrack
+ * remembers its host in ct->hpol together with the generation of the
+ * host table it was looked up in, so a packet costs a compare and the
+ * bucket update; a configuration change bumps the generation and every
+ * connection looks its host up again on its next packet.
+ *
+ * Through disable_hwacc the hardware NAT is told to keep flows of a
+ * policed host in software, or to bind them with a meter whose rate it
+ * reads back with ntc_shaper_hwacc_meter().
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/ntc_shaper_hooks.h>
+#include <net/genetlink.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <linux/netfilter/nf_conntrack_hpol.h>
+
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+#include <../ndm/hw_nat/ra_nat.h>
+#endif
+
+#define HPOL_HOSTS_DEF		64
+/* Slot plus one is kept in the low 16 bits of ct->hpol */
+#define HPOL_HOSTS_LIMIT	65535
+#define HPOL_GEN_SHIFT		16
+#define HPOL_SLOT_MASK		0xffff
+
+/* Fixed point of the nanoseconds per byte */
+#define HPOL_RATE_SHIFT		16
+/* Default burst is 100 ms of the rate, but not less than this */
+#define HPOL_BURST_MIN		4096
+
+struct hpol_bucket {
+	spinlock_t lock;
+	u32 rate;			/* bytes per second, 0 if unlimited */
+	u32 burst;			/* bytes */
+	u64 rate_mult;			/* ns per byte << HPOL_RATE_SHIFT */
+	s64 burst_ns;
+	s64 tokens;			/* ns, negative while in debt */
+	u64 t_c;			/* ns of the last update */
+	u64 drops;
+};
+
+struct hpol_host {
+	struct hlist_node hnode;
+	struct list_head list;		/* free list */
+	union nf_inet_addr addr;
+	u8 family;			/* 0 while free */
+	u8 hwacc;			/* enum hpol_hwacc */
+	struct hpol_bucket bucket[IP_CT_DIR_MAX];
+};
+
+static unsigned int hpol_hosts_max __read_mostly = HPOL_HOSTS_DEF;
+module_param_named(hosts, hpol_hosts_max, uint, 0400);
+MODULE_PARM_DESC(hosts, "maximum number of policed hosts");
+
+/* Serializes configuration changes */
+static DEFINE_MUTEX(hpol_mutex);
+static struct hpol_host *hpol_hosts __read_mostly;
+static struct hlist_head *hpol_hash __read_mostly;
+static unsigned int hpol_hsize __read_mostly;
+static u32 hpol_hash_rnd __read_mostly;
+static LIST_HEAD(hpol_free);
+static unsigned int hpol_used;
+
+/* Generation of the host table, 1 to 0xffff so that 0 is never current */
+static u32 hpol_gen = 1;
+
+static inline unsigned int hpol_hash_addr(const union nf_inet_addr *addr,
+					  u8 family)
+{
+	return jhash2(addr->all, ARRAY_SIZE(addr->all),
+		      hpol_hash_rnd ^ family) & (hpol_hsize - 1);
+}
+
+static struct hpol_host *hpol_find(const union nf_inet_addr *addr, u8 family)
+{
+	unsigned int hash = hpol_hash_addr(addr, family);
+	struct hpol_host *host;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(host, n, &hpol_hash[hash], hnode) {
+		if (host->family == family &&
+		    nf_inet_addr_cmp(&host->addr, addr))
+			return host;
+	}
+
+	return NULL;
+}
+
+/* Looks the initiator of ct up and remembers the result for gen */
+static struct hpol_host *hpol_bind(struct nf_conn *ct, u32 gen)
+{
+	const struct nf_conntrack_tuple *tuple;
+	struct hpol_host *host;
+	union nf_inet_addr addr;
+	unsigned int slot = 0;
+
+	/* A host removed before gen was bumped must not be found */
+	smp_rmb();
+
+	tuple = nf_ct_tuple(ct, IP_CT_DIR_ORIGINAL);
+	nf_ct_addr_to_inet(&addr, &tuple->src.u3);
+
+	host = hpol_find(&addr, tuple->src.l3num);
+	if (host != NULL)
+		slot = host - hpol_hosts + 1;
+
+	/* One store, so a racing CPU never sees a slot of another gen */
+	ACCESS_ONCE(ct->hpol) = (gen << HPOL_GEN_SHIFT) | slot;
+
+	return host;
+}
+
+/* Host policing ct or NULL, called under rcu_read_lock() */
+static inline struct hpol_host *hpol_get(struct nf_conn *ct)
+{
+	u32 gen = ACCESS_ONCE(hpol_gen);
+	u32 val = ACCESS_ONCE(ct->hpol);
+	unsigned int slot;
+
+	if (unlikely(val >> HPOL_GEN_SHIFT != gen))
+		return hpol_bind(ct, gen);
+
+	slot = val & HPOL_SLOT_MASK;
+
+	return slot != 0 ? &hpol_hosts[slot - 1] : NULL;
+}
+
+static int hpol_unbind(struct nf_conn *ct, void *data)
+{
+	ct->hpol = 0;
+	return 0;
+}
+
+/* Makes every connection look its host up again, hpol_mutex held */
+static void hpol_gen_bump(void)
+{
+	u32 gen = hpol_gen + 1;
+
+	if (gen > HPOL_SLOT_MASK) {
+		/* Old values of the restarted generations must not match */
+		nf_ct_iterate_cleanup(&init_net, hpol_unbind, NULL);
+		gen = 1;
+	}
+
+	smp_wmb();
+	ACCESS_ONCE(hpol_gen) = gen;
+}
+
+static bool hpol_conform(struct hpol_bucket *b, unsigned int len)
+{
+	u64 now;
+	s64 toks;
+	bool ok;
+
+	if (ACCESS_ONCE(b->rate) == 0)
+		return true;
+
+	now = ktime_to_ns(ktime_get());
+
+	spin_lock(&b->lock);
+
+	toks = b->tokens + (s64)(now - b->t_c);
+	if (toks > b->burst_ns)
+		toks = b->burst_ns;
+
+	ok = toks >= 0;
+	if (ok)
+		toks -= ((u64)len * b->rate_mult) >> HPOL_RATE_SHIFT;
+	else
+		b->drops++;
+
+	b->tokens = toks;
+	b->t_c = now;
+
+	spin_unlock(&b->lock);
+
+	return ok;
+}
+
+static void hpol_bucket_set(struct hpol_bucket *b, u32 rate, u32 burst)
+{
+	if (burst == 0)
+		burst = max_t(u32, rate / 10, HPOL_BURST_MIN);
+
+	spin_lock_bh(&b->lock);
+
+	b->rate = rate;
+	b->burst = burst;
+	b->rate_mult = rate != 0 ?
+		div_u64((u64)NSEC_PER_SEC << HPOL_RATE_SHIFT, rate) : 0;
+	b->burst_ns = ((u64)burst * b->rate_mult) >> HPOL_RATE_SHIFT;
+	b->tokens = b->burst_ns;
+	b->t_c = ktime_to_ns(ktime_get());
+
+	spin_unlock_bh(&b->lock);
+}
+
+/* NF_ACCEPT or NF_DROP, *disable_hwacc tells what hardware NAT may do.
+ * Without @charge only the hardware NAT verdict is given.
+ */
+static unsigned int hpol_police(struct sk_buff *skb, uint32_t *disable_hwacc,
+				bool charge)
+{
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+	struct hpol_host *host;
+
+	if (ct == NULL || nf_ct_is_untracked(ct))
+		return NF_ACCEPT;
+
+	host = hpol_get(ct);
+	if (host == NULL)
+		return NF_ACCEPT;
+
+	if (disable_hwacc != NULL)
+		*disable_hwacc = ACCESS_ONCE(host->hwacc) == HPOL_HWACC_METER ?
+				 NTC_HWACC_METER : NTC_HWACC_DISABLE;
+
+	if (!charge || hpol_conform(&host->bucket[CTINFO2DIR(ctinfo)], skb->len))
+		return NF_ACCEPT;
+
+	return NF_DROP;
+}
+
+/* A fast NAT packet passing the ingress hook always reaches the egress
+ * one, so it is charged there only.  The packet is never queued.
+ */
+static unsigned int hpol_shaper_ingress(struct sk_buff *skb,
+					const uint32_t saddr,
+					const uint32_t daddr,
+					uint32_t *disable_hwacc,
+					int (*okfn_nf)(struct sk_buff *),
+					int (*okfn_custom)(struct sk_buff *, void *),
+					void *data)
+{
+	return hpol_police(skb, disable_hwacc, false);
+}
+
+static unsigned int hpol_shaper_egress(struct sk_buff *skb,
+				       const uint32_t saddr,
+				       const uint32_t daddr,
+				       uint32_t *disable_hwacc,
+				       int (*okfn_nf)(struct sk_buff *),
+				       int (*okfn_custom)(struct sk_buff *, void *),
+				       void *data)
+{
+	return hpol_police(skb, disable_hwacc, true);
+}
+
+static unsigned int hpol_forward(unsigned int hooknum,
+				 struct sk_buff *skb,
+				 const struct net_device *in,
+				 const struct net_device *out,
+				 int (*okfn)(struct sk_buff *))
+{
+	uint32_t disable_hwacc = NTC_HWACC_ALLOW;
+	unsigned int verdict = hpol_police(skb, &disable_hwacc, true);
+
+#if IS_ENABLED(CONFIG_RA_HW_NAT)
+	if (verdict == NF_ACCEPT && disable_hwacc == NTC_HWACC_DISABLE)
+		FOE_ALG_MARK(skb);
+#endif
+
+	return verdict;
+}
+
+static int hpol_hwacc_meter(struct nf_conn *ct, int dir,
+			    uint32_t *rate, uint32_t *burst)
+{
+	struct hpol_host *host;
+	int ret = -ENOENT;
+
+	if (dir < 0 || dir >= IP_CT_DIR_MAX)
+		return -EINVAL;
+
+	rcu_read_lock();
+
+	host = hpol_get(ct);
+	if (host != NULL && ACCESS_ONCE(host->hwacc) == HPOL_HWACC_METER) {
+		struct hpol_bucket *b = &host->bucket[dir];
+
+		spin_lock_bh(&b->lock);
+		*rate = b->rate;
+		*burst = b->burst;
+		spin_unlock_bh(&b->lock);
+		ret = 0;
+	}
+
+	rcu_read_unlock();
+
+	return ret;
+}
+
+static struct nf_hook_ops hpol_ops[] __read_mostly = {
+	{
+		.hook		= hpol_forward,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV4,
+		.hooknum	= NF_INET_FORWARD,
+		.priority	= NF_IP_PRI_FILTER + 1,
+	},
+	{
+		.hook		= hpol_forward,
+		.owner		= THIS_MODULE,
+		.pf		= NFPROTO_IPV6,
+		.hooknum	= NF_INET_FORWARD,
+		.priority	= NF_IP6_PRI_FILTER + 1,
+	},
+};
+
+static struct genl_family hpol_genl_family = {
+	.id		= GENL_ID_GENERATE,
+	.hdrsize	= 0,
+	.name		= HPOL_GENL_NAME,
+	.version	= HPOL_GENL_VERSION,
+	.maxattr	= HPOL_A_MAX,
+};
+
+static const struct nla_policy hpol_genl_policy[HPOL_A_MAX + 1] = {
+	[HPOL_A_HOST]		= { .type = NLA_NESTED },
+};
+
+static const struct nla_policy hpol_host_policy[HPOL_HOST_MAX + 1] = {
+	[HPOL_HOST_FAMILY]	= { .type = NLA_U8 },
+	[HPOL_HOST_ADDR]	= { .type = NLA_BINARY,
+				    .len = sizeof(struct in6_addr) },
+	[HPOL_HOST_HWACC]	= { .type = NLA_U8 },
+	[HPOL_HOST_TX_RATE]	= { .type = NLA_U32 },
+	[HPOL_HOST_TX_BURST]	= { .type = NLA_U32 },
+	[HPOL_HOST_RX_RATE]	= { .type = NLA_U32 },
+	[HPOL_HOST_RX_BURST]	= { .type = NLA_U32 },
+};
+
+/* Parses the HPOL_A_HOST of a request and its address */
+static int hpol_parse_host(struct genl_info *info, struct nlattr **tb,
+			   union nf_inet_addr *addr, u8 *family)
+{
+	int ret;
+
+	if (info->attrs[HPOL_A_HOST] == NULL)
+		return -EINVAL;
+
+	ret = nla_parse_nested(tb, HPOL_HOST_MAX, info->attrs[HPOL_A_HOST],
+			       hpol_host_policy);
+	if (ret)
+		return ret;
+
+	if (tb[HPOL_HOST_FAMILY] == NULL || tb[HPOL_HOST_ADDR] == NULL)
+		return -EINVAL;
+
+	*family = nla_get_u8(tb[HPOL_HOST_FAMILY]);
+	memset(addr, 0, sizeof(*addr));
+
+	switch (*family) {
+	case AF_INET:
+		if (nla_len(tb[HPOL_HOST_ADDR]) != sizeof(addr->ip))
+			return -EINVAL;
+		break;
+	case AF_INET6:
+		if (nla_len(tb[HPOL_HOST_ADDR]) != sizeof(addr->ip6))
+			return -EINVAL;
+		break;
+	default:
+		return -EAFNOSUPPORT;
+	}
+
+	nla_memcpy(addr, tb[HPOL_HOST_ADDR], sizeof(*addr));
+
+	return 0;
+}
+
+static int hpol_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (msg == NULL)
+		return -ENOMEM;
+
+	hdr = genlmsg_put_reply(msg, info, &hpol_genl_family, 0,
+				HPOL_CMD_GET);
+	if (hdr == NULL)
+		goto nla_put_failure;
+
+	if (nla_put_u32(msg, HPOL_A_HOSTS_MAX, hpol_hosts_max) ||
+	    nla_put_u32(msg, HPOL_A_HOSTS, ACCESS_ONCE(hpol_used)))
+		goto nla_put_failure;
+
+	genlmsg_end(msg, hdr);
+
+	return genlmsg_reply(msg, info);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return -EMSGSIZE;
+}
+
+static int hpol_genl_set(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *tb[HPOL_HOST_MAX + 1];
+	struct hpol_host *host;
+	union nf_inet_addr addr;
+	u8 family;
+	int ret;
+
+	ret = hpol_parse_host(info, tb, &addr, &family);
+	if (ret)
+		return ret;
+
+	if (tb[HPOL_HOST_HWACC] != NULL &&
+	    nla_get_u8(tb[HPOL_HOST_HWACC]) > HPOL_HWACC_METER)
+		return -EINVAL;
+
+	mutex_lock(&hpol_mutex);
+
+	host = hpol_find(&addr, family);
+	if (host == NULL) {
+		if (list_empty(&hpol_free)) {
+			ret = -ENOSPC;
+			goto out;
+		}
+
+		host = list_first_entry(&hpol_free, struct hpol_host, list);
+		list_del_init(&host->list);
+		hpol_used++;
+
+		host->addr = addr;
+		host->family = family;
+		host->hwacc = HPOL_HWACC_OFF;
+		hpol_bucket_set(&host->bucket[IP_CT_DIR_ORIGINAL], 0, 0);
+		hpol_bucket_set(&host->bucket[IP_CT_DIR_REPLY], 0, 0);
+		host->bucket[IP_CT_DIR_ORIGINAL].drops = 0;
+		host->bucket[IP_CT_DIR_REPLY].drops = 0;
+
+		hlist_add_head_rcu(&host->hnode,
+				   &hpol_hash[hpol_hash_addr(&addr, family)]);
+
+		/* Connections which found no host look again */
+		hpol_gen_bump();
+	}
+
+	if (tb[HPOL_HOST_HWACC] != NULL)
+		ACCESS_ONCE(host->hwacc) = nla_get_u8(tb[HPOL_HOST_HWACC]);
+
+	if (tb[HPOL_HOST_TX_RATE] != NULL)
+		hpol_bucket_set(&host->bucket[IP_CT_DIR_ORIGINAL],
+				nla_get_u32(tb[HPOL_HOST_TX_RATE]),
+				tb[HPOL_HOST_TX_BURST] != NULL ?
+				nla_get_u32(tb[HPOL_HOST_TX_BURST]) : 0);
+
+	if (tb[HPOL_HOST_RX_RATE] != NULL)
+		hpol_bucket_set(&host->bucket[IP_CT_DIR_REPLY],
+				nla_get_u32(tb[HPOL_HOST_RX_RATE]),
+				tb[HPOL_HOST_RX_BURST] != NULL ?
+				nla_get_u32(tb[HPOL_HOST_RX_BURST]) : 0);
+out:
+	mutex_unlock(&hpol_mutex);
+
+	return ret;
+}
+
+/* Slots of unhashed hosts are reused once no packet can see them */
+static void hpol_release(struct list_head *released)
+{
+	struct hpol_host *host, *next;
+
+	hpol_gen_bump();
+	synchronize_rcu();
+
+	list_for_each_entry_safe(host, next, released, list) {
+		host->family = 0;
+		list_move_tail(&host->list, &hpol_free);
+		hpol_used--;
+	}
+}
+
+static int hpol_genl_del(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *tb[HPOL_HOST_MAX + 1];
+	struct hpol_host *host;
+	union nf_inet_addr addr;
+	LIST_HEAD(released);
+	u8 family;
+	int ret;
+
+	ret = hpol_parse_host(info, tb, &addr, &family);
+	if (ret)
+		return ret;
+
+	mutex_lock(&hpol_mutex);
+
+	host = hpol_find(&addr, family);
+	if (host == NULL) {
+		ret = -ENOENT;
+	} else {
+		hlist_del_rcu(&host->hnode);
+		list_add(&host->list, &released);
+		hpol_release(&released);
+	}
+
+	mutex_unlock(&hpol_mutex);
+
+	return ret;
+}
+
+static int hpol_genl_flush(struct sk_buff *skb, struct genl_info *info)
+{
+	LIST_HEAD(released);
+	unsigned int i;
+
+	mutex_lock(&hpol_mutex);
+
+	for (i = 0; i < hpol_hosts_max; i++) {
+		struct hpol_host *host = &hpol_hosts[i];
+
+		if (host->family == 0)
+			continue;
+
+		hlist_del_rcu(&host->hnode);
+		list_add_tail(&host->list, &released);
+	}
+
+	if (!list_empty(&released))
+		hpol_release(&released);
+
+	mutex_unlock(&hpol_mutex);
+
+	return 0;
+}
+
+/* Adds the host in slot to a dump: 1 if added, 0 if the slot is free,
+   -EMSGSIZE if it does not fit; hpol_mutex held */
+static int hpol_fill_host(struct sk_buff *skb, unsigned int slot)
+{
+	struct hpol_host *host = &hpol_hosts[slot];
+	u32 rate[IP_CT_DIR_MAX], burst[IP_CT_DIR_MAX];
+	u64 drops[IP_CT_DIR_MAX];
+	struct nlattr *nest;
+	int dir;
+
+	if (host->family == 0)
+		return 0;
+
+	for (dir = 0; dir < IP_CT_DIR_MAX; dir++) {
+		struct hpol_bucket *b = &host->bucket[dir];
+
+		spin_lock_bh(&b->lock);
+		rate[dir] = b->rate;
+		burst[dir] = b->burst;
+		drops[dir] = b->drops;
+		spin_unlock_bh(&b->lock);
+	}
+
+	nest = nla_nest_start(skb, HPOL_A_HOST);
+	if (nest == NULL)
+		return -EMSGSIZE;
+
+	if (nla_put_u8(skb, HPOL_HOST_FAMILY, host->family) ||
+	    nla_put(skb, HPOL_HOST_ADDR,
+		    host->family == AF_INET ? sizeof(host->addr.ip) :
+					      sizeof(host->addr.ip6),
+		    &host->addr) ||
+	    nla_put_u8(skb, HPOL_HOST_HWACC, host->hwacc) ||
+	    nla_put_u32(skb, HPOL_HOST_TX_RATE, rate[IP_CT_DIR_ORIGINAL]) ||
+	    nla_put_u32(skb, HPOL_HOST_TX_BURST, burst[IP_CT_DIR_ORIGINAL]) ||
+	    nla_put_u32(skb, HPOL_HOST_RX_RATE, rate[IP_CT_DIR_REPLY]) ||
+	    nla_put_u32(skb, HPOL_HOST_RX_BURST, burst[IP_CT_DIR_REPLY]) ||
+	    nla_put_u64(skb, HPOL_HOST_TX_DROPS, drops[IP_CT_DIR_ORIGINAL]) ||
+	    nla_put_u64(skb, HPOL_HOST_RX_DROPS, drops[IP_CT_DIR_REPLY])) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, nest);
+
+	return 1;
+}
+
+/* Each message carries as many hosts as fit, cb->args[0] is the next slot */
+static int hpol_genl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	unsigned int slot = cb->args[0], added = 0;
+	void *hdr;
+	int ret;
+
+	if (slot >= hpol_hosts_max)
+		return 0;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &hpol_genl_family, NLM_F_MULTI, HPOL_CMD_GET);
+	if (hdr == NULL)
+		return -EMSGSIZE;
+
+	mutex_lock(&hpol_mutex);
+
+	for (; slot < hpol_hosts_max; slot++) {
+		ret = hpol_fill_host(skb, slot);
+		if (ret < 0)
+			break;
+		added += ret;
+	}
+
+	mutex_unlock(&hpol_mutex);
+
+	cb->args[0] = slot;
+
+	if (added == 0) {
+		genlmsg_cancel(skb, hdr);
+		return skb->len;
+	}
+
+	genlmsg_end(skb, hdr);
+
+	return skb->len;
+}
+
+static struct genl_ops hpol_genl_ops[] = {
+	{
+		.cmd		= HPOL_CMD_GET,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= hpol_genl_policy,
+		.doit		= hpol_genl_get,
+		.dumpit		= hpol_genl_dump,
+	},
+	{
+		.cmd		= HPOL_CMD_SET,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= hpol_genl_policy,
+		.doit		= hpol_genl_set,
+	},
+	{
+		.cmd		= HPOL_CMD_DEL,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= hpol_genl_policy,
+		.doit		= hpol_genl_del,
+	},
+	{
+		.cmd		= HPOL_CMD_FLUSH,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= hpol_genl_policy,
+		.doit		= hpol_genl_flush,
+	},
+};
+
+static void hpol_tables_free(void)
+{
+	kfree(hpol_hash);
+	vfree(hpol_hosts);
+}
+
+static int hpol_tables_alloc(void)
+{
+	unsigned int i;
+	int dir;
+
+	hpol_hsize = roundup_pow_of_two(hpol_hosts_max);
+
+	hpol_hosts = vzalloc(hpol_hosts_max * sizeof(struct hpol_host));
+	hpol_hash = kcalloc(hpol_hsize, sizeof(struct hlist_head),
+			    GFP_KERNEL);
+	if (hpol_hosts == NULL || hpol_hash == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < hpol_hosts_max; i++) {
+		INIT_HLIST_NODE(&hpol_hosts[i].hnode);
+		for (dir = 0; dir < IP_CT_DIR_MAX; dir++)
+			spin_lock_init(&hpol_hosts[i].bucket[dir].lock);
+		list_add_tail(&hpol_hosts[i].list, &hpol_free);
+	}
+
+	return 0;
+}
+
+static int __init hpol_init(void)
+{
+	int ret;
+
+	if (hpol_hosts_max == 0 || hpol_hosts_max > HPOL_HOSTS_LIMIT) {
+		printk(KERN_ERR "hpol: hosts must be 1 to %u\n",
+		       HPOL_HOSTS_LIMIT);
+		return -EINVAL;
+	}
+
+	/* The shaper hooks have room for one user */
+	if (rcu_access_pointer(ntc_shaper_ingress_hook) != NULL ||
+	    rcu_access_pointer(ntc_shaper_egress_hook) != NULL ||
+	    rcu_access_pointer(ntc_shaper_hwacc_meter) != NULL)
+		return -EBUSY;
+
+	get_random_bytes(&hpol_hash_rnd, sizeof(hpol_hash_rnd));
+
+	ret = hpol_tables_alloc();
+	if (ret)
+		goto err_free;
+
+	ret = genl_register_family_with_ops(&hpol_genl_family,
+					    hpol_genl_ops,
+					    ARRAY_SIZE(hpol_genl_ops));
+	if (ret)
+		goto err_free;
+
+	ret = nf_register_hooks(hpol_ops, ARRAY_SIZE(hpol_ops));
+	if (ret)
+		goto err_genl;
+
+	rcu_assign_pointer(ntc_shaper_hwacc_meter, hpol_hwacc_meter);
+	ntc_shaper_hooks_set(hpol_shaper_ingress, hpol_shaper_egress);
+
+	printk(KERN_INFO "hpol: per-host policer loaded (%u hosts)\n",
+	       hpol_hosts_max);
+
+	return 0;
+
+err_genl:
+	genl_unregister_family(&hpol_genl_family);
+err_free:
+	hpol_tables_free();
+	return ret;
+}
+
+static void __exit hpol_fini(void)
+{
+	ntc_shaper_hooks_set(NULL, NULL);
+	rcu_assign_pointer(ntc_shaper_hwacc_meter, NULL);
+	nf_unregister_hooks(hpol_ops, ARRAY_SIZE(hpol_ops));
+	genl_unregister_family(&hpol_genl_family);
+	synchronize_rcu();
+
+	/* Generations mean nothing to the next instance */
+	nf_ct_iterate_cleanup(&init_net, hpol_unbind, NULL);
+
+	hpol_tables_free();
+
+	printk(KERN_INFO "hpol: per-host policer unloaded\n");
+}
+
+module_init(hpol_init);
+module_exit(hpol_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("http://www.ndmsystems.com");
+MODULE_DESCRIPTION("Per-host policer");
@@ -0,0 +1,536 @@
+/*
+ * Per-host traffic accounting.
+ *
+ * A connection is bound to the host that initiated it on the first
+ * packet of its original direction seen by nf_ct_nacct_packet(), which
+ * is called next to the conntrack counter updates of the slow path and
+ * of the fast NAT paths.  The host then collects per-CPU counters of
+ * what it sent (original direction) and received (reply direction).
+ * The number of live connections of a host is folded back when the
+ * conntrack is freed; a host without connections keeps its counters
+ * until its slot is taken by a new host.  A host is its address together
+ * with the source MAC when the initiator came in over Ethernet, so a
+ * DHCP lease handed to another device starts a new host.
+ *
+ * The host table is a fixed array sized like the DHCP pool with the
+ * "hosts" parameter, so binding never allocates.  Hosts are read over
+ * the NACCT generic netlink family, many hosts per message.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/u64_stats_sync.h>
+#include <net/genetlink.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_nacct.h>
+#include <linux/netfilter/nf_conntrack_nacct.h>
+
+#define NACCT_HOSTS_DEF		256
+/* Slot plus one is kept in a u16 of the conntrack */
+#define NACCT_HOSTS_LIMIT	65535
+
+struct nacct_host {
+	struct hlist_node hnode;
+	struct list_head list;		/* free or idle list */
+	union nf_inet_addr addr;
+	u8 family;			/* 0 while never used */
+	u8 has_mac;
+	u8 mac[ETH_ALEN];
+	u32 serial;
+	unsigned int conns;
+};
+
+struct nacct_counters {
+	u64 packets[IP_CT_DIR_MAX];
+	u64 bytes[IP_CT_DIR_MAX];
+	struct u64_stats_sync syncp;
+};
+
+static unsigned int nacct_hosts_max __read_mostly = NACCT_HOSTS_DEF;
+module_param_named(hosts, nacct_hosts_max, uint, 0400);
+MODULE_PARM_DESC(hosts, "host table size, e.g. the DHCP pool size");
+
+/* Only initiators received on this device are accounted, 0 for any */
+static int nacct_ifindex __read_mostly;
+
+static DEFINE_SPINLOCK(nacct_lock);
+static struct nacct_host *nacct_hosts __read_mostly;
+static struct hlist_head *nacct_hash __read_mostly;
+static unsigned int nacct_hsize __read_mostly;
+static u32 nacct_hash_rnd __read_mostly;
+static LIST_HEAD(nacct_free);
+static LIST_HEAD(nacct_idle);		/* oldest first */
+static unsigned int nacct_used;
+static u32 nacct_serial;
+
+/* Counters of CPU c are nacct_stats[c][slot] */
+static struct nacct_counters **nacct_stats __read_mostly;
+
+static inline unsigned int nacct_hash_addr(const union nf_inet_addr *addr,
+					   u8 family)
+{
+	return jhash2(addr->all, ARRAY_SIZE(addr->all),
+		      nacct_hash_rnd ^ family) & (nacct_hsize - 1);
+}
+
+/* mac is NULL for initiators not seen on Ethernet */
+static struct nacct_host *nacct_find(const union nf_inet_addr *addr,
+				     u8 family, const u8 *mac,
+				     unsigned int hash)
+{
+	struct nacct_host *host;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(host, n, &nacct_hash[hash], hnode) {
+		if (host->family == family &&
+		    nf_inet_addr_cmp(&host->addr, addr) &&
+		    host->has_mac == (mac != NULL) &&
+		    (mac == NULL || ether_addr_equal(host->mac, mac)))
+			return host;
+	}
+
+	return NULL;
+}
+
+/* Takes a free slot, or the one idle for the longest time */
+static struct nacct_host *nacct_alloc(const union nf_inet_addr *addr,
+				      u8 family, const u8 *mac,
+				      unsigned int hash)
+{
+	struct nacct_host *host;
+
+	if (!list_empty(&nacct_free)) {
+		host = list_first_entry(&nacct_free, struct nacct_host, list);
+		nacct_used++;
+	} else if (!list_empty(&nacct_idle)) {
+		unsigned int slot;
+		int cpu;
+
+		host = list_first_entry(&nacct_idle, struct nacct_host, list);
+		hlist_del(&host->hnode);
+
+		/* No connection is bound, so nothing updates these */
+		slot = host - nacct_hosts;
+		for_each_possible_cpu(cpu)
+			memset(&nacct_stats[cpu][slot], 0,
+			       sizeof(struct nacct_counters));
+	} else {
+		return NULL;
+	}
+
+	list_del_init(&host->list);
+	host->addr = *addr;
+	host->family = family;
+	host->has_mac = mac != NULL;
+	if (mac != NULL)
+		memcpy(host->mac, mac, ETH_ALEN);
+	host->serial = ++nacct_serial;
+	host->conns = 0;
+	hlist_add_head(&host->hnode, &nacct_hash[hash]);
+
+	return host;
+}
+
+/* Binds ct to its initiator, returns the slot plus one or 0 */
+static unsigned int nacct_bind(struct nf_conn *ct, const struct sk_buff *skb)
+{
+	const struct nf_conntrack_tuple *tuple;
+	const struct net_device *dev = skb->dev;
+	struct nacct_host *host;
+	union nf_inet_addr addr;
+	const u8 *mac = NULL;
+	unsigned int hash, slot;
+	int ifindex = ACCESS_ONCE(nacct_ifindex);
+	u8 family;
+
+	if (ifindex != 0 && (dev == NULL || dev->ifindex != ifindex))
+		return 0;
+
+	if (dev != NULL && dev->type == ARPHRD_ETHER &&
+	    skb_mac_header_was_set(skb) &&
+	    skb_mac_header(skb) + ETH_HLEN <= skb_network_header(skb))
+		mac = eth_hdr(skb)->h_source;
+
+	tuple = nf_ct_tuple(ct, IP_CT_DIR_ORIGINAL);
+	nf_ct_addr_to_inet(&addr, &tuple->src.u3);
+	family = tuple->src.l3num;
+	hash = nacct_hash_addr(&addr, family);
+
+	spin_lock(&nacct_lock);
+
+	/* Another CPU may have been first */
+	slot = ct->nacct_host;
+	if (slot != 0)
+		goto out;
+
+	host = nacct_find(&addr, family, mac, hash);
+	if (host == NULL) {
+		host = nacct_alloc(&addr, family, mac, hash);
+		if (host == NULL)
+			goto out;
+	}
+
+	/* First connection takes the host off the idle list */
+	if (host->conns++ == 0)
+		list_del_init(&host->list);
+
+	slot = host - nacct_hosts + 1;
+	ct->nacct_host = slot;
+out:
+	spin_unlock(&nacct_lock);
+
+	return slot;
+}
+
+static void nacct_packet(struct nf_conn *ct, enum ip_conntrack_dir dir,
+			 const struct sk_buff *skb, unsigned int len)
+{
+	struct nacct_counters *c;
+	unsigned int slot, segs;
+
+	if (unlikely(nf_ct_is_untracked(ct)))
+		return;
+
+	/* Also called from process context on local output */
+	local_bh_disable();
+
+	slot = ct->nacct_host;
+	if (unlikely(slot == 0)) {
+		if (dir != IP_CT_DIR_ORIGINAL)
+			goto out;
+
+		slot = nacct_bind(ct, skb);
+		if (slot == 0)
+			goto out;
+	}
+
+	segs = nf_ct_acct_segs(skb, &len);
+
+	c = &nacct_stats[smp_processor_id()][slot - 1];
+	u64_stats_update_begin(&c->syncp);
+	c->packets[dir] += segs;
+	c->bytes[dir] += len;
+	u64_stats_update_end(&c->syncp);
+out:
+	local_bh_enable();
+}
+
+static void nacct_conntrack_destroy(struct nf_conn *ct)
+{
+	unsigned int slot = ct->nacct_host;
+	struct nacct_host *host;
+
+	if (slot == 0 || slot > nacct_hosts_max)
+		return;
+
+	ct->nacct_host = 0;
+	host = &nacct_hosts[slot - 1];
+
+	spin_lock_bh(&nacct_lock);
+	if (host->conns > 0 && --host->conns == 0)
+		list_add_tail(&host->list, &nacct_idle);
+	spin_unlock_bh(&nacct_lock);
+}
+
+static int nacct_unbind(struct nf_conn *ct, void *data)
+{
+	ct->nacct_host = 0;
+	return 0;
+}
+
+static void nacct_unbind_pcpu(struct net *net, bool dying)
+{
+	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_node *n;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct ct_pcpu *pcpu = per_cpu_ptr(net->ct.pcpu_lists, cpu);
+
+		spin_lock_bh(&pcpu->lock);
+		hlist_nulls_for_each_entry(h, n, dying ? &pcpu->dying :
+						 &pcpu->unconfirmed, hnnode)
+			nacct_unbind(nf_ct_tuplehash_to_ctrack(h), NULL);
+		spin_unlock_bh(&pcpu->lock);
+	}
+}
+
+static struct genl_family nacct_genl_family = {
+	.id		= GENL_ID_GENERATE,
+	.hdrsize	= 0,
+	.name		= NACCT_GENL_NAME,
+	.version	= NACCT_GENL_VERSION,
+	.maxattr	= NACCT_A_MAX,
+};
+
+static const struct nla_policy nacct_genl_policy[NACCT_A_MAX + 1] = {
+	[NACCT_A_IFINDEX]	= { .type = NLA_U32 },
+};
+
+static int nacct_genl_get(struct sk_buff *skb, struct genl_info *info)
+{
+	struct sk_buff *msg;
+	void *hdr;
+
+	msg = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (msg == NULL)
+		return -ENOMEM;
+
+	hdr = genlmsg_put_reply(msg, info, &nacct_genl_family, 0,
+				NACCT_CMD_GET);
+	if (hdr == NULL)
+		goto nla_put_failure;
+
+	if (nla_put_u32(msg, NACCT_A_IFINDEX, ACCESS_ONCE(nacct_ifindex)) ||
+	    nla_put_u32(msg, NACCT_A_HOSTS_MAX, nacct_hosts_max) ||
+	    nla_put_u32(msg, NACCT_A_HOSTS, ACCESS_ONCE(nacct_used)))
+		goto nla_put_failure;
+
+	genlmsg_end(msg, hdr);
+
+	return genlmsg_reply(msg, info);
+
+nla_put_failure:
+	nlmsg_free(msg);
+	return -EMSGSIZE;
+}
+
+static int nacct_genl_set(struct sk_buff *skb, struct genl_info *info)
+{
+	if (info->attrs[NACCT_A_IFINDEX])
+		nacct_ifindex = nla_get_u32(info->attrs[NACCT_A_IFINDEX]);
+
+	return 0;
+}
+
+/* Adds the host in slot to a dump: 1 if added, 0 if the slot was never
+   used, -EMSGSIZE if it does not fit */
+static int nacct_fill_host(struct sk_buff *skb, unsigned int slot)
+{
+	u64 packets[IP_CT_DIR_MAX] = { 0, 0 }, bytes[IP_CT_DIR_MAX] = { 0, 0 };
+	struct nacct_host host;
+	struct nlattr *nest;
+	int cpu;
+
+	spin_lock_bh(&nacct_lock);
+
+	host = nacct_hosts[slot];
+	if (host.family == 0) {
+		spin_unlock_bh(&nacct_lock);
+		return 0;
+	}
+
+	for_each_possible_cpu(cpu) {
+		const struct nacct_counters *c = &nacct_stats[cpu][slot];
+		u64 p[IP_CT_DIR_MAX], b[IP_CT_DIR_MAX];
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&c->syncp);
+			memcpy(p, c->packets, sizeof(p));
+			memcpy(b, c->bytes, sizeof(b));
+		} while (u64_stats_fetch_retry_bh(&c->syncp, start));
+
+		packets[IP_CT_DIR_ORIGINAL] += p[IP_CT_DIR_ORIGINAL];
+		packets[IP_CT_DIR_REPLY] += p[IP_CT_DIR_REPLY];
+		bytes[IP_CT_DIR_ORIGINAL] += b[IP_CT_DIR_ORIGINAL];
+		bytes[IP_CT_DIR_REPLY] += b[IP_CT_DIR_REPLY];
+	}
+
+	spin_unlock_bh(&nacct_lock);
+
+	nest = nla_nest_start(skb, NACCT_A_HOST);
+	if (nest == NULL)
+		return -EMSGSIZE;
+
+	if (nla_put_u8(skb, NACCT_HOST_FAMILY, host.family) ||
+	    nla_put(skb, NACCT_HOST_ADDR,
+		    host.family == AF_INET ? sizeof(host.addr.ip) :
+					     sizeof(host.addr.ip6),
+		    &host.addr) ||
+	    (host.has_mac &&
+	     nla_put(skb, NACCT_HOST_MAC, ETH_ALEN, host.mac)) ||
+	    nla_put_u32(skb, NACCT_HOST_SERIAL, host.serial) ||
+	    nla_put_u32(skb, NACCT_HOST_CONNS, host.conns) ||
+	    nla_put_u64(skb, NACCT_HOST_TX_PACKETS,
+			packets[IP_CT_DIR_ORIGINAL]) ||
+	    nla_put_u64(skb, NACCT_HOST_TX_BYTES, bytes[IP_CT_DIR_ORIGINAL]) ||
+	    nla_put_u64(skb, NACCT_HOST_RX_PACKETS, packets[IP_CT_DIR_REPLY]) ||
+	    nla_put_u64(skb, NACCT_HOST_RX_BYTES, bytes[IP_CT_DIR_REPLY])) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, nest);
+
+	return 1;
+}
+
+/* Each message carries as many hosts as fit, cb->args[0] is the next slot */
+static int nacct_genl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	unsigned int slot = cb->args[0], added = 0;
+	void *hdr;
+	int ret;
+
+	if (slot >= nacct_hosts_max)
+		return 0;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &nacct_genl_family, NLM_F_MULTI, NACCT_CMD_GET);
+	if (hdr == NULL)
+		return -EMSGSIZE;
+
+	for (; slot < nacct_hosts_max; slot++) {
+		ret = nacct_fill_host(skb, slot);
+		if (ret < 0)
+			break;
+		added += ret;
+	}
+
+	cb->args[0] = slot;
+
+	if (added == 0) {
+		genlmsg_cancel(skb, hdr);
+		return skb->len;
+	}
+
+	genlmsg_end(skb, hdr);
+
+	return skb->len;
+}
+
+static struct genl_ops nacct_genl_ops[] = {
+	{
+		.cmd		= NACCT_CMD_GET,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= nacct_genl_policy,
+		.doit		= nacct_genl_get,
+		.dumpit		= nacct_genl_dump,
+	},
+	{
+		.cmd		= NACCT_CMD_SET,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= nacct_genl_policy,
+		.doit		= nacct_genl_set,
+	},
+};
+
+static void nacct_tables_free(void)
+{
+	int cpu;
+
+	if (nacct_stats != NULL) {
+		for_each_possible_cpu(cpu)
+			vfree(nacct_stats[cpu]);
+		kfree(nacct_stats);
+	}
+
+	kfree(nacct_hash);
+	vfree(nacct_hosts);
+}
+
+static int nacct_tables_alloc(void)
+{
+	unsigned int i;
+	int cpu;
+
+	nacct_hsize = roundup_pow_of_two(nacct_hosts_max);
+
+	nacct_hosts = vzalloc(nacct_hosts_max * sizeof(struct nacct_host));
+	nacct_hash = kcalloc(nacct_hsize, sizeof(struct hlist_head),
+			     GFP_KERNEL);
+	nacct_stats = kcalloc(nr_cpu_ids, sizeof(struct nacct_counters *),
+			      GFP_KERNEL);
+	if (nacct_hosts == NULL || nacct_hash == NULL || nacct_stats == NULL)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		nacct_stats[cpu] = vzalloc(nacct_hosts_max *
+					   sizeof(struct nacct_counters));
+		if (nacct_stats[cpu] == NULL)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < nacct_hosts_max; i++) {
+		INIT_HLIST_NODE(&nacct_hosts[i].hnode);
+		list_add_tail(&nacct_hosts[i].list, &nacct_free);
+	}
+
+	return 0;
+}
+
+static int __init nacct_init(void)
+{
+	int ret;
+
+	if (nacct_hosts_max == 0 || nacct_hosts_max > NACCT_HOSTS_LIMIT) {
+		printk(KERN_ERR "nacct: hosts must be 1 to %u\n",
+		       NACCT_HOSTS_LIMIT);
+		return -EINVAL;
+	}
+
+	if (rcu_access_pointer(nacct_conntrack_free) != NULL ||
+	    rcu_access_pointer(nacct_packet_hook) != NULL)
+		return -EBUSY;
+
+	get_random_bytes(&nacct_hash_rnd, sizeof(nacct_hash_rnd));
+
+	ret = nacct_tables_alloc();
+	if (ret)
+		goto err_free;
+
+	ret = genl_register_family_with_ops(&nacct_genl_family,
+					    nacct_genl_ops,
+					    ARRAY_SIZE(nacct_genl_ops));
+	if (ret)
+		goto err_free;
+
+	rcu_assign_pointer(nacct_conntrack_free, nacct_conntrack_destroy);
+	rcu_assign_pointer(nacct_packet_hook, nacct_packet);
+	static_key_slow_inc(&nacct_packet_key);
+
+	printk(KERN_INFO "nacct: per-host accounting loaded (%u hosts)\n",
+	       nacct_hosts_max);
+
+	return 0;
+
+err_free:
+	nacct_tables_free();
+	return ret;
+}
+
+static void __exit nacct_fini(void)
+{
+	static_key_slow_dec(&nacct_packet_key);
+	rcu_assign_pointer(nacct_packet_hook, NULL);
+	rcu_assign_pointer(nacct_conntrack_free, NULL);
+	synchronize_rcu();
+
+	/* Slots mean nothing to the next instance.  Conntracks only move
+	   from unconfirmed to the hash and from there to dying, so in this
+	   order none is missed. */
+	nacct_unbind_pcpu(&init_net, false);
+	nf_ct_iterate_cleanup(&init_net, nacct_unbind, NULL);
+	nacct_unbind_pcpu(&init_net, true);
+
+	genl_unregister_family(&nacct_genl_family);
+	nacct_tables_free();
+
+	printk(KERN_INFO "nacct: per-host accounting unloaded\n");
+}
+
+module_init(nacct_init);
+module_exit(nacct_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("http://www.ndmsystems.com");
+MODULE_DESCRIPTION("Per-host traffic accounting");
@@ -144,10 +144,7 @@ nla_put_failure:
 static inline int
 ctnetlink_dump_timeout(struct sk_buff *skb, const struct nf_conn *ct)
 {
-	long timeout = ((long)ct->timeout.expires - (long)jiffies) / HZ;
-
-	if (timeout < 0)
-		timeout = 0;
+	long timeout = nf_ct_expires(ct) / HZ;
 
 	if (nla_put_be32(skb, CTA_TIMEOUT, htonl(timeout)))
 		goto nla_put_failure;
@@ -248,11 +245,10 @@ ctnetlink_dump_counters(struct sk_buff *skb, const struct nf_conn *ct,
 		return 0;
 
 	if (type == IPCTNL_MSG_CT_GET_CTRZERO) {
-		pkts = atomic64_xchg(&acct[dir].packets, 0);
-		bytes = atomic64_xchg(&acct[dir].bytes, 0);
+		nf_ct_acct_read_and_zero(&acct[dir], &pkts, &bytes);
 	} else {
-		pkts = atomic64_read(&acct[dir].packets);
-		bytes = atomic64_read(&acct[dir].bytes);
+		pkts = nf_ct_acct_packets(&acct[dir]);
+		bytes = nf_ct_acct_bytes(&acct[dir]);
 	}
 	return dump_counters(skb, pkts, bytes, dir);
 }
@@ -436,9 +432,20 @@ nla_put_failure:
 	return -1;
 }
 
+static inline int
+ctnetlink_dump_gen(struct sk_buff *skb, u32 gen)
+{
+	if (gen && nla_put_be32(skb, CTA_DUMP_GEN, htonl(gen)))
+		goto nla_put_failure;
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
 static int
 ctnetlink_fill_info(struct sk_buff *skb, u32 pid, u32 seq, u32 type,
-		    struct nf_conn *ct)
+		    struct nf_conn *ct, u32 gen)
 {
 	struct nlmsghdr *nlh;
 	struct nfgenmsg *nfmsg;
@@ -482,7 +489,8 @@ ctnetlink_fill_info(struct sk_buff *skb, u32 pid, u32 seq, u32 type,
 	    ctnetlink_dump_id(skb, ct) < 0 ||
 	    ctnetlink_dump_use(skb, ct) < 0 ||
 	    ctnetlink_dump_master(skb, ct) < 0 ||
-	    ctnetlink_dump_nat_seq_adj(skb, ct) < 0)
+	    ctnetlink_dump_nat_seq_adj(skb, ct) < 0 ||
+	    ctnetlink_dump_gen(skb, gen) < 0)
 		goto nla_put_failure;
 
 	nlmsg_end(skb, nlh);
@@ -516,7 +524,7 @@ ctnetlink_proto_size(const struct nf_conn *ct)
 static inline size_t
 ctnetlink_counters_size(const struct nf_conn *ct)
 {
-	if (!nf_ct_ext_exist(ct, NF_CT_EXT_ACCT))
+	if (!nf_conn_acct_find(ct))
 		return 0;
 	return 2 * nla_total_size(0) /* CTA_COUNTERS_ORIG|REPL */
 	       + 2 * nla_total_size(sizeof(uint64_t)) /* CTA_COUNTERS_PACKETS */
@@ -727,13 +735,53 @@ static int ctnetlink_done(struct netlink_callback *cb)
 	return 0;
 }
 
+#define CTNL_FILTER_MARK	0x01
+#define CTNL_FILTER_NDMMARK	0x02
+#define CTNL_FILTER_L4PROTO	0x04
+#define CTNL_FILTER_DELTA	0x08
+
 struct ctnetlink_dump_filter {
+	unsigned int flags;
 	struct {
 		u_int32_t val;
 		u_int32_t mask;
 	} mark;
+	struct {
+		u_int8_t val;
+		u_int8_t mask;
+	} ndm_mark;
+	u_int8_t l4proto;
+	/* Only entries changed in generation since or later */
+	u_int32_t since;
+	/* Generation opened by this dump, reported to the client */
+	u_int32_t gen;
 };
 
+static bool
+ctnetlink_filter_match(const struct nf_conn *ct,
+		       const struct ctnetlink_dump_filter *filter)
+{
+#ifdef CONFIG_NF_CONNTRACK_MARK
+	if ((filter->flags & CTNL_FILTER_MARK) &&
+	    (ct->mark & filter->mark.mask) != filter->mark.val)
+		return false;
+
+	if ((filter->flags & CTNL_FILTER_NDMMARK) &&
+	    (ct->ndm_mark & filter->ndm_mark.mask) != filter->ndm_mark.val)
+		return false;
+#endif
+	if ((filter->flags & CTNL_FILTER_L4PROTO) &&
+	    nf_ct_protonum(ct) != filter->l4proto)
+		return false;
+
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	if ((filter->flags & CTNL_FILTER_DELTA) && filter->since &&
+	    (s32)(ct->dump_gen - filter->since) < 0)
+		return false;
+#endif
+	return true;
+}
+
 static int
 ctnetlink_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
 {
@@ -743,15 +791,21 @@ ctnetlink_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
 	struct hlist_nulls_node *n;
 	struct nfgenmsg *nfmsg = nlmsg_data(cb->nlh);
 	u_int8_t l3proto = nfmsg->nfgen_family;
+	spinlock_t *lockp;
 	int res;
-#ifdef CONFIG_NF_CONNTRACK_MARK
 	const struct ctnetlink_dump_filter *filter = cb->data;
-#endif
 
-	spin_lock_bh(&nf_conntrack_lock);
+	local_bh_disable();
 	last = (struct nf_conn *)cb->args[1];
 	for (; cb->args[0] < net->ct.htable_size; cb->args[0]++) {
 restart:
+		lockp = &nf_conntrack_locks[cb->args[0] % CONNTRACK_LOCKS];
+		nf_conntrack_bucket_lock(lockp);
+		/* The table may have shrunk while we were waiting */
+		if (cb->args[0] >= net->ct.htable_size) {
+			spin_unlock(lockp);
+			goto out;
+		}
 		hlist_nulls_for_each_entry(h, n, &net->ct.hash[cb->args[0]],
 					 hnnode) {
 			if (NF_CT_DIRECTION(h) != IP_CT_DIR_ORIGINAL)
@@ -767,32 +821,30 @@ restart:
 					continue;
 				cb->args[1] = 0;
 			}
-#ifdef CONFIG_NF_CONNTRACK_MARK
-			if (filter && !((ct->mark & filter->mark.mask) ==
-					filter->mark.val)) {
+			if (filter && !ctnetlink_filter_match(ct, filter))
 				continue;
-			}
-#endif
 			rcu_read_lock();
 			res =
 			ctnetlink_fill_info(skb, NETLINK_CB(cb->skb).pid,
 					    cb->nlh->nlmsg_seq,
 					    NFNL_MSG_TYPE(cb->nlh->nlmsg_type),
-					    ct);
+					    ct, filter ? filter->gen : 0);
 			rcu_read_unlock();
 			if (res < 0) {
 				nf_conntrack_get(&ct->ct_general);
 				cb->args[1] = (unsigned long)ct;
+				spin_unlock(lockp);
 				goto out;
 			}
 		}
+		spin_unlock(lockp);
 		if (cb->args[1]) {
 			cb->args[1] = 0;
 			goto restart;
 		}
 	}
 out:
-	spin_unlock_bh(&nf_conntrack_lock);
+	local_bh_enable();
 	if (last) {
 		/* nf ct hash resize happened, now clear the leftover. */
 		if ((struct nf_conn *)cb->args[1] == last)
@@ -950,6 +1002,9 @@ static const struct nla_policy ct_nla_policy[CTA_MAX+1] = {
 	[CTA_ZONE]		= { .type = NLA_U16 },
 	[CTA_MARK_MASK]		= { .type = NLA_U32 },
 	[CTA_NDMMARK]		= { .type = NLA_U8 },
+	[CTA_NDMMARK_MASK]	= { .type = NLA_U8 },
+	[CTA_DUMP_GEN]		= { .type = NLA_U32 },
+	[CTA_DUMP_L4PROTO]	= { .type = NLA_U8 },
 };
 
 static int
@@ -999,7 +1054,7 @@ ctnetlink_del_conntrack(struct sock *ctnl, struct sk_buff *skb,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
+	if (nf_ct_timeout_del(ct)) {
 		if (nf_conntrack_event_report(IPCT_DESTROY, ct,
 					      NETLINK_CB(skb).pid,
 					      nlmsg_report(nlh)) < 0) {
@@ -1019,6 +1074,58 @@ ctnetlink_del_conntrack(struct sock *ctnl, struct sk_buff *skb,
 	return 0;
 }
 
+/* Dump filter of a request, NULL to dump everything */
+static struct ctnetlink_dump_filter *
+ctnetlink_alloc_filter(struct net *net, const struct nlattr * const cda[])
+{
+	struct ctnetlink_dump_filter *filter;
+
+#ifndef CONFIG_NF_CONNTRACK_DELTA
+	if (cda[CTA_DUMP_GEN])
+		return ERR_PTR(-EOPNOTSUPP);
+#endif
+
+	filter = kzalloc(sizeof(struct ctnetlink_dump_filter), GFP_ATOMIC);
+	if (filter == NULL)
+		return ERR_PTR(-ENOMEM);
+
+#ifdef CONFIG_NF_CONNTRACK_MARK
+	if (cda[CTA_MARK] && cda[CTA_MARK_MASK]) {
+		filter->mark.val = ntohl(nla_get_be32(cda[CTA_MARK]));
+		filter->mark.mask = ntohl(nla_get_be32(cda[CTA_MARK_MASK]));
+		filter->flags |= CTNL_FILTER_MARK;
+	}
+
+	if (cda[CTA_NDMMARK]) {
+		filter->ndm_mark.mask = cda[CTA_NDMMARK_MASK] ?
+			nla_get_u8(cda[CTA_NDMMARK_MASK]) : 0xff;
+		filter->ndm_mark.val = nla_get_u8(cda[CTA_NDMMARK]) &
+			filter->ndm_mark.mask;
+		filter->flags |= CTNL_FILTER_NDMMARK;
+	}
+#endif
+	if (cda[CTA_DUMP_L4PROTO]) {
+		filter->l4proto = nla_get_u8(cda[CTA_DUMP_L4PROTO]);
+		filter->flags |= CTNL_FILTER_L4PROTO;
+	}
+
+#ifdef CONFIG_NF_CONNTRACK_DELTA
+	if (cda[CTA_DUMP_GEN]) {
+		/* Changes from now on are stamped with the new generation,
+		   which the client passes back on its next poll. */
+		filter->since = ntohl(nla_get_be32(cda[CTA_DUMP_GEN]));
+		filter->gen = atomic_inc_return(&net->ct.dump_gen);
+		filter->flags |= CTNL_FILTER_DELTA;
+	}
+#endif
+	if (!filter->flags) {
+		kfree(filter);
+		return NULL;
+	}
+
+	return filter;
+}
+
 static int
 ctnetlink_get_conntrack(struct sock *ctnl, struct sk_buff *skb,
 			const struct nlmsghdr *nlh,
@@ -1039,21 +1146,13 @@ ctnetlink_get_conntrack(struct sock *ctnl, struct sk_buff *skb,
 			.dump = ctnetlink_dump_table,
 			.done = ctnetlink_done,
 		};
-#ifdef CONFIG_NF_CONNTRACK_MARK
-		if (cda[CTA_MARK] && cda[CTA_MARK_MASK]) {
-			struct ctnetlink_dump_filter *filter;
-
-			filter = kzalloc(sizeof(struct ctnetlink_dump_filter),
-					 GFP_ATOMIC);
-			if (filter == NULL)
-				return -ENOMEM;
-
-			filter->mark.val = ntohl(nla_get_be32(cda[CTA_MARK]));
-			filter->mark.mask =
-				ntohl(nla_get_be32(cda[CTA_MARK_MASK]));
-			c.data = filter;
-		}
-#endif
+		struct ctnetlink_dump_filter *filter;
+
+		filter = ctnetlink_alloc_filter(net, cda);
+		if (IS_ERR(filter))
+			return PTR_ERR(filter);
+
+		c.data = filter;
 		return netlink_dump_start(ctnl, skb, nlh, &c);
 	}
 
@@ -1086,7 +1185,7 @@ ctnetlink_get_conntrack(struct sock *ctnl, struct sk_buff *skb,
 
 	rcu_read_lock();
 	err = ctnetlink_fill_info(skb2, NETLINK_CB(skb).pid, nlh->nlmsg_seq,
-				  NFNL_MSG_TYPE(nlh->nlmsg_type), ct);
+				  NFNL_MSG_TYPE(nlh->nlmsg_type), ct, 0);
 	rcu_read_unlock();
 	nf_ct_put(ct);
 	if (err <= 0)
@@ -1270,11 +1369,10 @@ ctnetlink_change_timeout(struct nf_conn *ct, const struct nlattr * const cda[])
 {
 	u_int32_t timeout = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
 
-	if (!del_timer(&ct->timeout))
+	if (!nf_ct_timeout_del(ct))
 		return -ETIME;
 
-	ct->timeout.expires = jiffies + timeout * HZ;
-	add_timer(&ct->timeout);
+	nf_ct_timeout_start(ct, jiffies + timeout * HZ);
 
 	return 0;
 }
@@ -1420,6 +1518,7 @@ ctnetlink_change_conntrack(struct nf_conn *ct,
 			return err;
 	}
 #endif
+	nf_ct_touch(ct);
 
 	return 0;
 }
@@ -1442,9 +1541,9 @@ ctnetlink_create_conntrack(struct net *net,
 
 	if (!cda[CTA_TIMEOUT])
 		goto err1;
-	ct->timeout.expires = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
+	nf_ct_timeout_expires(ct) = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
 
-	ct->timeout.expires = jiffies + ct->timeout.expires * HZ;
+	nf_ct_timeout_expires(ct) = jiffies + nf_ct_timeout_expires(ct) * HZ;
 
 	rcu_read_lock();
  	if (cda[CTA_HELP]) {
@@ -523,8 +523,9 @@ static int dccp_packet(struct nf_conn *ct, const struct sk_buff *skb,
 	case CT_DCCP_PARTOPEN:
 		if (old_state == CT_DCCP_RESPOND &&
 		    type == DCCP_PKT_ACK &&
-		    dccp_ack_seq(dh) == ct->proto.dccp.handshake_seq)
-			set_bit(IPS_ASSURED_BIT, &ct->status);
+		    dccp_ack_seq(dh) == ct->proto.dccp.handshake_seq &&
+		    !test_and_set_bit(IPS_ASSURED_BIT, &ct->status))
+			nf_ct_evict_update(ct);
 		break;
 	case CT_DCCP_IGNORE:
 		/*
@@ -254,8 +254,10 @@ static int gre_packet(struct nf_conn *ct,
 		nf_ct_refresh_acct(ct, ctinfo, skb,
 				   ct->proto.gre.stream_timeout);
 		/* Also, more likely to be important, and not a probe. */
-		if (!test_and_set_bit(IPS_ASSURED_BIT, &ct->status))
+		if (!test_and_set_bit(IPS_ASSURED_BIT, &ct->status)) {
 			nf_conntrack_event_cache(IPCT_ASSURED, ct);
+			nf_ct_evict_update(ct);
+		}
 	} else
 		nf_ct_refresh_acct(ct, ctinfo, skb,
 				   ct->proto.gre.timeout);
@@ -384,6 +384,7 @@ static int sctp_packet(struct nf_conn *ct,
 		pr_debug("Setting assured bit\n");
 		set_bit(IPS_ASSURED_BIT, &ct->status);
 		nf_conntrack_event_cache(IPCT_ASSURED, ct);
+		nf_ct_evict_update(ct);
 	}
 
 	return NF_ACCEPT;
@@ -1045,8 +1045,11 @@ static int tcp_packet(struct nf_conn *ct,
 		timeout = timeouts[new_state];
 	spin_unlock_bh(&ct->lock);
 
-	if (new_state != old_state)
+	if (new_state != old_state) {
 		nf_conntrack_event_cache(IPCT_PROTOINFO, ct);
+		if (nf_ct_is_confirmed(ct))
+			nf_ct_evict_update(ct);
+	}
 
 	if (!test_bit(IPS_SEEN_REPLY_BIT, &ct->status)) {
 		/* If only reply is a RST, we can consider ourselves not to
@@ -1072,6 +1075,7 @@ static int tcp_packet(struct nf_conn *ct,
 		   connection. */
 		set_bit(IPS_ASSURED_BIT, &ct->status);
 		nf_conntrack_event_cache(IPCT_ASSURED, ct);
+		nf_ct_evict_update(ct);
 	}
 	nf_ct_refresh_acct(ct, ctinfo, skb, timeout);
 
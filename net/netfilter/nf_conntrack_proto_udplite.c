@@ -89,8 +89,10 @@ static int udplite_packet(struct nf_conn *ct,
 		nf_ct_refresh_acct(ct, ctinfo, skb,
 				   timeouts[UDPLITE_CT_REPLIED]);
 		/* Also, more likely to be important, and not a probe */
-		if (!test_and_set_bit(IPS_ASSURED_BIT, &ct->status))
+		if (!test_and_set_bit(IPS_ASSURED_BIT, &ct->status)) {
 			nf_conntrack_event_cache(IPCT_ASSURED, ct);
+			nf_ct_evict_update(ct);
+		}
 	} else {
 		nf_ct_refresh_acct(ct, ctinfo, skb,
 				   timeouts[UDPLITE_CT_UNREPLIED]);
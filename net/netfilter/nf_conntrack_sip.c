@@ -74,7 +74,7 @@ unsigned int (*nf_nat_sdp_addr_hook)(struct sk_buff *skb, unsigned int dataoff,
 				     unsigned int sdpoff,
 				     enum sdp_header_types type,
 				     enum sdp_header_types term,
-				     const union nf_inet_addr *addr)
+				     const union nf_conntrack_address *addr)
 				     __read_mostly;
 EXPORT_SYMBOL_GPL(nf_nat_sdp_addr_hook);
 
@@ -91,7 +91,7 @@ unsigned int (*nf_nat_sdp_session_hook)(struct sk_buff *skb,
 					const char **dptr,
 					unsigned int *datalen,
 					unsigned int sdpoff,
-					const union nf_inet_addr *addr)
+					const union nf_conntrack_address *addr)
 					__read_mostly;
 EXPORT_SYMBOL_GPL(nf_nat_sdp_session_hook);
 
@@ -102,7 +102,7 @@ unsigned int (*nf_nat_sdp_media_hook)(struct sk_buff *skb, unsigned int dataoff,
 				      struct nf_conntrack_expect *rtcp_exp,
 				      unsigned int mediaoff,
 				      unsigned int medialen,
-				      union nf_inet_addr *rtp_addr)
+				      union nf_conntrack_address *rtp_addr)
 				      __read_mostly;
 EXPORT_SYMBOL_GPL(nf_nat_sdp_media_hook);
 
@@ -184,7 +184,7 @@ static int media_len(const struct nf_conn *ct, const char *dptr,
 }
 
 static int parse_addr(const struct nf_conn *ct, const char *cp,
-                      const char **endp, union nf_inet_addr *addr,
+                      const char **endp, union nf_conntrack_address *addr,
                       const char *limit)
 {
 	const char *end;
@@ -198,9 +198,11 @@ static int parse_addr(const struct nf_conn *ct, const char *cp,
 	case AF_INET:
 		ret = in4_pton(cp, limit - cp, (u8 *)&addr->ip, -1, &end);
 		break;
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case AF_INET6:
 		ret = in6_pton(cp, limit - cp, (u8 *)&addr->ip6, -1, &end);
 		break;
+#endif
 	default:
 		BUG();
 	}
@@ -216,7 +218,7 @@ static int parse_addr(const struct nf_conn *ct, const char *cp,
 static int epaddr_len(const struct nf_conn *ct, const char *dptr,
 		      const char *limit, int *shift)
 {
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	const char *aux = dptr;
 
 	if (!parse_addr(ct, dptr, &dptr, &addr, limit)) {
@@ -268,7 +270,7 @@ static int skp_epaddr_len(const struct nf_conn *ct, const char *dptr,
 int ct_sip_parse_request(const struct nf_conn *ct,
 			 const char *dptr, unsigned int datalen,
 			 unsigned int *matchoff, unsigned int *matchlen,
-			 union nf_inet_addr *addr, __be16 *port)
+			 union nf_conntrack_address *addr, __be16 *port)
 {
 	const char *start = dptr, *limit = dptr + datalen, *end;
 	unsigned int mlen;
@@ -537,7 +539,7 @@ int ct_sip_parse_header_uri(const struct nf_conn *ct, const char *dptr,
 			    unsigned int *dataoff, unsigned int datalen,
 			    enum sip_header_types type, int *in_header,
 			    unsigned int *matchoff, unsigned int *matchlen,
-			    union nf_inet_addr *addr, __be16 *port)
+			    union nf_conntrack_address *addr, __be16 *port)
 {
 	const char *c, *limit = dptr + datalen;
 	unsigned int p;
@@ -598,7 +600,7 @@ int ct_sip_parse_address_param(const struct nf_conn *ct, const char *dptr,
 			       unsigned int dataoff, unsigned int datalen,
 			       const char *name,
 			       unsigned int *matchoff, unsigned int *matchlen,
-			       union nf_inet_addr *addr)
+			       union nf_conntrack_address *addr)
 {
 	const char *limit = dptr + datalen;
 	const char *start, *end;
@@ -765,7 +767,7 @@ static int ct_sip_parse_sdp_addr(const struct nf_conn *ct, const char *dptr,
 				 enum sdp_header_types type,
 				 enum sdp_header_types term,
 				 unsigned int *matchoff, unsigned int *matchlen,
-				 union nf_inet_addr *addr)
+				 union nf_conntrack_address *addr)
 {
 	int ret;
 
@@ -781,7 +783,7 @@ static int ct_sip_parse_sdp_addr(const struct nf_conn *ct, const char *dptr,
 }
 
 static int refresh_signalling_expectation(struct nf_conn *ct,
-					  union nf_inet_addr *addr,
+					  union nf_conntrack_address *addr,
 					  u8 proto, __be16 port,
 					  unsigned int expires)
 {
@@ -793,7 +795,7 @@ static int refresh_signalling_expectation(struct nf_conn *ct,
 	spin_lock_bh(&nf_conntrack_lock);
 	hlist_for_each_entry_safe(exp, n, next, &help->expectations, lnode) {
 		if (exp->class != SIP_EXPECT_SIGNALLING ||
-		    !nf_inet_addr_cmp(&exp->tuple.dst.u3, addr) ||
+		    !nf_ct_addr_cmp(&exp->tuple.dst.u3, addr) ||
 		    exp->tuple.dst.protonum != proto ||
 		    exp->tuple.dst.u.udp.port != port)
 			continue;
@@ -831,7 +833,7 @@ static void flush_expectations(struct nf_conn *ct, bool media)
 
 static int set_expected_rtp_rtcp(struct sk_buff *skb, unsigned int dataoff,
 				 const char **dptr, unsigned int *datalen,
-				 union nf_inet_addr *daddr, __be16 port,
+				 union nf_conntrack_address *daddr, __be16 port,
 				 enum sip_expectation_classes class,
 				 unsigned int mediaoff, unsigned int medialen)
 {
@@ -840,7 +842,7 @@ static int set_expected_rtp_rtcp(struct sk_buff *skb, unsigned int dataoff,
 	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
 	struct net *net = nf_ct_net(ct);
 	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
-	union nf_inet_addr *saddr;
+	union nf_conntrack_address *saddr;
 	struct nf_conntrack_tuple tuple;
 	int direct_rtp = 0, skip_expect = 0, ret = NF_DROP;
 	u_int16_t base_port;
@@ -850,7 +852,7 @@ static int set_expected_rtp_rtcp(struct sk_buff *skb, unsigned int dataoff,
 
 	saddr = NULL;
 	if (sip_direct_media) {
-		if (!nf_inet_addr_cmp(daddr, &ct->tuplehash[dir].tuple.src.u3))
+		if (!nf_ct_addr_cmp(daddr, &ct->tuplehash[dir].tuple.src.u3))
 			return NF_ACCEPT;
 		saddr = &ct->tuplehash[!dir].tuple.src.u3;
 	}
@@ -982,7 +984,7 @@ static int process_sdp(struct sk_buff *skb, unsigned int dataoff,
 	unsigned int sdpoff;
 	unsigned int caddr_len, maddr_len;
 	unsigned int i;
-	union nf_inet_addr caddr, maddr, rtp_addr;
+	union nf_conntrack_address caddr, maddr, rtp_addr;
 	unsigned int port;
 	enum sdp_header_types c_hdr;
 	const struct sdp_media_type *t;
@@ -1159,7 +1161,7 @@ static int process_register_request(struct sk_buff *skb, unsigned int dataoff,
 	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
 	unsigned int matchoff, matchlen;
 	struct nf_conntrack_expect *exp;
-	union nf_inet_addr *saddr, daddr;
+	union nf_conntrack_address *saddr, daddr;
 	__be16 port;
 	u8 proto;
 	unsigned int expires = 0;
@@ -1191,7 +1193,7 @@ static int process_register_request(struct sk_buff *skb, unsigned int dataoff,
 		return NF_ACCEPT;
 
 	/* We don't support third-party registrations */
-	if (!nf_inet_addr_cmp(&ct->tuplehash[dir].tuple.src.u3, &daddr))
+	if (!nf_ct_addr_cmp(&ct->tuplehash[dir].tuple.src.u3, &daddr))
 		return NF_ACCEPT;
 
 	if (ct_sip_parse_transport(ct, *dptr, matchoff + matchlen, *datalen,
@@ -1248,7 +1250,7 @@ static int process_register_response(struct sk_buff *skb, unsigned int dataoff,
 	struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
 	struct nf_conn_help *help = nfct_help(ct);
 	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	__be16 port;
 	u8 proto;
 	unsigned int matchoff, matchlen, coff = 0;
@@ -1288,7 +1290,7 @@ static int process_register_response(struct sk_buff *skb, unsigned int dataoff,
 			break;
 
 		/* We don't support third-party registrations */
-		if (!nf_inet_addr_cmp(&ct->tuplehash[dir].tuple.dst.u3, &addr))
+		if (!nf_ct_addr_cmp(&ct->tuplehash[dir].tuple.dst.u3, &addr))
 			continue;
 
 		if (ct_sip_parse_transport(ct, *dptr, matchoff + matchlen,
@@ -1368,7 +1370,7 @@ static int process_sip_request(struct sk_buff *skb, unsigned int dataoff,
 	enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
 	unsigned int matchoff, matchlen;
 	unsigned int cseq, i;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 	__be16 port;
 
 	/* Many Cisco IP phones use a high source port for SIP requests, but
@@ -1381,7 +1383,7 @@ static int process_sip_request(struct sk_buff *skb, unsigned int dataoff,
 				    SIP_HDR_VIA_UDP, NULL, &matchoff,
 				    &matchlen, &addr, &port) > 0 &&
 	    port != ct->tuplehash[dir].tuple.src.u.udp.port &&
-	    nf_inet_addr_cmp(&addr, &ct->tuplehash[dir].tuple.src.u3))
+	    nf_ct_addr_cmp(&addr, &ct->tuplehash[dir].tuple.src.u3))
 		help->help.ct_sip_info.forced_dport = port;
 
 	for (i = 0; i < ARRAY_SIZE(sip_handlers); i++) {
@@ -31,6 +31,7 @@
 #include <net/netfilter/nf_conntrack_acct.h>
 #include <net/netfilter/nf_conntrack_timestamp.h>
 #include <net/netfilter/nf_conntrack_ext_mark.h>
+#include <net/netfilter/nf_conntrack_fastnat.h>
 #include <linux/rculist_nulls.h>
 
 MODULE_LICENSE("GPL");
@@ -47,20 +48,21 @@ EXPORT_SYMBOL_GPL(print_tuple);
 
 struct ct_iter_state {
 	struct seq_net_private p;
+	struct hlist_nulls_head *hash;
+	unsigned int htable_size;
 	unsigned int bucket;
 	u_int64_t time_now;
 };
 
 static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 {
-	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
 	struct hlist_nulls_node *n;
 
 	for (st->bucket = 0;
-	     st->bucket < net->ct.htable_size;
+	     st->bucket < st->htable_size;
 	     st->bucket++) {
-		n = rcu_dereference(hlist_nulls_first_rcu(&net->ct.hash[st->bucket]));
+		n = rcu_dereference(hlist_nulls_first_rcu(&st->hash[st->bucket]));
 		if (!is_a_nulls(n))
 			return n;
 	}
@@ -70,18 +72,17 @@ static struct hlist_nulls_node *ct_get_first(struct seq_file *seq)
 static struct hlist_nulls_node *ct_get_next(struct seq_file *seq,
 				      struct hlist_nulls_node *head)
 {
-	struct net *net = seq_file_net(seq);
 	struct ct_iter_state *st = seq->private;
 
 	head = rcu_dereference(hlist_nulls_next_rcu(head));
 	while (is_a_nulls(head)) {
 		if (likely(get_nulls_value(head) == st->bucket)) {
-			if (++st->bucket >= net->ct.htable_size)
+			if (++st->bucket >= st->htable_size)
 				return NULL;
 		}
 		head = rcu_dereference(
 				hlist_nulls_first_rcu(
-					&net->ct.hash[st->bucket]));
+					&st->hash[st->bucket]));
 	}
 	return head;
 }
@@ -103,6 +104,7 @@ static void *ct_seq_start(struct seq_file *seq, loff_t *pos)
 
 	st->time_now = ktime_to_ns(ktime_get_real());
 	rcu_read_lock();
+	nf_conntrack_get_ht(seq_file_net(seq), &st->hash, &st->htable_size);
 	return ct_get_idx(seq, *pos);
 }
 
@@ -196,8 +198,7 @@ static int ct_seq_show(struct seq_file *s, void *v)
 	if (seq_printf(s, "%-8s %u %-8s %u %ld ",
 		       l3proto->name, nf_ct_l3num(ct),
 		       l4proto->name, nf_ct_protonum(ct),
-		       timer_pending(&ct->timeout)
-		       ? (long)(ct->timeout.expires - jiffies)/HZ : 0) != 0)
+		       (long)nf_ct_expires(ct) / HZ) != 0)
 		goto release;
 
 	if (l4proto->print_conntrack && l4proto->print_conntrack(s, ct))
@@ -272,7 +273,7 @@ static int ct_open(struct inode *inode, struct file *file)
 
 struct kill_request {
 	u16 family;
-	union nf_inet_addr addr;
+	union nf_conntrack_address addr;
 };
 
 static int kill_matching(struct nf_conn *i, void *data)
@@ -287,10 +288,10 @@ static int kill_matching(struct nf_conn *i, void *data)
 	if (t1->src.l3num != kr->family)
 		return 0;
 
-	return (nf_inet_addr_cmp(&kr->addr, &t1->src.u3) ||
-	        nf_inet_addr_cmp(&kr->addr, &t1->dst.u3) ||
-	        nf_inet_addr_cmp(&kr->addr, &t2->src.u3) ||
-	        nf_inet_addr_cmp(&kr->addr, &t2->dst.u3));
+	return (nf_ct_addr_cmp(&kr->addr, &t1->src.u3) ||
+	        nf_ct_addr_cmp(&kr->addr, &t1->dst.u3) ||
+	        nf_ct_addr_cmp(&kr->addr, &t2->src.u3) ||
+	        nf_ct_addr_cmp(&kr->addr, &t2->dst.u3));
 }
 
 static ssize_t ct_file_write(struct file *file, const char __user *buf,
@@ -299,6 +300,7 @@ static ssize_t ct_file_write(struct file *file, const char __user *buf,
 	struct seq_file *seq = file->private_data;
 	struct net *net = seq_file_net(seq);
 	struct kill_request kr = { };
+	union nf_inet_addr addr = { };
 	char req[INET6_ADDRSTRLEN] = { };
 
 	if (count == 0)
@@ -312,13 +314,14 @@ static ssize_t ct_file_write(struct file *file, const char __user *buf,
 
 	if (strnchr(req, count, ':')) {
 		kr.family = AF_INET6;
-		if (!in6_pton(req, count, (void *)&kr.addr, '\n', NULL))
+		if (!in6_pton(req, count, (void *)&addr, '\n', NULL))
 			return -EINVAL;
 	} else if (strnchr(req, count, '.')) {
 		kr.family = AF_INET;
-		if (!in4_pton(req, count, (void *)&kr.addr, '\n', NULL))
+		if (!in4_pton(req, count, (void *)&addr, '\n', NULL))
 			return -EINVAL;
 	}
+	nf_ct_addr_from_inet(&kr.addr, &addr);
 
 	nf_ct_iterate_cleanup(net, kill_matching, &kr);
 
@@ -472,6 +475,35 @@ static int log_invalid_proto_max = 255;
 
 static struct ctl_table_header *nf_ct_netfilter_header;
 
+#if IS_ENABLED(CONFIG_FAST_NAT)
+extern int ipv6_fastnat_conntrack;
+#endif
+
+/* Resizes the hash table online, init_net only */
+static int nf_conntrack_hash_sysctl(struct ctl_table *table, int write,
+				    void __user *buffer, size_t *lenp,
+				    loff_t *ppos)
+{
+	unsigned int hashsize = *(unsigned int *)table->data;
+	struct ctl_table tmp = {
+		.data	= &hashsize,
+		.maxlen	= sizeof(hashsize),
+	};
+	int ret;
+
+	ret = proc_dointvec(&tmp, write, buffer, lenp, ppos);
+	if (ret < 0 || !write)
+		return ret;
+
+	if (table->data != &init_net.ct.htable_size)
+		return -EOPNOTSUPP;
+
+	if (hashsize == init_net.ct.htable_size)
+		return 0;
+
+	return nf_conntrack_hash_resize(hashsize);
+}
+
 static struct ctl_table nf_ct_sysctl_table[] = {
 	{
 		.procname	= "nf_conntrack_max",
@@ -491,8 +523,8 @@ static struct ctl_table nf_ct_sysctl_table[] = {
 		.procname       = "nf_conntrack_buckets",
 		.data           = &init_net.ct.htable_size,
 		.maxlen         = sizeof(unsigned int),
-		.mode           = 0444,
-		.proc_handler   = proc_dointvec,
+		.mode           = 0644,
+		.proc_handler   = nf_conntrack_hash_sysctl,
 	},
 	{
 		.procname	= "nf_conntrack_checksum",
@@ -525,6 +557,21 @@ static struct ctl_table nf_ct_sysctl_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+#endif
+#if IS_ENABLED(CONFIG_FAST_NAT)
+	{
+		.procname	= "nf_conntrack_fastnat6",
+		.data		= &ipv6_fastnat_conntrack,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec,
+	},
+	{
+		.procname	= "nf_conntrack_fastnat_policy",
+		.maxlen		= NF_CT_FASTNAT_POLICY_LEN,
+		.mode		= 0644,
+		.proc_handler	= nf_ct_fastnat_policy_sysctl,
+	},
 #endif
 	{ }
 };
@@ -565,6 +612,8 @@ static int nf_conntrack_standalone_init_sysctl(struct net *net)
 
 	table[1].data = &net->ct.count;
 	table[2].data = &net->ct.htable_size;
+	if (!net_eq(net, &init_net))
+		table[2].mode = 0444;
 	table[3].data = &net->ct.sysctl_checksum;
 	table[4].data = &net->ct.sysctl_log_invalid;
 
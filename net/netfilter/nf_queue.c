@@ -264,6 +264,36 @@ static void nf_bridge_adjust_segmented_data(struct sk_buff *skb)
 #define nf_bridge_adjust_segmented_data(s) do {} while (0)
 #endif
 
+static int nf_queue_precheck(const struct sk_buff *skb, u_int8_t pf,
+			     unsigned int queuenum
+#if defined(CONFIG_IMQ) || defined(CONFIG_IMQ_MODULE)
+			    ,unsigned int queuetype
+#endif
+			     )
+{
+	const struct nf_queue_handler *qh;
+	int status = 0;
+
+	rcu_read_lock();
+
+#if defined(CONFIG_IMQ) || defined(CONFIG_IMQ_MODULE)
+	if (queuetype == NF_IMQ_QUEUE) {
+		qh = rcu_dereference(queue_imq_handler);
+	} else {
+		qh = rcu_dereference(queue_handler[pf]);
+	}
+#else
+	qh = rcu_dereference(queue_handler[pf]);
+#endif
+
+	if (qh && qh->precheck)
+		status = qh->precheck(skb, queuenum);
+
+	rcu_read_unlock();
+
+	return status;
+}
+
 int nf_queue(struct sk_buff *skb,
 	     struct list_head *elem,
 	     u_int8_t pf, unsigned int hook,
@@ -280,6 +310,16 @@ int nf_queue(struct sk_buff *skb,
 	int err = -EINVAL;
 	unsigned int queued;
 
+	/* Spare the entry and the segmentation of a refused packet */
+#if defined(CONFIG_IMQ) || defined(CONFIG_IMQ_MODULE)
+	err = nf_queue_precheck(skb, pf, queuenum, queuetype);
+#else
+	err = nf_queue_precheck(skb, pf, queuenum);
+#endif
+	if (err < 0)
+		return err;
+	err = -EINVAL;
+
 	if (!skb_is_gso(skb))
 		return __nf_queue(skb, elem, pf, hook, indev, outdev, okfn,
 #if defined(CONFIG_IMQ) || defined(CONFIG_IMQ_MODULE)
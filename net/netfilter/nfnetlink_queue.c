@@ -30,6 +30,14 @@
 #include <linux/list.h>
 #include <net/sock.h>
 #include <net/netfilter/nf_queue.h>
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_ecache.h>
+#endif
 
 #include <linux/atomic.h>
 
@@ -39,6 +47,25 @@
 
 #define NFQNL_QMAX_DEFAULT 1024
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+#define NFQNL_RING_MAX_SIZE	(16 << 20)
+
+/* Slot of a packet flushed while userspace still owns its frame */
+#define NFQNL_RING_DROPPED	((struct nf_queue_entry *)1)
+
+struct nfqnl_ring {
+	void *frames;			/* vmalloc_user'd, mapped to userspace */
+	unsigned int frame_size;
+	unsigned int frame_nr;
+	unsigned int copy_range;
+	/* Frames [tail, head) are in userspace, under the queue lock */
+	unsigned int head;
+	unsigned int tail;
+	struct nf_queue_entry **entries;	/* packet of each frame */
+	wait_queue_head_t wait;
+};
+#endif
+
 struct nfqnl_instance {
 	struct hlist_node hlist;		/* global list of queues */
 	struct rcu_head rcu;
@@ -60,6 +87,9 @@ struct nfqnl_instance {
 	unsigned int	queue_total;
 	unsigned int	id_sequence;		/* 'sequence' of pkt ids */
 	struct list_head queue_list;		/* packets in queue */
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	struct nfqnl_ring __rcu *ring;		/* bound via the nfqueue device */
+#endif
 };
 
 typedef int (*nfqnl_cmpfn)(struct nf_queue_entry *, unsigned long);
@@ -204,6 +234,9 @@ static void
 nfqnl_flush(struct nfqnl_instance *queue, nfqnl_cmpfn cmpfn, unsigned long data)
 {
 	struct nf_queue_entry *entry, *next;
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	struct nfqnl_ring *ring;
+#endif
 
 	spin_lock_bh(&queue->lock);
 	list_for_each_entry_safe(entry, next, &queue->queue_list, list) {
@@ -213,6 +246,25 @@ nfqnl_flush(struct nfqnl_instance *queue, nfqnl_cmpfn cmpfn, unsigned long data)
 			nf_reinject(entry, NF_DROP);
 		}
 	}
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	ring = rcu_dereference_raw(queue->ring);
+	if (ring) {
+		unsigned int i, slot;
+
+		for (i = ring->tail; i != ring->head; i++) {
+			slot = i & (ring->frame_nr - 1);
+			entry = ring->entries[slot];
+			if (!entry || entry == NFQNL_RING_DROPPED)
+				continue;
+			if (!cmpfn || cmpfn(entry, data)) {
+				/* The frame stays with userspace until answered */
+				ring->entries[slot] = NFQNL_RING_DROPPED;
+				queue->queue_total--;
+				nf_reinject(entry, NF_DROP);
+			}
+		}
+	}
+#endif
 	spin_unlock_bh(&queue->lock);
 }
 
@@ -403,6 +455,134 @@ nla_put_failure:
 	return NULL;
 }
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+static inline struct nfqnl_frame_hdr *
+nfqnl_ring_frame(const struct nfqnl_ring *ring, unsigned int slot)
+{
+	return ring->frames + slot * ring->frame_size;
+}
+
+static bool nfqnl_flow_bypassed(const struct sk_buff *skb,
+				unsigned int queuenum)
+{
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+	enum ip_conntrack_info ctinfo;
+	const struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+
+	return ct && ACCESS_ONCE(ct->nfq_bypass) == queuenum + 1;
+#else
+	return false;
+#endif
+}
+
+static u_int32_t nfqnl_ct_mark(const struct sk_buff *skb)
+{
+#if IS_ENABLED(CONFIG_NF_CONNTRACK) && defined(CONFIG_NF_CONNTRACK_MARK)
+	enum ip_conntrack_info ctinfo;
+	const struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+
+	if (ct && !nf_ct_is_untracked(ct))
+		return ct->mark;
+#endif
+	return 0;
+}
+
+/* Called with the queue locked */
+static bool nfqnl_ring_full(struct nfqnl_instance *queue,
+			    const struct nfqnl_ring *ring)
+{
+	if (ring->head - ring->tail < ring->frame_nr)
+		return false;
+
+	queue->queue_dropped++;
+	net_warn_ratelimited("nf_queue: ring full at %d entries, dropping packets(s)\n",
+			     queue->queue_total);
+	return true;
+}
+
+static int
+nfqnl_ring_enqueue(struct nfqnl_instance *queue, struct nfqnl_ring *ring,
+		   struct nf_queue_entry *entry)
+{
+	struct sk_buff *entskb = entry->skb;
+	struct nfqnl_frame_hdr *hdr;
+	unsigned int slot, cap_len;
+
+	cap_len = min(ring->copy_range, entskb->len);
+	if (cap_len && entskb->ip_summed == CHECKSUM_PARTIAL &&
+	    skb_checksum_help(entskb))
+		return -ENOMEM;
+
+	spin_lock_bh(&queue->lock);
+
+	if (nfqnl_ring_full(queue, ring)) {
+		spin_unlock_bh(&queue->lock);
+		return -ENOBUFS;
+	}
+
+	slot = ring->head & (ring->frame_nr - 1);
+	hdr = nfqnl_ring_frame(ring, slot);
+	entry->id = ++queue->id_sequence;
+
+	hdr->id		= entry->id;
+	hdr->verdict	= NF_DROP;
+	hdr->flags	= 0;
+	hdr->mark	= entskb->mark;
+	hdr->ct_mark	= nfqnl_ct_mark(entskb);
+	hdr->hw_protocol = entskb->protocol;
+	hdr->hook	= entry->hook;
+	hdr->pf		= entry->pf;
+	hdr->indev	= entry->indev ? entry->indev->ifindex : 0;
+	hdr->outdev	= entry->outdev ? entry->outdev->ifindex : 0;
+	hdr->len	= entskb->len;
+	hdr->cap_len	= cap_len;
+	if (cap_len && skb_copy_bits(entskb, 0, hdr + 1, cap_len))
+		BUG();
+
+	/* Userspace owns the frame once it sees the status */
+	smp_wmb();
+	hdr->status = NFQNL_FRAME_PACKET;
+
+	ring->entries[slot] = entry;
+	ring->head++;
+	queue->queue_total++;
+
+	spin_unlock_bh(&queue->lock);
+
+	wake_up_interruptible(&ring->wait);
+	return 0;
+}
+
+/* Turns away bypassed flows and packets a full ring would drop before
+ * nf_queue() allocates and segments them */
+static int
+nfqnl_enqueue_precheck(const struct sk_buff *skb, unsigned int queuenum)
+{
+	struct nfqnl_instance *queue;
+	struct nfqnl_ring *ring;
+	bool full;
+
+	/* The rest of the flow was accepted by this queue, ignore the hook */
+	if (nfqnl_flow_bypassed(skb, queuenum))
+		return -ECANCELED;
+
+	/* rcu_read_lock()ed by nf_queue() */
+	queue = instance_lookup(queuenum);
+	if (!queue)
+		return 0;
+	ring = rcu_dereference(queue->ring);
+	if (!ring ||
+	    ACCESS_ONCE(ring->head) - ACCESS_ONCE(ring->tail) < ring->frame_nr)
+		return 0;
+
+	spin_lock_bh(&queue->lock);
+	full = nfqnl_ring_full(queue, ring);
+	spin_unlock_bh(&queue->lock);
+
+	return full ? -ENOBUFS : 0;
+}
+#endif
+
 static int
 nfqnl_enqueue_packet(struct nf_queue_entry *entry, unsigned int queuenum)
 {
@@ -410,6 +590,9 @@ nfqnl_enqueue_packet(struct nf_queue_entry *entry, unsigned int queuenum)
 	struct nfqnl_instance *queue;
 	int err = -ENOBUFS;
 	__be32 *packet_id_ptr;
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	struct nfqnl_ring *ring;
+#endif
 
 	/* rcu_read_lock()ed by nf_hook_slow() */
 	queue = instance_lookup(queuenum);
@@ -418,6 +601,12 @@ nfqnl_enqueue_packet(struct nf_queue_entry *entry, unsigned int queuenum)
 		goto err_out;
 	}
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	ring = rcu_dereference(queue->ring);
+	if (ring)
+		return nfqnl_ring_enqueue(queue, ring, entry);
+#endif
+
 	if (queue->copy_mode == NFQNL_COPY_NONE) {
 		err = -EINVAL;
 		goto err_out;
@@ -771,6 +960,9 @@ static const struct nla_policy nfqa_cfg_policy[NFQA_CFG_MAX+1] = {
 static const struct nf_queue_handler nfqh = {
 	.name 	= "nf_queue",
 	.outfn	= &nfqnl_enqueue_packet,
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	.precheck = &nfqnl_enqueue_precheck,
+#endif
 };
 
 static int
@@ -983,6 +1175,281 @@ static const struct file_operations nfqnl_file_ops = {
 
 #endif /* PROC_FS */
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+static DEFINE_MUTEX(nfqnl_ring_mutex);
+
+static struct nfqnl_instance *nfqnl_ring_queue(struct file *file)
+{
+	struct nfqnl_instance *queue = ACCESS_ONCE(file->private_data);
+
+	smp_read_barrier_depends();
+	return queue;
+}
+
+static unsigned int
+nfqnl_ring_apply(struct nfqnl_instance *queue, struct nf_queue_entry *entry,
+		 const struct nfqnl_frame_hdr *v)
+{
+	unsigned int verdict = v->verdict;
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct;
+#endif
+
+	if ((verdict & NF_VERDICT_MASK) > NF_MAX_VERDICT ||
+	    (verdict & NF_VERDICT_MASK) == NF_STOLEN)
+		return NF_DROP;
+
+	if (v->flags & NFQNL_FRAME_F_MARK)
+		entry->skb->mark = v->mark;
+
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+	ct = nf_ct_get(entry->skb, &ctinfo);
+	if (!ct || nf_ct_is_untracked(ct))
+		return verdict;
+#ifdef CONFIG_NF_CONNTRACK_MARK
+	if ((v->flags & NFQNL_FRAME_F_CTMARK) && ct->mark != v->ct_mark) {
+		ct->mark = v->ct_mark;
+		nf_conntrack_event_cache(IPCT_MARK, ct);
+		nf_ct_touch(ct);
+	}
+#endif
+	/* The first queue to accept the flow keeps it, others still see it */
+	if ((v->flags & NFQNL_FRAME_F_FLOW) && verdict == NF_ACCEPT &&
+	    ct->nfq_bypass == 0 && queue->queue_num != USHRT_MAX) {
+		ct->nfq_bypass = queue->queue_num + 1;
+		nf_ct_touch(ct);
+	}
+#endif
+	return verdict;
+}
+
+/* Reinject all answered packets, returns their number */
+static int
+nfqnl_ring_verdicts(struct nfqnl_instance *queue, struct nfqnl_ring *ring)
+{
+	struct nfqnl_frame_hdr *hdr, v;
+	struct nf_queue_entry *entry;
+	unsigned int i, slot;
+	int n = 0;
+
+	spin_lock_bh(&queue->lock);
+
+	for (i = ring->tail; i != ring->head; i++) {
+		slot = i & (ring->frame_nr - 1);
+		entry = ring->entries[slot];
+		hdr = nfqnl_ring_frame(ring, slot);
+		if (!entry || ACCESS_ONCE(hdr->status) != NFQNL_FRAME_VERDICT)
+			continue;
+		smp_rmb();
+
+		/* The frame is not reused before the tail passes it */
+		ring->entries[slot] = NULL;
+		if (entry == NFQNL_RING_DROPPED)
+			continue;
+		queue->queue_total--;
+		v = *hdr;
+		n++;
+
+		/* Reinjection may queue to this instance again */
+		spin_unlock_bh(&queue->lock);
+		nf_reinject(entry, nfqnl_ring_apply(queue, entry, &v));
+		spin_lock_bh(&queue->lock);
+	}
+
+	while (ring->tail != ring->head) {
+		slot = ring->tail & (ring->frame_nr - 1);
+		if (ring->entries[slot])
+			break;
+		nfqnl_ring_frame(ring, slot)->status = NFQNL_FRAME_UNUSED;
+		ring->tail++;
+	}
+
+	spin_unlock_bh(&queue->lock);
+
+	return n;
+}
+
+static int
+nfqnl_ring_setup(struct file *file, const struct nfqnl_ring_req *req)
+{
+	struct nfqnl_instance *queue;
+	struct nfqnl_ring *ring;
+	int err;
+
+	if (req->frame_size < sizeof(struct nfqnl_frame_hdr) ||
+	    req->frame_size % NFQNL_FRAME_ALIGNMENT ||
+	    !req->frame_nr || !is_power_of_2(req->frame_nr) ||
+	    (u64)req->frame_size * req->frame_nr > NFQNL_RING_MAX_SIZE)
+		return -EINVAL;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return -ENOMEM;
+
+	ring->frame_size = req->frame_size;
+	ring->frame_nr = req->frame_nr;
+	ring->copy_range = min_t(unsigned int, req->copy_range,
+				 req->frame_size - sizeof(struct nfqnl_frame_hdr));
+	init_waitqueue_head(&ring->wait);
+
+	err = -ENOMEM;
+	ring->frames = vmalloc_user(ring->frame_size * ring->frame_nr);
+	if (!ring->frames)
+		goto err_free;
+	ring->entries = vzalloc(ring->frame_nr * sizeof(*ring->entries));
+	if (!ring->entries)
+		goto err_free;
+
+	mutex_lock(&nfqnl_ring_mutex);
+	if (file->private_data) {
+		err = -EBUSY;
+		goto err_unlock;
+	}
+
+	/* No netlink peer may match pid 0, the device owns the queue */
+	queue = instance_create(req->queue_num, 0);
+	if (IS_ERR(queue)) {
+		err = PTR_ERR(queue);
+		goto err_unlock;
+	}
+
+	spin_lock_bh(&queue->lock);
+	queue->queue_maxlen = ring->frame_nr;
+	queue->copy_mode = NFQNL_COPY_PACKET;
+	queue->copy_range = ring->copy_range;
+	spin_unlock_bh(&queue->lock);
+	rcu_assign_pointer(queue->ring, ring);
+
+	smp_wmb();
+	file->private_data = queue;
+	mutex_unlock(&nfqnl_ring_mutex);
+	return 0;
+
+err_unlock:
+	mutex_unlock(&nfqnl_ring_mutex);
+err_free:
+	vfree(ring->entries);
+	vfree(ring->frames);
+	kfree(ring);
+	return err;
+}
+
+static int nfqnl_ring_open(struct inode *inode, struct file *file)
+{
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	return nonseekable_open(inode, file);
+}
+
+static int nfqnl_ring_release(struct inode *inode, struct file *file)
+{
+	struct nfqnl_instance *queue = file->private_data;
+	struct nfqnl_ring *ring;
+
+	if (!queue)
+		return 0;
+
+	spin_lock(&instances_lock);
+	hlist_del_rcu(&queue->hlist);
+	spin_unlock(&instances_lock);
+
+	/* Wait for enqueues and device flushes still using the ring */
+	synchronize_rcu();
+
+	nfqnl_flush(queue, NULL, 0);
+
+	ring = rcu_dereference_protected(queue->ring, 1);
+	vfree(ring->entries);
+	vfree(ring->frames);
+	kfree(ring);
+
+	kfree(queue);
+	module_put(THIS_MODULE);
+	return 0;
+}
+
+static long
+nfqnl_ring_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct nfqnl_instance *queue;
+	struct nfqnl_ring_req req;
+
+	switch (cmd) {
+	case NFQNL_RING_SETUP:
+		if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+			return -EFAULT;
+		return nfqnl_ring_setup(file, &req);
+
+	case NFQNL_RING_VERDICT:
+		queue = nfqnl_ring_queue(file);
+		if (!queue)
+			return -ENODEV;
+		return nfqnl_ring_verdicts(queue,
+				rcu_dereference_protected(queue->ring, 1));
+	}
+
+	return -ENOTTY;
+}
+
+static int nfqnl_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct nfqnl_instance *queue = nfqnl_ring_queue(file);
+	struct nfqnl_ring *ring;
+
+	if (!queue || vma->vm_pgoff)
+		return -EINVAL;
+
+	ring = rcu_dereference_protected(queue->ring, 1);
+	return remap_vmalloc_range(vma, ring->frames, 0);
+}
+
+/* Collects answered frames, readable while the newest frame is unanswered */
+static unsigned int nfqnl_ring_poll(struct file *file, poll_table *wait)
+{
+	struct nfqnl_instance *queue = nfqnl_ring_queue(file);
+	struct nfqnl_ring *ring;
+	unsigned int mask = 0;
+	unsigned int slot;
+
+	if (!queue)
+		return POLLERR;
+
+	ring = rcu_dereference_protected(queue->ring, 1);
+	nfqnl_ring_verdicts(queue, ring);
+
+	poll_wait(file, &ring->wait, wait);
+
+	spin_lock_bh(&queue->lock);
+	if (ring->head != ring->tail) {
+		slot = (ring->head - 1) & (ring->frame_nr - 1);
+		if (nfqnl_ring_frame(ring, slot)->status == NFQNL_FRAME_PACKET)
+			mask |= POLLIN | POLLRDNORM;
+	}
+	spin_unlock_bh(&queue->lock);
+
+	return mask;
+}
+
+static const struct file_operations nfqnl_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= nfqnl_ring_open,
+	.release	= nfqnl_ring_release,
+	.unlocked_ioctl	= nfqnl_ring_ioctl,
+	.compat_ioctl	= nfqnl_ring_ioctl,
+	.mmap		= nfqnl_ring_mmap,
+	.poll		= nfqnl_ring_poll,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice nfqnl_ring_dev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= NFQNL_RING_DEVICE,
+	.fops	= &nfqnl_ring_fops,
+};
+#endif /* CONFIG_NETFILTER_NETLINK_QUEUE_RING */
+
 static int __init nfnetlink_queue_init(void)
 {
 	int i, status = -ENOMEM;
@@ -1003,11 +1470,27 @@ static int __init nfnetlink_queue_init(void)
 		goto cleanup_subsys;
 #endif
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	status = misc_register(&nfqnl_ring_dev);
+	if (status < 0) {
+		printk(KERN_ERR "nf_queue: failed to register ring device\n");
+		goto cleanup_proc;
+	}
+#endif
+
 	register_netdevice_notifier(&nfqnl_dev_notifier);
 	return status;
 
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+cleanup_proc:
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("nfnetlink_queue", proc_net_netfilter);
+#endif
+#endif
 #ifdef CONFIG_PROC_FS
 cleanup_subsys:
+#endif
+#if defined(CONFIG_PROC_FS) || defined(CONFIG_NETFILTER_NETLINK_QUEUE_RING)
 	nfnetlink_subsys_unregister(&nfqnl_subsys);
 #endif
 cleanup_netlink_notifier:
@@ -1019,6 +1502,9 @@ static void __exit nfnetlink_queue_fini(void)
 {
 	nf_unregister_queue_handlers(&nfqh);
 	unregister_netdevice_notifier(&nfqnl_dev_notifier);
+#ifdef CONFIG_NETFILTER_NETLINK_QUEUE_RING
+	misc_deregister(&nfqnl_ring_dev);
+#endif
 #ifdef CONFIG_PROC_FS
 	remove_proc_entry("nfnetlink_queue", proc_net_netfilter);
 #endif
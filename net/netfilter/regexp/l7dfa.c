@@ -0,0 +1,668 @@
+/*
+ * Deterministic automata for l7-filter patterns.
+ *
+ * Patterns are parsed with the grammar of regexp.c into one Thompson
+ * NFA, which is then turned into a DFA by subset construction over
+ * classes of input bytes that no pattern tells apart.  Everything here
+ * runs in process context when rules are inserted; the match path only
+ * uses l7dfa_step() and the accept masks.
+ *
+ * Only patterns regcomp() has accepted are passed in, so the parser
+ * does not repeat its diagnostics.
+ */
+
+#include <linux/bitops.h>
+#include <linux/ctype.h>
+#include <linux/err.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "l7dfa.h"
+
+enum {
+	NFA_CHAR,		/* c, then out */
+	NFA_SET,		/* byte in sets[set], then out */
+	NFA_SPLIT,		/* out and out1 */
+	NFA_EPS,		/* out */
+	NFA_BOL,		/* out at the first byte only */
+	NFA_EOL,		/* out at the end of the data only */
+	NFA_MATCH,		/* pattern c found */
+};
+
+struct nfa_node {
+	u8 type;
+	u8 c;
+	u16 set;
+	int out;
+	int out1;
+};
+
+struct nfa_set {
+	unsigned long bits[BITS_TO_LONGS(256)];
+};
+
+struct nfa {
+	struct nfa_node *nodes;
+	unsigned int nnodes;
+	unsigned int maxnodes;
+	struct nfa_set *sets;
+	unsigned int nsets;
+	unsigned int maxsets;
+};
+
+/* Fragment with a single exit: nodes[end].out is patched later */
+struct nfa_frag {
+	int start;
+	int end;
+};
+
+struct nfa_parser {
+	struct nfa *nfa;
+	const unsigned char *p;
+};
+
+static void *l7dfa_alloc(size_t size)
+{
+	if (size > PAGE_SIZE)
+		return vzalloc(size);
+	return kzalloc(size, GFP_KERNEL);
+}
+
+static void l7dfa_kvfree(const void *p)
+{
+	if (is_vmalloc_addr(p))
+		vfree(p);
+	else
+		kfree(p);
+}
+
+static int nfa_node(struct nfa *nfa, u8 type, int out, int out1)
+{
+	struct nfa_node *n;
+
+	if (nfa->nnodes == nfa->maxnodes)
+		return -1;
+
+	n = &nfa->nodes[nfa->nnodes];
+	n->type = type;
+	n->out = out;
+	n->out1 = out1;
+
+	return nfa->nnodes++;
+}
+
+static int nfa_frag1(struct nfa *nfa, u8 type, struct nfa_frag *f)
+{
+	int i = nfa_node(nfa, type, -1, -1);
+
+	if (i < 0)
+		return -ENOMEM;
+
+	f->start = f->end = i;
+	return 0;
+}
+
+static int nfa_parse_reg(struct nfa_parser *ps, struct nfa_frag *f);
+
+static int nfa_parse_class(struct nfa_parser *ps, struct nfa_frag *f)
+{
+	struct nfa *nfa = ps->nfa;
+	struct nfa_set *set;
+	const unsigned char *p = ps->p;
+	bool invert = false;
+	int err;
+
+	if (nfa->nsets == nfa->maxsets)
+		return -ENOMEM;
+
+	set = &nfa->sets[nfa->nsets];
+	memset(set, 0, sizeof(*set));
+
+	if (*p == '^') {
+		invert = true;
+		p++;
+	}
+
+	if (*p == ']' || *p == '-')
+		__set_bit(*p++, set->bits);
+
+	while (*p != '\0' && *p != ']') {
+		if (*p == '-') {
+			p++;
+			if (*p == ']' || *p == '\0') {
+				__set_bit('-', set->bits);
+			} else {
+				unsigned int c = p[-2] + 1;
+
+				if (c > *p + 1U)
+					return -EINVAL;
+				for (; c <= *p; c++)
+					__set_bit(c, set->bits);
+				p++;
+			}
+		} else
+			__set_bit(*p++, set->bits);
+	}
+
+	if (*p != ']')
+		return -EINVAL;
+	ps->p = p + 1;
+
+	if (invert)
+		bitmap_complement(set->bits, set->bits, 256);
+	__clear_bit(0, set->bits);
+
+	err = nfa_frag1(nfa, NFA_SET, f);
+	if (err)
+		return err;
+
+	nfa->nodes[f->start].set = nfa->nsets++;
+	return 0;
+}
+
+static int nfa_parse_atom(struct nfa_parser *ps, struct nfa_frag *f)
+{
+	struct nfa *nfa = ps->nfa;
+	unsigned char c = *ps->p++;
+	int err;
+
+	switch (c) {
+	case '^':
+		return nfa_frag1(nfa, NFA_BOL, f);
+	case '$':
+		return nfa_frag1(nfa, NFA_EOL, f);
+	case '.':
+		if (nfa->nsets == nfa->maxsets)
+			return -ENOMEM;
+		err = nfa_frag1(nfa, NFA_SET, f);
+		if (err)
+			return err;
+		bitmap_fill(nfa->sets[nfa->nsets].bits, 256);
+		__clear_bit(0, nfa->sets[nfa->nsets].bits);
+		nfa->nodes[f->start].set = nfa->nsets++;
+		return 0;
+	case '[':
+		return nfa_parse_class(ps, f);
+	case '(':
+		err = nfa_parse_reg(ps, f);
+		if (err)
+			return err;
+		if (*ps->p++ != ')')
+			return -EINVAL;
+		return 0;
+	case '\\':
+		c = *ps->p++;
+		if (c == '\0')
+			return -EINVAL;
+		break;
+	case '\0':
+	case '|':
+	case ')':
+	case '?':
+	case '+':
+	case '*':
+		return -EINVAL;
+	}
+
+	err = nfa_frag1(nfa, NFA_CHAR, f);
+	if (err)
+		return err;
+
+	nfa->nodes[f->start].c = c;
+	return 0;
+}
+
+static int nfa_parse_piece(struct nfa_parser *ps, struct nfa_frag *f)
+{
+	struct nfa *nfa = ps->nfa;
+	struct nfa_frag a;
+	int split, end, err;
+
+	err = nfa_parse_atom(ps, &a);
+	if (err)
+		return err;
+
+	switch (*ps->p) {
+	case '*':
+	case '+':
+	case '?':
+		break;
+	default:
+		*f = a;
+		return 0;
+	}
+
+	end = nfa_node(nfa, NFA_EPS, -1, -1);
+	split = nfa_node(nfa, NFA_SPLIT, a.start, end);
+	if (end < 0 || split < 0)
+		return -ENOMEM;
+
+	f->start = split;
+	f->end = end;
+
+	switch (*ps->p++) {
+	case '+':
+		f->start = a.start;
+		/* fall through */
+	case '*':
+		nfa->nodes[a.end].out = split;
+		break;
+	case '?':
+		nfa->nodes[a.end].out = end;
+		break;
+	}
+
+	return 0;
+}
+
+static int nfa_parse_branch(struct nfa_parser *ps, struct nfa_frag *f)
+{
+	struct nfa_frag piece;
+	int err;
+
+	err = nfa_frag1(ps->nfa, NFA_EPS, f);
+	if (err)
+		return err;
+
+	while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+		err = nfa_parse_piece(ps, &piece);
+		if (err)
+			return err;
+		ps->nfa->nodes[f->end].out = piece.start;
+		f->end = piece.end;
+	}
+
+	return 0;
+}
+
+static int nfa_parse_reg(struct nfa_parser *ps, struct nfa_frag *f)
+{
+	struct nfa *nfa = ps->nfa;
+	struct nfa_frag br;
+	int split, join = -1, err;
+
+	err = nfa_parse_branch(ps, f);
+	if (err)
+		return err;
+
+	while (*ps->p == '|') {
+		ps->p++;
+		err = nfa_parse_branch(ps, &br);
+		if (err)
+			return err;
+
+		if (join < 0) {
+			join = nfa_node(nfa, NFA_EPS, -1, -1);
+			if (join < 0)
+				return -ENOMEM;
+			nfa->nodes[f->end].out = join;
+			f->end = join;
+		}
+
+		split = nfa_node(nfa, NFA_SPLIT, f->start, br.start);
+		if (split < 0)
+			return -ENOMEM;
+		nfa->nodes[br.end].out = join;
+		f->start = split;
+	}
+
+	return 0;
+}
+
+/* Adds the nodes reachable from the stacked ones without input */
+static void nfa_closure(const struct nfa *nfa, unsigned long *set,
+			int *stack, int sp, bool bol, bool eol)
+{
+	const struct nfa_node *n;
+
+#define NFA_PUSH(i)							\
+	do {								\
+		if (!__test_and_set_bit((i), set))			\
+			stack[sp++] = (i);				\
+	} while (0)
+
+	while (sp > 0) {
+		n = &nfa->nodes[stack[--sp]];
+		switch (n->type) {
+		case NFA_SPLIT:
+			NFA_PUSH(n->out1);
+			/* fall through */
+		case NFA_EPS:
+			NFA_PUSH(n->out);
+			break;
+		case NFA_BOL:
+			if (bol)
+				NFA_PUSH(n->out);
+			break;
+		case NFA_EOL:
+			if (eol)
+				NFA_PUSH(n->out);
+			break;
+		}
+	}
+
+#undef NFA_PUSH
+}
+
+static bool nfa_accepts(const struct nfa *nfa, const struct nfa_node *n,
+			unsigned int c)
+{
+	if (n->type == NFA_CHAR)
+		return n->c == c;
+	if (n->type == NFA_SET)
+		return test_bit(c, nfa->sets[n->set].bits);
+	return false;
+}
+
+static u32 nfa_matches(const struct nfa *nfa, const unsigned long *set)
+{
+	unsigned int i;
+	u32 m = 0;
+
+	for_each_set_bit(i, set, nfa->nnodes)
+		if (nfa->nodes[i].type == NFA_MATCH)
+			m |= 1U << nfa->nodes[i].c;
+
+	return m;
+}
+
+/* Splits the byte values into classes no NFA transition tells apart,
+ * returns their number */
+static int nfa_classes(const struct nfa *nfa, u8 *class)
+{
+	unsigned int i, b, n = 1;
+	int *cls, *split;
+
+	/* Too big for the stack */
+	cls = kcalloc(256 + 512, sizeof(int), GFP_KERNEL);
+	if (cls == NULL)
+		return -ENOMEM;
+	split = cls + 256;
+
+	for (i = 0; i < nfa->nnodes; i++) {
+		const struct nfa_node *node = &nfa->nodes[i];
+
+		if (node->type != NFA_CHAR && node->type != NFA_SET)
+			continue;
+
+		memset(split, -1, 512 * sizeof(int));
+		for (b = 0; b < 256; b++) {
+			if (!nfa_accepts(nfa, node, b))
+				continue;
+			if (split[cls[b]] < 0)
+				split[cls[b]] = n++;
+			cls[b] = split[cls[b]];
+		}
+
+		/* Renumber densely, classes emptied above go away */
+		memset(split, -1, 512 * sizeof(int));
+		n = 0;
+		for (b = 0; b < 256; b++) {
+			if (split[cls[b]] < 0)
+				split[cls[b]] = n++;
+			cls[b] = split[cls[b]];
+		}
+	}
+
+	for (b = 0; b < 256; b++)
+		class[b] = cls[b];
+
+	kfree(cls);
+	return n;
+}
+
+static void l7dfa_free(struct l7dfa *dfa)
+{
+	if (dfa == NULL)
+		return;
+
+	l7dfa_kvfree(dfa->next);
+	l7dfa_kvfree(dfa->accept);
+	l7dfa_kvfree(dfa->accept_eol);
+	kfree(dfa);
+}
+
+struct dfa_builder {
+	const struct nfa *nfa;
+	struct l7dfa *dfa;
+	unsigned int words;
+	unsigned int hsize;
+	unsigned int max_states;
+	unsigned long *sets;	/* NFA nodes of each DFA state */
+	u16 *hash;		/* state + 1 by hash of its node set */
+	int *stack;
+};
+
+/* Trims the tables, sized for max_states, to the states built */
+static int dfa_shrink(struct l7dfa *dfa)
+{
+	u16 *next;
+	u32 *accept, *accept_eol;
+
+	next = l7dfa_alloc(dfa->nstates * dfa->nclasses * sizeof(u16));
+	accept = l7dfa_alloc(dfa->nstates * sizeof(u32));
+	accept_eol = l7dfa_alloc(dfa->nstates * sizeof(u32));
+	if (next == NULL || accept == NULL || accept_eol == NULL) {
+		l7dfa_kvfree(next);
+		l7dfa_kvfree(accept);
+		l7dfa_kvfree(accept_eol);
+		return -ENOMEM;
+	}
+
+	memcpy(next, dfa->next, dfa->nstates * dfa->nclasses * sizeof(u16));
+	memcpy(accept, dfa->accept, dfa->nstates * sizeof(u32));
+	memcpy(accept_eol, dfa->accept_eol, dfa->nstates * sizeof(u32));
+
+	l7dfa_kvfree(dfa->next);
+	l7dfa_kvfree(dfa->accept);
+	l7dfa_kvfree(dfa->accept_eol);
+	dfa->next = next;
+	dfa->accept = accept;
+	dfa->accept_eol = accept_eol;
+
+	return 0;
+}
+
+/* Returns the state for node set cur, which is clobbered */
+static int dfa_state(struct dfa_builder *b, unsigned long *cur)
+{
+	const struct nfa *nfa = b->nfa;
+	struct l7dfa *dfa = b->dfa;
+	unsigned long *set;
+	unsigned int h, i, s;
+	int sp = 0;
+
+	h = jhash(cur, b->words * sizeof(long), 0) & (b->hsize - 1);
+	while (b->hash[h] != 0) {
+		s = b->hash[h] - 1;
+		if (bitmap_equal(b->sets + s * b->words, cur, nfa->nnodes))
+			return s;
+		h = (h + 1) & (b->hsize - 1);
+	}
+
+	if (dfa->nstates == b->max_states)
+		return -E2BIG;
+
+	s = dfa->nstates++;
+	b->hash[h] = s + 1;
+	set = b->sets + s * b->words;
+	bitmap_copy(set, cur, nfa->nnodes);
+	dfa->accept[s] = nfa_matches(nfa, set);
+
+	/* What the state finds if no more data follows */
+	for_each_set_bit(i, set, nfa->nnodes)
+		if (nfa->nodes[i].type == NFA_EOL)
+			b->stack[sp++] = i;
+	nfa_closure(nfa, cur, b->stack, sp, false, true);
+	dfa->accept_eol[s] = nfa_matches(nfa, cur);
+
+	return s;
+}
+
+/* Subset construction from NFA node start */
+static struct l7dfa *nfa_to_dfa(const struct nfa *nfa, int start,
+				unsigned int max_states)
+{
+	struct dfa_builder b = {
+		.nfa		= nfa,
+		.words		= BITS_TO_LONGS(nfa->nnodes),
+		.hsize		= roundup_pow_of_two(2 * max_states),
+		.max_states	= max_states,
+	};
+	unsigned long *restart, *cur;
+	unsigned int s, k, i, c;
+	unsigned char rep[256];
+	struct l7dfa *dfa;
+	u8 class[256];
+	int t, err = -ENOMEM;
+
+	b.dfa = dfa = kzalloc(sizeof(*dfa), GFP_KERNEL);
+	b.sets = l7dfa_alloc((max_states + 2) * b.words * sizeof(long));
+	b.hash = l7dfa_alloc(b.hsize * sizeof(u16));
+	b.stack = l7dfa_alloc(nfa->nnodes * sizeof(int));
+	if (dfa == NULL || b.sets == NULL || b.hash == NULL || b.stack == NULL)
+		goto err;
+
+	t = nfa_classes(nfa, class);
+	if (t < 0)
+		goto err;
+	dfa->nclasses = t;
+	for (c = 256; c-- > 0; )
+		rep[class[c]] = c;
+	for (c = 0; c < 256; c++)
+		dfa->class[c] = class[isascii(c) ? tolower(c) : c];
+
+	dfa->next = l7dfa_alloc(max_states * dfa->nclasses * sizeof(u16));
+	dfa->accept = l7dfa_alloc(max_states * sizeof(u32));
+	dfa->accept_eol = l7dfa_alloc(max_states * sizeof(u32));
+	if (dfa->next == NULL || dfa->accept == NULL ||
+	    dfa->accept_eol == NULL)
+		goto err;
+
+	/* Scratch sets past the states: restart closure and work set */
+	restart = b.sets + max_states * b.words;
+	cur = restart + b.words;
+
+	b.stack[0] = start;
+	__set_bit(start, restart);
+	nfa_closure(nfa, restart, b.stack, 1, false, false);
+
+	/* The start state is the only one where '^' matches */
+	b.stack[0] = start;
+	__set_bit(start, cur);
+	nfa_closure(nfa, cur, b.stack, 1, true, false);
+	dfa_state(&b, cur);
+
+	for (s = 0; s < dfa->nstates; s++) {
+		const unsigned long *from = b.sets + s * b.words;
+
+		for (k = 0; k < dfa->nclasses; k++) {
+			int sp = 0;
+
+			/* Unanchored search: every state restarts too */
+			bitmap_copy(cur, restart, nfa->nnodes);
+			for_each_set_bit(i, from, nfa->nnodes) {
+				const struct nfa_node *n = &nfa->nodes[i];
+
+				if (nfa_accepts(nfa, n, rep[k]) &&
+				    !__test_and_set_bit(n->out, cur))
+					b.stack[sp++] = n->out;
+			}
+			nfa_closure(nfa, cur, b.stack, sp, false, false);
+
+			t = dfa_state(&b, cur);
+			if (t < 0) {
+				err = t;
+				goto err;
+			}
+			dfa->next[s * dfa->nclasses + k] = t;
+		}
+	}
+
+	err = dfa_shrink(dfa);
+	if (err)
+		goto err;
+
+	l7dfa_kvfree(b.sets);
+	l7dfa_kvfree(b.hash);
+	l7dfa_kvfree(b.stack);
+	return dfa;
+
+err:
+	l7dfa_kvfree(b.sets);
+	l7dfa_kvfree(b.hash);
+	l7dfa_kvfree(b.stack);
+	l7dfa_free(dfa);
+	return ERR_PTR(err);
+}
+
+static struct l7dfa *l7dfa_compile(const char * const *patterns,
+				   unsigned int n, unsigned int max_states)
+{
+	struct nfa nfa = {};
+	struct nfa_parser ps;
+	struct nfa_frag f;
+	struct l7dfa *dfa;
+	unsigned int i;
+	size_t len = 0;
+	int start, err;
+
+	if (n == 0 || n > L7DFA_GROUP_MAX ||
+	    max_states == 0 || max_states >= USHRT_MAX)
+		return ERR_PTR(-EINVAL);
+
+	for (i = 0; i < n; i++)
+		len += strlen(patterns[i]);
+
+	/* At most three nodes per pattern byte, plus the glue */
+	nfa.maxnodes = 3 * len + 3 * n;
+	nfa.maxsets = len;
+	nfa.nodes = l7dfa_alloc(nfa.maxnodes * sizeof(*nfa.nodes));
+	nfa.sets = l7dfa_alloc((nfa.maxsets + 1) * sizeof(*nfa.sets));
+	if (nfa.nodes == NULL || nfa.sets == NULL) {
+		dfa = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+
+	start = -1;
+	for (i = 0; i < n; i++) {
+		int match, split;
+
+		ps.nfa = &nfa;
+		ps.p = (const unsigned char *)patterns[i];
+		err = nfa_parse_reg(&ps, &f);
+		if (err == 0 && *ps.p != '\0')
+			err = -EINVAL;
+		if (err) {
+			dfa = ERR_PTR(err);
+			goto out;
+		}
+
+		match = nfa_node(&nfa, NFA_MATCH, -1, -1);
+		if (match < 0) {
+			dfa = ERR_PTR(-ENOMEM);
+			goto out;
+		}
+		nfa.nodes[match].c = i;
+		nfa.nodes[f.end].out = match;
+
+		if (start < 0) {
+			start = f.start;
+			continue;
+		}
+		split = nfa_node(&nfa, NFA_SPLIT, start, f.start);
+		if (split < 0) {
+			dfa = ERR_PTR(-ENOMEM);
+			goto out;
+		}
+		start = split;
+	}
+
+	dfa = nfa_to_dfa(&nfa, start, max_states);
+out:
+	l7dfa_kvfree(nfa.nodes);
+	l7dfa_kvfree(nfa.sets);
+	return dfa;
+}
@@ -0,0 +1,39 @@
+/*
+ * Deterministic automata for l7-filter patterns.
+ *
+ * A group of patterns in the regexp.c syntax is compiled into one DFA
+ * which finds all of them in a single pass.  The search is unanchored
+ * like regexec(): '^' only matches at the first byte looked at, '$'
+ * at the end of the data looked at so far.  Input bytes are folded to
+ * lower case as add_datastr() does.
+ */
+
+#ifndef L7DFA_H
+#define L7DFA_H
+
+/* Patterns per automaton, one bit each in the accept masks */
+#define L7DFA_GROUP_MAX	32
+
+#define L7DFA_START	0
+
+struct l7dfa {
+	unsigned int nstates;
+	unsigned int nclasses;
+	u8 class[256];		/* input byte to class */
+	u16 *next;		/* [state * nclasses + class] */
+	u32 *accept;		/* patterns matched when entering state */
+	u32 *accept_eol;	/* patterns matched if the data ends here */
+};
+
+static inline unsigned int
+l7dfa_step(const struct l7dfa *dfa, unsigned int state, unsigned char c)
+{
+	return dfa->next[state * dfa->nclasses + dfa->class[c]];
+}
+
+/* Returns ERR_PTR(-E2BIG) past max_states states */
+static struct l7dfa *l7dfa_compile(const char * const *patterns,
+				   unsigned int n, unsigned int max_states);
+static void l7dfa_free(struct l7dfa *dfa);
+
+#endif
@@ -23,7 +23,7 @@ static inline u32 nf_ct_orig_ipv4_src(const struct nf_conn *ct)
 
 static inline const u32 *nf_ct_orig_ipv6_src(const struct nf_conn *ct)
 {
-	return (__force u32 *)ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple.src.u3.ip6;
+	return ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple.src.u3.all;
 }
 
 static inline u_int32_t
@@ -40,46 +40,46 @@ connbytes_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	case XT_CONNBYTES_PKTS:
 		switch (sinfo->direction) {
 		case XT_CONNBYTES_DIR_ORIGINAL:
-			what = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].packets);
+			what = nf_ct_acct_packets(&counters[IP_CT_DIR_ORIGINAL]);
 			break;
 		case XT_CONNBYTES_DIR_REPLY:
-			what = atomic64_read(&counters[IP_CT_DIR_REPLY].packets);
+			what = nf_ct_acct_packets(&counters[IP_CT_DIR_REPLY]);
 			break;
 		case XT_CONNBYTES_DIR_BOTH:
-			what = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].packets);
-			what += atomic64_read(&counters[IP_CT_DIR_REPLY].packets);
+			what = nf_ct_acct_packets(&counters[IP_CT_DIR_ORIGINAL]);
+			what += nf_ct_acct_packets(&counters[IP_CT_DIR_REPLY]);
 			break;
 		}
 		break;
 	case XT_CONNBYTES_BYTES:
 		switch (sinfo->direction) {
 		case XT_CONNBYTES_DIR_ORIGINAL:
-			what = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].bytes);
+			what = nf_ct_acct_bytes(&counters[IP_CT_DIR_ORIGINAL]);
 			break;
 		case XT_CONNBYTES_DIR_REPLY:
-			what = atomic64_read(&counters[IP_CT_DIR_REPLY].bytes);
+			what = nf_ct_acct_bytes(&counters[IP_CT_DIR_REPLY]);
 			break;
 		case XT_CONNBYTES_DIR_BOTH:
-			what = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].bytes);
-			what += atomic64_read(&counters[IP_CT_DIR_REPLY].bytes);
+			what = nf_ct_acct_bytes(&counters[IP_CT_DIR_ORIGINAL]);
+			what += nf_ct_acct_bytes(&counters[IP_CT_DIR_REPLY]);
 			break;
 		}
 		break;
 	case XT_CONNBYTES_AVGPKT:
 		switch (sinfo->direction) {
 		case XT_CONNBYTES_DIR_ORIGINAL:
-			bytes = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].bytes);
-			pkts  = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].packets);
+			bytes = nf_ct_acct_bytes(&counters[IP_CT_DIR_ORIGINAL]);
+			pkts  = nf_ct_acct_packets(&counters[IP_CT_DIR_ORIGINAL]);
 			break;
 		case XT_CONNBYTES_DIR_REPLY:
-			bytes = atomic64_read(&counters[IP_CT_DIR_REPLY].bytes);
-			pkts  = atomic64_read(&counters[IP_CT_DIR_REPLY].packets);
+			bytes = nf_ct_acct_bytes(&counters[IP_CT_DIR_REPLY]);
+			pkts  = nf_ct_acct_packets(&counters[IP_CT_DIR_REPLY]);
 			break;
 		case XT_CONNBYTES_DIR_BOTH:
-			bytes = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].bytes) +
-				atomic64_read(&counters[IP_CT_DIR_REPLY].bytes);
-			pkts  = atomic64_read(&counters[IP_CT_DIR_ORIGINAL].packets) +
-				atomic64_read(&counters[IP_CT_DIR_REPLY].packets);
+			bytes = nf_ct_acct_bytes(&counters[IP_CT_DIR_ORIGINAL]) +
+				nf_ct_acct_bytes(&counters[IP_CT_DIR_REPLY]);
+			pkts  = nf_ct_acct_packets(&counters[IP_CT_DIR_ORIGINAL]) +
+				nf_ct_acct_packets(&counters[IP_CT_DIR_REPLY]);
 			break;
 		}
 		if (pkts != 0)
@@ -32,9 +32,15 @@
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_layer7.h>
 #include <linux/ctype.h>
+#include <linux/jhash.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
 
 #include "regexp/regexp.c"
+#include "regexp/l7dfa.c"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Matthew Strait <quadong@users.sf.net>, Ethan Sommer <sommere@users.sf.net>");
@@ -45,6 +51,9 @@ MODULE_VERSION("2.21");
 static int maxdatalen = 2048; // this is the default
 module_param(maxdatalen, int, 0444);
 MODULE_PARM_DESC(maxdatalen, "maximum bytes of data looked at by l7-filter");
+static unsigned int dfa_states = 1024;
+module_param(dfa_states, uint, 0644);
+MODULE_PARM_DESC(dfa_states, "maximum states of one combined pattern automaton");
 #ifdef CONFIG_NETFILTER_XT_MATCH_LAYER7_DEBUG
 	#define DPRINTK(format,args...) printk(format,##args)
 #else
@@ -55,13 +64,75 @@ MODULE_PARM_DESC(maxdatalen, "maximum bytes of data looked at by l7-filter");
 This can be modified through /proc/net/layer7_numpackets */
 static int num_packets = 10;
 
-static struct pattern_cache {
-	char * regex_string;
-	regexp * pattern;
-	struct pattern_cache * next;
-} * first_pattern_cache = NULL;
+/*
+ * The patterns of all loaded rules are combined into a few automata,
+ * L7DFA_GROUP_MAX patterns each, which look at every byte once no matter
+ * how many rules there are.  A pattern which would blow an automaton
+ * past dfa_states states is matched with regexec() on the collected data
+ * as before.  match() sees an immutable l7_set under RCU; rule changes
+ * build a new one under l7_mutex.
+ */
+
+/* A protocol and pattern of the loaded rules */
+struct l7_pattern {
+	struct list_head list;
+	atomic_t refcnt;		/* registry, sets and groups */
+	unsigned int rules;		/* under l7_mutex */
+	spinlock_t lock;		/* regexec() writes to prog */
+	regexp *prog;			/* NULL if it does not compile */
+	char *protocol;
+	char *regex;
+};
+
+/* Patterns searched by one automaton, shared between sets */
+struct l7_group {
+	atomic_t refcnt;
+	struct l7dfa *dfa;
+	unsigned int n;
+	struct l7_pattern *pat[L7DFA_GROUP_MAX];
+};
 
-DEFINE_SPINLOCK(l7_lock);
+struct l7_entry {
+	struct l7_pattern *pat;
+	int group;			/* -1 if matched with regexec() */
+	unsigned int bit;
+	bool shared;			/* protocol name used by another */
+	int next;			/* in hash chain, -1 ends */
+};
+
+#define L7_HASH_SIZE	64
+
+struct l7_set {
+	struct rcu_head rcu;
+	struct work_struct work;
+	unsigned int gen;
+	unsigned int ngroups;
+	unsigned int nentries;
+	bool fallback;			/* some entry needs collected data */
+	size_t flow_size;
+	struct l7_group **groups;
+	int hash[L7_HASH_SIZE];
+	struct l7_entry entries[0];
+};
+
+/* Search state of a connection, kept in layer7.app_data */
+struct l7_flow {
+	unsigned int gen;		/* of the set the states belong to */
+	unsigned int len;		/* bytes looked at */
+	char *data;			/* collected for regexec(), or NULL */
+	struct {
+		u16 state;
+		u32 matched;
+	} g[0];
+};
+
+static DEFINE_MUTEX(l7_mutex);
+static LIST_HEAD(l7_patterns);
+static struct l7_set __rcu *l7_set;
+static unsigned int l7_gen;
+
+/* Per packet matching with regexec() */
+static DEFINE_PER_CPU(char *, l7_scratch);
 
 static int total_acct_packets(struct nf_conn *ct)
 {
@@ -75,139 +146,371 @@ static int total_acct_packets(struct nf_conn *ct)
 	acct = nf_conn_acct_find(ct);
 	if (!acct)
 		return 0;
-	return (atomic64_read(&acct[IP_CT_DIR_ORIGINAL].packets) + atomic64_read(&acct[IP_CT_DIR_REPLY].packets));
+	return (nf_ct_acct_packets(&acct[IP_CT_DIR_ORIGINAL]) + nf_ct_acct_packets(&acct[IP_CT_DIR_REPLY]));
 #endif
 }
 
-#ifdef CONFIG_IP_NF_MATCH_LAYER7_DEBUG
-/* Converts an unfriendly string into a friendly one by
-replacing unprintables with periods and all whitespace with " ". */
-static char * friendly_print(unsigned char * s)
+
+static void l7_pattern_put(struct l7_pattern *pat)
 {
-	char * f = kmalloc(strlen(s) + 1, GFP_ATOMIC);
-	int i;
+	if (!atomic_dec_and_test(&pat->refcnt))
+		return;
 
-	if(!f) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"friendly_print, bailing.\n");
+	kfree(pat->prog);
+	kfree(pat->protocol);
+	kfree(pat->regex);
+	kfree(pat);
+}
+
+static struct l7_pattern *l7_pattern_alloc(const struct xt_layer7_info *info)
+{
+	struct l7_pattern *pat;
+	int len;
+
+	pat = kzalloc(sizeof(*pat), GFP_KERNEL);
+	if (pat == NULL)
 		return NULL;
-	}
 
-	for(i = 0; i < strlen(s); i++){
-		if(isprint(s[i]) && s[i] < 128)	f[i] = s[i];
-		else if(isspace(s[i]))		f[i] = ' ';
-		else 				f[i] = '.';
+	atomic_set(&pat->refcnt, 1);
+	pat->rules = 1;
+	spin_lock_init(&pat->lock);
+	pat->protocol = kstrdup(info->protocol, GFP_KERNEL);
+	pat->regex = kstrdup(info->pattern, GFP_KERNEL);
+	if (pat->protocol == NULL || pat->regex == NULL) {
+		l7_pattern_put(pat);
+		return NULL;
 	}
-	f[i] = '\0';
-	return f;
+
+	DPRINTK("About to compile this: \"%s\"\n", pat->regex);
+	len = strlen(pat->regex);
+	pat->prog = regcomp(pat->regex, &len);
+	if (pat->prog == NULL)
+		printk(KERN_ERR "layer7: Error compiling regexp \"%s\" (%s)\n",
+		       pat->regex, pat->protocol);
+
+	return pat;
 }
 
-static char dec2hex(int i)
+static void l7_group_put(struct l7_group *g)
 {
-	switch (i) {
-		case 0 ... 9:
-			return (i + '0');
-			break;
-		case 10 ... 15:
-			return (i - 10 + 'a');
-			break;
-		default:
-			if (net_ratelimit())
-				printk("layer7: Problem in dec2hex\n");
-			return '\0';
-	}
+	unsigned int i;
+
+	if (!atomic_dec_and_test(&g->refcnt))
+		return;
+
+	for (i = 0; i < g->n; i++)
+		l7_pattern_put(g->pat[i]);
+	l7dfa_free(g->dfa);
+	kfree(g);
 }
 
-static char * hex_print(unsigned char * s)
+/* Compiles the live patterns of pats plus extra, if not NULL */
+static struct l7_group *l7_group_build(struct l7_pattern * const *pats,
+				       unsigned int n,
+				       struct l7_pattern *extra)
 {
-	char * g = kmalloc(strlen(s)*3 + 1, GFP_ATOMIC);
-	int i;
+	const char *regex[L7DFA_GROUP_MAX];
+	struct l7_group *g;
+	unsigned int i;
+
+	g = kzalloc(sizeof(*g), GFP_KERNEL);
+	if (g == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	atomic_set(&g->refcnt, 1);
+	for (i = 0; i < n; i++) {
+		if (pats[i]->rules == 0)
+			continue;
+		g->pat[g->n++] = pats[i];
+	}
+	if (extra != NULL)
+		g->pat[g->n++] = extra;
 
-	if(!g) {
-	       if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in hex_print, "
-					"bailing.\n");
-	       return NULL;
+	for (i = 0; i < g->n; i++) {
+		atomic_inc(&g->pat[i]->refcnt);
+		regex[i] = g->pat[i]->regex;
 	}
 
-	for(i = 0; i < strlen(s); i++) {
-		g[i*3    ] = dec2hex(s[i]/16);
-		g[i*3 + 1] = dec2hex(s[i]%16);
-		g[i*3 + 2] = ' ';
+	if (g->n == 0) {
+		kfree(g);
+		return NULL;
+	}
+
+	g->dfa = l7dfa_compile(regex, g->n,
+			       clamp(dfa_states, 1U, USHRT_MAX - 1U));
+	if (IS_ERR(g->dfa)) {
+		int err = PTR_ERR(g->dfa);
+
+		g->dfa = NULL;
+		l7_group_put(g);
+		return ERR_PTR(err);
 	}
-	g[i*3] = '\0';
 
 	return g;
 }
-#endif // DEBUG
 
-/* Use instead of regcomp.  As we expect to be seeing the same regexps over and
-over again, it make sense to cache the results. */
-static regexp * compile_and_cache(const char * regex_string, 
-                                  const char * protocol)
+static void l7_set_free_work(struct work_struct *work)
+{
+	struct l7_set *set = container_of(work, struct l7_set, work);
+	unsigned int i;
+
+	for (i = 0; i < set->ngroups; i++)
+		l7_group_put(set->groups[i]);
+	for (i = 0; i < set->nentries; i++)
+		l7_pattern_put(set->entries[i].pat);
+	kfree(set->groups);
+	kfree(set);
+}
+
+/* Automata may be vmalloc'ed, drop them in process context */
+static void l7_set_free_rcu(struct rcu_head *head)
+{
+	struct l7_set *set = container_of(head, struct l7_set, rcu);
+
+	INIT_WORK(&set->work, l7_set_free_work);
+	schedule_work(&set->work);
+}
+
+static unsigned int l7_hash(const char *protocol)
 {
-	struct pattern_cache * node               = first_pattern_cache;
-	struct pattern_cache * last_pattern_cache = first_pattern_cache;
-	struct pattern_cache * tmp;
-	unsigned int len;
+	return jhash(protocol, strlen(protocol), 0) & (L7_HASH_SIZE - 1);
+}
 
-	while (node != NULL) {
-		if (!strcmp(node->regex_string, regex_string))
-		return node->pattern;
+/* Replaces the set by one with the registered patterns and groups */
+static int l7_publish(struct l7_group * const *groups, unsigned int ngroups)
+{
+	struct l7_set *set, *old;
+	struct l7_pattern *pat;
+	unsigned int i, j, n = 0;
+
+	list_for_each_entry(pat, &l7_patterns, list)
+		n++;
+
+	set = kzalloc(sizeof(*set) + n * sizeof(set->entries[0]),
+		      GFP_KERNEL);
+	if (set == NULL)
+		return -ENOMEM;
+
+	set->groups = kmemdup(groups, ngroups * sizeof(groups[0]) ? : 1,
+			      GFP_KERNEL);
+	if (set->groups == NULL) {
+		kfree(set);
+		return -ENOMEM;
+	}
+	set->ngroups = ngroups;
+	for (i = 0; i < ngroups; i++)
+		atomic_inc(&groups[i]->refcnt);
+
+	for (i = 0; i < L7_HASH_SIZE; i++)
+		set->hash[i] = -1;
+
+	list_for_each_entry(pat, &l7_patterns, list) {
+		struct l7_entry *e = &set->entries[set->nentries];
+		unsigned int h = l7_hash(pat->protocol);
+		int k;
+
+		atomic_inc(&pat->refcnt);
+		e->pat = pat;
+		e->group = -1;
+		for (i = 0; i < ngroups; i++) {
+			for (j = 0; j < groups[i]->n; j++) {
+				if (groups[i]->pat[j] == pat) {
+					e->group = i;
+					e->bit = j;
+				}
+			}
+		}
+		if (e->group < 0 && pat->prog != NULL)
+			set->fallback = true;
 
-		last_pattern_cache = node;/* points at the last non-NULL node */
-		node = node->next;
+		for (k = set->hash[h]; k >= 0; k = set->entries[k].next) {
+			if (!strcmp(set->entries[k].pat->protocol,
+				    pat->protocol))
+				set->entries[k].shared = e->shared = true;
+		}
+		e->next = set->hash[h];
+		set->hash[h] = set->nentries++;
 	}
 
-	/* If we reach the end of the list, then we have not yet cached
-	   the pattern for this regex. Let's do that now.
-	   Be paranoid about running out of memory to avoid list corruption. */
-	tmp = kmalloc(sizeof(struct pattern_cache), GFP_ATOMIC);
+	set->flow_size = sizeof(struct l7_flow) +
+			 ngroups * sizeof(((struct l7_flow *)0)->g[0]);
+	if (set->fallback)
+		set->flow_size += maxdatalen;
 
-	if(!tmp) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"compile_and_cache, bailing.\n");
-		return NULL;
+	set->gen = ++l7_gen;
+
+	old = rcu_dereference_protected(l7_set, lockdep_is_held(&l7_mutex));
+	rcu_assign_pointer(l7_set, set);
+	if (old != NULL)
+		call_rcu(&old->rcu, l7_set_free_rcu);
+
+	return 0;
+}
+
+/* Searches pat with the last automaton or a new one */
+static int l7_set_add(struct l7_pattern *pat)
+{
+	struct l7_set *old;
+	struct l7_group **groups, *last, *g = NULL;
+	unsigned int n = 0;
+	int err;
+
+	old = rcu_dereference_protected(l7_set, lockdep_is_held(&l7_mutex));
+	if (old != NULL)
+		n = old->ngroups;
+
+	groups = kmalloc((n + 1) * sizeof(groups[0]), GFP_KERNEL);
+	if (groups == NULL)
+		return -ENOMEM;
+	if (n)
+		memcpy(groups, old->groups, n * sizeof(groups[0]));
+
+	if (pat->prog == NULL)
+		goto publish;
+
+	last = n ? groups[n - 1] : NULL;
+	if (last != NULL && last->n < L7DFA_GROUP_MAX) {
+		g = l7_group_build(last->pat, last->n, pat);
+		if (!IS_ERR(g)) {
+			groups[n - 1] = g;
+			goto publish;
+		}
+		if (PTR_ERR(g) != -E2BIG) {
+			err = PTR_ERR(g);
+			goto out;
+		}
 	}
 
-	tmp->regex_string  = kmalloc(strlen(regex_string) + 1, GFP_ATOMIC);
-	tmp->pattern       = kmalloc(sizeof(struct regexp),    GFP_ATOMIC);
-	tmp->next = NULL;
+	g = l7_group_build(NULL, 0, pat);
+	if (!IS_ERR(g)) {
+		groups[n++] = g;
+	} else if (PTR_ERR(g) == -E2BIG) {
+		printk(KERN_INFO "layer7: pattern of %s needs more than %u "
+		       "states, using regexec\n", pat->protocol, dfa_states);
+		g = NULL;
+	} else {
+		err = PTR_ERR(g);
+		goto out;
+	}
 
-	if(!tmp->regex_string || !tmp->pattern) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: out of memory in "
-					"compile_and_cache, bailing.\n");
-		kfree(tmp->regex_string);
-		kfree(tmp->pattern);
-		kfree(tmp);
-		return NULL;
+publish:
+	err = l7_publish(groups, n);
+	if (g != NULL)
+		l7_group_put(g);
+out:
+	kfree(groups);
+	return err;
+}
+
+/* Rebuilds the automaton pat was searched with */
+static void l7_set_del(struct l7_pattern *pat)
+{
+	struct l7_set *old;
+	struct l7_group **groups, *g = NULL;
+	unsigned int i, j, n;
+
+	old = rcu_dereference_protected(l7_set, lockdep_is_held(&l7_mutex));
+	n = old->ngroups;
+
+	groups = kmemdup(old->groups, n * sizeof(groups[0]) ? : 1,
+			 GFP_KERNEL);
+	if (groups == NULL)
+		return;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < groups[i]->n; j++)
+			if (groups[i]->pat[j] == pat)
+				break;
+		if (j < groups[i]->n)
+			break;
 	}
 
-	/* Ok.  The new node is all ready now. */
-	node = tmp;
+	if (i < n) {
+		g = l7_group_build(groups[i]->pat, groups[i]->n, NULL);
+		if (!IS_ERR_OR_NULL(g)) {
+			groups[i] = g;
+		} else {
+			/* Nothing left, or the rest go to regexec() */
+			memmove(&groups[i], &groups[i + 1],
+				(n - i - 1) * sizeof(groups[0]));
+			n--;
+			g = NULL;
+		}
+	}
 
-	if(first_pattern_cache == NULL) /* list is empty */
-		first_pattern_cache = node; /* make node the beginning */
-	else
-		last_pattern_cache->next = node; /* attach node to the end */
+	/* On failure the old set keeps searching for pat, harmlessly */
+	l7_publish(groups, n);
+	if (g != NULL)
+		l7_group_put(g);
+	kfree(groups);
+}
 
-	/* copy the string and compile the regex */
-	len = strlen(regex_string);
-	DPRINTK("About to compile this: \"%s\"\n", regex_string);
-	node->pattern = regcomp((char *)regex_string, &len);
-	if ( !node->pattern ) {
-		if (net_ratelimit())
-			printk(KERN_ERR "layer7: Error compiling regexp "
-					"\"%s\" (%s)\n", 
-					regex_string, protocol);
-		/* pattern is now cached as NULL, so we won't try again. */
+static int l7_pattern_add(const struct xt_layer7_info *info)
+{
+	struct l7_pattern *pat;
+	int err = 0;
+
+	mutex_lock(&l7_mutex);
+	list_for_each_entry(pat, &l7_patterns, list) {
+		if (!strcmp(pat->protocol, info->protocol) &&
+		    !strcmp(pat->regex, info->pattern)) {
+			pat->rules++;
+			goto out;
+		}
 	}
 
-	strcpy(node->regex_string, regex_string);
-	return node->pattern;
+	pat = l7_pattern_alloc(info);
+	if (pat == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	list_add_tail(&pat->list, &l7_patterns);
+	err = l7_set_add(pat);
+	if (err) {
+		list_del(&pat->list);
+		pat->rules = 0;
+		l7_pattern_put(pat);
+	}
+out:
+	mutex_unlock(&l7_mutex);
+	return err;
+}
+
+static void l7_pattern_del(const struct xt_layer7_info *info)
+{
+	struct l7_pattern *pat;
+
+	mutex_lock(&l7_mutex);
+	list_for_each_entry(pat, &l7_patterns, list) {
+		if (!strcmp(pat->protocol, info->protocol) &&
+		    !strcmp(pat->regex, info->pattern)) {
+			if (--pat->rules == 0) {
+				list_del(&pat->list);
+				l7_set_del(pat);
+				l7_pattern_put(pat);
+			}
+			break;
+		}
+	}
+	mutex_unlock(&l7_mutex);
+}
+
+static const struct l7_entry *l7_set_find(const struct l7_set *set,
+					  const struct xt_layer7_info *info)
+{
+	const struct l7_entry *e;
+	int i;
+
+	for (i = set->hash[l7_hash(info->protocol)]; i >= 0; i = e->next) {
+		e = &set->entries[i];
+		if (strcmp(e->pat->protocol, info->protocol))
+			continue;
+		if (!e->shared || !strcmp(e->pat->regex, info->pattern))
+			return e;
+	}
+
+	return NULL;
 }
 
 static int can_handle(const struct sk_buff *skb)
@@ -248,6 +551,27 @@ static int app_data_offset(const struct sk_buff *skb)
 	}
 }
 
+/* Linearizes the skb and returns where the app data starts, or NULL */
+static unsigned char *app_data_get(struct sk_buff *skb, unsigned int *len)
+{
+	unsigned char *app_data;
+
+	if(skb_is_nonlinear(skb)){
+		if(skb_linearize(skb) != 0){
+			if (net_ratelimit())
+				printk(KERN_ERR "layer7: failed to linearize "
+						"packet, bailing.\n");
+			return NULL;
+		}
+	}
+
+	/* now that the skb is linearized, it's safe to set these. */
+	app_data = skb->data + app_data_offset(skb);
+	*len = skb_tail_pointer(skb) - app_data;
+
+	return app_data;
+}
+
 /* handles whether there's a match when we aren't appending data anymore */
 static int match_no_append(struct nf_conn * conntrack, 
                            struct nf_conn * master_conntrack, 
@@ -255,25 +579,16 @@ static int match_no_append(struct nf_conn * conntrack,
                            enum ip_conntrack_info master_ctinfo,
                            const struct xt_layer7_info * info)
 {
-	/* If we're in here, throw the app data away */
+	/* If we're in here, throw the search state away */
 	if(master_conntrack->layer7.app_data != NULL) {
+		struct l7_flow *flow = master_conntrack->layer7.app_data;
 
-	#ifdef CONFIG_IP_NF_MATCH_LAYER7_DEBUG
-		if(!master_conntrack->layer7.app_proto) {
-			char * f = 
-			  friendly_print(master_conntrack->layer7.app_data);
-			char * g = 
-			  hex_print(master_conntrack->layer7.app_data);
-			DPRINTK("\nl7-filter gave up after %d bytes "
-				"(%d packets):\n%s\n",
-				strlen(f), total_acct_packets(master_conntrack), f);
-			kfree(f);
-			DPRINTK("In hex: %s\n", g);
-			kfree(g);
-		}
-	#endif
+		if(!master_conntrack->layer7.app_proto)
+			DPRINTK("\nl7-filter gave up after %u bytes "
+				"(%d packets)\n", flow->len,
+				total_acct_packets(master_conntrack));
 
-		kfree(master_conntrack->layer7.app_data);
+		kfree(flow);
 		master_conntrack->layer7.app_data = NULL; /* don't free again */
 	}
 
@@ -281,8 +596,8 @@ static int match_no_append(struct nf_conn * conntrack,
 		/* Here child connections set their .app_proto (for /proc) */
 		if(!conntrack->layer7.app_proto) {
 			conntrack->layer7.app_proto = 
-			  kmalloc(strlen(master_conntrack->layer7.app_proto)+1, 
-			    GFP_ATOMIC);
+			  kstrdup(master_conntrack->layer7.app_proto,
+				  GFP_ATOMIC);
 			if(!conntrack->layer7.app_proto){
 				if (net_ratelimit())
 					printk(KERN_ERR "layer7: out of memory "
@@ -290,8 +605,6 @@ static int match_no_append(struct nf_conn * conntrack,
 							"bailing.\n");
 				return 1;
 			}
-			strcpy(conntrack->layer7.app_proto, 
-				master_conntrack->layer7.app_proto);
 		}
 
 		return (!strcmp(master_conntrack->layer7.app_proto, 
@@ -301,14 +614,13 @@ static int match_no_append(struct nf_conn * conntrack,
 		/* If not classified, set to "unknown" to distinguish from
 		connections that are still being tested. */
 		master_conntrack->layer7.app_proto = 
-			kmalloc(strlen("unknown")+1, GFP_ATOMIC);
+			kstrdup("unknown", GFP_ATOMIC);
 		if(!master_conntrack->layer7.app_proto){
 			if (net_ratelimit())
 				printk(KERN_ERR "layer7: out of memory in "
 						"match_no_append, bailing.\n");
 			return 1;
 		}
-		strcpy(master_conntrack->layer7.app_proto, "unknown");
 		return 0;
 	}
 }
@@ -335,18 +647,129 @@ static int add_datastr(char *target, int offset, char *app_data, int len)
 	return length;
 }
 
-/* add the new app data to the conntrack.  Return number of bytes added. */
-static int add_data(struct nf_conn * master_conntrack,
-                    char * app_data, int appdatalen)
+static struct l7_flow *l7_flow_alloc(const struct l7_set *set)
+{
+	struct l7_flow *flow;
+	unsigned int i;
+
+	flow = kmalloc(set->flow_size, GFP_ATOMIC);
+	if (flow == NULL)
+		return NULL;
+
+	flow->gen = set->gen;
+	flow->len = 0;
+	for (i = 0; i < set->ngroups; i++) {
+		flow->g[i].state = L7DFA_START;
+		flow->g[i].matched = set->groups[i]->dfa->accept[L7DFA_START];
+	}
+
+	flow->data = NULL;
+	if (set->fallback) {
+		flow->data = (char *)&flow->g[set->ngroups];
+		flow->data[0] = '\0';
+	}
+
+	return flow;
+}
+
+/* Runs the new app data through the automata.  Return number of bytes
+ * added, counted as add_datastr() does. */
+static int l7_flow_feed(const struct l7_set *set, struct l7_flow *flow,
+			const unsigned char *app_data, int len)
 {
-	int length;
+	int n = min(len, maxdatalen - (int)flow->len - 1);
+	int i, k, length = 0;
+
+	for (k = 0; k < n; k++)
+		if (app_data[k] != '\0')
+			length++;
+
+	for (i = 0; i < set->ngroups; i++) {
+		const struct l7dfa *dfa = set->groups[i]->dfa;
+		unsigned int state = flow->g[i].state;
+		u32 matched = flow->g[i].matched;
 
-	length = add_datastr(master_conntrack->layer7.app_data, master_conntrack->layer7.app_data_len, app_data, appdatalen);
-	master_conntrack->layer7.app_data_len += length;
+		for (k = 0; k < n; k++) {
+			if (app_data[k] == '\0')
+				continue;
+			state = l7dfa_step(dfa, state, app_data[k]);
+			matched |= dfa->accept[state];
+		}
+
+		flow->g[i].state = state;
+		flow->g[i].matched = matched;
+	}
+
+	if (flow->data != NULL)
+		add_datastr(flow->data, flow->len, (char *)app_data, len);
+	flow->len += length;
 
 	return length;
 }
 
+static int l7_flow_match(const struct l7_set *set, const struct l7_flow *flow,
+			 const struct l7_entry *e)
+{
+	struct l7_pattern *pat = e->pat;
+	int ret;
+
+	if (pat->prog == NULL)
+		return 0;
+
+	if (e->group >= 0) {
+		const struct l7dfa *dfa = set->groups[e->group]->dfa;
+		u32 matched = flow->g[e->group].matched |
+			      dfa->accept_eol[flow->g[e->group].state];
+
+		return (matched >> e->bit) & 1;
+	}
+
+	spin_lock(&pat->lock);
+	ret = regexec(pat->prog, flow->data);
+	spin_unlock(&pat->lock);
+
+	return ret ? 1 : 0;
+}
+
+/* Matches the data of a single packet */
+static int l7_packet_match(const struct l7_set *set, const struct l7_entry *e,
+			   const unsigned char *app_data, int len)
+{
+	struct l7_pattern *pat = e->pat;
+	char *buf;
+	int ret;
+
+	if (pat->prog == NULL)
+		return 0;
+
+	if (e->group >= 0) {
+		const struct l7dfa *dfa = set->groups[e->group]->dfa;
+		unsigned int state = L7DFA_START;
+		u32 matched = dfa->accept[L7DFA_START];
+		int k, n = min(len, maxdatalen - 1);
+
+		for (k = 0; k < n; k++) {
+			if (app_data[k] == '\0')
+				continue;
+			state = l7dfa_step(dfa, state, app_data[k]);
+			matched |= dfa->accept[state];
+		}
+		matched |= dfa->accept_eol[state];
+
+		return (matched >> e->bit) & 1;
+	}
+
+	/* Bottom halves are off, the buffer is ours until we return */
+	buf = __this_cpu_read(l7_scratch);
+	add_datastr(buf, 0, (char *)app_data, len);
+
+	spin_lock(&pat->lock);
+	ret = regexec(pat->prog, buf);
+	spin_unlock(&pat->lock);
+
+	return ret ? 1 : 0;
+}
+
 /* taken from drivers/video/modedb.c */
 static int my_atoi(const char *s)
 {
@@ -442,16 +865,14 @@ match(const struct sk_buff *skbin,
 
 	enum ip_conntrack_info master_ctinfo, ctinfo;
 	struct nf_conn *master_conntrack, *conntrack;
-	unsigned char *app_data, *tmp_data;
+	unsigned char *app_data;
 	unsigned int pattern_result, appdatalen;
-	regexp * comppattern;
-
-	/* Be paranoid/incompetent - lock the entire match function. */
-	spin_lock_bh(&l7_lock);
+	const struct l7_entry *entry;
+	const struct l7_set *set;
+	struct l7_flow *flow;
 
 	if(!can_handle(skb)){
 		DPRINTK("layer7: This is some protocol I can't handle.\n");
-		spin_unlock_bh(&l7_lock);
 		return info->invert;
 	}
 
@@ -461,7 +882,6 @@ match(const struct sk_buff *skbin,
 	if(!(conntrack = nf_ct_get(skb, &ctinfo)) ||
 	   !(master_conntrack=nf_ct_get(skb,&master_ctinfo))){
 		DPRINTK("layer7: couldn't get conntrack.\n");
-		spin_unlock_bh(&l7_lock);
 		return info->invert;
 	}
 
@@ -469,9 +889,28 @@ match(const struct sk_buff *skbin,
 	while (master_ct(master_conntrack) != NULL)
 		master_conntrack = master_ct(master_conntrack);
 
+	if (info->pkt) {
+		app_data = app_data_get(skb, &appdatalen);
+		if (app_data == NULL)
+			return info->invert;
+
+		rcu_read_lock();
+		set = rcu_dereference(l7_set);
+		entry = set ? l7_set_find(set, info) : NULL;
+		pattern_result = entry ?
+			l7_packet_match(set, entry, app_data, appdatalen) : 0;
+		rcu_read_unlock();
+
+		return (pattern_result ^ info->invert);
+	}
+
+	/* All state of the connection family is under the master's lock */
+	rcu_read_lock();
+	spin_lock_bh(&master_conntrack->lock);
+
 	/* if we've classified it or seen too many packets */
-	if(!info->pkt && (total_acct_packets(master_conntrack) > num_packets ||
-	   master_conntrack->layer7.app_proto)) {
+	if(total_acct_packets(master_conntrack) > num_packets ||
+	   master_conntrack->layer7.app_proto) {
 
 		pattern_result = match_no_append(conntrack, master_conntrack, 
 						 ctinfo, master_ctinfo, info);
@@ -483,78 +922,55 @@ match(const struct sk_buff *skbin,
 		else in the skbs that make it here. */
 		skb->cb[0] = 1; /* marking it seen here's probably irrelevant */
 
-		spin_unlock_bh(&l7_lock);
-		return (pattern_result ^ info->invert);
+		goto out;
 	}
 
-	if(skb_is_nonlinear(skb)){
-		if(skb_linearize(skb) != 0){
-			if (net_ratelimit())
-				printk(KERN_ERR "layer7: failed to linearize "
-						"packet, bailing.\n");
-			spin_unlock_bh(&l7_lock);
-			return info->invert;
-		}
+	app_data = app_data_get(skb, &appdatalen);
+	if (app_data == NULL) {
+		pattern_result = 0;
+		goto out;
 	}
 
-	/* now that the skb is linearized, it's safe to set these. */
-	app_data = skb->data + app_data_offset(skb);
-	appdatalen = skb_tail_pointer(skb) - app_data;
-
-	/* the return value gets checked later, when we're ready to use it */
-	comppattern = compile_and_cache(info->pattern, info->protocol);
+	set = rcu_dereference(l7_set);
+	entry = set ? l7_set_find(set, info) : NULL;
+	flow = master_conntrack->layer7.app_data;
 
-	if (info->pkt) {
-		tmp_data = kmalloc(maxdatalen, GFP_ATOMIC);
-		if(!tmp_data){
-			if (net_ratelimit())
-				printk(KERN_ERR "layer7: out of memory in match, bailing.\n");
-			return info->invert;
-		}
-
-		tmp_data[0] = '\0';
-		add_datastr(tmp_data, 0, app_data, appdatalen);
-		pattern_result = ((comppattern && regexec(comppattern, tmp_data)) ? 1 : 0);
-
-		kfree(tmp_data);
-		tmp_data = NULL;
-		spin_unlock_bh(&l7_lock);
-
-		return (pattern_result ^ info->invert);
+	/* Rules changed since the state was set up: search again from here */
+	if(flow && set && flow->gen != set->gen){
+		kfree(flow);
+		flow = master_conntrack->layer7.app_data =
+			l7_flow_alloc(set);
 	}
 
-	/* On the first packet of a connection, allocate space for app data */
+	/* On the first packet of a connection, set up the search state */
 	if(total_acct_packets(master_conntrack) == 1 && !skb->cb[0] && 
-	   !master_conntrack->layer7.app_data){
-		master_conntrack->layer7.app_data = 
-			kmalloc(maxdatalen, GFP_ATOMIC);
-		if(!master_conntrack->layer7.app_data){
+	   !flow && set){
+		flow = master_conntrack->layer7.app_data = l7_flow_alloc(set);
+		if(!flow){
 			if (net_ratelimit())
 				printk(KERN_ERR "layer7: out of memory in "
 						"match, bailing.\n");
-			spin_unlock_bh(&l7_lock);
-			return info->invert;
+			pattern_result = 0;
+			goto out;
 		}
-
-		master_conntrack->layer7.app_data[0] = '\0';
 	}
 
 	/* Can be here, but unallocated, if numpackets is increased near
 	the beginning of a connection */
-	if(master_conntrack->layer7.app_data == NULL){
-		spin_unlock_bh(&l7_lock);
-		return info->invert; /* unmatched */
+	if(flow == NULL || entry == NULL){
+		pattern_result = 0; /* unmatched */
+		goto out;
 	}
 
 	if(!skb->cb[0]){
 		int newbytes;
-		newbytes = add_data(master_conntrack, app_data, appdatalen);
+		newbytes = l7_flow_feed(set, flow, app_data, appdatalen);
 
 		if(newbytes == 0) { /* didn't add any data */
 			skb->cb[0] = 1;
 			/* Didn't match before, not going to match now */
-			spin_unlock_bh(&l7_lock);
-			return info->invert;
+			pattern_result = 0;
+			goto out;
 		}
 	}
 
@@ -569,24 +985,21 @@ match(const struct sk_buff *skbin,
 		DPRINTK("layer7: matched unset: not yet classified "
 			"(%d/%d packets)\n",
                         total_acct_packets(master_conntrack), num_packets);
-	/* If the regexp failed to compile, don't bother running it */
-	} else if(comppattern && 
-		  regexec(comppattern, master_conntrack->layer7.app_data)){
+	/* If the regexp failed to compile, this never matches */
+	} else if(l7_flow_match(set, flow, entry)){
 		DPRINTK("layer7: matched %s\n", info->protocol);
 		pattern_result = 1;
 	} else pattern_result = 0;
 
 	if(pattern_result == 1) {
 		master_conntrack->layer7.app_proto = 
-			kmalloc(strlen(info->protocol)+1, GFP_ATOMIC);
+			kstrdup(info->protocol, GFP_ATOMIC);
 		if(!master_conntrack->layer7.app_proto){
 			if (net_ratelimit())
 				printk(KERN_ERR "layer7: out of memory in "
 						"match, bailing.\n");
-			spin_unlock_bh(&l7_lock);
-			return (pattern_result ^ info->invert);
+			goto out;
 		}
-		strcpy(master_conntrack->layer7.app_proto, info->protocol);
 	} else if(pattern_result > 1) { /* cleanup from "unset" */
 		pattern_result = 1;
 	}
@@ -594,7 +1007,9 @@ match(const struct sk_buff *skbin,
 	/* mark the packet seen */
 	skb->cb[0] = 1;
 
-	spin_unlock_bh(&l7_lock);
+out:
+	spin_unlock_bh(&master_conntrack->lock);
+	rcu_read_unlock();
 	return (pattern_result ^ info->invert);
 }
 
@@ -607,26 +1022,39 @@ static bool
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 28)
 check(const struct xt_mtchk_param *par)
 {
-        if (nf_ct_l3proto_try_module_get(par->match->family) < 0) {
-                printk(KERN_WARNING "can't load conntrack support for "
-                                    "proto=%d\n", par->match->family);
+	const struct xt_layer7_info *info = par->matchinfo;
+	u_int8_t family = par->match->family;
 #else
 check(const char *tablename, const void *inf,
 		 const struct xt_match *match, void *matchinfo,
 		 unsigned int hook_mask)
 {
-        if (nf_ct_l3proto_try_module_get(match->family) < 0) {
-                printk(KERN_WARNING "can't load conntrack support for "
-                                    "proto=%d\n", match->family);
+	const struct xt_layer7_info *info = matchinfo;
+	u_int8_t family = match->family;
 #endif
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
-		return -EINVAL;
+	int err = -EINVAL;
+
+	if (strnlen(info->protocol, sizeof(info->protocol)) ==
+	    sizeof(info->protocol) ||
+	    strnlen(info->pattern, sizeof(info->pattern)) ==
+	    sizeof(info->pattern))
+		goto out;
+
+        if (nf_ct_l3proto_try_module_get(family) < 0) {
+                printk(KERN_WARNING "can't load conntrack support for "
+                                    "proto=%d\n", family);
+		goto out;
 	}
-	return 0;
+
+	/* Compile the pattern into the automata now, not in match() */
+	err = l7_pattern_add(info);
+	if (err)
+		nf_ct_l3proto_module_put(family);
+out:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35)
+	return err;
 #else
-                return 0;
-        }
-	return 1;
+	return err == 0;
 #endif
 }
 
@@ -634,11 +1062,13 @@ check(const char *tablename, const void *inf,
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 28)
 	static void destroy(const struct xt_mtdtor_param *par)
 	{
+		l7_pattern_del(par->matchinfo);
 		nf_ct_l3proto_module_put(par->match->family);
 	}
 #else
 	static void destroy(const struct xt_match *match, void *matchinfo)
 	{
+		l7_pattern_del(matchinfo);
 		nf_ct_l3proto_module_put(match->family);
 	}
 #endif
@@ -669,11 +1099,20 @@ static void layer7_init_proc(void)
 	entry->write_proc = layer7_write_proc;
 }
 
+static void layer7_free_scratch(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu(l7_scratch, cpu));
+}
+
 static int __init xt_layer7_init(void)
 {
+	int cpu, err;
+
 	need_conntrack();
 
-	layer7_init_proc();
 	if(maxdatalen < 1) {
 		printk(KERN_WARNING "layer7: maxdatalen can't be < 1, "
 			"using 1\n");
@@ -686,14 +1125,42 @@ static int __init xt_layer7_init(void)
 			"using 65536\n");
 		maxdatalen = 65536;
 	}
-	return xt_register_matches(xt_layer7_match,
-				   ARRAY_SIZE(xt_layer7_match));
+
+	for_each_possible_cpu(cpu) {
+		per_cpu(l7_scratch, cpu) = kmalloc(maxdatalen, GFP_KERNEL);
+		if (!per_cpu(l7_scratch, cpu)) {
+			layer7_free_scratch();
+			return -ENOMEM;
+		}
+	}
+
+	err = xt_register_matches(xt_layer7_match,
+				  ARRAY_SIZE(xt_layer7_match));
+	if (err) {
+		layer7_free_scratch();
+		return err;
+	}
+
+	layer7_init_proc();
+	return 0;
 }
 
 static void __exit xt_layer7_fini(void)
 {
+	struct l7_set *set;
+
 	layer7_cleanup_proc();
 	xt_unregister_matches(xt_layer7_match, ARRAY_SIZE(xt_layer7_match));
+
+	/* All rules are gone, drop the last set and wait for the others */
+	set = rcu_dereference_protected(l7_set, 1);
+	RCU_INIT_POINTER(l7_set, NULL);
+	if (set)
+		call_rcu(&set->rcu, l7_set_free_rcu);
+	rcu_barrier();
+	flush_scheduled_work();
+
+	layer7_free_scratch();
 }
 
 module_init(xt_layer7_init);
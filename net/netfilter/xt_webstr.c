@@ -38,11 +38,21 @@
 #include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_webstr.h>
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 #include <linux/tcp.h>
+#include <linux/ctype.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <net/sock.h>
 #include <net/ipv6.h>
+#include <net/genetlink.h>
 
 extern unsigned int web_str_loaded;
 
@@ -64,7 +74,8 @@ enum xt_webstr_type
 {
     XT_WEBSTR_HOST,
     XT_WEBSTR_URL,
-    XT_WEBSTR_CONTENT
+    XT_WEBSTR_CONTENT,
+    XT_WEBSTR_HOSTSET		/* string is a domain set name */
 };
 
 typedef char *(*proc_xt_search_t) (char *, char *, int, int);
@@ -265,6 +276,770 @@ static char *search_linear(char *needle, char *haystack, int needle_len, int hay
 	return NULL;
 }
 
+/*
+ * Domain sets.  Domains are hashed label by label from the right, so
+ * all suffixes of a hostname are looked up in a single pass over it.
+ * Readers walk the table under RCU.  A resize links every domain into
+ * the new table through its spare node, as the bridge mdb does.
+ */
+#define WEBSTR_HASH_INIT	2166136261U
+#define WEBSTR_BITS_MIN		4
+#define WEBSTR_BITS_MAX		20
+
+struct webstr_domain {
+	struct hlist_node node[2];
+	u32 hash;
+	u8 len;
+	char name[0];		/* lower case, not terminated */
+};
+
+struct webstr_table {
+	unsigned int bits;
+	unsigned int ver;	/* node[] of the domains used here */
+	struct hlist_head buckets[0];
+};
+
+struct webstr_set {
+	struct list_head list;
+	struct webstr_table __rcu *table;
+	unsigned int elements;
+	unsigned int maxelem;
+	unsigned int references;
+	char name[WEBSTR_SET_MAXNAMELEN];
+};
+
+/* Sets change under webstr_mutex, matches look them up under RCU */
+static DEFINE_MUTEX(webstr_mutex);
+static LIST_HEAD(webstr_sets);
+
+static inline u32 webstr_hash_step(u32 hash, char c)
+{
+	return (hash ^ (u8)tolower(c)) * 16777619U;
+}
+
+static struct webstr_table *webstr_table_alloc(unsigned int bits,
+					       unsigned int ver)
+{
+	size_t size = sizeof(struct webstr_table) +
+		      (sizeof(struct hlist_head) << bits);
+	struct webstr_table *t;
+
+	if (size > PAGE_SIZE)
+		t = vzalloc(size);
+	else
+		t = kzalloc(size, GFP_KERNEL);
+	if (t == NULL)
+		return NULL;
+
+	t->bits = bits;
+	t->ver = ver;
+	return t;
+}
+
+static void webstr_table_free(struct webstr_table *t)
+{
+	if (is_vmalloc_addr(t))
+		vfree(t);
+	else
+		kfree(t);
+}
+
+/* Frees the domains of a table nobody can see anymore */
+static void webstr_table_destroy(struct webstr_table *t)
+{
+	struct webstr_domain *d;
+	struct hlist_node *n, *tmp;
+	unsigned int i;
+
+	for (i = 0; i < (1U << t->bits); i++)
+		hlist_for_each_entry_safe(d, n, tmp, &t->buckets[i],
+					  node[t->ver])
+			kfree(d);
+	webstr_table_free(t);
+}
+
+static struct webstr_domain *
+webstr_table_find(const struct webstr_table *t, u32 hash,
+		  const char *name, unsigned int len)
+{
+	struct webstr_domain *d;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(d, n, &t->buckets[hash_32(hash, t->bits)],
+				 node[t->ver]) {
+		if (d->hash == hash && d->len == len &&
+		    !strncasecmp(d->name, name, len))
+			return d;
+	}
+
+	return NULL;
+}
+
+/* Is host, or a domain it is under, in the set? */
+static bool webstr_set_test(const struct webstr_set *set,
+			    const char *host, unsigned int len)
+{
+	const struct webstr_table *t = rcu_dereference(set->table);
+	u32 hash = WEBSTR_HASH_INIT;
+	const char *colon;
+	unsigned int i;
+
+	/* "example.com:8080." is example.com, IPv6 literals are not */
+	if (len == 0 || host[0] == '[')
+		return false;
+	colon = memchr(host, ':', len);
+	if (colon != NULL)
+		len = colon - host;
+	if (len > 0 && host[len - 1] == '.')
+		len--;
+
+	for (i = len; i-- > 0; ) {
+		hash = webstr_hash_step(hash, host[i]);
+		if ((i == 0 || host[i - 1] == '.') &&
+		    webstr_table_find(t, hash, host + i, len - i))
+			return true;
+	}
+
+	return false;
+}
+
+static struct webstr_set *webstr_set_find(const char *name)
+{
+	struct webstr_set *set;
+
+	list_for_each_entry_rcu(set, &webstr_sets, list)
+		if (!strcmp(set->name, name))
+			return set;
+
+	return NULL;
+}
+
+static int webstr_set_grow(struct webstr_set *set)
+{
+	struct webstr_table *old, *new;
+	struct webstr_domain *d;
+	struct hlist_node *n;
+	unsigned int i;
+
+	old = rcu_dereference_protected(set->table,
+					lockdep_is_held(&webstr_mutex));
+	new = webstr_table_alloc(old->bits + 1, old->ver ^ 1);
+	if (new == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < (1U << old->bits); i++)
+		hlist_for_each_entry(d, n, &old->buckets[i], node[old->ver])
+			hlist_add_head(&d->node[new->ver],
+				&new->buckets[hash_32(d->hash, new->bits)]);
+
+	rcu_assign_pointer(set->table, new);
+	synchronize_rcu();
+	webstr_table_free(old);
+
+	return 0;
+}
+
+/* Strips "*." or "." in front and a trailing dot */
+static const char *webstr_domain_trim(const char *name, unsigned int *len)
+{
+	*len = strlen(name);
+	if (*len >= 2 && name[0] == '*' && name[1] == '.') {
+		name += 2;
+		*len -= 2;
+	} else if (*len >= 1 && name[0] == '.') {
+		name++;
+		(*len)--;
+	}
+	if (*len > 0 && name[*len - 1] == '.')
+		(*len)--;
+
+	return name;
+}
+
+static u32 webstr_domain_hash(const char *name, unsigned int len)
+{
+	u32 hash = WEBSTR_HASH_INIT;
+
+	while (len-- > 0)
+		hash = webstr_hash_step(hash, name[len]);
+
+	return hash;
+}
+
+static int webstr_domain_add(struct webstr_set *set, const char *name)
+{
+	struct webstr_table *t;
+	struct webstr_domain *d;
+	unsigned int len, i;
+	u32 hash;
+	int err;
+
+	name = webstr_domain_trim(name, &len);
+	if (len == 0 || len > WEBSTR_DOMAIN_MAXLEN)
+		return -EINVAL;
+
+	t = rcu_dereference_protected(set->table,
+				      lockdep_is_held(&webstr_mutex));
+	hash = webstr_domain_hash(name, len);
+	if (webstr_table_find(t, hash, name, len))
+		return 0;
+
+	if (set->elements >= set->maxelem)
+		return -ENOSPC;
+
+	if (set->elements >= (2U << t->bits) && t->bits < WEBSTR_BITS_MAX) {
+		err = webstr_set_grow(set);
+		if (err)
+			return err;
+		t = rcu_dereference_protected(set->table,
+					lockdep_is_held(&webstr_mutex));
+	}
+
+	d = kmalloc(sizeof(*d) + len, GFP_KERNEL);
+	if (d == NULL)
+		return -ENOMEM;
+
+	d->hash = hash;
+	d->len = len;
+	for (i = 0; i < len; i++)
+		d->name[i] = tolower(name[i]);
+
+	hlist_add_head_rcu(&d->node[t->ver],
+			   &t->buckets[hash_32(hash, t->bits)]);
+	set->elements++;
+
+	return 0;
+}
+
+/* Unlinks a domain onto the caller's list, freed after a grace period */
+static void webstr_domain_del(struct webstr_set *set, const char *name,
+			      struct hlist_head *freelist)
+{
+	struct webstr_table *t;
+	struct webstr_domain *d;
+	unsigned int len;
+
+	name = webstr_domain_trim(name, &len);
+	if (len == 0 || len > WEBSTR_DOMAIN_MAXLEN)
+		return;
+
+	t = rcu_dereference_protected(set->table,
+				      lockdep_is_held(&webstr_mutex));
+	d = webstr_table_find(t, webstr_domain_hash(name, len), name, len);
+	if (d == NULL)
+		return;
+
+	hlist_del_rcu(&d->node[t->ver]);
+	hlist_add_head(&d->node[t->ver ^ 1], freelist);
+	set->elements--;
+}
+
+static struct genl_family webstr_genl_family = {
+	.id		= GENL_ID_GENERATE,
+	.hdrsize	= 0,
+	.name		= WEBSTR_GENL_NAME,
+	.version	= WEBSTR_GENL_VERSION,
+	.maxattr	= WEBSTR_A_MAX,
+};
+
+static const struct nla_policy webstr_genl_policy[WEBSTR_A_MAX + 1] = {
+	[WEBSTR_A_SET]		= { .type = NLA_NUL_STRING,
+				    .len = WEBSTR_SET_MAXNAMELEN - 1 },
+	[WEBSTR_A_HASHSIZE]	= { .type = NLA_U32 },
+	[WEBSTR_A_MAXELEM]	= { .type = NLA_U32 },
+	[WEBSTR_A_DOMAIN]	= { .type = NLA_NUL_STRING,
+				    .len = WEBSTR_DOMAIN_MAXLEN + 2 },
+};
+
+static struct webstr_set *webstr_genl_set(struct genl_info *info)
+{
+	if (info->attrs[WEBSTR_A_SET] == NULL)
+		return NULL;
+
+	return webstr_set_find(nla_data(info->attrs[WEBSTR_A_SET]));
+}
+
+static int webstr_genl_new(struct sk_buff *skb, struct genl_info *info)
+{
+	unsigned int bits = 10, size;
+	struct webstr_table *t;
+	struct webstr_set *set;
+	int err = 0;
+
+	if (info->attrs[WEBSTR_A_SET] == NULL)
+		return -EINVAL;
+
+	if (info->attrs[WEBSTR_A_HASHSIZE]) {
+		size = nla_get_u32(info->attrs[WEBSTR_A_HASHSIZE]);
+		bits = size > 1 ? ilog2(size - 1) + 1 : 0;
+		bits = clamp_t(unsigned int, bits,
+			       WEBSTR_BITS_MIN, WEBSTR_BITS_MAX);
+	}
+
+	mutex_lock(&webstr_mutex);
+	if (webstr_genl_set(info) != NULL) {
+		err = -EEXIST;
+		goto out;
+	}
+
+	set = kzalloc(sizeof(*set), GFP_KERNEL);
+	t = webstr_table_alloc(bits, 0);
+	if (set == NULL || t == NULL) {
+		kfree(set);
+		if (t != NULL)
+			webstr_table_free(t);
+		err = -ENOMEM;
+		goto out;
+	}
+
+	nla_strlcpy(set->name, info->attrs[WEBSTR_A_SET], sizeof(set->name));
+	set->maxelem = 1 << 20;
+	if (info->attrs[WEBSTR_A_MAXELEM])
+		set->maxelem = nla_get_u32(info->attrs[WEBSTR_A_MAXELEM]);
+	RCU_INIT_POINTER(set->table, t);
+	list_add_tail_rcu(&set->list, &webstr_sets);
+out:
+	mutex_unlock(&webstr_mutex);
+	return err;
+}
+
+static int webstr_genl_destroy(struct sk_buff *skb, struct genl_info *info)
+{
+	struct webstr_set *set;
+	int err = 0;
+
+	mutex_lock(&webstr_mutex);
+	set = webstr_genl_set(info);
+	if (set == NULL) {
+		err = -ENOENT;
+		goto out;
+	}
+	if (set->references) {
+		err = -EBUSY;
+		goto out;
+	}
+
+	list_del_rcu(&set->list);
+	synchronize_rcu();
+	webstr_table_destroy(rcu_dereference_protected(set->table, 1));
+	kfree(set);
+out:
+	mutex_unlock(&webstr_mutex);
+	return err;
+}
+
+static int webstr_genl_flush(struct sk_buff *skb, struct genl_info *info)
+{
+	struct webstr_table *old, *new;
+	struct webstr_set *set;
+	int err = 0;
+
+	mutex_lock(&webstr_mutex);
+	set = webstr_genl_set(info);
+	if (set == NULL) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	old = rcu_dereference_protected(set->table,
+					lockdep_is_held(&webstr_mutex));
+	new = webstr_table_alloc(old->bits, 0);
+	if (new == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	rcu_assign_pointer(set->table, new);
+	set->elements = 0;
+	synchronize_rcu();
+	webstr_table_destroy(old);
+out:
+	mutex_unlock(&webstr_mutex);
+	return err;
+}
+
+/* Adds or removes all WEBSTR_A_DOMAIN of the message, in bulk */
+static int webstr_genl_update(struct sk_buff *skb, struct genl_info *info)
+{
+	bool add = info->genlhdr->cmd == WEBSTR_CMD_ADD;
+	HLIST_HEAD(freelist);
+	struct webstr_domain *d;
+	struct hlist_node *n, *tmp;
+	struct webstr_set *set;
+	struct nlattr *attr;
+	int rem, err = 0;
+
+	mutex_lock(&webstr_mutex);
+	set = webstr_genl_set(info);
+	if (set == NULL) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	nlmsg_for_each_attr(attr, info->nlhdr, GENL_HDRLEN, rem) {
+		if (nla_type(attr) != WEBSTR_A_DOMAIN)
+			continue;
+		if (add) {
+			err = webstr_domain_add(set, nla_data(attr));
+			if (err)
+				break;
+		} else
+			webstr_domain_del(set, nla_data(attr), &freelist);
+	}
+
+	if (!hlist_empty(&freelist)) {
+		unsigned int ver = rcu_dereference_protected(set->table,
+					lockdep_is_held(&webstr_mutex))->ver;
+
+		synchronize_rcu();
+		hlist_for_each_entry_safe(d, n, tmp, &freelist, node[ver ^ 1])
+			kfree(d);
+	}
+out:
+	mutex_unlock(&webstr_mutex);
+	return err;
+}
+
+static int webstr_genl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct webstr_set *set;
+	unsigned int idx = 0;
+	void *hdr;
+
+	mutex_lock(&webstr_mutex);
+	list_for_each_entry(set, &webstr_sets, list) {
+		if (idx++ < cb->args[0])
+			continue;
+
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				  cb->nlh->nlmsg_seq, &webstr_genl_family,
+				  NLM_F_MULTI, WEBSTR_CMD_GET);
+		if (hdr == NULL)
+			break;
+
+		if (nla_put_string(skb, WEBSTR_A_SET, set->name) ||
+		    nla_put_u32(skb, WEBSTR_A_HASHSIZE, 1U <<
+				rcu_dereference_protected(set->table, 1)->bits) ||
+		    nla_put_u32(skb, WEBSTR_A_MAXELEM, set->maxelem) ||
+		    nla_put_u32(skb, WEBSTR_A_ELEMENTS, set->elements) ||
+		    nla_put_u32(skb, WEBSTR_A_REFERENCES, set->references)) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+
+		genlmsg_end(skb, hdr);
+		cb->args[0] = idx;
+	}
+	mutex_unlock(&webstr_mutex);
+
+	return skb->len;
+}
+
+static struct genl_ops webstr_genl_ops[] = {
+	{
+		.cmd		= WEBSTR_CMD_NEW,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.doit		= webstr_genl_new,
+	},
+	{
+		.cmd		= WEBSTR_CMD_DESTROY,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.doit		= webstr_genl_destroy,
+	},
+	{
+		.cmd		= WEBSTR_CMD_FLUSH,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.doit		= webstr_genl_flush,
+	},
+	{
+		.cmd		= WEBSTR_CMD_ADD,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.doit		= webstr_genl_update,
+	},
+	{
+		.cmd		= WEBSTR_CMD_DEL,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.doit		= webstr_genl_update,
+	},
+	{
+		.cmd		= WEBSTR_CMD_GET,
+		.flags		= GENL_ADMIN_PERM,
+		.policy		= webstr_genl_policy,
+		.dumpit		= webstr_genl_dump,
+	},
+};
+
+/*
+ * TLS server name.  A ClientHello with a large key share may not fit in
+ * one segment, and its server_name extension may come after that.  The
+ * walk over the extensions then stops at the end of the segment and is
+ * picked up in the next in-order segment of the flow, remembered in a
+ * small direct-mapped cache.  Each flow keeps the walk state for its
+ * expected segment and the one after, so retransmits and several rules
+ * looking at the same segment see the same result.  The walk ends with
+ * the first record of the handshake; a name split between segments is
+ * not found.
+ */
+#define TLS_PEND_BITS		7
+#define TLS_PEND_TIMEOUT	(5 * HZ)
+
+struct tls_walk {
+	u32 seq;		/* of the segment this state is for */
+	u16 skip;		/* bytes of the current extension to come */
+	u16 left;		/* extension bytes after those */
+	u8 have;		/* bytes of a split extension header */
+	u8 hdr[4];
+	u8 valid;
+};
+
+struct tls_pend {
+	union nf_inet_addr saddr, daddr;
+	__be16 sport, dport;
+	u8 family;
+	unsigned long stamp;
+	struct tls_walk cur, next;
+};
+
+static struct tls_pend tls_pend[1 << TLS_PEND_BITS];
+static DEFINE_SPINLOCK(tls_pend_lock);
+static u32 tls_pend_rnd __read_mostly;
+
+static inline bool tls_walk_pending(const struct tls_walk *w)
+{
+	return w->skip != 0 || w->left != 0;
+}
+
+/* Walks extensions in data from the state in w, returns the server
+ * name or NULL with w telling what is left for the next segment. */
+static const char *tls_walk_ext(const unsigned char *data, unsigned int len,
+				struct tls_walk *w, unsigned int *namelen)
+{
+	unsigned int off = 0, type, n;
+
+	for (;;) {
+		if (w->skip != 0) {
+			n = min_t(unsigned int, w->skip, len - off);
+			off += n;
+			w->skip -= n;
+			if (w->skip != 0)
+				return NULL;
+		}
+
+		if (w->have == 0 && w->left < 4)
+			break;
+		while (w->have < 4 && off < len)
+			w->hdr[w->have++] = data[off++];
+		if (w->have < 4)
+			return NULL;
+
+		type = (w->hdr[0] << 8) | w->hdr[1];
+		n = (w->hdr[2] << 8) | w->hdr[3];
+		if (4 + n > w->left)
+			break;
+		/* the server name starts with the next segment */
+		if (type == 0 && off == len)
+			return NULL;
+		w->have = 0;
+		w->left -= 4 + n;
+
+		/* server_name: list length, host_name type, length, name */
+		if (type == 0) {
+			if (off + n > len || n < 5 || data[off + 2] != 0)
+				break;
+			*namelen = (data[off + 3] << 8) | data[off + 4];
+			if (5 + *namelen > n)
+				break;
+			w->skip = w->left = 0;
+			return (const char *)data + off + 5;
+		}
+		w->skip = n;
+	}
+
+	/* malformed, or no server name */
+	w->skip = w->left = 0;
+	return NULL;
+}
+
+/* Server name of a TLS ClientHello starting the segment, or NULL with
+ * w telling where the walk over its extensions stopped */
+static const char *tls_server_name(const unsigned char *data,
+				   unsigned int len, unsigned int *namelen,
+				   struct tls_walk *w)
+{
+	unsigned int off, end, n;
+
+	memset(w, 0, sizeof(*w));
+
+	/* handshake record of TLS 1.x, ClientHello */
+	if (len < 5 + 4 || data[0] != 0x16 || data[1] != 0x03 ||
+	    data[5] != 0x01)
+		return NULL;
+
+	end = 5 + ((data[3] << 8) | data[4]);
+	off = 5 + 4 + 2 + 32;	/* record, handshake, version, random */
+
+	/* session id, cipher suites, compression methods */
+	if (off + 1 > len)
+		return NULL;
+	off += 1 + data[off];
+	if (off + 2 > len)
+		return NULL;
+	off += 2 + ((data[off] << 8) | data[off + 1]);
+	if (off + 1 > len)
+		return NULL;
+	off += 1 + data[off];
+
+	if (off + 2 > min(len, end))
+		return NULL;
+	n = (data[off] << 8) | data[off + 1];
+	off += 2;
+	w->left = min_t(unsigned int, n, end - off);
+
+	return tls_walk_ext(data + off, min(len, end) - off, w, namelen);
+}
+
+static void tls_pend_key(const struct sk_buff *skb, u8 family,
+			 const struct tcphdr *tcph, struct tls_pend *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->family = family;
+	key->sport = tcph->source;
+	key->dport = tcph->dest;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	if (family == NFPROTO_IPV6) {
+		key->saddr.in6 = ipv6_hdr(skb)->saddr;
+		key->daddr.in6 = ipv6_hdr(skb)->daddr;
+		return;
+	}
+#endif
+	key->saddr.ip = ip_hdr(skb)->saddr;
+	key->daddr.ip = ip_hdr(skb)->daddr;
+}
+
+static struct tls_pend *tls_pend_slot(const struct tls_pend *key)
+{
+	u32 hash;
+
+	hash = jhash2(key->saddr.all, ARRAY_SIZE(key->saddr.all),
+		      tls_pend_rnd ^ key->family);
+	hash = jhash_3words(hash, jhash2(key->daddr.all,
+					 ARRAY_SIZE(key->daddr.all), 0),
+			    ((u32)key->sport << 16) | key->dport,
+			    tls_pend_rnd);
+
+	return &tls_pend[hash_32(hash, TLS_PEND_BITS)];
+}
+
+static bool tls_pend_same(const struct tls_pend *e, const struct tls_pend *key)
+{
+	return e->family == key->family &&
+	       e->sport == key->sport && e->dport == key->dport &&
+	       nf_inet_addr_cmp(&e->saddr, &key->saddr) &&
+	       nf_inet_addr_cmp(&e->daddr, &key->daddr) &&
+	       time_before(jiffies, e->stamp + TLS_PEND_TIMEOUT);
+}
+
+/* The server name of a ClientHello, from this segment or from one the
+ * flow had before */
+static const char *tls_server_name_flow(const struct sk_buff *skb,
+					u8 family, const struct tcphdr *tcph,
+					const unsigned char *data,
+					unsigned int len,
+					unsigned int *namelen)
+{
+	u32 seq = ntohl(tcph->seq);
+	struct tls_pend key, *e;
+	struct tls_walk w;
+	const char *name;
+
+	if (len == 0)
+		return NULL;
+
+	name = tls_server_name(data, len, namelen, &w);
+	if (name != NULL)
+		return name;
+
+	tls_pend_key(skb, family, tcph, &key);
+	e = tls_pend_slot(&key);
+
+	/* Most segments do not continue a ClientHello: peek at the slot
+	 * without the lock, it is looked at again under the lock */
+	if (!tls_walk_pending(&w) && !tls_pend_same(e, &key))
+		return NULL;
+
+	spin_lock(&tls_pend_lock);
+
+	if (tls_walk_pending(&w)) {
+		/* first segment of a ClientHello, the flow starts over */
+		key.stamp = jiffies;
+		key.cur = w;
+		key.cur.seq = seq + len;
+		key.cur.valid = 1;
+		*e = key;
+		goto out;
+	}
+
+	if (!tls_pend_same(e, &key))
+		goto out;
+
+	if (e->next.valid && e->next.seq == seq) {
+		e->cur = e->next;
+		e->next.valid = 0;
+	}
+	if (!e->cur.valid || e->cur.seq != seq)
+		goto out;
+
+	w = e->cur;
+	name = tls_walk_ext(data, len, &w, namelen);
+	if (name == NULL && tls_walk_pending(&w)) {
+		e->next = w;
+		e->next.seq = seq + len;
+		e->next.valid = 1;
+	}
+out:
+	spin_unlock(&tls_pend_lock);
+
+	return name;
+}
+
+static bool webstr_hostset_mt(const struct xt_webstr_info *info,
+			      const struct sk_buff *skb, u8 family,
+			      const struct tcphdr *tcph,
+			      unsigned char *data, unsigned int datalen,
+			      httpinfo_t *htinfo)
+{
+	const struct webstr_set *set;
+	const char *host;
+	unsigned int hostlen;
+	int found;
+
+	if (get_http_info(data, datalen, HTTP_HOST, htinfo) > 0) {
+		host = htinfo->url;
+		hostlen = htinfo->hostlen;
+	} else {
+		host = tls_server_name_flow(skb, family, tcph, data, datalen,
+					    &hostlen);
+		if (host == NULL)
+			return 0;
+	}
+
+	/* Rules hold a reference, so the set is still there */
+	rcu_read_lock();
+	set = webstr_set_find(info->string);
+	found = set != NULL && webstr_set_test(set, host, hostlen);
+	rcu_read_unlock();
+
+	SPARQ_LOG("%s: host=%.*s set=%s found=%d\n", __FUNCTION__,
+		  hostlen, host, info->string, found);
+
+	return (found ^ info->invert);
+}
+
 static bool
 webstr_mt(const struct sk_buff *skb, struct xt_action_param *par)
 {
@@ -309,12 +1084,19 @@ webstr_mt(const struct sk_buff *skb, struct xt_action_param *par)
 	}
 
 	data = (void *)tcph + (tcph->doff * 4);
+	if (data > skb_tail_pointer(skb))
+		return info->invert;
+	datalen = skb_tail_pointer(skb) - data;
 	SPARQ_LOG("%s: type=%s seq=%u family=%d datalen=%d\n ", __FUNCTION__,
 		(info->type == XT_WEBSTR_URL) ? "XT_WEBSTR_URL"
 		: (info->type == XT_WEBSTR_HOST) ? "XT_WEBSTR_HOST"
 		: "XT_WEBSTR_CONTENT",
 		ntohl(tcph->seq), par->family, datalen);
 
+	if (info->type == XT_WEBSTR_HOSTSET)
+		return webstr_hostset_mt(info, skb, par->family, tcph,
+					 data, datalen, &htinfo);
+
 	/* Determine the flags value for get_http_info(), and mangle packet 
 	 * if needed. */
 	switch (info->type)
@@ -419,9 +1201,32 @@ match_ret:
 }
 
 
+/* The set must exist and cannot be destroyed while rules use it.
+ * Matchinfo is copied back to userspace as is, so the rule keeps only
+ * the name and the set is looked up by it. */
+static int webstr_mt_check_set(const struct xt_webstr_info *info)
+{
+	struct webstr_set *set;
+	int err = 0;
+
+	if (strnlen(info->string, WEBSTR_SET_MAXNAMELEN) ==
+	    WEBSTR_SET_MAXNAMELEN)
+		return -EINVAL;
+
+	mutex_lock(&webstr_mutex);
+	set = webstr_set_find(info->string);
+	if (set != NULL)
+		set->references++;
+	else
+		err = -ENOENT;
+	mutex_unlock(&webstr_mutex);
+
+	return err;
+}
+
 static int webstr_mt_check(const struct xt_mtchk_param *par)
 {
-	const struct xt_webstr_info *info = par->matchinfo;
+	struct xt_webstr_info *info = par->matchinfo;
 
 	/* allowed types */
 	switch (info->type) {
@@ -429,6 +1234,8 @@ static int webstr_mt_check(const struct xt_mtchk_param *par)
 		case XT_WEBSTR_HOST:
 		case XT_WEBSTR_CONTENT:
 			break;
+		case XT_WEBSTR_HOSTSET:
+			return webstr_mt_check_set(info);
 		default:
 			return -EINVAL;
 	}
@@ -439,11 +1246,24 @@ static int webstr_mt_check(const struct xt_mtchk_param *par)
 	return 0;
 }
 
+static void webstr_mt_destroy(const struct xt_mtdtor_param *par)
+{
+	const struct xt_webstr_info *info = par->matchinfo;
+
+	if (info->type != XT_WEBSTR_HOSTSET)
+		return;
+
+	mutex_lock(&webstr_mutex);
+	webstr_set_find(info->string)->references--;
+	mutex_unlock(&webstr_mutex);
+}
+
 static struct xt_match xt_webstr_match __read_mostly = {
 	.name		= "webstr",
 	.family		= NFPROTO_UNSPEC,
 	.match		= webstr_mt,
 	.checkentry	= webstr_mt_check,
+	.destroy	= webstr_mt_destroy,
 	.matchsize	= sizeof(struct xt_webstr_info),
 	.proto		= IPPROTO_TCP,
 	.me		= THIS_MODULE
@@ -451,15 +1271,40 @@ static struct xt_match xt_webstr_match __read_mostly = {
 
 static int __init webstr_init(void)
 {
+	int ret;
+
+	ret = genl_register_family_with_ops(&webstr_genl_family,
+					    webstr_genl_ops,
+					    ARRAY_SIZE(webstr_genl_ops));
+	if (ret)
+		return ret;
+
+	ret = xt_register_match(&xt_webstr_match);
+	if (ret) {
+		genl_unregister_family(&webstr_genl_family);
+		return ret;
+	}
+
+	get_random_bytes(&tls_pend_rnd, sizeof(tls_pend_rnd));
 	web_str_loaded = 1;
 	search = search_linear;
-	return xt_register_match(&xt_webstr_match);
+	return 0;
 }
 
 static void __exit webstr_fini(void)
 {
+	struct webstr_set *set, *tmp;
+
 	web_str_loaded = 0;
 	xt_unregister_match(&xt_webstr_match);
+	genl_unregister_family(&webstr_genl_family);
+
+	/* No rules and no requests left */
+	list_for_each_entry_safe(set, tmp, &webstr_sets, list) {
+		list_del(&set->list);
+		webstr_table_destroy(rcu_dereference_protected(set->table, 1));
+		kfree(set);
+	}
 }
 
 module_init(webstr_init);
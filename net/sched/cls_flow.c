@@ -149,8 +149,10 @@ static u32 flow_get_nfct_src(const struct sk_buff *skb, const struct flow_keys *
 	switch (skb->protocol) {
 	case htons(ETH_P_IP):
 		return ntohl(CTTUPLE(skb, src.u3.ip));
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case htons(ETH_P_IPV6):
 		return ntohl(CTTUPLE(skb, src.u3.ip6[3]));
+#endif
 	}
 fallback:
 	return flow_get_src(skb, flow);
@@ -161,8 +163,10 @@ static u32 flow_get_nfct_dst(const struct sk_buff *skb, const struct flow_keys *
 	switch (skb->protocol) {
 	case htons(ETH_P_IP):
 		return ntohl(CTTUPLE(skb, dst.u3.ip));
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
 	case htons(ETH_P_IPV6):
 		return ntohl(CTTUPLE(skb, dst.u3.ip6[3]));
+#endif
 	}
 fallback:
 	return flow_get_dst(skb, flow);
@@ -0,0 +1,694 @@
+/*
+ * Fair Queue per host discipline
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ *
+ * Based on sch_fq_codel.c by Eric Dumazet <edumazet@google.com>
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/string.h>
+#include <linux/in.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <net/netlink.h>
+#include <net/pkt_sched.h>
+#include <net/flow_keys.h>
+#include <net/codel.h>
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+#include <net/netfilter/nf_conntrack.h>
+#endif
+
+/*	Fair Queue per host.
+ *
+ * Packets are hashed on hosts by the internal address: the source
+ * before NAT or the destination after NAT, taken from the conntrack
+ * entry when there is one, so the same host is seen on both sides of
+ * a NAT router.  Hosts are served Deficit Round Robin.  The flows of a
+ * host are served as in fq_codel, each with a CoDel managed queue.
+ * Both tables are stochastic.
+ *
+ * An optional rate paces the dequeues as a token bucket, so a single
+ * qdisc shapes the link without a class tree above it.
+ */
+
+struct fq_host_host;
+
+struct fq_host_flow {
+	struct sk_buff	  *head;
+	struct sk_buff	  *tail;
+	struct list_head  flowchain;	/* in new_flows/old_flows of host */
+	struct fq_host_host *host;	/* owner while on a list */
+	int		  deficit;
+	u32		  backlog;
+	u32		  dropped; /* number of drops (or ECN marks) on this flow */
+	struct codel_vars cvars;
+};
+
+struct fq_host_host {
+	struct list_head  hostchain;	/* in active_hosts */
+	struct list_head  new_flows;	/* list of new flows */
+	struct list_head  old_flows;	/* list of old flows */
+	int		  deficit;
+	u32		  backlog;
+};
+
+/* Fixed point of the nanoseconds per byte */
+#define FQ_HOST_RATE_SHIFT	16
+
+struct fq_host_sched_data {
+	struct fq_host_flow *flows;	/* Flows table [flows_cnt] */
+	struct fq_host_host *hosts;	/* Hosts table [hosts_cnt] */
+	u32		flows_cnt;	/* number of flows */
+	u32		hosts_cnt;	/* number of hosts */
+	u32		perturbation;	/* hash perturbation */
+	u32		quantum;	/* psched_mtu(qdisc_dev(sch)); */
+	u32		mode;		/* enum tc_fq_host_mode */
+	u32		rate;		/* bytes per second, 0 if unlimited */
+	u32		burst;		/* bytes */
+	u64		rate_mult;	/* ns per byte << FQ_HOST_RATE_SHIFT */
+	u64		burst_ns;
+	u64		time_next;	/* ns, departure of the next packet */
+	struct qdisc_watchdog watchdog;
+	struct codel_params cparams;
+	struct codel_stats cstats;
+	u32		drop_overlimit;
+	u32		new_flow_count;
+	u32		throttled;
+
+	struct list_head active_hosts;	/* hosts with flows */
+};
+
+static inline u64 fq_host_len_ns(const struct fq_host_sched_data *q,
+				 unsigned int len)
+{
+	return ((u64)len * q->rate_mult) >> FQ_HOST_RATE_SHIFT;
+}
+
+static u32 fq_host_addr(const struct fq_host_sched_data *q,
+			const struct sk_buff *skb,
+			const struct flow_keys *keys)
+{
+#if IS_ENABLED(CONFIG_NF_CONNTRACK)
+	enum ip_conntrack_info ctinfo;
+	const struct nf_conn *ct = nf_ct_get(skb, &ctinfo);
+
+	if (ct && !nf_ct_is_untracked(ct)) {
+		const struct nf_conntrack_tuple *tuple;
+		enum ip_conntrack_dir dir = CTINFO2DIR(ctinfo);
+
+		/* The tuple of a direction holds the addresses before NAT,
+		 * the source of the other direction is the destination
+		 * after NAT.
+		 */
+		if (q->mode == TC_FQ_HOST_DST)
+			dir = !dir;
+		tuple = &ct->tuplehash[dir].tuple;
+
+		switch (nf_ct_l3num(ct)) {
+		case NFPROTO_IPV4:
+			return (__force u32)tuple->src.u3.ip;
+#ifndef CONFIG_NF_CONNTRACK_IPV4_TUPLE
+		case NFPROTO_IPV6:
+			return (__force u32)tuple->src.u3.ip6[3];
+#endif
+		}
+	}
+#endif
+	return (__force u32)(q->mode == TC_FQ_HOST_DST ?
+			     keys->dst : keys->src);
+}
+
+static void fq_host_classify(const struct fq_host_sched_data *q,
+			     const struct sk_buff *skb,
+			     unsigned int *hidx, unsigned int *fidx)
+{
+	struct flow_keys keys;
+	unsigned int hash;
+
+	skb_flow_dissect(skb, &keys);
+
+	hash = jhash_1word(fq_host_addr(q, skb, &keys), q->perturbation);
+	*hidx = ((u64)hash * q->hosts_cnt) >> 32;
+
+	hash = jhash_3words((__force u32)keys.dst,
+			    (__force u32)keys.src ^ keys.ip_proto,
+			    (__force u32)keys.ports, q->perturbation);
+	*fidx = ((u64)hash * q->flows_cnt) >> 32;
+}
+
+/* remove one skb from head of slot queue */
+static inline struct sk_buff *dequeue_head(struct fq_host_flow *flow)
+{
+	struct sk_buff *skb = flow->head;
+
+	flow->head = skb->next;
+	skb->next = NULL;
+	return skb;
+}
+
+/* add skb to flow queue (tail add) */
+static inline void flow_queue_add(struct fq_host_flow *flow,
+				  struct sk_buff *skb)
+{
+	if (flow->head == NULL)
+		flow->head = skb;
+	else
+		flow->tail->next = skb;
+	flow->tail = skb;
+	skb->next = NULL;
+}
+
+static struct fq_host_flow *fq_host_drop(struct Qdisc *sch)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	struct fq_host_host *host = NULL, *h;
+	struct fq_host_flow *flow = NULL, *f;
+	struct sk_buff *skb;
+	u32 maxbacklog = 0;
+	unsigned int len;
+
+	/* Queue is full! Drop from the fat flow of the fat host.  Only
+	 * hosts and flows holding packets are looked at.
+	 */
+	list_for_each_entry(h, &q->active_hosts, hostchain) {
+		if (h->backlog > maxbacklog) {
+			maxbacklog = h->backlog;
+			host = h;
+		}
+	}
+
+	maxbacklog = 0;
+	list_for_each_entry(f, &host->new_flows, flowchain) {
+		if (f->backlog > maxbacklog) {
+			maxbacklog = f->backlog;
+			flow = f;
+		}
+	}
+	list_for_each_entry(f, &host->old_flows, flowchain) {
+		if (f->backlog > maxbacklog) {
+			maxbacklog = f->backlog;
+			flow = f;
+		}
+	}
+
+	skb = dequeue_head(flow);
+	len = qdisc_pkt_len(skb);
+	flow->backlog -= len;
+	host->backlog -= len;
+	kfree_skb(skb);
+	sch->q.qlen--;
+	sch->qstats.drops++;
+	sch->qstats.backlog -= len;
+	flow->dropped++;
+	return flow;
+}
+
+static unsigned int fq_host_qdisc_drop(struct Qdisc *sch)
+{
+	unsigned int prev_backlog;
+
+	if (!sch->q.qlen)
+		return 0;
+
+	prev_backlog = sch->qstats.backlog;
+	fq_host_drop(sch);
+	return prev_backlog - sch->qstats.backlog;
+}
+
+static int fq_host_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	unsigned int hidx, fidx, len = qdisc_pkt_len(skb);
+	struct fq_host_flow *flow;
+	struct fq_host_host *host;
+
+	fq_host_classify(q, skb, &hidx, &fidx);
+
+	codel_set_enqueue_time(skb);
+	flow = &q->flows[fidx];
+	flow_queue_add(flow, skb);
+
+	/* A queued flow stays with its host until it drains */
+	if (list_empty(&flow->flowchain)) {
+		host = &q->hosts[hidx];
+		if (list_empty(&host->hostchain)) {
+			list_add_tail(&host->hostchain, &q->active_hosts);
+			host->deficit = q->quantum;
+		}
+		list_add_tail(&flow->flowchain, &host->new_flows);
+		q->new_flow_count++;
+		flow->deficit = q->quantum;
+		flow->host = host;
+	}
+	flow->backlog += len;
+	flow->host->backlog += len;
+	sch->qstats.backlog += len;
+
+	if (++sch->q.qlen <= sch->limit)
+		return NET_XMIT_SUCCESS;
+
+	q->drop_overlimit++;
+	/* Return Congestion Notification only if we dropped a packet
+	 * from this flow.
+	 */
+	if (fq_host_drop(sch) == flow)
+		return NET_XMIT_CN;
+
+	/* As we dropped a packet, better let upper stack know this */
+	qdisc_tree_decrease_qlen(sch, 1);
+	return NET_XMIT_SUCCESS;
+}
+
+/* This is the specific function called from codel_dequeue()
+ * to dequeue a packet from queue. Note: backlog is handled in
+ * codel, we dont need to reduce it here.
+ */
+static struct sk_buff *dequeue(struct codel_vars *vars, struct Qdisc *sch)
+{
+	struct fq_host_flow *flow;
+	struct sk_buff *skb = NULL;
+	unsigned int len;
+
+	flow = container_of(vars, struct fq_host_flow, cvars);
+	if (flow->head) {
+		skb = dequeue_head(flow);
+		len = qdisc_pkt_len(skb);
+		flow->backlog -= len;
+		flow->host->backlog -= len;
+		sch->q.qlen--;
+	}
+	return skb;
+}
+
+static struct sk_buff *fq_host_dequeue(struct Qdisc *sch)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	struct fq_host_host *host;
+	struct fq_host_flow *flow;
+	struct list_head *head;
+	u32 prev_drop_count, prev_ecn_mark;
+	u64 now = 0;
+
+	if (!sch->q.qlen)
+		return NULL;
+
+	if (q->rate) {
+		now = ktime_to_ns(ktime_get());
+		if (now < q->time_next) {
+			q->throttled++;
+			qdisc_watchdog_schedule(&q->watchdog,
+						PSCHED_NS2TICKS(q->time_next));
+			return NULL;
+		}
+	}
+
+begin_host:
+	if (list_empty(&q->active_hosts))
+		return NULL;
+	host = list_first_entry(&q->active_hosts, struct fq_host_host,
+				hostchain);
+
+	if (host->deficit <= 0) {
+		host->deficit += q->quantum;
+		list_move_tail(&host->hostchain, &q->active_hosts);
+		goto begin_host;
+	}
+
+begin_flow:
+	head = &host->new_flows;
+	if (list_empty(head)) {
+		head = &host->old_flows;
+		if (list_empty(head)) {
+			list_del_init(&host->hostchain);
+			goto begin_host;
+		}
+	}
+	flow = list_first_entry(head, struct fq_host_flow, flowchain);
+
+	if (flow->deficit <= 0) {
+		flow->deficit += q->quantum;
+		list_move_tail(&flow->flowchain, &host->old_flows);
+		goto begin_flow;
+	}
+
+	prev_drop_count = q->cstats.drop_count;
+	prev_ecn_mark = q->cstats.ecn_mark;
+
+	skb = codel_dequeue(sch, &q->cparams, &flow->cvars, &q->cstats,
+			    dequeue);
+
+	flow->dropped += q->cstats.drop_count - prev_drop_count;
+	flow->dropped += q->cstats.ecn_mark - prev_ecn_mark;
+
+	if (!skb) {
+		/* force a pass through old_flows to prevent starvation */
+		if ((head == &host->new_flows) &&
+		    !list_empty(&host->old_flows))
+			list_move_tail(&flow->flowchain, &host->old_flows);
+		else
+			list_del_init(&flow->flowchain);
+		goto begin_flow;
+	}
+	qdisc_bstats_update(sch, skb);
+	flow->deficit -= qdisc_pkt_len(skb);
+	host->deficit -= qdisc_pkt_len(skb);
+
+	if (q->rate) {
+		/* Credit of an idle link is capped at the burst */
+		if (q->time_next + q->burst_ns < now)
+			q->time_next = now - q->burst_ns;
+		q->time_next += fq_host_len_ns(q, qdisc_pkt_len(skb));
+	}
+
+	/* We cant call qdisc_tree_decrease_qlen() if our qlen is 0,
+	 * or HTB crashes. Defer it for next round.
+	 */
+	if (q->cstats.drop_count && sch->q.qlen) {
+		qdisc_tree_decrease_qlen(sch, q->cstats.drop_count);
+		q->cstats.drop_count = 0;
+	}
+	return skb;
+}
+
+static void fq_host_reset(struct Qdisc *sch)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	int i;
+
+	INIT_LIST_HEAD(&q->active_hosts);
+	for (i = 0; i < q->hosts_cnt; i++) {
+		struct fq_host_host *host = q->hosts + i;
+
+		INIT_LIST_HEAD(&host->hostchain);
+		INIT_LIST_HEAD(&host->new_flows);
+		INIT_LIST_HEAD(&host->old_flows);
+		host->backlog = 0;
+	}
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_host_flow *flow = q->flows + i;
+
+		while (flow->head) {
+			struct sk_buff *skb = dequeue_head(flow);
+
+			sch->qstats.backlog -= qdisc_pkt_len(skb);
+			kfree_skb(skb);
+		}
+
+		INIT_LIST_HEAD(&flow->flowchain);
+		codel_vars_init(&flow->cvars);
+		flow->backlog = 0;
+	}
+	sch->q.qlen = 0;
+	q->time_next = 0;
+	qdisc_watchdog_cancel(&q->watchdog);
+}
+
+static const struct nla_policy fq_host_policy[TCA_FQ_HOST_MAX + 1] = {
+	[TCA_FQ_HOST_TARGET]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_LIMIT]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_INTERVAL]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_ECN]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_FLOWS]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_HOSTS]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_QUANTUM]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_MODE]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_RATE]	= { .type = NLA_U32 },
+	[TCA_FQ_HOST_BURST]	= { .type = NLA_U32 },
+};
+
+static void fq_host_set_rate(struct fq_host_sched_data *q)
+{
+	u32 burst = q->burst;
+
+	if (!q->rate) {
+		q->rate_mult = 0;
+		q->burst_ns = 0;
+		return;
+	}
+
+	/* Default to a burst of 4 ms at the rate */
+	if (!burst)
+		burst = max(2 * q->quantum, q->rate / 250);
+
+	q->rate_mult = div_u64((u64)NSEC_PER_SEC << FQ_HOST_RATE_SHIFT,
+			       q->rate);
+	q->burst_ns = fq_host_len_ns(q, burst);
+}
+
+static int fq_host_change(struct Qdisc *sch, struct nlattr *opt)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	struct nlattr *tb[TCA_FQ_HOST_MAX + 1];
+	int err;
+
+	if (!opt)
+		return -EINVAL;
+
+	err = nla_parse_nested(tb, TCA_FQ_HOST_MAX, opt, fq_host_policy);
+	if (err < 0)
+		return err;
+	if (tb[TCA_FQ_HOST_FLOWS]) {
+		if (q->flows)
+			return -EINVAL;
+		q->flows_cnt = nla_get_u32(tb[TCA_FQ_HOST_FLOWS]);
+		if (!q->flows_cnt ||
+		    q->flows_cnt > 65536)
+			return -EINVAL;
+	}
+	if (tb[TCA_FQ_HOST_HOSTS]) {
+		if (q->hosts)
+			return -EINVAL;
+		q->hosts_cnt = nla_get_u32(tb[TCA_FQ_HOST_HOSTS]);
+		if (!q->hosts_cnt ||
+		    q->hosts_cnt > 65536)
+			return -EINVAL;
+	}
+	if (tb[TCA_FQ_HOST_MODE] &&
+	    nla_get_u32(tb[TCA_FQ_HOST_MODE]) > TC_FQ_HOST_DST)
+		return -EINVAL;
+
+	sch_tree_lock(sch);
+
+	if (tb[TCA_FQ_HOST_TARGET]) {
+		u64 target = nla_get_u32(tb[TCA_FQ_HOST_TARGET]);
+
+		q->cparams.target = (target * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+
+	if (tb[TCA_FQ_HOST_INTERVAL]) {
+		u64 interval = nla_get_u32(tb[TCA_FQ_HOST_INTERVAL]);
+
+		q->cparams.interval = (interval * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+
+	if (tb[TCA_FQ_HOST_LIMIT])
+		sch->limit = nla_get_u32(tb[TCA_FQ_HOST_LIMIT]);
+
+	if (tb[TCA_FQ_HOST_ECN])
+		q->cparams.ecn = !!nla_get_u32(tb[TCA_FQ_HOST_ECN]);
+
+	if (tb[TCA_FQ_HOST_QUANTUM])
+		q->quantum = max(256U, nla_get_u32(tb[TCA_FQ_HOST_QUANTUM]));
+
+	if (tb[TCA_FQ_HOST_MODE])
+		q->mode = nla_get_u32(tb[TCA_FQ_HOST_MODE]);
+
+	if (tb[TCA_FQ_HOST_RATE])
+		q->rate = nla_get_u32(tb[TCA_FQ_HOST_RATE]);
+
+	if (tb[TCA_FQ_HOST_BURST])
+		q->burst = nla_get_u32(tb[TCA_FQ_HOST_BURST]);
+
+	fq_host_set_rate(q);
+
+	/* Packets may not skip the rate limit */
+	if (sch->limit >= 1 && !q->rate)
+		sch->flags |= TCQ_F_CAN_BYPASS;
+	else
+		sch->flags &= ~TCQ_F_CAN_BYPASS;
+
+	while (sch->q.qlen > sch->limit) {
+		fq_host_drop(sch);
+		q->cstats.drop_count++;
+	}
+	qdisc_tree_decrease_qlen(sch, q->cstats.drop_count);
+	q->cstats.drop_count = 0;
+
+	sch_tree_unlock(sch);
+	return 0;
+}
+
+static void *fq_host_zalloc(size_t sz)
+{
+	void *ptr = kzalloc(sz, GFP_KERNEL | __GFP_NOWARN);
+
+	if (!ptr)
+		ptr = vzalloc(sz);
+	return ptr;
+}
+
+static void fq_host_free(void *addr)
+{
+	if (is_vmalloc_addr(addr))
+		vfree(addr);
+	else
+		kfree(addr);
+}
+
+static void fq_host_destroy(struct Qdisc *sch)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+
+	qdisc_watchdog_cancel(&q->watchdog);
+	fq_host_free(q->hosts);
+	fq_host_free(q->flows);
+}
+
+static int fq_host_init(struct Qdisc *sch, struct nlattr *opt)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	int i;
+
+	sch->limit = 1024;
+	q->flows_cnt = 1024;
+	q->hosts_cnt = 256;
+	q->quantum = psched_mtu(qdisc_dev(sch));
+	q->mode = TC_FQ_HOST_SRC;
+	q->perturbation = random32();
+	INIT_LIST_HEAD(&q->active_hosts);
+	qdisc_watchdog_init(&q->watchdog, sch);
+	codel_params_init(&q->cparams);
+	codel_stats_init(&q->cstats);
+	q->cparams.ecn = true;
+
+	if (opt) {
+		int err = fq_host_change(sch, opt);
+		if (err)
+			return err;
+	} else {
+		sch->flags |= TCQ_F_CAN_BYPASS;
+	}
+
+	q->flows = fq_host_zalloc(q->flows_cnt * sizeof(struct fq_host_flow));
+	if (!q->flows)
+		return -ENOMEM;
+	q->hosts = fq_host_zalloc(q->hosts_cnt * sizeof(struct fq_host_host));
+	if (!q->hosts) {
+		fq_host_free(q->flows);
+		q->flows = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_host_flow *flow = q->flows + i;
+
+		INIT_LIST_HEAD(&flow->flowchain);
+		codel_vars_init(&flow->cvars);
+	}
+	for (i = 0; i < q->hosts_cnt; i++) {
+		struct fq_host_host *host = q->hosts + i;
+
+		INIT_LIST_HEAD(&host->hostchain);
+		INIT_LIST_HEAD(&host->new_flows);
+		INIT_LIST_HEAD(&host->old_flows);
+	}
+	return 0;
+}
+
+static int fq_host_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	struct nlattr *opts;
+
+	opts = nla_nest_start(skb, TCA_OPTIONS);
+	if (opts == NULL)
+		goto nla_put_failure;
+
+	if (nla_put_u32(skb, TCA_FQ_HOST_TARGET,
+			codel_time_to_us(q->cparams.target)) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_LIMIT,
+			sch->limit) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_INTERVAL,
+			codel_time_to_us(q->cparams.interval)) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_ECN,
+			q->cparams.ecn) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_QUANTUM,
+			q->quantum) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_FLOWS,
+			q->flows_cnt) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_HOSTS,
+			q->hosts_cnt) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_MODE,
+			q->mode) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_RATE,
+			q->rate) ||
+	    nla_put_u32(skb, TCA_FQ_HOST_BURST,
+			q->burst))
+		goto nla_put_failure;
+
+	return nla_nest_end(skb, opts);
+
+nla_put_failure:
+	return -1;
+}
+
+static int fq_host_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct fq_host_sched_data *q = qdisc_priv(sch);
+	struct tc_fq_host_xstats st = {
+		.maxpacket		= q->cstats.maxpacket,
+		.drop_overlimit		= q->drop_overlimit,
+		.ecn_mark		= q->cstats.ecn_mark,
+		.new_flow_count		= q->new_flow_count,
+		.throttled		= q->throttled,
+	};
+	struct list_head *pos;
+
+	list_for_each(pos, &q->active_hosts)
+		st.hosts_len++;
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops fq_host_qdisc_ops __read_mostly = {
+	.id		=	"fq_host",
+	.priv_size	=	sizeof(struct fq_host_sched_data),
+	.enqueue	=	fq_host_enqueue,
+	.dequeue	=	fq_host_dequeue,
+	.peek		=	qdisc_peek_dequeued,
+	.drop		=	fq_host_qdisc_drop,
+	.init		=	fq_host_init,
+	.reset		=	fq_host_reset,
+	.destroy	=	fq_host_destroy,
+	.change		=	fq_host_change,
+	.dump		=	fq_host_dump,
+	.dump_stats	=	fq_host_dump_stats,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init fq_host_module_init(void)
+{
+	return register_qdisc(&fq_host_qdisc_ops);
+}
+
+static void __exit fq_host_module_exit(void)
+{
+	unregister_qdisc(&fq_host_qdisc_ops);
+}
+
+module_init(fq_host_module_init)
+module_exit(fq_host_module_exit)
+MODULE_AUTHOR("http://www.ndmsystems.com");
+MODULE_LICENSE("GPL");